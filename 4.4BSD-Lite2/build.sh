@@ -17,6 +17,9 @@ $CC -c sys/kern/uipc_socket2.c -o objs/uipc_socket2.o
 #$CC -c sys/kern/uipc_syscalls.c -o objs/uipc_syscalls.o
 $CC -c sys/kern/sys_socket.c -o objs/sys_socket.o
 
+$CC -c sys/net/bpf.c -o objs/bpf.o
+$CC -c sys/net/bpf_filter.c -o objs/bpf_filter.o
+$CC -c sys/net/fib.c -o objs/fib.o
 $CC -c sys/net/if.c -o objs/if.o
 $CC -c sys/net/if_ethersubr.c -o objs/if_ethersubr.o
 $CC -c sys/net/if_loop.c -o objs/if_loop.o
@@ -35,21 +38,34 @@ $CC -c sys/netinet/ip_input.c -o objs/ip_input.o
 $CC -c sys/netinet/ip_output.c -o objs/ip_output.o
 $CC -c sys/netinet/raw_ip.c -o objs/raw_ip.o
 
+$CC -c sys/netinet/tcp_autobuf.c -o objs/tcp_autobuf.o
+$CC -c sys/netinet/tcp_bbr.c -o objs/tcp_bbr.o
+$CC -c sys/netinet/tcp_cc.c -o objs/tcp_cc.o
+$CC -c sys/netinet/tcp_cubic.c -o objs/tcp_cubic.o
 $CC -c sys/netinet/tcp_debug.c -o objs/tcp_debug.o
+$CC -c sys/netinet/tcp_gro.c -o objs/tcp_gro.o
 $CC -c sys/netinet/tcp_input.c -o objs/tcp_input.o
 $CC -c sys/netinet/tcp_output.c -o objs/tcp_output.o
+$CC -c sys/netinet/tcp_reass.c -o objs/tcp_reass.o
+$CC -c sys/netinet/tcp_sack.c -o objs/tcp_sack.o
 $CC -c sys/netinet/tcp_subr.c -o objs/tcp_subr.o
+$CC -c sys/netinet/tcp_syncache.c -o objs/tcp_syncache.o
 $CC -c sys/netinet/tcp_timer.c -o objs/tcp_timer.o
+$CC -c sys/netinet/tcp_timewait.c -o objs/tcp_timewait.o
 $CC -c sys/netinet/tcp_usrreq.c -o objs/tcp_usrreq.o
 
 $CC -c sys/netinet/udp_usrreq.c -o objs/udp_usrreq.o
 
+$CC -c lib/bpfdev.c -o objs/bpfdev.o
+$CC -c lib/cksum.c -o objs/cksum.o
 $CC -c lib/handshake.c -o objs/handshake.o
+$CC -c lib/if_eloop.c -o objs/if_eloop.o
 $CC -c lib/if_pigeon.c -o objs/if_pigeon.o
 $CC -c lib/if_tun.c -o objs/if_tun.o
 $CC -c lib/ip_intercept.c -o objs/ip_intercept.o
 $CC -c lib/init.c -o objs/init.o
 $CC -c lib/ping.c -o objs/ping.o
+$CC -c lib/sopoll.c -o objs/sopoll.o
 $CC -c lib/stub.c -o objs/stub.o
 
 gcc -c -m32 -g -Wall tools/pcap.c -o objs/pcap.o
@@ -57,6 +73,29 @@ gcc -c -m32 -g -Wall tools/trace.c -o objs/trace.o
 
 ar rcs objs/libnetinet.a objs/*.o
 
-gcc -m32 -g -Wall tests/init.c -o objs/test_init objs/libnetinet.a
-gcc -m32 -g -Wall tests/pigeon.c -o objs/test_pigeon objs/libnetinet.a
-gcc -m32 -g -Wall tests/tun.c -o objs/test_tun objs/libnetinet.a
+gcc -m32 -g -Wall tests/init.c -o objs/test_init objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/pigeon.c -o objs/test_pigeon objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/tun.c -o objs/test_tun objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/pcbhash.c -o objs/test_pcbhash objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/timerwheel.c -o objs/test_timerwheel objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/cksum.c -o objs/test_cksum objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/mbuf.c -o objs/test_mbuf objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/scaling.c -o objs/test_scaling objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/sopoll.c -o objs/test_sopoll objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/zerocopy.c -o objs/test_zerocopy objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/pcap.c -o objs/test_pcap objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/sack.c -o objs/test_sack objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/reass.c -o objs/test_reass objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/cc.c -o objs/test_cc objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/tso.c -o objs/test_tso objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/gro.c -o objs/test_gro objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/fib.c -o objs/test_fib objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/arp.c -o objs/test_arp objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/frag.c -o objs/test_frag objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/bpf.c -o objs/test_bpf objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/bpfring.c -o objs/test_bpfring objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/syncache.c -o objs/test_syncache objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/timewait.c -o objs/test_timewait objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/autobuf.c -o objs/test_autobuf objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/ipbatch.c -o objs/test_ipbatch objs/libnetinet.a -lpthread
+gcc -m32 -g -Wall tests/udpmmsg.c -o objs/test_udpmmsg objs/libnetinet.a -lpthread
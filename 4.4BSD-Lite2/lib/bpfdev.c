@@ -0,0 +1,164 @@
+#include "stub.h"
+
+#include <net/bpf.h>
+
+/*
+ * The bpf device, opened from the process.  There are no file
+ * descriptors: a unit is the minor of /dev/bpfN, and the calls go
+ * straight to bpfopen(), bpfioctl(), bpfread() and bpfclose().
+ *
+ * A unit opened with bpf_openring() delivers into a ring of blocks
+ * (BIOCSRING) in the process's memory.  The reader walks the block
+ * at its cursor while bb_status says BPF_BLOCK_USER, then gives it
+ * back by setting BPF_BLOCK_KERNEL.  Nothing is copied out and
+ * nothing is called.  A unit opened with bpf_openbuf() is read with
+ * bpf_readbuf() as from the device.
+ */
+
+int	bpfopen __P((dev_t, int));
+int	bpfclose __P((dev_t, int));
+int	bpfread __P((dev_t, struct uio *));
+int	bpfioctl __P((dev_t, u_long, caddr_t, int));
+
+static int
+bpf_setup(unit, ifname, insns, ninsns)
+	int unit;
+	const char *ifname;
+	const void *insns;
+	int ninsns;
+{
+	struct bpf_program prog;
+	struct ifreq ifr;
+	int error;
+
+	if (insns) {
+		prog.bf_len = ninsns;
+		prog.bf_insns = (struct bpf_insn *)insns;
+		error = bpfioctl(unit, BIOCSETF, (caddr_t)&prog, FREAD);
+		if (error)
+			return (error);
+	}
+	bzero(&ifr, sizeof ifr);
+	strcpy(ifr.ifr_name, ifname);
+	return (bpfioctl(unit, BIOCSETIF, (caddr_t)&ifr, FREAD));
+}
+
+/*
+ * Open unit on interface ifname with the filter insns, if any, and a
+ * ring of nblocks blocks of blocksize bytes; a block not yet full is
+ * handed over timeout ms after its first packet.  Returns the ring,
+ * or 0 with the error in *errp.
+ */
+char *
+bpf_openring(unit, ifname, insns, ninsns, blocksize, nblocks, timeout, errp)
+	int unit;
+	const char *ifname;
+	const void *insns;
+	int ninsns, blocksize, nblocks, timeout, *errp;
+{
+	struct bpf_ringreq rr;
+	int error;
+
+	if ((error = bpfopen(unit, FREAD)) != 0)
+		goto bad;
+	rr.br_blocksize = blocksize;
+	rr.br_nblocks = nblocks;
+	rr.br_timeout = timeout;
+	if ((error = bpfioctl(unit, BIOCSRING, (caddr_t)&rr, FREAD)) != 0 ||
+	    (error = bpf_setup(unit, ifname, insns, ninsns)) != 0) {
+		bpfclose(unit, FREAD);
+		goto bad;
+	}
+	return (rr.br_ring);
+bad:
+	if (errp)
+		*errp = error;
+	return (0);
+}
+
+/*
+ * Open unit on interface ifname to be read with bpf_readbuf(), in
+ * buffers of bufsize bytes.  It is in immediate mode, so that what
+ * there is can be read without waiting for the buffer to fill.
+ */
+int
+bpf_openbuf(unit, ifname, insns, ninsns, bufsize)
+	int unit;
+	const char *ifname;
+	const void *insns;
+	int ninsns, bufsize;
+{
+	u_int size = bufsize;
+	int on = 1, error;
+
+	if ((error = bpfopen(unit, FREAD)) != 0)
+		return (error);
+	if ((error = bpfioctl(unit, BIOCSBLEN, (caddr_t)&size, FREAD)) != 0 ||
+	    (error = bpfioctl(unit, BIOCIMMEDIATE, (caddr_t)&on, FREAD)) != 0 ||
+	    (error = bpf_setup(unit, ifname, insns, ninsns)) != 0)
+		bpfclose(unit, FREAD);
+	return (error);
+}
+
+/*
+ * Read what unit holds into buf, which must be as long as its buffer.
+ * Returns the bytes read, 0 if there were none; doesn't wait.
+ */
+int
+bpf_readbuf(unit, buf, len)
+	int unit;
+	char *buf;
+	int len;
+{
+	struct uio uio;
+	struct iovec iov;
+	int n, error;
+
+	/* bpfread() would sleep for packets */
+	if (bpfioctl(unit, FIONREAD, (caddr_t)&n, FREAD) != 0 || n == 0)
+		return (0);
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	uio.uio_iov = &iov;
+	uio.uio_iovcnt = 1;
+	uio.uio_offset = 0;
+	uio.uio_resid = len;
+	uio.uio_segflg = UIO_SYSSPACE;
+	uio.uio_rw = UIO_READ;
+	uio.uio_procp = NULL;
+	if ((error = bpfread(unit, &uio)) != 0)
+		return (-error);
+	return (len - uio.uio_resid);
+}
+
+/*
+ * Packets unit has seen, and those dropped for want of room.
+ */
+void
+bpf_getstats(unit, recv, drop)
+	int unit;
+	unsigned *recv, *drop;
+{
+	struct bpf_stat bs;
+
+	bpfioctl(unit, BIOCGSTATS, (caddr_t)&bs, FREAD);
+	*recv = bs.bs_recv;
+	*drop = bs.bs_drop;
+}
+
+/*
+ * Throw away what unit holds, as BIOCFLUSH.
+ */
+void
+bpf_flush(unit)
+	int unit;
+{
+	bpfioctl(unit, BIOCFLUSH, (caddr_t)0, FREAD);
+}
+
+void
+bpf_close(unit)
+	int unit;
+{
+	bpfclose(unit, FREAD);
+}
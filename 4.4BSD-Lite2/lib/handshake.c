@@ -1,6 +1,7 @@
 #include "stub.h"
 
 int sockargs(struct mbuf **mp, caddr_t buf, int buflen, int type);
+int udp_sendmmsg(struct socket *so, struct mmsghdr *msgs, int n, int *countp);
 void puts(const char*);
 void tcp_fasttimo();
 extern int tcp_do_rfc1323;
@@ -23,6 +24,50 @@ struct socket* connectto(u_int32_t ip, u_int16_t port)
 	return clientso;
 }
 
+// connectto() with an explicit local port, for when the
+// ephemeral range (IPPORT_RESERVED..IPPORT_USERRESERVED) is too small
+struct socket* connectfrom(u_int16_t lport, u_int32_t ip, u_int16_t port)
+{
+	struct socket* clientso = NULL;
+	socreate(AF_INET, &clientso, SOCK_STREAM, 0);
+	// lport may already be in use towards another server port
+	clientso->so_options |= SO_REUSEADDR;
+	struct sockaddr_in addr;
+	bzero(&addr, sizeof addr);
+	addr.sin_len = sizeof addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(lport);
+	struct mbuf* nam;
+	sockargs(&nam, (caddr_t)&addr, sizeof addr, MT_SONAME);
+	sobind(clientso, nam);
+	m_freem(nam);
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(ip);
+	sockargs(&nam, (caddr_t)&addr, sizeof addr, MT_SONAME);
+	soconnect(clientso, nam);
+	clientso->so_state |= SS_NBIO;
+	m_freem(nam);
+	return clientso;
+}
+
+// a UDP socket bound to port, for readso() to take datagrams from
+struct socket* udpon(u_int16_t port)
+{
+	struct socket* so = NULL;
+	socreate(AF_INET, &so, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	bzero(&addr, sizeof addr);
+	addr.sin_len = sizeof addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	struct mbuf* nam;
+	sockargs(&nam, (caddr_t)&addr, sizeof addr, MT_SONAME);
+	sobind(so, nam);
+	so->so_state |= SS_NBIO;
+	m_freem(nam);
+	return so;
+}
+
 // util for setup a server socket
 // 创建一个socket
 struct socket* listenon(unsigned short port)
@@ -41,7 +86,7 @@ struct socket* listenon(unsigned short port)
 	sobind(so, nam);
 	m_freem(nam);
 	// listen()
-	solisten(so, 5);
+	solisten(so, somaxconn);
 	return so;
 }
 
@@ -58,13 +103,14 @@ struct socket* acceptso(struct socket* server)
 //		so->so_error = 0;
 //		return (error);
 	int s = splnet();
-	struct socket *so = server->so_q;
+	struct socket *so = server->so_q.tqh_first;
 	if (!so)
 		goto done;
 	if (soqremque(so, 1) == 0)
 		panic("accept");
 	struct mbuf *nam = m_get(M_WAIT, MT_SONAME);
 	(void) soaccept(so, nam);
+	so->so_state |= SS_NBIO;
 	m_freem(nam);
 done:
 	splx(s);
@@ -119,6 +165,252 @@ int readso(struct socket* so, void* buf, int nbyte)
 	return cnt;
 }
 
+// one datagram to ip:port through sosend(), as sendto() would
+int sendtoso(struct socket* so, void* buf, int nbyte, u_int32_t ip,
+	     u_int16_t port)
+{
+	struct uio auio;
+	struct iovec aiov;
+	struct sockaddr_in addr;
+	struct mbuf *nam;
+	int error;
+	bzero(&addr, sizeof addr);
+	addr.sin_len = sizeof addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(ip);
+	sockargs(&nam, (caddr_t)&addr, sizeof addr, MT_SONAME);
+	aiov.iov_base = (caddr_t)buf;
+	aiov.iov_len = nbyte;
+	auio.uio_iov = &aiov;
+	auio.uio_iovcnt = 1;
+	auio.uio_resid = nbyte;
+	auio.uio_rw = UIO_WRITE;
+	auio.uio_segflg = UIO_USERSPACE;
+	auio.uio_procp = curproc;
+	error = sosend(so, nam, &auio, (struct mbuf *)0, (struct mbuf *)0, 0);
+	m_freem(nam);
+	return error ? -1 : nbyte;
+}
+
+// one datagram through soreceive(), with its sender if ip and port
+// aren't NULL, as recvfrom() would; -1 if there's none
+int recvfromso(struct socket* so, void* buf, int nbyte, u_int32_t* ip,
+	       u_int16_t* port)
+{
+	struct uio auio;
+	struct iovec aiov;
+	struct mbuf *nam = NULL;
+	aiov.iov_base = (caddr_t)buf;
+	aiov.iov_len = nbyte;
+	auio.uio_iov = &aiov;
+	auio.uio_iovcnt = 1;
+	auio.uio_resid = nbyte;
+	auio.uio_rw = UIO_READ;
+	auio.uio_segflg = UIO_USERSPACE;
+	auio.uio_procp = curproc;
+	if (soreceive(so, &nam, &auio, (struct mbuf **)0,
+	    (struct mbuf **)0, (int *)0)) {
+		if (nam)
+			m_freem(nam);
+		return -1;
+	}
+	if (nam && ip && port) {
+		struct sockaddr_in *sin = mtod(nam, struct sockaddr_in *);
+		*ip = ntohl(sin->sin_addr.s_addr);
+		*port = ntohs(sin->sin_port);
+	}
+	if (nam)
+		m_freem(nam);
+	return nbyte - auio.uio_resid;
+}
+
+/*
+ * sendmmsg() and recvmmsg() on a UDP socket: a batch of datagrams a
+ * call, through udp_sendmmsg() and soreceivemmsg().  ips and ports
+ * may be NULL, to send to the peer of a connected socket or not to
+ * be told the senders.  Both return how many datagrams went or came.
+ */
+int sendmmsgso(struct socket* so, char* const* bufs, const int* lens,
+	       const u_int32_t* ips, const u_int16_t* ports, int n)
+{
+	struct mmsghdr msgs[n];
+	struct iovec iov[n];
+	struct sockaddr_in addrs[n];
+	int i, count;
+	bzero(msgs, sizeof msgs);
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = lens[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (ips == NULL)
+			continue;
+		bzero(&addrs[i], sizeof addrs[i]);
+		addrs[i].sin_len = sizeof addrs[i];
+		addrs[i].sin_family = AF_INET;
+		addrs[i].sin_port = htons(ports[i]);
+		addrs[i].sin_addr.s_addr = htonl(ips[i]);
+		msgs[i].msg_hdr.msg_name = (caddr_t)&addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof addrs[i];
+	}
+	udp_sendmmsg(so, msgs, n, &count);
+	return count;
+}
+
+// lens[i] is the size of bufs[i], and is set to what the datagram
+// filled of it
+int recvmmsgso(struct socket* so, char* const* bufs, int* lens,
+	       u_int32_t* ips, u_int16_t* ports, int n)
+{
+	struct mmsghdr msgs[n];
+	struct iovec iov[n];
+	struct sockaddr_in addrs[n];
+	int i, count;
+	bzero(msgs, sizeof msgs);
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = lens[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = (caddr_t)&addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof addrs[i];
+	}
+	soreceivemmsg(so, msgs, n, 0, &count);
+	for (i = 0; i < count; i++) {
+		lens[i] = msgs[i].msg_len;
+		if (ips)
+			ips[i] = ntohl(addrs[i].sin_addr.s_addr);
+		if (ports)
+			ports[i] = ntohs(addrs[i].sin_port);
+	}
+	return count;
+}
+
+int setsockoptso(struct socket* so, int level, int optname,
+		 const void* val, int len)
+{
+	struct mbuf *m;
+	if (len > MLEN)
+		return EINVAL;
+	m = m_get(M_WAIT, MT_SOOPTS);
+	bcopy(val, mtod(m, caddr_t), len);
+	m->m_len = len;
+	return sosetopt(so, level, optname, m);
+}
+
+int getsockoptso(struct socket* so, int level, int optname,
+		 void* val, int* len)
+{
+	struct mbuf *m = NULL;
+	int error;
+	if ((error = sogetopt(so, level, optname, &m)) != 0)
+		return error;
+	if (*len > m->m_len)
+		*len = m->m_len;
+	bcopy(mtod(m, caddr_t), val, *len);
+	m_free(m);
+	return 0;
+}
+
+/*
+ * Zero-copy writeso(): the stack queues buf itself, in external mbufs
+ * that share one reference count, and calls freefn(buf, arg) once the
+ * last of them is freed.  That may happen before returning, if less
+ * than nbyte could be queued.
+ */
+struct extbuf {
+	u_int	eb_refcnt;
+	char	*eb_buf;
+	void	(*eb_free)(char *, void *);
+	void	*eb_arg;
+};
+
+static void
+extbuf_free(buf, size, arg)
+	caddr_t buf;
+	u_int size;
+	void *arg;
+{
+	struct extbuf *eb = arg;
+
+	(*eb->eb_free)(eb->eb_buf, eb->eb_arg);
+	free(eb, M_TEMP);
+}
+
+int writeso_ext(struct socket* so, char* buf, int nbyte,
+		void (*freefn)(char*, void*), void* arg)
+{
+	struct extbuf *eb = malloc(sizeof(*eb), M_TEMP, M_NOWAIT);
+	int cnt = 0;
+	if (eb == NULL)
+		return 0;
+	eb->eb_refcnt = 1;
+	eb->eb_buf = buf;
+	eb->eb_free = freefn;
+	eb->eb_arg = arg;
+	// sosend() takes a chain whole, so hand it no more than fits
+	while (cnt < nbyte) {
+		long len = sbspace(&so->so_snd);
+		struct mbuf *m;
+		if (len > nbyte - cnt)
+			len = nbyte - cnt;
+		if (len <= 0)
+			break;
+		MGETHDR(m, M_DONTWAIT, MT_DATA);
+		if (m == NULL)
+			break;
+		MEXTADD(m, buf + cnt, len, extbuf_free, &eb->eb_refcnt, eb);
+		m->m_len = m->m_pkthdr.len = len;
+		m->m_pkthdr.rcvif = NULL;
+		if (sosend(so, (struct mbuf *)0, (struct uio *)0, m,
+		    (struct mbuf *)0, 0))
+			break;
+		cnt += len;
+	}
+	MEXTUNREF(buf, nbyte, extbuf_free, &eb->eb_refcnt, eb);
+	return cnt;
+}
+
+/*
+ * Zero-copy readso(): takes up to nbyte bytes out of so_rcv as the
+ * mbuf chain they arrived in.  The caller reads it with mtoiov() and
+ * frees it with m_freem().
+ */
+struct mbuf* readso_mbuf(struct socket* so, int nbyte)
+{
+	struct uio auio;
+	struct mbuf *m = NULL;
+	bzero(&auio, sizeof auio);
+	auio.uio_resid = nbyte;
+	auio.uio_rw = UIO_READ;
+	auio.uio_segflg = UIO_SYSSPACE;
+	auio.uio_procp = curproc;
+	if (soreceive(so, (struct mbuf **)0, &auio, &m,
+	    (struct mbuf **)0, (int *)0) && m) {
+		m_freem(m);
+		m = NULL;
+	}
+	return m;
+}
+
+// points up to iovcnt iovecs at the chain from *mp on, and advances *mp
+// past the mbufs covered
+int mtoiov(struct mbuf** mp, struct iovec* iov, int iovcnt)
+{
+	struct mbuf *m;
+	int n = 0;
+	for (m = *mp; m && n < iovcnt; m = m->m_next) {
+		if (m->m_len == 0)
+			continue;
+		iov[n].iov_base = mtod(m, char *);
+		iov[n].iov_len = m->m_len;
+		n++;
+	}
+	*mp = m;
+	return n;
+}
+
 void handshake()
 {
 	int port = 1234;
@@ -0,0 +1,122 @@
+#include "stub.h"
+
+#include <net/bpf.h>
+#include <net/if_dl.h>
+#include <netinet/if_ether.h>
+
+/*
+ * An Ethernet interface whose wire is the process: frames the stack
+ * sends are queued for el_dequeue(), and frames handed to el_input()
+ * are received as from the cable, ARP included.  A test on the other
+ * end plays the hosts of the segment.
+ */
+struct	arpcom elif;
+struct	ifqueue el_out_queue;
+
+int el_dequeue(char *buf, int len)
+{
+	int copied = 0;
+	struct mbuf *m = dequeue(&el_out_queue);
+	if (m) {
+		copied = m_copydata(m, 0, len, buf);
+		m_freem(m);
+	}
+	return copied;
+}
+
+void el_setqlen(int maxlen)
+{
+	el_out_queue.ifq_maxlen = maxlen;
+}
+
+/*
+ * Put what ether_output() queued on the wire.
+ */
+int
+elstart(ifp)
+	struct ifnet *ifp;
+{
+	struct mbuf *m;
+
+	for (;;) {
+		IF_DEQUEUE(&ifp->if_snd, m);
+		if (m == NULL)
+			break;
+		ifp->if_opackets++;
+		if (ifp->if_bpf)
+			bpf_mtap(ifp->if_bpf, m);
+		enqueue(&el_out_queue, m);
+	}
+	return 0;
+}
+
+/*
+ * Receive a frame, Ethernet header first, and run the input queues.
+ */
+void
+el_input(buf, len)
+	const char *buf;
+	int len;
+{
+	register struct ifnet *ifp = &elif.ac_if;
+	struct ether_header eh;
+	struct mbuf *m;
+
+	updatetime();
+	if (len < sizeof (eh))
+		return;
+	if (ifp->if_bpf)
+		bpf_tap(ifp->if_bpf, (u_char *)buf, len);
+	bcopy(buf, &eh, sizeof (eh));
+	eh.ether_type = ntohs(eh.ether_type);
+	m = m_devget((char *)buf + sizeof (eh), len - sizeof (eh), 0, ifp, NULL);
+	if (m == NULL) {
+		ifp->if_iqdrops++;
+		return;
+	}
+	ifp->if_ipackets++;
+	ether_input(ifp, &eh, m);
+	arpintr();
+	ipintr();
+}
+
+int
+elioctl(ifp, cmd, data)
+	register struct ifnet *ifp;
+	u_long cmd;
+	caddr_t data;
+{
+	struct ifaddr *ifa = (struct ifaddr *)data;
+	int error = 0;
+
+	switch (cmd) {
+	case SIOCSIFADDR:
+		ifp->if_flags |= IFF_UP | IFF_RUNNING;
+		if (ifa->ifa_addr->sa_family == AF_INET) {
+			elif.ac_ipaddr = IA_SIN(ifa)->sin_addr;
+			arpwhohas(&elif, &IA_SIN(ifa)->sin_addr);
+		}
+		break;
+	default:
+		error = EINVAL;
+	}
+	return error;
+}
+
+void elattach(int n)
+{
+	static u_char enaddr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+	register struct ifnet *ifp = &elif.ac_if;
+
+	el_out_queue.ifq_maxlen = IFQ_MAXLEN;
+	bcopy(enaddr, elif.ac_enaddr, sizeof (enaddr));
+	ifp->if_name = "el";
+	ifp->if_flags = IFF_BROADCAST | IFF_SIMPLEX;
+	ifp->if_ioctl = elioctl;
+	ifp->if_output = ether_output;
+	ifp->if_start = elstart;
+	ifp->if_snd.ifq_maxlen = IFQ_MAXLEN;
+	if_attach(ifp);
+	ether_ifattach(ifp);
+	bpfattach(&ifp->if_bpf, ifp, DLT_EN10MB, sizeof (struct ether_header));
+}
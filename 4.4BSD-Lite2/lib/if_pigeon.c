@@ -4,6 +4,8 @@
 
 #include "stub.h"
 
+#include <net/bpf.h>
+
 extern void ip_intercept(struct mbuf *m);
 
 struct	ifnet pigeonif;
@@ -20,6 +22,11 @@ int pigeon_dequeue(char *buf, int len)
 	return copied;
 }
 
+void pigeon_setqlen(int maxlen)
+{
+	pigeon_out_queue.ifq_maxlen = maxlen;
+}
+
 int
 pigeonoutput(ifp, m, dst, rt)
 	struct ifnet *ifp;
@@ -27,6 +34,8 @@ pigeonoutput(ifp, m, dst, rt)
 	struct sockaddr *dst;
 	register struct rtentry *rt;
 {
+	if (ifp->if_bpf)
+		bpf_mtap(ifp->if_bpf, m);
 	ip_intercept(m);
 	enqueue(&pigeon_out_queue, m);
 	return 0;
@@ -74,5 +83,6 @@ void pigeonattach(int n)
 	ifp->if_addrlen = 0;
     // 激活该设备
 	if_attach(ifp);
+	bpfattach(&ifp->if_bpf, ifp, DLT_RAW, 0);
 }
 
@@ -1,8 +1,50 @@
 #include "stub.h"
 
+#include <net/bpf.h>
+
 struct	ifnet tunif;
 
+// defined by the host, as write() and writev(); -1 only for EAGAIN
 int tun_write(const char *buf, int len);
+int tun_writev(const struct iovec *iov, int iovcnt);
+
+/*
+ * Zero-copy mode.  The host reads packets straight into the cluster
+ * mbufs of tun_rxring, handed out by tun_rxbufs(), and passes a batch
+ * of them up with tun_input().  On output the chain is written with
+ * one writev() over its mbufs instead of being copied into a buffer.
+ */
+#define	TUN_NRX		64		/* receive ring size */
+#define	TUN_MAXSEG	16		/* mbufs per writev() */
+#define	TUN_COPYBREAK	MHLEN		/* copy packets this small */
+
+int	tun_zerocopy;
+struct	mbuf *tun_rxring[TUN_NRX];
+
+void tun_setzerocopy(int on)
+{
+	tun_zerocopy = on;
+}
+
+/*
+ * Account for a packet of len bytes written to the host.  -1 is a
+ * write the host couldn't take now, EAGAIN on a non-blocking fd: the
+ * packet is dropped as a full output queue would drop it.
+ */
+static void
+tun_written(ifp, n, len)
+	struct ifnet *ifp;
+	int n, len;
+{
+	if (n < 0) {
+		ifp->if_oerrors++;
+		return;
+	}
+	if (n != len)
+		panic("short write tun");
+	ifp->if_opackets++;
+	ifp->if_obytes += len;
+}
 
 int
 tunoutput(ifp, m, dst, rt)
@@ -11,15 +53,113 @@ tunoutput(ifp, m, dst, rt)
 	struct sockaddr *dst;
 	register struct rtentry *rt;
 {
+	if (ifp->if_bpf)
+		bpf_mtap(ifp->if_bpf, m);
+	if (tun_zerocopy) {
+		struct iovec iov[TUN_MAXSEG];
+		register struct mbuf *n;
+		int iovcnt = 0, len = 0;
+
+		for (n = m; n && iovcnt < TUN_MAXSEG; n = n->m_next) {
+			if (n->m_len == 0)
+				continue;
+			iov[iovcnt].iov_base = mtod(n, char *);
+			iov[iovcnt].iov_len = n->m_len;
+			len += n->m_len;
+			iovcnt++;
+		}
+		if (n == NULL) {
+			tun_written(ifp, tun_writev(iov, iovcnt), len);
+			m_freem(m);
+			return 0;
+		}
+		/* too many pieces, flatten it */
+	}
 	char buf[2048];
 	int len = m_copydata(m, 0, sizeof buf, buf);
-	if (tun_write(buf, len) == len)
-		m_freem(m);
-	else
-		panic("short write tun");
+	tun_written(ifp, tun_write(buf, len), len);
+	m_freem(m);
 	return 0;
 }
 
+/*
+ * Fill the receive ring with cluster mbufs and point iov[] at them.
+ * Returns how many buffers are ready, fewer than n if mbufs ran out.
+ */
+int
+tun_rxbufs(iov, n)
+	struct iovec *iov;
+	int n;
+{
+	register struct mbuf *m;
+	int i;
+
+	if (n > TUN_NRX)
+		n = TUN_NRX;
+	for (i = 0; i < n; i++) {
+		if ((m = tun_rxring[i]) == NULL) {
+			MGETHDR(m, M_DONTWAIT, MT_DATA);
+			if (m == NULL)
+				break;
+			MCLGET(m, M_DONTWAIT);
+			if ((m->m_flags & M_EXT) == 0) {
+				m_free(m);
+				break;
+			}
+			tun_rxring[i] = m;
+		}
+		iov[i].iov_base = mtod(m, char *);
+		iov[i].iov_len = MCLBYTES;
+	}
+	return i;
+}
+
+/*
+ * The host has read n packets into the first n ring buffers, lens[i]
+ * bytes into buffer i.  Queue them for IP and run ipintr() once for
+ * the whole batch.  Small packets are copied into a plain mbuf so the
+ * cluster stays in the ring.
+ */
+void
+tun_input(lens, n)
+	const int *lens;
+	int n;
+{
+	register struct ifnet *ifp = &tunif;
+	register struct mbuf *m;
+	int i, s;
+
+	updatetime();
+	for (i = 0; i < n; i++) {
+		if (lens[i] <= 0)
+			continue;
+		if (lens[i] <= TUN_COPYBREAK) {
+			MGETHDR(m, M_DONTWAIT, MT_DATA);
+			if (m == NULL) {
+				ifp->if_iqdrops++;
+				continue;
+			}
+			bcopy(mtod(tun_rxring[i], caddr_t), mtod(m, caddr_t),
+			    (unsigned)lens[i]);
+		} else {
+			m = tun_rxring[i];
+			tun_rxring[i] = NULL;
+		}
+		m->m_len = m->m_pkthdr.len = lens[i];
+		m->m_pkthdr.rcvif = ifp;
+		if (ifp->if_bpf)
+			bpf_mtap(ifp->if_bpf, m);
+		ifp->if_ipackets++;
+		ifp->if_ibytes += lens[i];
+		if (IF_QFULL(&ipintrq))
+			ipintr();
+		s = splimp();
+		IF_ENQUEUE(&ipintrq, m);
+		splx(s);
+	}
+	ipintr();
+}
+
 /*
  * Process an ioctl request.
  */
@@ -55,5 +195,6 @@ void tunattach(int n)
 	ifp->if_hdrlen = 0;
 	ifp->if_addrlen = 0;
 	if_attach(ifp);
+	bpfattach(&ifp->if_bpf, ifp, DLT_RAW, 0);
 }
 
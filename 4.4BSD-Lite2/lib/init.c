@@ -1,12 +1,37 @@
 #include "stub.h"
 
+#include <vm/vm.h>
+#include <vm/vm_kern.h>
+
+#include <netinet/if_ether.h>
+#include <netinet/in_pcb.h>
+#include <netinet/tcp.h>
+#define TCPSTATES
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+
+extern int strcmp(const char *, const char *);
+
 struct	pcred cred0;
 struct	ucred ucred0;
 
+static int timeset;
+
 // 获取时间戳
 void updatetime()
 {
-  microtime((struct timeval *)&time);
+  if (!timeset)
+    microtime((struct timeval *)&time);
+}
+
+// from now on the clock only moves with settime(), for simulations
+void settime(long long usec)
+{
+  timeset = 1;
+  time.tv_sec = usec / 1000000;
+  time.tv_usec = usec % 1000000;
 }
 
 void setipaddr(const char* name, uint ip)
@@ -29,19 +54,151 @@ void setipaddr(const char* name, uint ip)
   sofree(so);  // FIXME: this doesn't free memory
 }
 
+static void setsin(struct sockaddr_in* sin, uint ip)
+{
+  bzero(sin, sizeof *sin);
+  sin->sin_len = sizeof *sin;
+  sin->sin_family = AF_INET;
+  sin->sin_addr.s_addr = htonl(ip);
+}
+
+// adds the route to ip/len through gw, as route(8) add does
+int addroute(uint ip, int len, uint gw)
+{
+  struct sockaddr_in dst, gate, mask;
+  setsin(&dst, ip);
+  setsin(&gate, gw);
+  setsin(&mask, len ? 0xffffffff << (32 - len) : 0);
+  return rtrequest(RTM_ADD, (struct sockaddr*)&dst, (struct sockaddr*)&gate,
+                   (struct sockaddr*)&mask, RTF_UP | RTF_GATEWAY | RTF_STATIC,
+                   NULL);
+}
+
+int delroute(uint ip, int len)
+{
+  struct sockaddr_in dst, mask;
+  setsin(&dst, ip);
+  setsin(&mask, len ? 0xffffffff << (32 - len) : 0);
+  return rtrequest(RTM_DELETE, (struct sockaddr*)&dst, NULL,
+                   (struct sockaddr*)&mask, 0, NULL);
+}
+
+// the route to ip found by walking the radix tree, NULL if none
+struct rtentry* rtlookup_radix(uint ip)
+{
+  struct radix_node_head* rnh = rt_tables[AF_INET];
+  struct radix_node* rn;
+  struct sockaddr_in dst;
+  setsin(&dst, ip);
+  rn = rnh->rnh_matchaddr((caddr_t)&dst, rnh);
+  return rn && (rn->rn_flags & RNF_ROOT) == 0 ? (struct rtentry*)rn : NULL;
+}
+
+// the same from the FIB, see sys/net/fib.c
+struct rtentry* rtlookup_fib(uint ip)
+{
+  return fib_lookup(htonl(ip));
+}
+
 void cpu_startup()
 {
+        vm_offset_t maxaddr;
+
         /*
          * Finally, allocate mbuf pool.  Since mclrefcnt is an off-size
          * we use the more space efficient malloc in place of kmem_alloc.
          */
-        mclrefcnt = (char *)malloc(NMBCLUSTERS+CLBYTES/MCLBYTES,
+        mclrefcnt = (char *)malloc(nmbclusters+CLBYTES/MCLBYTES,
                                    M_MBUF, M_NOWAIT);
-        bzero(mclrefcnt, NMBCLUSTERS+CLBYTES/MCLBYTES);
-/*
-        mb_map = kmem_suballoc(kernel_map, (vm_offset_t)&mbutl, &maxaddr,
-                               VM_MBUF_SIZE, FALSE);
-*/
+        bzero(mclrefcnt, nmbclusters+CLBYTES/MCLBYTES);
+        mb_map = kmem_suballoc(kernel_map, (vm_offset_t *)&mbutl, &maxaddr,
+                               nmbclusters*MCLBYTES, FALSE);
+}
+
+void mbstat_print()
+{
+  printf("mbufs: %lu in pool, %lu free, %lu most in use, %lu hits, %lu misses\n",
+         mbstat.m_mbufs, mbstat.m_mbfree, mbstat.m_mbhiwat,
+         mbstat.m_mbhits, mbstat.m_mbmisses);
+  printf("clusters: %lu in pool, %lu free, %lu most in use, %lu hits, %lu misses\n",
+         mbstat.m_clusters, mbstat.m_clfree, mbstat.m_clhiwat,
+         mbstat.m_clhits, mbstat.m_clmisses);
+}
+
+static void printaddr(struct in_addr addr, u_short port)
+{
+  u_long a = ntohl(addr.s_addr);
+  printf("%lu.%lu.%lu.%lu:%u", a >> 24, a >> 16 & 0xff, a >> 8 & 0xff,
+         a & 0xff, ntohs(port));
+}
+
+void sbstat_print()
+{
+  printf("sockbufs: %lu reserved, %lu most, %lu budget; %lu grown, "
+         "%lu shrunk, %lu denied\n",
+         sbstat.sb_reserved, sbstat.sb_reshiwat, sb_budget, sbstat.sb_grown,
+         sbstat.sb_shrunk, sbstat.sb_denied);
+  for (struct inpcb* inp = tcb.inp_next; inp != &tcb; inp = inp->inp_next)
+  {
+    struct tcpcb* tp = intotcpcb(inp);
+    struct socket* so = inp->inp_socket;
+    if (tp == NULL)
+      continue;
+    printaddr(inp->inp_laddr, inp->inp_lport);
+    printf(" ");
+    printaddr(inp->inp_faddr, inp->inp_fport);
+    printf(" %s snd %lu/%lu%s rcv %lu/%lu%s cwnd %lu\n",
+           tcpstates[tp->t_state], so->so_snd.sb_cc, so->so_snd.sb_hiwat,
+           so->so_snd.sb_flags & SB_AUTOSIZE ? " auto" : "",
+           so->so_rcv.sb_cc, so->so_rcv.sb_hiwat,
+           so->so_rcv.sb_flags & SB_AUTOSIZE ? " auto" : "", tp->snd_cwnd);
+  }
+}
+
+// the counters tests read, by their names in the kernel's stats structs
+#define KSTAT(stats, field) { #field, &stats.field }
+static struct
+{
+  const char* name;
+  u_long* counter;
+} kstats[] = {
+  KSTAT(arpstat, as_dropped),
+  KSTAT(arpstat, as_rxreplies),
+  KSTAT(arpstat, as_timeouts),
+  KSTAT(arpstat, as_txrequests),
+  KSTAT(ipstat, ips_fragevicted),
+  KSTAT(ipstat, ips_reassembled),
+  KSTAT(sbstat, sb_denied),
+  KSTAT(sbstat, sb_reserved),
+  KSTAT(sbstat, sb_shrunk),
+  KSTAT(tcpstat, tcps_badsyn),
+  KSTAT(tcpstat, tcps_listendrop),
+  KSTAT(tcpstat, tcps_pawsdrop),
+  KSTAT(tcpstat, tcps_rcvdupack),
+  KSTAT(tcpstat, tcps_sackrecovery),
+  KSTAT(tcpstat, tcps_sc_added),
+  KSTAT(tcpstat, tcps_sc_completed),
+  KSTAT(tcpstat, tcps_sc_dupsyn),
+  KSTAT(tcpstat, tcps_sc_overflow),
+  KSTAT(tcpstat, tcps_sc_recvcookie),
+  KSTAT(tcpstat, tcps_sc_reset),
+  KSTAT(tcpstat, tcps_sc_restarted),
+  KSTAT(tcpstat, tcps_sc_retransmitted),
+  KSTAT(tcpstat, tcps_sc_sendcookie),
+  KSTAT(tcpstat, tcps_sc_timedout),
+  KSTAT(tcpstat, tcps_tw_added),
+  KSTAT(tcpstat, tcps_tw_expired),
+  KSTAT(tcpstat, tcps_tw_reset),
+  KSTAT(tcpstat, tcps_tw_reused),
+};
+
+u_long kstat(const char* name)
+{
+  for (int i = 0; i < sizeof kstats / sizeof kstats[0]; ++i)
+    if (strcmp(kstats[i].name, name) == 0)
+      return *kstats[i].counter;
+  panic("kstat %s", name);
+  return 0;
 }
 
 void init()
@@ -53,9 +210,10 @@ void init()
   // 绑定回环设备
   // 用来初始化回环设备
   loopattach(1);
+  // mbuf 池要先于 mbinit 分配
+  cpu_startup();
   // 初始化process和kernel之间的buffer
   mbinit();
-  cpu_startup();
 
   // 禁止packets的读取
   int s = splimp();
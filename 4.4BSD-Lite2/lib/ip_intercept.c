@@ -1,18 +1,60 @@
 #include "stub.h"
+#include <net/bpf.h>
 
 // defined in tools/pcap.c
 
 extern int pcap_enabled;
+extern int pcap_snaplen;
 
-int pcap_write(const char *buf, int len, int origlen);
+char *pcap_begin(int caplen, int origlen);
+void pcap_end();
 
+// the capture filter, compiled, NULL to take every packet
+struct bpf_tinsn *pcap_filter;
+
+int pcap_setfilter(const struct bpf_insn *insns, int ninsns)
+{
+  struct bpf_tinsn *f = NULL;
+  if (insns)
+  {
+    if (!bpf_validate((struct bpf_insn *)insns, ninsns))
+      return EINVAL;
+    f = bpf_compile((struct bpf_insn *)insns, ninsns);
+    if (f == NULL)
+      return ENOBUFS;
+  }
+  bpf_tfree(pcap_filter);
+  pcap_filter = f;
+  return 0;
+}
+
+// runs the filter on the chain in place, then copies at most snaplen
+// bytes straight into the capture ring
 void ip_intercept(struct mbuf *m)
 {
   if (pcap_enabled)
   {
-    char buf[2048];
-    int len = m_copydata(m, 0, sizeof buf, buf);
-    int origlen = (m->m_flags & M_PKTHDR) ? m->m_pkthdr.len : len;
-    pcap_write(buf, len, origlen);
+    int origlen = 0;
+    u_int caplen = pcap_snaplen;
+    struct mbuf *n;
+    if (m->m_flags & M_PKTHDR)
+      origlen = m->m_pkthdr.len;
+    else
+      for (n = m; n; n = n->m_next)
+        origlen += n->m_len;
+    // buflen 0 tells bpf_tfilter() it has an mbuf chain
+    if (pcap_filter &&
+        (caplen = bpf_tfilter(pcap_filter, (u_char *)m, origlen, 0)) == 0)
+      return;
+    if (caplen > pcap_snaplen)
+      caplen = pcap_snaplen;
+    if (caplen > origlen)
+      caplen = origlen;
+    char *p = pcap_begin(caplen, origlen);
+    if (p)
+    {
+      m_copydata(m, 0, caplen, p);
+      pcap_end();
+    }
   }
 }
@@ -1,5 +1,9 @@
 #include "stub.h"
 
+#include <net/bpf.h>
+
+extern struct ifnet pigeonif;
+
 void enqueue(struct ifqueue *inq, struct mbuf *m)
 {
 	int s = splimp();
@@ -22,13 +26,43 @@ struct mbuf *dequeue(struct ifqueue *inq)
 
 void inject(char* msg, int len)
 {
-	struct mbuf *m = m_devget(msg, len, 0, NULL, NULL);
+	struct mbuf *m;
+
+	/* what comes in this way comes in on pg0 */
+	if (pigeonif.if_bpf)
+		bpf_tap(pigeonif.if_bpf, (u_char *)msg, len);
+	m = m_devget(msg, len, 0, &pigeonif, NULL);
 	enqueue(&ipintrq, m);
     // 更新时间
 	updatetime();
 	ipintr();
 }
 
+/*
+ * Queue n packets for IP and run ipintr() once for the batch, as
+ * tun_input() does.  Returns how many ipintr_budget left on ipintrq,
+ * for another ipintr() after the timers.
+ */
+int inject_batch(char **msgs, const int *lens, int n)
+{
+	struct mbuf *m;
+	int i;
+
+	updatetime();
+	for (i = 0; i < n; i++) {
+		if (pigeonif.if_bpf)
+			bpf_tap(pigeonif.if_bpf, (u_char *)msgs[i], lens[i]);
+		m = m_devget(msgs[i], lens[i], 0, &pigeonif, NULL);
+		if (m == NULL)
+			continue;
+		if (IF_QFULL(&ipintrq))
+			ipintr();
+		enqueue(&ipintrq, m);
+	}
+	ipintr();
+	return ipintrq.ifq_len;
+}
+
 void ping()
 {
 	// An ICMP echo request, sending from 127.0.0.1 to 127.0.0.1
@@ -0,0 +1,282 @@
+/*
+ * Readiness notification for sockets, in the manner of epoll.
+ *
+ * Every sorwakeup()/sowwakeup() goes through sowakeup(), which calls
+ * selwakeup() on the sockbuf's selinfo.  A registered socket has the
+ * index of its registration in si_pid of both sockbufs, where select
+ * would keep the selecting process, so selwakeup() can put it on the
+ * ready list of its poll set in constant time.  sopoll_wait() then
+ * only looks at sockets that had a wakeup, not at all of them.
+ *
+ * Events are level-triggered: a reported socket stays on the ready
+ * list and is checked again by the next sopoll_wait().  With
+ * SOPOLL_ET it is reported once per wakeup.
+ */
+
+#include "stub.h"
+#include <sys/queue.h>
+
+#define	SOPOLL_IN	0x0001		/* readable, or a connection to accept */
+#define	SOPOLL_OUT	0x0004		/* writable */
+#define	SOPOLL_ERR	0x0008		/* so_error set */
+#define	SOPOLL_HUP	0x0010		/* both directions shut down */
+#define	SOPOLL_ET	0x40000000	/* edge-triggered */
+
+struct sopoll_event {
+	int	events;
+	void	*udata;
+};
+
+struct sopollent {
+	struct	socket *pe_so;
+	struct	sopoll *pe_set;
+	int	pe_events;		/* SOPOLL_* wanted */
+	int	pe_queued;		/* on pe_set's ready list */
+	void	*pe_udata;
+	LIST_ENTRY(sopollent) pe_link;	/* all of pe_set's */
+	TAILQ_ENTRY(sopollent) pe_ready;
+};
+
+struct sopoll {
+	LIST_HEAD(, sopollent) sp_all;
+	TAILQ_HEAD(, sopollent) sp_ready;
+	int	sp_nready;		/* on sp_ready */
+};
+
+/*
+ * Registrations by index; si_pid holds index + 1.  The indices of
+ * free slots are kept on a stack.
+ */
+static struct sopollent **sopolltab;
+static int *sopollfree;
+static int sopolltabsize;
+static int nsopollfree;
+
+#define	SOPOLL_IDX(so)	((so)->so_rcv.sb_sel.si_pid - 1)
+
+/*
+ * Ask for the next wakeup on both sockbufs, as selrecord() would.
+ * sowakeup() clears SB_SEL, and tcp_input() calls sowwakeup() only
+ * while SB_NOTIFY is set, so it is set again each time a socket is
+ * looked at.
+ */
+#define	SOPOLL_ARM(so) { \
+	(so)->so_rcv.sb_flags |= SB_SEL; \
+	(so)->so_snd.sb_flags |= SB_SEL; \
+}
+
+static int
+sopoll_ready(pe)
+	register struct sopollent *pe;
+{
+	register struct socket *so = pe->pe_so;
+	register int revents = 0;
+
+	if ((pe->pe_events & SOPOLL_IN) && soreadable(so))
+		revents |= SOPOLL_IN;
+	if ((pe->pe_events & SOPOLL_OUT) && sowriteable(so))
+		revents |= SOPOLL_OUT;
+	if (so->so_error)
+		revents |= SOPOLL_ERR;
+	if ((so->so_state & (SS_CANTRCVMORE|SS_CANTSENDMORE)) ==
+	    (SS_CANTRCVMORE|SS_CANTSENDMORE))
+		revents |= SOPOLL_HUP;
+	return (revents);
+}
+
+static void
+sopoll_enqueue(pe)
+	register struct sopollent *pe;
+{
+	if (pe->pe_queued)
+		return;
+	pe->pe_queued = 1;
+	TAILQ_INSERT_TAIL(&pe->pe_set->sp_ready, pe, pe_ready);
+	pe->pe_set->sp_nready++;
+}
+
+static void
+sopoll_dequeue(pe)
+	register struct sopollent *pe;
+{
+	if (!pe->pe_queued)
+		return;
+	pe->pe_queued = 0;
+	TAILQ_REMOVE(&pe->pe_set->sp_ready, pe, pe_ready);
+	pe->pe_set->sp_nready--;
+}
+
+/*
+ * Do a wakeup when a selectable event occurs.
+ */
+void
+selwakeup(sip)
+	register struct selinfo *sip;
+{
+	if (sip->si_pid <= 0 || sip->si_pid > sopolltabsize)
+		return;
+	sopoll_enqueue(sopolltab[sip->si_pid - 1]);
+}
+
+struct sopoll *
+sopoll_create()
+{
+	register struct sopoll *sp;
+
+	sp = malloc(sizeof(*sp), M_TEMP, M_NOWAIT);
+	if (sp == NULL)
+		return (NULL);
+	LIST_INIT(&sp->sp_all);
+	TAILQ_INIT(&sp->sp_ready);
+	sp->sp_nready = 0;
+	return (sp);
+}
+
+/*
+ * Register so with sp for events; udata is handed back with them.
+ * A socket can be in one poll set at a time.
+ */
+int
+sopoll_add(sp, so, events, udata)
+	struct sopoll *sp;
+	struct socket *so;
+	int events;
+	void *udata;
+{
+	register struct sopollent *pe;
+	int i;
+
+	if (so->so_rcv.sb_sel.si_pid != 0)
+		return (EEXIST);
+	if (nsopollfree == 0) {
+		int nsize = sopolltabsize ? 2 * sopolltabsize : 64;
+		struct sopollent **t;
+		int *f;
+
+		t = malloc(nsize * sizeof(*t), M_TEMP, M_NOWAIT);
+		f = malloc(nsize * sizeof(*f), M_TEMP, M_NOWAIT);
+		if (t == NULL || f == NULL) {
+			if (t)
+				free(t, M_TEMP);
+			if (f)
+				free(f, M_TEMP);
+			return (ENOBUFS);
+		}
+		if (sopolltab) {
+			bcopy(sopolltab, t, sopolltabsize * sizeof(*t));
+			free(sopolltab, M_TEMP);
+			free(sopollfree, M_TEMP);
+		}
+		for (i = nsize - 1; i >= sopolltabsize; i--)
+			f[nsopollfree++] = i;
+		sopolltab = t;
+		sopollfree = f;
+		sopolltabsize = nsize;
+	}
+	pe = malloc(sizeof(*pe), M_TEMP, M_NOWAIT);
+	if (pe == NULL)
+		return (ENOBUFS);
+	i = sopollfree[--nsopollfree];
+	sopolltab[i] = pe;
+
+	pe->pe_so = so;
+	pe->pe_set = sp;
+	pe->pe_events = events;
+	pe->pe_queued = 0;
+	pe->pe_udata = udata;
+	so->so_rcv.sb_sel.si_pid = so->so_snd.sb_sel.si_pid = i + 1;
+	LIST_INSERT_HEAD(&sp->sp_all, pe, pe_link);
+	SOPOLL_ARM(so);
+	/* it may be ready already */
+	sopoll_enqueue(pe);
+	return (0);
+}
+
+/*
+ * Change the events wanted for a registered socket.
+ */
+int
+sopoll_mod(sp, so, events, udata)
+	struct sopoll *sp;
+	struct socket *so;
+	int events;
+	void *udata;
+{
+	register struct sopollent *pe;
+
+	if (so->so_rcv.sb_sel.si_pid <= 0)
+		return (ENOENT);
+	pe = sopolltab[SOPOLL_IDX(so)];
+	if (pe->pe_set != sp)
+		return (ENOENT);
+	pe->pe_events = events;
+	pe->pe_udata = udata;
+	SOPOLL_ARM(so);
+	sopoll_enqueue(pe);
+	return (0);
+}
+
+/*
+ * Unregister so.  Must be done before soclose(), which may free it.
+ */
+int
+sopoll_del(sp, so)
+	struct sopoll *sp;
+	struct socket *so;
+{
+	register struct sopollent *pe;
+	int i;
+
+	if (so->so_rcv.sb_sel.si_pid <= 0)
+		return (ENOENT);
+	i = SOPOLL_IDX(so);
+	pe = sopolltab[i];
+	if (pe->pe_set != sp)
+		return (ENOENT);
+	sopoll_dequeue(pe);
+	LIST_REMOVE(pe, pe_link);
+	so->so_rcv.sb_sel.si_pid = so->so_snd.sb_sel.si_pid = 0;
+	sopolltab[i] = NULL;
+	sopollfree[nsopollfree++] = i;
+	free(pe, M_TEMP);
+	return (0);
+}
+
+/*
+ * Fill in up to maxevents events for the sockets that are ready now,
+ * and return how many.  Never blocks: the caller runs ipintr() and
+ * the callouts, then asks what became ready.
+ */
+int
+sopoll_wait(sp, ev, maxevents)
+	struct sopoll *sp;
+	struct sopoll_event *ev;
+	int maxevents;
+{
+	register struct sopollent *pe;
+	int n = 0, revents, todo;
+
+	/* entries put back for level-triggering are not looked at twice */
+	for (todo = sp->sp_nready; todo > 0 && n < maxevents; todo--) {
+		pe = sp->sp_ready.tqh_first;
+		sopoll_dequeue(pe);
+		SOPOLL_ARM(pe->pe_so);
+		if ((revents = sopoll_ready(pe)) != 0) {
+			ev[n].events = revents;
+			ev[n].udata = pe->pe_udata;
+			n++;
+			if ((pe->pe_events & SOPOLL_ET) == 0)
+				sopoll_enqueue(pe);
+		}
+	}
+	return (n);
+}
+
+void
+sopoll_close(sp)
+	struct sopoll *sp;
+{
+	while (sp->sp_all.lh_first)
+		sopoll_del(sp, sp->sp_all.lh_first->pe_so);
+	free(sp, M_TEMP);
+}
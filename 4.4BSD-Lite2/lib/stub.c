@@ -26,6 +26,7 @@
 
 extern void exit(int) __attribute__ ((__noreturn__));
 extern int gettimeofday(struct timeval *, void*);
+extern int strcmp(const char *, const char *);
 
 int splnet(void)
 {
@@ -71,6 +72,7 @@ void ovbcopy(const void *src, void *dest, size_t n)
 #define HZ 100
 int hz = HZ;
 int tick = 1000000 / HZ;
+int nmbclusters = NMBCLUSTERS;
 struct	proc proc0;
 struct	proc *curproc = &proc0;
 struct	pcred cred0;
@@ -140,13 +142,145 @@ int copyin(void* from, void* to, u_int len)
  */
 volatile struct	timeval time;
 
+/*
+ * Pending callouts are kept in a binary min-heap ordered by the time,
+ * in milliseconds, they are due; callouts due at the same time run in
+ * the order they were scheduled.  There is no clock interrupt here,
+ * so the event loop drives them through callout_run().
+ */
+struct callentry {
+	long long c_time;			/* when it is due */
+	u_long	c_seq;				/* tie breaker */
+	void	(*c_func) __P((void *));	/* function to call */
+	void	*c_arg;				/* function argument */
+};
+
+static struct callentry *callheap;
+static int ncallout, callheapsize;
+static u_long callseq;
+static long long callnow;			/* time of last callout_run */
+
+static int
+callout_before(a, b)
+	register struct callentry *a, *b;
+{
+	if (a->c_time != b->c_time)
+		return (a->c_time < b->c_time);
+	return ((long)(a->c_seq - b->c_seq) < 0);
+}
+
+static void
+callout_siftup(i)
+	register int i;
+{
+	struct callentry c = callheap[i];
+	register int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!callout_before(&c, &callheap[parent]))
+			break;
+		callheap[i] = callheap[parent];
+		i = parent;
+	}
+	callheap[i] = c;
+}
+
+static void
+callout_siftdown(i)
+	register int i;
+{
+	struct callentry c = callheap[i];
+	register int child;
+
+	while ((child = 2 * i + 1) < ncallout) {
+		if (child + 1 < ncallout &&
+		    callout_before(&callheap[child + 1], &callheap[child]))
+			child++;
+		if (!callout_before(&callheap[child], &c))
+			break;
+		callheap[i] = callheap[child];
+		i = child;
+	}
+	callheap[i] = c;
+}
+
+static void
+callout_delete(i)
+	int i;
+{
+	if (--ncallout == i)
+		return;
+	callheap[i] = callheap[ncallout];
+	if (i > 0 && callout_before(&callheap[i], &callheap[(i - 1) / 2]))
+		callout_siftup(i);
+	else
+		callout_siftdown(i);
+}
+
 void
 timeout(ftn, arg, ticks)
 	void (*ftn) __P((void *));
 	void *arg;
 	register int ticks;
 {
-	// FIXME
+	register struct callentry *c;
+
+	if (ticks <= 0)
+		ticks = 1;
+	if (ncallout == callheapsize) {
+		int nsize = callheapsize ? 2 * callheapsize : 32;
+
+		c = malloc(nsize * sizeof(*c), M_TEMP, M_NOWAIT);
+		if (c == NULL)
+			panic("timeout table overflow");
+		if (callheap) {
+			bcopy(callheap, c, ncallout * sizeof(*c));
+			free(callheap, M_TEMP);
+		}
+		callheap = c;
+		callheapsize = nsize;
+	}
+	c = &callheap[ncallout];
+	c->c_time = callnow + (long long)ticks * (tick / 1000);
+	c->c_seq = callseq++;
+	c->c_func = ftn;
+	c->c_arg = arg;
+	callout_siftup(ncallout++);
+}
+
+void
+untimeout(ftn, arg)
+	void (*ftn) __P((void *));
+	void *arg;
+{
+	register int i;
+
+	for (i = 0; i < ncallout; i++)
+		if (callheap[i].c_func == ftn && callheap[i].c_arg == arg) {
+			callout_delete(i);
+			return;
+		}
+}
+
+/*
+ * Run the callouts due at or before now (milliseconds, on the clock
+ * the caller uses for its own waits).  Returns when the next callout
+ * is due, or -1 if none is pending.
+ */
+long long
+callout_run(now)
+	long long now;
+{
+	struct callentry c;
+
+	callnow = now;
+	while (ncallout > 0 && callheap[0].c_time <= now) {
+		c = callheap[0];
+		callout_delete(0);
+		(*c.c_func)(c.c_arg);
+	}
+	return (ncallout > 0 ? callheap[0].c_time : -1);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -158,19 +292,30 @@ extern void *malloc (size_t __size);
 extern void *memalign (size_t __alignment, size_t __size);
 extern void free (void *__ptr);
 
+struct kmemstats kmemstats[M_LAST];
+
 /*
- * Allocate a block of memory
+ * Allocate a block of memory.  The size goes in a header in front of
+ * it, for kmemstats.
  */
 void *
 xmalloc(size, type, flags)
 	unsigned long size;
 	int type, flags;
 {
-	// mbuf requires 128-byte alignment
-	if (size > 8 && (size & (size-1)) == 0)
-		return memalign(size, size);
-	else
-		return malloc(size);
+	register struct kmemstats *ksp = &kmemstats[type];
+	long *p;
+
+	// mbufs and clusters come from mb_map, see kmem_malloc()
+	if ((p = malloc(size + 2 * sizeof(long))) == NULL)
+		return (NULL);
+	p[0] = size;
+	ksp->ks_memuse += size;
+	ksp->ks_inuse++;
+	ksp->ks_calls++;
+	if (ksp->ks_memuse > ksp->ks_maxused)
+		ksp->ks_maxused = ksp->ks_memuse;
+	return (p + 2);
 }
 
 /*
@@ -181,7 +326,28 @@ xfree(addr, type)
 	void *addr;
 	int type;
 {
-	return free(addr);
+	register struct kmemstats *ksp = &kmemstats[type];
+	long *p = (long *)addr - 2;
+
+	if (addr == NULL)
+		return;
+	ksp->ks_memuse -= p[0];
+	ksp->ks_inuse--;
+	free(p);
+}
+
+// bytes held by malloc() for a type, by its name in sys/malloc.h:
+// "routetbl", "socket" and so on
+long kmemuse(const char *type)
+{
+	static char *names[] = INITKMEMNAMES;
+	int i;
+
+	for (i = 0; i < M_LAST; i++)
+		if (names[i] && strcmp(names[i], type) == 0)
+			return kmemstats[i].ks_memuse;
+	panic("kmemuse %s", type);
+	return 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -317,12 +483,16 @@ pfind(pid)
 //////////////////////////////////////////////////////////////////////////////
 // sys/kern/sys_generic.c
 //////////////////////////////////////////////////////////////////////////////
+// selwakeup() is in lib/sopoll.c
+
 /*
- * Do a wakeup when a selectable event occurs.
+ * Record a select request.  Nothing selects here: readiness is told by
+ * sopoll, and bpf rings are looked at.
  */
 void
-selwakeup(sip)
-	register struct selinfo *sip;
+selrecord(selector, sip)
+	struct proc *selector;
+	struct selinfo *sip;
 {
 }
 
@@ -420,6 +590,30 @@ rt_newaddrmsg(cmd, ifa, error, rt)
 
 struct vm_map mb_map_0;
 vm_map_t	mb_map = &mb_map_0;
+static vm_offset_t mb_map_brk;
+
+/*
+ * Allocate a submap of the kernel map.  Only mb_map is supported: its
+ * range is reserved in one piece, so that mtocl() can index clusters
+ * from mbutl, and kmem_malloc() hands it out in order.
+ */
+vm_map_t
+kmem_suballoc(parent, min, max, size, pageable)
+	register vm_map_t	parent;
+	vm_offset_t		*min, *max;
+	register vm_size_t	size;
+	boolean_t		pageable;
+{
+	if (mb_map_brk)
+		panic("kmem_suballoc: mb_map already allocated");
+	*min = (vm_offset_t)memalign(CLBYTES, size);
+	if (*min == 0)
+		panic("kmem_suballoc: cannot allocate");
+	*max = *min + size;
+	mb_map->min_offset = mb_map_brk = *min;
+	mb_map->max_offset = *max;
+	return (mb_map);
+}
 
 /*
  * Allocate wired-down memory in the kernel's address map for the higher
@@ -443,7 +637,14 @@ kmem_malloc(map, size, canwait)
 	register vm_size_t	size;
 	boolean_t		canwait;
 {
+	vm_offset_t addr;
+
 	if (map != mb_map)
 		panic("kmem_malloc: unknown map");
-	return (vm_offset_t)malloc(size);
+	size = roundup(size, CLBYTES);
+	if (mb_map_brk == 0 || size > mb_map->max_offset - mb_map_brk)
+		return (0);
+	addr = mb_map_brk;
+	mb_map_brk += size;
+	return (addr);
 }
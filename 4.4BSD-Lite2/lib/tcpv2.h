@@ -9,20 +9,118 @@ void ping();
 void handshake();
 
 void setipaddr(const char* name, unsigned ip);
+// routes to ip/len, see lib/init.c
+int addroute(unsigned ip, int len, unsigned gw);
+int delroute(unsigned ip, int len);
+struct rtentry;
+struct rtentry* rtlookup_radix(unsigned ip);
+struct rtentry* rtlookup_fib(unsigned ip);
 void inject(const char* msg, int len);
+// inject()s n packets as one batch, returns how many ipintr() left queued
+int inject_batch(const char* const* msgs, const int* lens, int n);
 
 struct socket;
 struct socket* connectto(unsigned ip, unsigned short port);
+struct socket* connectfrom(unsigned short lport, unsigned ip, unsigned short port);
 struct socket* listenon(unsigned short port);
 struct socket* acceptso(struct socket*);
+struct socket* udpon(unsigned short port);
 int writeso(struct socket* so, void* buf, int nbyte);
 int readso(struct socket* so, void* buf, int nbyte);
+// datagrams one at a time with an address, as sendto() and recvfrom()
+int sendtoso(struct socket* so, void* buf, int nbyte, unsigned ip,
+             unsigned short port);
+int recvfromso(struct socket* so, void* buf, int nbyte, unsigned* ip,
+               unsigned short* port);
+// and a batch at a time, as sendmmsg() and recvmmsg(); see lib/handshake.c
+int sendmmsgso(struct socket* so, char* const* bufs, const int* lens,
+               const unsigned* ips, const unsigned short* ports, int n);
+int recvmmsgso(struct socket* so, char* const* bufs, int* lens,
+               unsigned* ips, unsigned short* ports, int n);
+int setsockoptso(struct socket* so, int level, int optname,
+                 const void* val, int len);
+int getsockoptso(struct socket* so, int level, int optname,
+                 void* val, int* len);
+// zero-copy versions, see lib/handshake.c
+struct iovec;
+struct mbuf;
+int writeso_ext(struct socket* so, char* buf, int nbyte,
+                void (*freefn)(char* buf, void* arg), void* arg);
+struct mbuf* readso_mbuf(struct socket* so, int nbyte);
+int mtoiov(struct mbuf** mp, struct iovec* iov, int iovcnt);
 
 void pigeonattach(int);
 int pigeon_dequeue(char *buf, int len);
+void pigeon_setqlen(int maxlen);
+
+// an Ethernet segment played by the test, see lib/if_eloop.c
+void elattach(int);
+int el_dequeue(char* buf, int len);
+void el_setqlen(int maxlen);
+void el_input(const char* buf, int len);
 
 void tunattach(int);
+// zero-copy mode: read into tun_rxbufs(), pass up with tun_input()
+void tun_setzerocopy(int on);
+int tun_rxbufs(struct iovec* iov, int n);
+void tun_input(const int* lens, int n);
+
+// bpf units opened in-process, see lib/bpfdev.c; insns as in sys/net/bpf.h
+char* bpf_openring(int unit, const char* ifname, const void* insns,
+                   int ninsns, int blocksize, int nblocks, int timeout,
+                   int* errp);
+int bpf_openbuf(int unit, const char* ifname, const void* insns, int ninsns,
+                int bufsize);
+int bpf_readbuf(int unit, char* buf, int len);
+void bpf_getstats(int unit, unsigned* recv, unsigned* drop);
+void bpf_flush(int unit);
+void bpf_close(int unit);
+
+void mbstat_print();
+// socket buffer space, and the buffers of each TCP connection
+void sbstat_print();
+// bytes malloc()ed for a type, by its name in sys/malloc.h: "socket"
+long kmemuse(const char* type);
+// a counter by its name in tcpstat and the like, "tcps_rcvdupack"; see
+// lib/init.c for those there are
+unsigned long kstat(const char* name);
+
+// epoll-like readiness notification, see lib/sopoll.c
+enum
+{
+  SOPOLL_IN = 0x0001,   // readable, or a connection to accept
+  SOPOLL_OUT = 0x0004,  // writable
+  SOPOLL_ERR = 0x0008,  // so_error set
+  SOPOLL_HUP = 0x0010,  // both directions shut down
+  SOPOLL_ET = 0x40000000,  // edge-triggered
+};
+struct sopoll;
+struct sopoll_event
+{
+  int events;
+  void* udata;
+};
+struct sopoll* sopoll_create();
+int sopoll_add(struct sopoll* sp, struct socket* so, int events, void* udata);
+int sopoll_mod(struct sopoll* sp, struct socket* so, int events, void* udata);
+int sopoll_del(struct sopoll* sp, struct socket* so);  // before soclose()
+int sopoll_wait(struct sopoll* sp, struct sopoll_event* ev, int maxevents);
+void sopoll_close(struct sopoll* sp);
+
+// runs the timeout()s due by now (ms), returns when the next one is due or -1
+long long callout_run(long long now);
+// stops the clock at usec; from then on only settime() moves it
+void settime(long long usec);
+
+struct mbuf* mkchain(const char* buf, int len, int seglen, int skew);
+int in_cksum_portable(struct mbuf* m, int len);
 
 // defined in sys/
 void ipintr();
 void soclose(struct socket*);
+struct mbuf* m_get(int how, int type);
+struct mbuf* m_free(struct mbuf*);
+void m_freem(struct mbuf*);
+int in_cksum(struct mbuf* m, int len);
+int in_cksum_select(int impl);
+int in_cksum_update(unsigned cksum, unsigned oldw, unsigned neww);
@@ -89,11 +89,7 @@
 #define	MCLSHIFT	11
 #define	MCLOFSET	(MCLBYTES - 1)
 #ifndef NMBCLUSTERS
-#ifdef GATEWAY
-#define	NMBCLUSTERS	512		/* map size, max cluster allocation */
-#else
-#define	NMBCLUSTERS	256		/* map size, max cluster allocation */
-#endif
+#define	NMBCLUSTERS	65536		/* map size, max cluster allocation */
 #endif
 
 /*
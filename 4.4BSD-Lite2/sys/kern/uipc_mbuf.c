@@ -101,6 +101,41 @@ m_clalloc(ncl, nowait)
 	return (1);
 }
 
+/*
+ * Allocate at least nmb mbufs and place them on the mbuf free list.
+ * Must be called at splimp.
+ */
+/* ARGSUSED */
+int
+m_mballoc(nmb, nowait)
+	register int nmb;
+	int nowait;
+{
+	static int logged;
+	register caddr_t p;
+	register int i;
+	int nbytes;
+
+	nbytes = roundup(nmb * MSIZE, CLBYTES);
+	p = (caddr_t)kmem_malloc(mb_map, nbytes, !nowait);
+	if (p == NULL) {
+		if (logged == 0) {
+			logged++;
+			log(LOG_ERR, "mb_map full\n");
+		}
+		return (0);
+	}
+	nmb = nbytes / MSIZE;
+	for (i = 0; i < nmb; i++) {
+		((struct mbuf *)p)->m_next = mmbfree;
+		mmbfree = (struct mbuf *)p;
+		p += MSIZE;
+	}
+	mbstat.m_mbufs += nmb;
+	mbstat.m_mbfree += nmb;
+	return (1);
+}
+
 /*
  * When MGET failes, ask protocols to free space when short of memory,
  * then re-attempt to allocate an mbuf.
@@ -296,7 +331,7 @@ m_copym(m, off0, len, wait)
 		n->m_len = min(len, m->m_len - off);
 		if (m->m_flags & M_EXT) {
 			n->m_data = m->m_data + off;
-			mclrefcnt[mtocl(m->m_ext.ext_buf)]++;
+			MEXTREF(m);
 			n->m_ext = m->m_ext;
 			n->m_flags |= M_EXT;
 		} else
@@ -575,7 +610,7 @@ extpacket:
 	if (m->m_flags & M_EXT) {
 		n->m_flags |= M_EXT;
 		n->m_ext = m->m_ext;
-		mclrefcnt[mtocl(m->m_ext.ext_buf)]++;
+		MEXTREF(m);
 		m->m_ext.ext_size = 0; /* For Accounting XXXXXX danger */
 		n->m_data = m->m_data + len;
 	} else {
@@ -138,13 +138,15 @@ solisten(so, backlog)
 		splx(s);
 		return (error);
 	}
-	if (so->so_q == 0)
-        // 
+	if ((so->so_options & SO_ACCEPTCONN) == 0) {
+		TAILQ_INIT(&so->so_q0);
+		TAILQ_INIT(&so->so_q);
 		so->so_options |= SO_ACCEPTCONN;
+	}
 	if (backlog < 0)
 		backlog = 0;
     // 取最小值
-	so->so_qlimit = min(backlog, SOMAXCONN);
+	so->so_qlimit = min(backlog, somaxconn);
 	splx(s);
 	return (0);
 }
@@ -179,10 +181,10 @@ soclose(so)
 	int error = 0;
 
 	if (so->so_options & SO_ACCEPTCONN) {
-		while (so->so_q0)
-			(void) soabort(so->so_q0);
-		while (so->so_q)
-			(void) soabort(so->so_q);
+		while (so->so_q0.tqh_first)
+			(void) soabort(so->so_q0.tqh_first);
+		while (so->so_q.tqh_first)
+			(void) soabort(so->so_q.tqh_first);
 	}
 	if (so->so_pcb == 0)
 		goto discard;
@@ -466,7 +468,12 @@ nopages:
 					top->m_flags |= M_EOR;
 				break;
 			}
-		    } while (space > 0 && atomic);
+			/*
+			 * Stream data too goes to the protocol all
+			 * together, so that it can send it in as few
+			 * packets as it likes.
+			 */
+		    } while (space > 0);
 		    if (dontroute)
 			    so->so_options |= SO_DONTROUTE;
 		    s = splnet();				/* XXX */
@@ -810,6 +817,133 @@ release:
 	return (error);
 }
 
+/*
+ * Receive up to n records from a socket of addressed records, as
+ * datagram sockets are, each as soreceive() would, and return in
+ * *countp how many came.  msg_name and msg_iov are in the kernel, as
+ * recvit() leaves them; the data goes to the user.  Only the first
+ * record is waited for.  The records are taken off so_rcv together,
+ * under one splnet(), and copied out after; control data isn't passed
+ * up, only flagged with MSG_CTRUNC.
+ */
+int
+soreceivemmsg(so, msgs, n, flags, countp)
+	register struct socket *so;
+	struct mmsghdr *msgs;
+	int n, flags, *countp;
+{
+	struct protosw *pr = so->so_proto;
+	register struct mbuf *m, *q;
+	register struct mmsghdr *mp;
+	register struct msghdr *mh;
+	struct mbuf *rec;
+	struct uio auio;
+	int i, len, s, error;
+
+	*countp = 0;
+	if ((pr->pr_flags & (PR_ATOMIC|PR_ADDR)) != (PR_ATOMIC|PR_ADDR) ||
+	    (flags & (MSG_OOB|MSG_PEEK)))
+		return (EOPNOTSUPP);
+	if (n <= 0)
+		return (0);
+restart:
+	if ( (error = sblock(&so->so_rcv, SBLOCKWAIT(flags))) != 0)
+		return (error);
+	s = splnet();
+	if (so->so_rcv.sb_mb == 0) {
+		if (so->so_error) {
+			error = so->so_error;
+			so->so_error = 0;
+		} else if ((so->so_state & SS_CANTRCVMORE) == 0) {
+			if ((so->so_state & SS_NBIO) || (flags & MSG_DONTWAIT))
+				error = EWOULDBLOCK;
+			else {
+				sbunlock(&so->so_rcv);
+				error = sbwait(&so->so_rcv);
+				splx(s);
+				if (error)
+					return (error);
+				goto restart;
+			}
+		}
+		splx(s);
+		sbunlock(&so->so_rcv);
+		return (error);
+	}
+	rec = m = so->so_rcv.sb_mb;
+	for (i = 1; ; i++) {
+		for (q = m; q; q = q->m_next)
+			sbfree(&so->so_rcv, q);
+		if (i == n || m->m_nextpkt == 0)
+			break;
+		m = m->m_nextpkt;
+	}
+	so->so_rcv.sb_mb = m->m_nextpkt;
+	m->m_nextpkt = 0;
+	if (pr->pr_flags & PR_WANTRCVD && so->so_pcb)
+		(*pr->pr_usrreq)(so, PRU_RCVD, (struct mbuf *)0,
+		    (struct mbuf *)0, (struct mbuf *)0);
+	splx(s);
+
+	for (mp = msgs; (m = rec) != 0; mp++) {
+		rec = m->m_nextpkt;
+		m->m_nextpkt = 0;
+		if (error) {
+			if (pr->pr_domain->dom_dispose)
+				(*pr->pr_domain->dom_dispose)(m);
+			m_freem(m);
+			continue;
+		}
+		mh = &mp->msg_hdr;
+		mh->msg_flags = 0;
+#ifdef DIAGNOSTIC
+		if (m->m_type != MT_SONAME)
+			panic("receive mmsg");
+#endif
+		if (mh->msg_name) {
+			len = min(mh->msg_namelen, m->m_len);
+			bcopy(mtod(m, caddr_t), mh->msg_name, (unsigned)len);
+			mh->msg_namelen = len;
+		}
+		if (m->m_next && m->m_next->m_type == MT_CONTROL) {
+			if (pr->pr_domain->dom_dispose)
+				(*pr->pr_domain->dom_dispose)(m);
+			mh->msg_flags |= MSG_CTRUNC;
+		}
+		mh->msg_controllen = 0;
+		m = m_free(m);
+		while (m && m->m_type == MT_CONTROL)
+			m = m_free(m);
+
+		auio.uio_iov = mh->msg_iov;
+		auio.uio_iovcnt = mh->msg_iovlen;
+		auio.uio_segflg = UIO_USERSPACE;
+		auio.uio_rw = UIO_READ;
+		auio.uio_procp = curproc;
+		auio.uio_offset = 0;
+		auio.uio_resid = 0;
+		for (i = 0; i < auio.uio_iovcnt; i++)
+			if ((auio.uio_resid += auio.uio_iov[i].iov_len) < 0) {
+				error = EINVAL;
+				break;
+			}
+		mp->msg_len = 0;
+		for (; m && error == 0; m = m_free(m)) {
+			len = min(m->m_len, auio.uio_resid);
+			if (len < m->m_len)
+				mh->msg_flags |= MSG_TRUNC;
+			error = uiomove(mtod(m, caddr_t), len, &auio);
+			mp->msg_len += len;
+		}
+		if (m)
+			m_freem(m);
+		if (error == 0)
+			(*countp)++;
+	}
+	sbunlock(&so->so_rcv);
+	return (error);
+}
+
 int
 soshutdown(so, how)
 	register struct socket *so;
@@ -856,6 +990,7 @@ sosetopt(so, level, optname, m0)
 {
 	int error = 0;
 	register struct mbuf *m = m0;
+	struct sockbuf *sb;
 
 	if (level != SOL_SOCKET) {
 		if (so->so_proto && so->so_proto->pr_ctloutput)
@@ -903,12 +1038,14 @@ sosetopt(so, level, optname, m0)
 
 			case SO_SNDBUF:
 			case SO_RCVBUF:
-				if (sbreserve(optname == SO_SNDBUF ?
-				    &so->so_snd : &so->so_rcv,
-				    (u_long) *mtod(m, int *)) == 0) {
+				sb = optname == SO_SNDBUF ?
+				    &so->so_snd : &so->so_rcv;
+				if (sbreserve(sb, (u_long) *mtod(m, int *)) == 0) {
 					error = ENOBUFS;
 					goto bad;
 				}
+				/* the size asked for, not the protocol's */
+				sb->sb_flags &= ~SB_AUTOSIZE;
 				break;
 
 			case SO_SNDLOWAT:
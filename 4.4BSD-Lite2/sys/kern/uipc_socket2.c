@@ -55,6 +55,8 @@ char	netcon[] = "netcon";
 char	netcls[] = "netcls";
 
 u_long	sb_max = SB_MAX;		/* patchable */
+u_long	sb_budget = SB_BUDGET;		/* patchable */
+int	somaxconn = SOMAXCONN;		/* patchable */
 
 /*
  * Procedures to manipulate state flags of socket
@@ -172,10 +174,14 @@ sonewconn1(head, connstatus)
 	so->so_timeo = head->so_timeo;
 	so->so_pgid = head->so_pgid;
 	(void) soreserve(so, head->so_snd.sb_hiwat, head->so_rcv.sb_hiwat);
+	so->so_snd.sb_flags |= head->so_snd.sb_flags & SB_AUTOSIZE;
+	so->so_rcv.sb_flags |= head->so_rcv.sb_flags & SB_AUTOSIZE;
 	soqinsque(head, so, soqueue);
 	if ((*so->so_proto->pr_usrreq)(so, PRU_ATTACH,
 	    (struct mbuf *)0, (struct mbuf *)0, (struct mbuf *)0)) {
 		(void) soqremque(so, soqueue);
+		sbrelease(&so->so_snd);
+		sbrelease(&so->so_rcv);
 		(void) free((caddr_t)so, M_SOCKET);
 		return ((struct socket *)0);
 	}
@@ -187,26 +193,27 @@ sonewconn1(head, connstatus)
 	return (so);
 }
 
+/*
+ * The queues are tail queues and a socket knows which one it is on,
+ * so that neither insertion nor removal walks them: a listener may
+ * hold tens of thousands of connections.
+ */
 void
 soqinsque(head, so, q)
 	register struct socket *head, *so;
 	int q;
 {
 
-	register struct socket **prev;
 	so->so_head = head;
 	if (q == 0) {
 		head->so_q0len++;
-		so->so_q0 = 0;
-		for (prev = &(head->so_q0); *prev; )
-			prev = &((*prev)->so_q0);
+		so->so_qstate = SQ_INCOMP;
+		TAILQ_INSERT_TAIL(&head->so_q0, so, so_list);
 	} else {
 		head->so_qlen++;
-		so->so_q = 0;
-		for (prev = &(head->so_q); *prev; )
-			prev = &((*prev)->so_q);
+		so->so_qstate = SQ_COMP;
+		TAILQ_INSERT_TAIL(&head->so_q, so, so_list);
 	}
-	*prev = so;
 }
 
 int
@@ -214,27 +221,22 @@ soqremque(so, q)
 	register struct socket *so;
 	int q;
 {
-	register struct socket *head, *prev, *next;
+	register struct socket *head;
 
 	head = so->so_head;
-	prev = head;
-	for (;;) {
-		next = q ? prev->so_q : prev->so_q0;
-		if (next == so)
-			break;
-		if (next == 0)
-			return (0);
-		prev = next;
-	}
 	if (q == 0) {
-		prev->so_q0 = next->so_q0;
+		if ((so->so_qstate & SQ_INCOMP) == 0)
+			return (0);
+		TAILQ_REMOVE(&head->so_q0, so, so_list);
 		head->so_q0len--;
 	} else {
-		prev->so_q = next->so_q;
+		if ((so->so_qstate & SQ_COMP) == 0)
+			return (0);
+		TAILQ_REMOVE(&head->so_q, so, so_list);
 		head->so_qlen--;
 	}
-	next->so_q0 = next->so_q = 0;
-	next->so_head = 0;
+	so->so_qstate = 0;
+	so->so_head = 0;
 	return (1);
 }
 
@@ -393,8 +395,12 @@ sbreserve(sb, cc)
 	u_long cc;
 {
 
-	if (cc > sb_max * MCLBYTES / (MSIZE + MCLBYTES))
+	/* divide first: sb_max * MCLBYTES overflows past 2 MB */
+	if (cc > sb_max / (MSIZE + MCLBYTES) * MCLBYTES)
 		return (0);
+	sbstat.sb_reserved += cc - sb->sb_hiwat;
+	if (sbstat.sb_reserved > sbstat.sb_reshiwat)
+		sbstat.sb_reshiwat = sbstat.sb_reserved;
 	sb->sb_hiwat = cc;
 	sb->sb_mbmax = min(cc * 2, sb_max);
 	if (sb->sb_lowat > sb->sb_hiwat)
@@ -411,6 +417,7 @@ sbrelease(sb)
 {
 
 	sbflush(sb);
+	sbstat.sb_reserved -= sb->sb_hiwat;
 	sb->sb_hiwat = sb->sb_mbmax = 0;
 }
 
@@ -261,7 +261,7 @@ accept1(p, uap, retval, compat_43)
 		return (error);
 	}
 	*retval = tmpfd;
-	{ struct socket *aso = so->so_q;
+	{ struct socket *aso = so->so_q.tqh_first;
         // 移除本套接字
 	  if (soqremque(aso, 1) == 0)
 		panic("accept");
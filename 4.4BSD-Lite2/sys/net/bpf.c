@@ -51,7 +51,6 @@
 #include <sys/buf.h>
 #include <sys/time.h>
 #include <sys/proc.h>
-#include <sys/user.h>
 #include <sys/ioctl.h>
 #include <sys/map.h>
 
@@ -91,6 +90,13 @@ static caddr_t bpf_alloc();
 
 #define PRINET  26			/* interruptible */
 
+int	uiomove __P((caddr_t, int, struct uio *));
+int	strcmp __P((const char *, const char *));
+
+#define BPF_RING_BLOCK(d, i) \
+	((struct bpf_block_hdr *)((d)->bd_ring + (i) * (d)->bd_rblksize))
+#define BPF_BLOCKHDRLEN BPF_WORDALIGN(sizeof(struct bpf_block_hdr))
+
 /*
  * The default read buffer size is patchable.
  */
@@ -129,8 +135,13 @@ static int	bpf_setif __P((struct bpf_d *, struct ifreq *));
 static int	bpf_setif __P((struct bpf_d *, struct ifreq *));
 static __inline void
 		bpf_wakeup __P((struct bpf_d *));
+static void	bpf_retire __P((struct bpf_d *));
+static void	bpf_ringtimo __P((void *));
+static int	bpf_setring __P((struct bpf_d *, struct bpf_ringreq *));
 static void	catchpacket __P((struct bpf_d *, u_char *, u_int,
 		    u_int, void (*)(const void *, void *, u_int)));
+static void	catchring __P((struct bpf_d *, u_char *, u_int,
+		    u_int, void (*)(const void *, void *, u_int)));
 static void	reset_d __P((struct bpf_d *));
 
 static int
@@ -417,6 +428,11 @@ bpfread(dev, uio)
 	 */
 	if (uio->uio_resid != d->bd_bufsize)
 		return (EINVAL);
+	/*
+	 * With a ring, packets are taken from it, not read.
+	 */
+	if (d->bd_ring)
+		return (EBUSY);
 
 	s = splimp();
 	/*
@@ -560,6 +576,15 @@ reset_d(d)
 	}
 	d->bd_slen = 0;
 	d->bd_hlen = 0;
+	/*
+	 * The blocks the reader holds are the reader's; start the current
+	 * one over, and its timeout with its first packet.
+	 */
+	d->bd_rfresh = 1;
+	if (d->bd_rarmed) {
+		d->bd_rarmed = 0;
+		untimeout(bpf_ringtimo, (void *)d);
+	}
 	d->bd_rcount = 0;
 	d->bd_dcount = 0;
 }
@@ -579,6 +604,7 @@ reset_d(d)
  *  BIOCGSTATS		Get packet stats.
  *  BIOCIMMEDIATE	Set immediate mode.
  *  BIOCVERSION		Get filter language version.
+ *  BIOCSRING		Set up a ring to take packets from.
  */
 /* ARGSUSED */
 int
@@ -777,6 +803,13 @@ bpfioctl(dev, cmd, addr, flag)
 			bv->bv_minor = BPF_MINOR_VERSION;
 			break;
 		}
+
+	/*
+	 * Set up the ring, before the interface.
+	 */
+	case BIOCSRING:
+		error = bpf_setring(d, (struct bpf_ringreq *)addr);
+		break;
 	}
 	return (error);
 }
@@ -790,7 +823,8 @@ bpf_setf(d, fp)
 	struct bpf_d *d;
 	struct bpf_program *fp;
 {
-	struct bpf_insn *fcode, *old;
+	struct bpf_insn *fcode;
+	struct bpf_tinsn *code, *old;
 	u_int flen, size;
 	int s;
 
@@ -802,8 +836,7 @@ bpf_setf(d, fp)
 		d->bd_filter = 0;
 		reset_d(d);
 		splx(s);
-		if (old != 0)
-			free((caddr_t)old, M_DEVBUF);
+		bpf_tfree(old);
 		return (0);
 	}
 	flen = fp->bf_len;
@@ -813,13 +846,13 @@ bpf_setf(d, fp)
 	size = flen * sizeof(*fp->bf_insns);
 	fcode = (struct bpf_insn *)malloc(size, M_DEVBUF, M_WAITOK);
 	if (copyin((caddr_t)fp->bf_insns, (caddr_t)fcode, size) == 0 &&
-	    bpf_validate(fcode, (int)flen)) {
+	    (code = bpf_compile(fcode, (int)flen)) != 0) {
+		free((caddr_t)fcode, M_DEVBUF);
 		s = splimp();
-		d->bd_filter = fcode;
+		d->bd_filter = code;
 		reset_d(d);
 		splx(s);
-		if (old != 0)
-			free((caddr_t)old, M_DEVBUF);
+		bpf_tfree(old);
 
 		return (0);
 	}
@@ -878,7 +911,7 @@ bpf_setif(d, ifr)
 		if ((ifp->if_flags & IFF_UP) == 0)
 			return (ENETDOWN);
 
-		if (d->bd_sbuf == 0) {
+		if (d->bd_sbuf == 0 && d->bd_ring == 0) {
 			error = bpf_allocbufs(d);
 			if (error != 0)
 				return (error);
@@ -913,7 +946,7 @@ bpf_ifname(ifp, ifr)
 	char *s = ifp->if_name;
 	char *d = ifr->ifr_name;
 
-	while (*d++ = *s++)
+	while ((*d++ = *s++) != 0)
 		continue;
 	/* XXX Assume that unit number is less than 10. */
 	*d++ = ifp->if_unit + '0';
@@ -959,7 +992,9 @@ bpf_select(dev, rw, p)
 	d = &bpf_dtab[minor(dev)];
 
 	s = splimp();
-	if (d->bd_hlen != 0 || (d->bd_immediate && d->bd_slen != 0)) {
+	if (d->bd_hlen != 0 || (d->bd_immediate && d->bd_slen != 0) ||
+	    (d->bd_ring && BPF_RING_BLOCK(d, (d->bd_rcur == 0 ?
+	    d->bd_rnblocks : d->bd_rcur) - 1)->bb_status == BPF_BLOCK_USER)) {
 		/*
 		 * There is data waiting.
 		 */
@@ -1008,7 +1043,7 @@ bpf_tap(arg, pkt, pktlen)
 	bp = (struct bpf_if *)arg;
 	for (d = bp->bif_dlist; d != 0; d = d->bd_next) {
 		++d->bd_rcount;
-		slen = bpf_filter(d->bd_filter, pkt, pktlen, pktlen);
+		slen = bpf_tfilter(d->bd_filter, pkt, pktlen, pktlen);
 		if (slen != 0)
 			catchpacket(d, pkt, pktlen, slen, bcopy);
 	}
@@ -1060,7 +1095,7 @@ bpf_mtap(arg, m)
 
 	for (d = bp->bif_dlist; d != 0; d = d->bd_next) {
 		++d->bd_rcount;
-		slen = bpf_filter(d->bd_filter, (u_char *)m, pktlen, 0);
+		slen = bpf_tfilter(d->bd_filter, (u_char *)m, pktlen, 0);
 		if (slen != 0)
 			catchpacket(d, (u_char *)m, pktlen, slen, bpf_mcopy);
 	}
@@ -1084,6 +1119,11 @@ catchpacket(d, pkt, pktlen, snaplen, cpfn)
 	register struct bpf_hdr *hp;
 	register int totlen, curlen;
 	register int hdrlen = d->bd_bif->bif_hdrlen;
+
+	if (d->bd_ring) {
+		catchring(d, pkt, pktlen, snaplen, cpfn);
+		return;
+	}
 	/*
 	 * Figure out how many bytes to move.  If the packet is
 	 * greater or equal to the snapshot length, transfer that
@@ -1143,6 +1183,155 @@ catchpacket(d, pkt, pktlen, snaplen, cpfn)
 	d->bd_slen = curlen + totlen;
 }
 
+/*
+ * Move the packet into the current block of the ring, handing the
+ * block over to the reader first if the packet won't fit.  This is
+ * the only copy: the reader takes the packet from where it is put.
+ */
+static void
+catchring(d, pkt, pktlen, snaplen, cpfn)
+	register struct bpf_d *d;
+	register u_char *pkt;
+	register u_int pktlen, snaplen;
+	register void (*cpfn)(const void *, void *, u_int);
+{
+	register struct bpf_block_hdr *bb;
+	register struct bpf_hdr *hp;
+	register int totlen, curlen;
+	register int hdrlen = d->bd_bif->bif_hdrlen;
+	int room = d->bd_rblksize - BPF_BLOCKHDRLEN;
+
+	totlen = hdrlen + min(snaplen, pktlen);
+	if (totlen > room)
+		totlen = room;
+	bb = BPF_RING_BLOCK(d, d->bd_rcur);
+	if (bb->bb_status != BPF_BLOCK_KERNEL) {
+		/*
+		 * The reader hasn't given the block back yet.
+		 */
+		++d->bd_dcount;
+		return;
+	}
+	if (d->bd_rfresh) {
+		d->bd_rfresh = 0;
+		bb->bb_npkts = 0;
+		bb->bb_offset = BPF_BLOCKHDRLEN;
+		bb->bb_len = 0;
+	}
+	curlen = BPF_WORDALIGN(bb->bb_len);
+	if (curlen + totlen > room) {
+		bpf_retire(d);
+		bb = BPF_RING_BLOCK(d, d->bd_rcur);
+		if (bb->bb_status != BPF_BLOCK_KERNEL) {
+			++d->bd_dcount;
+			return;
+		}
+		d->bd_rfresh = 0;
+		bb->bb_npkts = 0;
+		bb->bb_offset = BPF_BLOCKHDRLEN;
+		curlen = 0;
+	}
+
+	hp = (struct bpf_hdr *)((caddr_t)bb + BPF_BLOCKHDRLEN + curlen);
+	microtime(&hp->bh_tstamp);
+	hp->bh_datalen = pktlen;
+	hp->bh_hdrlen = hdrlen;
+	(*cpfn)(pkt, (u_char *)hp + hdrlen, (hp->bh_caplen = totlen - hdrlen));
+	bb->bb_len = curlen + totlen;
+	bb->bb_tslast = hp->bh_tstamp;
+	if (bb->bb_npkts++ == 0) {
+		bb->bb_tsfirst = hp->bh_tstamp;
+		if (d->bd_rtimo && !d->bd_rarmed) {
+			d->bd_rarmed = 1;
+			timeout(bpf_ringtimo, (void *)d, d->bd_rtimo);
+		}
+	}
+	if (d->bd_immediate)
+		bpf_retire(d);
+}
+
+/*
+ * Hand the current block over to the reader and move on to the next.
+ */
+static void
+bpf_retire(d)
+	register struct bpf_d *d;
+{
+	register struct bpf_block_hdr *bb = BPF_RING_BLOCK(d, d->bd_rcur);
+
+	bb->bb_seq = d->bd_rseq++;
+	/*
+	 * Everything in the block must be there before the reader can
+	 * see it is the reader's.  The i386 doesn't reorder stores; the compiler
+	 * mustn't either.
+	 */
+	__asm __volatile("" : : : "memory");
+	bb->bb_status = BPF_BLOCK_USER;
+	if (++d->bd_rcur == d->bd_rnblocks)
+		d->bd_rcur = 0;
+	d->bd_rfresh = 1;
+	if (d->bd_rarmed) {
+		d->bd_rarmed = 0;
+		untimeout(bpf_ringtimo, (void *)d);
+	}
+	bpf_wakeup(d);
+}
+
+/*
+ * A block has waited bd_rtimo for more packets: hand it over as is.
+ */
+static void
+bpf_ringtimo(arg)
+	void *arg;
+{
+	register struct bpf_d *d = (struct bpf_d *)arg;
+	register struct bpf_block_hdr *bb;
+	int s;
+
+	s = splimp();
+	d->bd_rarmed = 0;
+	bb = BPF_RING_BLOCK(d, d->bd_rcur);
+	if (!d->bd_rfresh && bb->bb_status == BPF_BLOCK_KERNEL &&
+	    bb->bb_npkts != 0)
+		bpf_retire(d);
+	splx(s);
+}
+
+/*
+ * Set up the ring asked for by rr, and tell where it is.
+ */
+static int
+bpf_setring(d, rr)
+	register struct bpf_d *d;
+	register struct bpf_ringreq *rr;
+{
+	register u_int i, size;
+
+	if (d->bd_bif != 0 || d->bd_ring != 0)
+		return (EINVAL);
+	size = BPF_WORDALIGN(rr->br_blocksize);
+	if (size < BPF_BLOCKHDRLEN + BPF_MINBUFSIZE || size > BPF_MAXBUFSIZE ||
+	    rr->br_nblocks < 2 || rr->br_nblocks > BPF_MAXRINGSIZE / size)
+		return (EINVAL);
+	d->bd_ring = (caddr_t)malloc(size * rr->br_nblocks, M_DEVBUF,
+	    M_WAITOK);
+	if (d->bd_ring == 0)
+		return (ENOBUFS);
+	d->bd_rblksize = size;
+	d->bd_rnblocks = rr->br_nblocks;
+	for (i = 0; i < d->bd_rnblocks; i++)
+		BPF_RING_BLOCK(d, i)->bb_status = BPF_BLOCK_KERNEL;
+	d->bd_rcur = 0;
+	d->bd_rseq = 0;
+	d->bd_rfresh = 1;
+	d->bd_rtimo = rr->br_timeout * hz / 1000;
+	if (rr->br_timeout != 0 && d->bd_rtimo == 0)
+		d->bd_rtimo = 1;
+	rr->br_blocksize = size;
+	rr->br_ring = d->bd_ring;
+	return (0);
+}
+
 /*
  * Initialize all nonzero fields of a descriptor.
  */
@@ -1184,8 +1373,12 @@ bpf_freed(d)
 		if (d->bd_fbuf != 0)
 			free(d->bd_fbuf, M_DEVBUF);
 	}
-	if (d->bd_filter)
-		free((caddr_t)d->bd_filter, M_DEVBUF);
+	if (d->bd_ring != 0) {
+		if (d->bd_rarmed)
+			untimeout(bpf_ringtimo, (void *)d);
+		free(d->bd_ring, M_DEVBUF);
+	}
+	bpf_tfree(d->bd_filter);
 
 	D_MARKFREE(d);
 }
@@ -1238,8 +1431,6 @@ bpfattach(driverp, ifp, dlt, hdrlen)
 	if (!D_ISFREE(&bpf_dtab[0]))
 		for (i = 0; i < NBPFILTER; ++i)
 			D_MARKFREE(&bpf_dtab[i]);
-
-	printf("bpf: %s%d attached\n", ifp->if_name, ifp->if_unit);
 }
 
 #if BSD >= 199103
@@ -67,6 +67,41 @@ struct bpf_stat {
 	u_int bs_drop;		/* number of packets dropped */
 };
 
+/*
+ * Structure for BIOCSRING: packets go into a ring of br_nblocks blocks
+ * of br_blocksize bytes, in the reader's memory, instead of being
+ * read().  A block that has been filled, or has waited br_timeout
+ * milliseconds for more (0 for as long as it takes), is handed over to
+ * the reader by setting its bb_status to BPF_BLOCK_USER, and comes
+ * back when the reader sets it to BPF_BLOCK_KERNEL.  Packets that
+ * arrive while the next block is still the reader's are dropped.
+ * BIOCSRING sets br_ring to the ring.
+ */
+struct bpf_ringreq {
+	u_int	br_blocksize;
+	u_int	br_nblocks;
+	u_int	br_timeout;
+	caddr_t	br_ring;
+};
+
+/*
+ * Header of a block in the ring.  The block's packets start at
+ * bb_offset and are laid out as read() returns them: each a bpf_hdr,
+ * then the packet, then padding to BPF_WORDALIGN.
+ */
+struct bpf_block_hdr {
+	volatile u_int	bb_status;	/* who has the block */
+	u_int		bb_seq;		/* blocks handed over before it */
+	u_int		bb_npkts;	/* packets in the block */
+	u_int		bb_offset;	/* of the first packet */
+	u_int		bb_len;		/* bytes of packets from bb_offset */
+	struct timeval	bb_tsfirst;	/* time of the first packet */
+	struct timeval	bb_tslast;	/* and of the last */
+};
+#define	BPF_BLOCK_KERNEL	0
+#define	BPF_BLOCK_USER		1
+#define	BPF_MAXRINGSIZE		(64 * 1024 * 1024)
+
 /*
  * Struct return by BIOCVERSION.  This represents the version number of 
  * the filter language described by the instruction encodings below.
@@ -107,6 +142,7 @@ struct bpf_version {
 #define BIOCGSTATS	_IOR(B,111, struct bpf_stat)
 #define BIOCIMMEDIATE	_IOW(B,112, u_int)
 #define BIOCVERSION	_IOR(B,113, struct bpf_version)
+#define BIOCSRING	_IOWR(B,114, struct bpf_ringreq)
 #else
 #define	BIOCGBLEN	_IOR('B',102, u_int)
 #define	BIOCSBLEN	_IOWR('B',102, u_int)
@@ -121,6 +157,7 @@ struct bpf_version {
 #define BIOCGSTATS	_IOR('B',111, struct bpf_stat)
 #define BIOCIMMEDIATE	_IOW('B',112, u_int)
 #define BIOCVERSION	_IOR('B',113, struct bpf_version)
+#define BIOCSRING	_IOWR('B',114, struct bpf_ringreq)
 #endif
 
 /*
@@ -157,6 +194,7 @@ struct bpf_hdr {
 #define DLT_SLIP	8	/* Serial Line IP */
 #define DLT_PPP		9	/* Point-to-point Protocol */
 #define DLT_FDDI	10	/* FDDI */
+#define DLT_RAW		12	/* raw IP, no link header */
 
 /*
  * The instruction encondings.
@@ -243,6 +281,11 @@ void	 bpf_mtap __P((caddr_t, struct mbuf *));
 void	 bpfattach __P((caddr_t *, struct ifnet *, u_int, u_int));
 void	 bpfilterattach __P((int));
 u_int	 bpf_filter __P((struct bpf_insn *, u_char *, u_int, u_int));
+struct bpf_tinsn;
+struct bpf_tinsn *
+	 bpf_compile __P((struct bpf_insn *, int));
+u_int	 bpf_tfilter __P((struct bpf_tinsn *, u_char *, u_int, u_int));
+void	 bpf_tfree __P((struct bpf_tinsn *));
 #endif
 
 /*
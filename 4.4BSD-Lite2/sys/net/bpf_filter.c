@@ -54,8 +54,8 @@
 #endif
 
 #ifndef BPF_ALIGN
-#define EXTRACT_SHORT(p)	((u_short)ntohs(*(u_short *)p))
-#define EXTRACT_LONG(p)		(ntohl(*(u_long *)p))
+#define EXTRACT_SHORT(p)	((u_short)ntohs(*(u_short *)(p)))
+#define EXTRACT_LONG(p)		(ntohl(*(u_long *)(p)))
 #else
 #define EXTRACT_SHORT(p)\
 	((u_short)\
@@ -70,6 +70,7 @@
 
 #ifdef KERNEL
 #include <sys/mbuf.h>
+#include <sys/malloc.h>
 #define MINDEX(m, k) \
 { \
 	register int len = m->m_len; \
@@ -83,81 +84,80 @@
 	} \
 }
 
+/*
+ * The n bytes at k in the chain m, which aren't all in one mbuf.
+ */
+static int
+m_xbytes(m, k, n, err)
+	register struct mbuf *m;
+	register u_int k;
+	int n, *err;
+{
+	register u_long v = 0;
+
+	while (--n >= 0) {
+		while (k >= m->m_len) {
+			k -= m->m_len;
+			m = m->m_next;
+			if (m == 0) {
+				*err = 1;
+				return 0;
+			}
+		}
+		v = v << 8 | mtod(m, u_char *)[k++];
+	}
+	*err = 0;
+	return v;
+}
+
 static int
 m_xword(m, k, err)
 	register struct mbuf *m;
-	register int k, *err;
+	register u_int k;
+	register int *err;
 {
-	register int len;
-	register u_char *cp, *np;
-	register struct mbuf *m0;
+	register u_int len;
 
 	len = m->m_len;
 	while (k >= len) {
 		k -= len;
 		m = m->m_next;
-		if (m == 0)
-			goto bad;
+		if (m == 0) {
+			*err = 1;
+			return 0;
+		}
 		len = m->m_len;
 	}
-	cp = mtod(m, u_char *) + k;
 	if (len - k >= 4) {
 		*err = 0;
-		return EXTRACT_LONG(cp);
+		return EXTRACT_LONG(mtod(m, u_char *) + k);
 	}
-	m0 = m->m_next;
-	if (m0 == 0 || m0->m_len + len - k < 4)
-		goto bad;
-	*err = 0;
-	np = mtod(m0, u_char *);
-	switch (len - k) {
-
-	case 1:
-		return (cp[k] << 24) | (np[0] << 16) | (np[1] << 8) | np[2];
-
-	case 2:
-		return (cp[k] << 24) | (cp[k + 1] << 16) | (np[0] << 8) | 
-			np[1];
-
-	default:
-		return (cp[k] << 24) | (cp[k + 1] << 16) | (cp[k + 2] << 8) |
-			np[0];
-	}
-    bad:
-	*err = 1;
-	return 0;
+	return m_xbytes(m, k, 4, err);
 }
 
 static int
 m_xhalf(m, k, err)
 	register struct mbuf *m;
-	register int k, *err;
+	register u_int k;
+	register int *err;
 {
-	register int len;
-	register u_char *cp;
-	register struct mbuf *m0;
+	register u_int len;
 
 	len = m->m_len;
 	while (k >= len) {
 		k -= len;
 		m = m->m_next;
-		if (m == 0)
-			goto bad;
+		if (m == 0) {
+			*err = 1;
+			return 0;
+		}
 		len = m->m_len;
 	}
-	cp = mtod(m, u_char *) + k;
 	if (len - k >= 2) {
 		*err = 0;
-		return EXTRACT_SHORT(cp);
+		return EXTRACT_SHORT(mtod(m, u_char *) + k);
 	}
-	m0 = m->m_next;
-	if (m0 == 0)
-		goto bad;
-	*err = 0;
-	return (cp[k] << 8) | mtod(m0, u_char *)[0];
- bad:
-	*err = 1;
-	return 0;
+	return m_xbytes(m, k, 2, err);
 }
 #endif
 
@@ -175,7 +175,7 @@ bpf_filter(pc, p, wirelen, buflen)
 	register u_int buflen;
 {
 	register u_long A, X;
-	register int k;
+	register u_int k;
 	long mem[BPF_MEMWORDS];
 
 	if (pc == 0)
@@ -183,10 +183,8 @@ bpf_filter(pc, p, wirelen, buflen)
 		 * No filter means accept all.
 		 */
 		return (u_int)-1;
-#ifdef lint
 	A = 0;
 	X = 0;
-#endif
 	--pc;
 	while (1) {
 		++pc;
@@ -206,7 +204,7 @@ bpf_filter(pc, p, wirelen, buflen)
 
 		case BPF_LD|BPF_W|BPF_ABS:
 			k = pc->k;
-			if (k + sizeof(long) > buflen) {
+			if (k >= buflen || buflen - k < sizeof(long)) {
 #ifdef KERNEL
 				int merr;
 
@@ -230,13 +228,15 @@ bpf_filter(pc, p, wirelen, buflen)
 
 		case BPF_LD|BPF_H|BPF_ABS:
 			k = pc->k;
-			if (k + sizeof(short) > buflen) {
+			if (k >= buflen || buflen - k < sizeof(short)) {
 #ifdef KERNEL
 				int merr;
 
 				if (buflen != 0)
 					return 0;
 				A = m_xhalf((struct mbuf *)p, k, &merr);
+				if (merr != 0)
+					return 0;
 				continue;
 #else
 				return 0;
@@ -274,7 +274,7 @@ bpf_filter(pc, p, wirelen, buflen)
 
 		case BPF_LD|BPF_W|BPF_IND:
 			k = X + pc->k;
-			if (k + sizeof(long) > buflen) {
+			if (k >= buflen || buflen - k < sizeof(long)) {
 #ifdef KERNEL
 				int merr;
 
@@ -298,7 +298,7 @@ bpf_filter(pc, p, wirelen, buflen)
 
 		case BPF_LD|BPF_H|BPF_IND:
 			k = X + pc->k;
-			if (k + sizeof(short) > buflen) {
+			if (k >= buflen || buflen - k < sizeof(short)) {
 #ifdef KERNEL
 				int merr;
 
@@ -325,7 +325,7 @@ bpf_filter(pc, p, wirelen, buflen)
 					return 0;
 				m = (struct mbuf *)p;
 				MINDEX(m, k);
-				A = mtod(m, char *)[k];
+				A = mtod(m, u_char *)[k];
 				continue;
 #else
 				return 0;
@@ -350,7 +350,7 @@ bpf_filter(pc, p, wirelen, buflen)
 				return 0;
 #endif
 			}
-			X = (p[pc->k] & 0xf) << 2;
+			X = (p[k] & 0xf) << 2;
 			continue;
 
 		case BPF_LD|BPF_IMM:
@@ -513,6 +513,8 @@ bpf_validate(f, len)
 	register int i;
 	register struct bpf_insn *p;
 
+	if (len < 1 || len > BPF_MAXINSNS)
+		return 0;
 	for (i = 0; i < len; ++i) {
 		/*
 		 * Check that that jumps are forward, and within 
@@ -523,7 +525,7 @@ bpf_validate(f, len)
 			register int from = i + 1;
 
 			if (BPF_OP(p->code) == BPF_JA) {
-				if (from + p->k >= len)
+				if (p->k < 0 || p->k >= len - from)
 					return 0;
 			}
 			else if (from + p->jt >= len || from + p->jf >= len)
@@ -533,7 +535,9 @@ bpf_validate(f, len)
 		 * Check that memory operations use valid addresses.
 		 */
 		if ((BPF_CLASS(p->code) == BPF_ST ||
-		     (BPF_CLASS(p->code) == BPF_LD && 
+		     BPF_CLASS(p->code) == BPF_STX ||
+		     ((BPF_CLASS(p->code) == BPF_LD ||
+		       BPF_CLASS(p->code) == BPF_LDX) &&
 		      (p->code & 0xe0) == BPF_MEM)) &&
 		    (p->k >= BPF_MEMWORDS || p->k < 0))
 			return 0;
@@ -546,3 +550,363 @@ bpf_validate(f, len)
 	return BPF_CLASS(f[len - 1].code) == BPF_RET;
 }
 #endif
+
+#ifdef KERNEL
+/*
+ * Filter programs compiled to direct-threaded code, for the paths
+ * that run one program over every packet.  bpf_compile() checks a
+ * program once and turns each instruction into the address of the
+ * code in bpf_trun() that does its work, with jump targets resolved
+ * to pointers, so that running it decodes nothing: each piece of code
+ * ends by going straight to the next one's.  A load followed by a
+ * conditional jump on a constant, most of what tcpdump generates, is
+ * fused into one.  Loads read the packet directly when the bytes are
+ * in the buffer, or in the first mbuf of a chain, and go to the rest
+ * of the chain only when they must.  The results are bpf_filter()'s.
+ *
+ * This needs GCC's labels as values.
+ */
+struct bpf_tinsn {
+	void	*ti_op;		/* the code for the instruction */
+	u_long	ti_k;
+	u_long	ti_k2;		/* the jump's constant, in a fused load */
+	struct	bpf_tinsn *ti_jt, *ti_jf;
+};
+
+/*
+ * The code for each instruction.  A load's is TI_LDW, TI_LDH or
+ * TI_LDB, plus TI_IND for X + k, plus one of TI_JEQ to TI_JSET if
+ * fused with the jump after it.
+ */
+enum {
+	TI_LDW = 0, TI_LDH = 10, TI_LDB = 20,
+	TI_IND = 5,
+	TI_JEQ = 1, TI_JGT, TI_JGE, TI_JSET,
+	TI_LDXMSH = 30, TI_LDLEN, TI_LDXLEN, TI_LDIMM, TI_LDXIMM,
+	TI_LDMEM, TI_LDXMEM, TI_ST, TI_STX,
+	TI_ADDK, TI_SUBK, TI_MULK, TI_DIVK, TI_ANDK, TI_ORK, TI_LSHK, TI_RSHK,
+	TI_ADDX, TI_SUBX, TI_MULX, TI_DIVX, TI_ANDX, TI_ORX, TI_LSHX, TI_RSHX,
+	TI_NEG, TI_TAX, TI_TXA,
+	TI_JA, TI_JGTK, TI_JGEK, TI_JEQK, TI_JSETK,
+	TI_JGTX, TI_JGEX, TI_JEQX, TI_JSETX,
+	TI_RETK, TI_RETA,
+	TI_NOPS
+};
+
+static void **bpf_tops;
+
+static u_int bpf_trun __P((struct bpf_tinsn *, u_char *, u_int, u_int,
+	    struct mbuf *));
+
+/*
+ * Load the size bytes at k that aren't in the first buffer: from the
+ * rest of the chain m, if there is one.
+ */
+static u_long
+bpf_ldslow(m, k, size, err)
+	register struct mbuf *m;
+	register u_int k;
+	int size, *err;
+{
+
+	if (m == 0) {
+		*err = 1;
+		return 0;
+	}
+	if (size == 4)
+		return m_xword(m, k, err);
+	if (size == 2)
+		return m_xhalf(m, k, err);
+	return m_xbytes(m, k, 1, err);
+}
+
+#define	EXTRACT_BYTE(p)	(*(u_char *)(p))
+
+#define	TI_NEXT(next) { \
+	ti = (next); \
+	goto *ti->ti_op; \
+}
+
+/*
+ * Load the size bytes at k into v, or reject the packet.
+ */
+#define	TI_LOAD(k, size, extract, v) { \
+	if ((k) < buflen && buflen - (k) >= (size)) \
+		v = extract(p + (k)); \
+	else { \
+		int merr; \
+		v = bpf_ldslow(m, k, size, &merr); \
+		if (merr) \
+			return 0; \
+	} \
+}
+
+/*
+ * A load at k, or at X + k, alone or with each of the jumps.
+ */
+#define	TI_LOADS(lbl, x, size, extract) \
+lbl:	k = ti->ti_k + (x); \
+	TI_LOAD(k, size, extract, A); \
+	TI_NEXT(ti + 1); \
+lbl##_jeq: \
+	k = ti->ti_k + (x); \
+	TI_LOAD(k, size, extract, A); \
+	TI_NEXT(A == ti->ti_k2 ? ti->ti_jt : ti->ti_jf); \
+lbl##_jgt: \
+	k = ti->ti_k + (x); \
+	TI_LOAD(k, size, extract, A); \
+	TI_NEXT(A > ti->ti_k2 ? ti->ti_jt : ti->ti_jf); \
+lbl##_jge: \
+	k = ti->ti_k + (x); \
+	TI_LOAD(k, size, extract, A); \
+	TI_NEXT(A >= ti->ti_k2 ? ti->ti_jt : ti->ti_jf); \
+lbl##_jset: \
+	k = ti->ti_k + (x); \
+	TI_LOAD(k, size, extract, A); \
+	TI_NEXT((A & ti->ti_k2) ? ti->ti_jt : ti->ti_jf);
+
+#define	TI_LOADOPS(op, lbl) \
+	[op] = &&lbl, [op + TI_JEQ] = &&lbl##_jeq, \
+	[op + TI_JGT] = &&lbl##_jgt, [op + TI_JGE] = &&lbl##_jge, \
+	[op + TI_JSET] = &&lbl##_jset
+
+/*
+ * Run code over the packet at p, buflen bytes of it in the first
+ * buffer and the rest in the chain after m, if m isn't 0.  Called
+ * with no code, sets bpf_tops.
+ */
+static u_int
+bpf_trun(ti, p, wirelen, buflen, m)
+	register struct bpf_tinsn *ti;
+	register u_char *p;
+	u_int wirelen;
+	register u_int buflen;
+	struct mbuf *m;
+{
+	static void *ops[TI_NOPS] = {
+		TI_LOADOPS(TI_LDW, ldw),
+		TI_LOADOPS(TI_LDW + TI_IND, ldwx),
+		TI_LOADOPS(TI_LDH, ldh),
+		TI_LOADOPS(TI_LDH + TI_IND, ldhx),
+		TI_LOADOPS(TI_LDB, ldb),
+		TI_LOADOPS(TI_LDB + TI_IND, ldbx),
+		[TI_LDXMSH] = &&ldxmsh, [TI_LDLEN] = &&ldlen,
+		[TI_LDXLEN] = &&ldxlen, [TI_LDIMM] = &&ldimm,
+		[TI_LDXIMM] = &&ldximm, [TI_LDMEM] = &&ldmem,
+		[TI_LDXMEM] = &&ldxmem, [TI_ST] = &&st, [TI_STX] = &&stx,
+		[TI_ADDK] = &&addk, [TI_SUBK] = &&subk, [TI_MULK] = &&mulk,
+		[TI_DIVK] = &&divk, [TI_ANDK] = &&andk, [TI_ORK] = &&ork,
+		[TI_LSHK] = &&lshk, [TI_RSHK] = &&rshk,
+		[TI_ADDX] = &&addx, [TI_SUBX] = &&subx, [TI_MULX] = &&mulx,
+		[TI_DIVX] = &&divx, [TI_ANDX] = &&andx, [TI_ORX] = &&orx,
+		[TI_LSHX] = &&lshx, [TI_RSHX] = &&rshx,
+		[TI_NEG] = &&neg, [TI_TAX] = &&tax, [TI_TXA] = &&txa,
+		[TI_JA] = &&ja, [TI_JGTK] = &&jgtk, [TI_JGEK] = &&jgek,
+		[TI_JEQK] = &&jeqk, [TI_JSETK] = &&jsetk,
+		[TI_JGTX] = &&jgtx, [TI_JGEX] = &&jgex,
+		[TI_JEQX] = &&jeqx, [TI_JSETX] = &&jsetx,
+		[TI_RETK] = &&retk, [TI_RETA] = &&reta,
+	};
+	register u_long A = 0, X = 0;
+	register u_int k;
+	long mem[BPF_MEMWORDS];
+
+	if (ti == 0) {
+		bpf_tops = ops;
+		return 0;
+	}
+	goto *ti->ti_op;
+
+	TI_LOADS(ldw, 0, 4, EXTRACT_LONG)
+	TI_LOADS(ldwx, X, 4, EXTRACT_LONG)
+	TI_LOADS(ldh, 0, 2, EXTRACT_SHORT)
+	TI_LOADS(ldhx, X, 2, EXTRACT_SHORT)
+	TI_LOADS(ldb, 0, 1, EXTRACT_BYTE)
+	TI_LOADS(ldbx, X, 1, EXTRACT_BYTE)
+ldxmsh:
+	k = ti->ti_k;
+	TI_LOAD(k, 1, EXTRACT_BYTE, X);
+	X = (X & 0xf) << 2;
+	TI_NEXT(ti + 1);
+ldlen:	A = wirelen;		TI_NEXT(ti + 1);
+ldxlen:	X = wirelen;		TI_NEXT(ti + 1);
+ldimm:	A = ti->ti_k;		TI_NEXT(ti + 1);
+ldximm:	X = ti->ti_k;		TI_NEXT(ti + 1);
+ldmem:	A = mem[ti->ti_k];	TI_NEXT(ti + 1);
+ldxmem:	X = mem[ti->ti_k];	TI_NEXT(ti + 1);
+st:	mem[ti->ti_k] = A;	TI_NEXT(ti + 1);
+stx:	mem[ti->ti_k] = X;	TI_NEXT(ti + 1);
+addk:	A += ti->ti_k;		TI_NEXT(ti + 1);
+subk:	A -= ti->ti_k;		TI_NEXT(ti + 1);
+mulk:	A *= ti->ti_k;		TI_NEXT(ti + 1);
+divk:	A /= ti->ti_k;		TI_NEXT(ti + 1);
+andk:	A &= ti->ti_k;		TI_NEXT(ti + 1);
+ork:	A |= ti->ti_k;		TI_NEXT(ti + 1);
+lshk:	A <<= ti->ti_k;		TI_NEXT(ti + 1);
+rshk:	A >>= ti->ti_k;		TI_NEXT(ti + 1);
+addx:	A += X;			TI_NEXT(ti + 1);
+subx:	A -= X;			TI_NEXT(ti + 1);
+mulx:	A *= X;			TI_NEXT(ti + 1);
+divx:
+	if (X == 0)
+		return 0;
+	A /= X;
+	TI_NEXT(ti + 1);
+andx:	A &= X;			TI_NEXT(ti + 1);
+orx:	A |= X;			TI_NEXT(ti + 1);
+lshx:	A <<= X;		TI_NEXT(ti + 1);
+rshx:	A >>= X;		TI_NEXT(ti + 1);
+neg:	A = -A;			TI_NEXT(ti + 1);
+tax:	X = A;			TI_NEXT(ti + 1);
+txa:	A = X;			TI_NEXT(ti + 1);
+ja:	TI_NEXT(ti->ti_jt);
+jgtk:	TI_NEXT(A > ti->ti_k ? ti->ti_jt : ti->ti_jf);
+jgek:	TI_NEXT(A >= ti->ti_k ? ti->ti_jt : ti->ti_jf);
+jeqk:	TI_NEXT(A == ti->ti_k ? ti->ti_jt : ti->ti_jf);
+jsetk:	TI_NEXT((A & ti->ti_k) ? ti->ti_jt : ti->ti_jf);
+jgtx:	TI_NEXT(A > X ? ti->ti_jt : ti->ti_jf);
+jgex:	TI_NEXT(A >= X ? ti->ti_jt : ti->ti_jf);
+jeqx:	TI_NEXT(A == X ? ti->ti_jt : ti->ti_jf);
+jsetx:	TI_NEXT((A & X) ? ti->ti_jt : ti->ti_jf);
+retk:	return (u_int)ti->ti_k;
+reta:	return (u_int)A;
+}
+
+/*
+ * Compile the len instructions at f, or return 0 if they aren't a
+ * valid program or there is no memory for them.
+ */
+struct bpf_tinsn *
+bpf_compile(f, len)
+	struct bpf_insn *f;
+	int len;
+{
+	register struct bpf_insn *p;
+	register struct bpf_tinsn *ti, *code;
+	register int i, op;
+
+	if (!bpf_validate(f, len))
+		return (0);
+	code = (struct bpf_tinsn *)malloc(len * sizeof (*code),
+	    M_DEVBUF, M_NOWAIT);
+	if (code == 0)
+		return (0);
+	if (bpf_tops == 0)
+		(void)bpf_trun((struct bpf_tinsn *)0, (u_char *)0, 0, 0,
+		    (struct mbuf *)0);
+	for (i = 0; i < len; i++) {
+		p = &f[i];
+		ti = &code[i];
+		ti->ti_k = p->k;
+		ti->ti_k2 = 0;
+		ti->ti_jt = ti->ti_jf = ti + 1;
+		if (BPF_CLASS(p->code) == BPF_JMP) {
+			if (BPF_OP(p->code) == BPF_JA)
+				ti->ti_jt = ti->ti_jf = ti + 1 + p->k;
+			else {
+				ti->ti_jt = ti + 1 + p->jt;
+				ti->ti_jf = ti + 1 + p->jf;
+			}
+		}
+		switch (p->code) {
+
+		default:
+			op = TI_RETK;
+			ti->ti_k = 0;
+			break;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+		case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS:
+		case BPF_LD|BPF_W|BPF_IND:
+		case BPF_LD|BPF_H|BPF_IND:
+		case BPF_LD|BPF_B|BPF_IND:
+			op = BPF_SIZE(p->code) == BPF_W ? TI_LDW :
+			    BPF_SIZE(p->code) == BPF_H ? TI_LDH : TI_LDB;
+			if (BPF_MODE(p->code) == BPF_IND)
+				op += TI_IND;
+			if (i + 1 < len &&
+			    (p[1].code & ~0xf0) == (BPF_JMP|BPF_K) &&
+			    BPF_OP(p[1].code) >= BPF_JEQ &&
+			    BPF_OP(p[1].code) <= BPF_JSET) {
+				op += TI_JEQ + ((BPF_OP(p[1].code) - BPF_JEQ) >> 4);
+				ti->ti_k2 = p[1].k;
+				ti->ti_jt = ti + 2 + p[1].jt;
+				ti->ti_jf = ti + 2 + p[1].jf;
+			}
+			break;
+
+		case BPF_LDX|BPF_MSH|BPF_B:	op = TI_LDXMSH;	break;
+		case BPF_LD|BPF_W|BPF_LEN:	op = TI_LDLEN;	break;
+		case BPF_LDX|BPF_W|BPF_LEN:	op = TI_LDXLEN;	break;
+		case BPF_LD|BPF_IMM:		op = TI_LDIMM;	break;
+		case BPF_LDX|BPF_IMM:		op = TI_LDXIMM;	break;
+		case BPF_LD|BPF_MEM:		op = TI_LDMEM;	break;
+		case BPF_LDX|BPF_MEM:		op = TI_LDXMEM;	break;
+		case BPF_ST:			op = TI_ST;	break;
+		case BPF_STX:			op = TI_STX;	break;
+		case BPF_ALU|BPF_ADD|BPF_K:	op = TI_ADDK;	break;
+		case BPF_ALU|BPF_SUB|BPF_K:	op = TI_SUBK;	break;
+		case BPF_ALU|BPF_MUL|BPF_K:	op = TI_MULK;	break;
+		case BPF_ALU|BPF_DIV|BPF_K:	op = TI_DIVK;	break;
+		case BPF_ALU|BPF_AND|BPF_K:	op = TI_ANDK;	break;
+		case BPF_ALU|BPF_OR|BPF_K:	op = TI_ORK;	break;
+		case BPF_ALU|BPF_LSH|BPF_K:	op = TI_LSHK;	break;
+		case BPF_ALU|BPF_RSH|BPF_K:	op = TI_RSHK;	break;
+		case BPF_ALU|BPF_ADD|BPF_X:	op = TI_ADDX;	break;
+		case BPF_ALU|BPF_SUB|BPF_X:	op = TI_SUBX;	break;
+		case BPF_ALU|BPF_MUL|BPF_X:	op = TI_MULX;	break;
+		case BPF_ALU|BPF_DIV|BPF_X:	op = TI_DIVX;	break;
+		case BPF_ALU|BPF_AND|BPF_X:	op = TI_ANDX;	break;
+		case BPF_ALU|BPF_OR|BPF_X:	op = TI_ORX;	break;
+		case BPF_ALU|BPF_LSH|BPF_X:	op = TI_LSHX;	break;
+		case BPF_ALU|BPF_RSH|BPF_X:	op = TI_RSHX;	break;
+		case BPF_ALU|BPF_NEG:		op = TI_NEG;	break;
+		case BPF_MISC|BPF_TAX:		op = TI_TAX;	break;
+		case BPF_MISC|BPF_TXA:		op = TI_TXA;	break;
+		case BPF_JMP|BPF_JA:		op = TI_JA;	break;
+		case BPF_JMP|BPF_JGT|BPF_K:	op = TI_JGTK;	break;
+		case BPF_JMP|BPF_JGE|BPF_K:	op = TI_JGEK;	break;
+		case BPF_JMP|BPF_JEQ|BPF_K:	op = TI_JEQK;	break;
+		case BPF_JMP|BPF_JSET|BPF_K:	op = TI_JSETK;	break;
+		case BPF_JMP|BPF_JGT|BPF_X:	op = TI_JGTX;	break;
+		case BPF_JMP|BPF_JGE|BPF_X:	op = TI_JGEX;	break;
+		case BPF_JMP|BPF_JEQ|BPF_X:	op = TI_JEQX;	break;
+		case BPF_JMP|BPF_JSET|BPF_X:	op = TI_JSETX;	break;
+		case BPF_RET|BPF_K:		op = TI_RETK;	break;
+		case BPF_RET|BPF_A:		op = TI_RETA;	break;
+		}
+		ti->ti_op = bpf_tops[op];
+	}
+	return (code);
+}
+
+void
+bpf_tfree(code)
+	struct bpf_tinsn *code;
+{
+
+	if (code)
+		free(code, M_DEVBUF);
+}
+
+/*
+ * Run a compiled program over a packet; the arguments are those of
+ * bpf_filter(), buflen 0 meaning that p is an mbuf chain.
+ */
+u_int
+bpf_tfilter(code, p, wirelen, buflen)
+	struct bpf_tinsn *code;
+	u_char *p;
+	u_int wirelen, buflen;
+{
+	register struct mbuf *m;
+
+	if (code == 0)
+		return (u_int)-1;
+	if (buflen != 0)
+		return bpf_trun(code, p, wirelen, buflen, (struct mbuf *)0);
+	m = (struct mbuf *)p;
+	return bpf_trun(code, mtod(m, u_char *), wirelen, m->m_len, m);
+}
+#endif
@@ -64,13 +64,26 @@ struct bpf_d {
 
 	struct bpf_if *	bd_bif;		/* interface descriptor */
 	u_long		bd_rtout;	/* Read timeout in 'ticks' */
-	struct bpf_insn *bd_filter; 	/* filter code */
+	struct bpf_tinsn *bd_filter; 	/* filter code, compiled */
 	u_long		bd_rcount;	/* number of packets received */
 	u_long		bd_dcount;	/* number of packets dropped */
 
 	u_char		bd_promisc;	/* true if listening promiscuously */
 	u_char		bd_state;	/* idle, waiting, or timed out */
 	u_char		bd_immediate;	/* true to return on packet arrival */
+	/*
+	 * The ring set up by BIOCSRING, which takes the place of the
+	 * buffers: bd_rnblocks blocks of bd_rblksize bytes, filled in
+	 * turn.
+	 */
+	caddr_t		bd_ring;
+	u_int		bd_rblksize;
+	u_int		bd_rnblocks;
+	u_int		bd_rcur;	/* block being filled */
+	u_int		bd_rseq;	/* blocks handed over */
+	int		bd_rtimo;	/* ticks a block waits, 0 for ever */
+	u_char		bd_rfresh;	/* bd_rcur is to be started afresh */
+	u_char		bd_rarmed;	/* bpf_ringtimo() is pending */
 #if BSD < 199103
 	u_char		bd_selcoll;	/* true if selects collide */
 	int		bd_timedout;
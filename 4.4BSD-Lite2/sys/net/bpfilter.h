@@ -0,0 +1 @@
+#define NBPFILTER 16
@@ -0,0 +1,445 @@
+/*
+ * An IPv4 forwarding table laid out for lookups: DIR-24-8, after
+ * Gupta, Lin and McKeown, "Routing Lookups in Hardware at Memory
+ * Access Speeds".  The radix tree stays the routing table; rtrequest()
+ * keeps this copy of it in step, and rtalloc1() looks here instead of
+ * walking the tree.
+ *
+ * fib_tbl24 has an entry for each /24: the route for all of it, or,
+ * when a route longer than /24 falls in it, the number of a group of
+ * 256 entries in fib_tbl8, one for each address.  A lookup is one
+ * load, or two.  Each entry keeps the length of the prefix it came
+ * from, so that adding a route overwrites only entries of routes no
+ * longer than it, and deleting one hands its entries to the longest
+ * route left that covers it.
+ *
+ * Entries name routes by their index in fib_rts[], kept in the route
+ * as rt_fibidx.  The table holds no reference: rtrequest() takes a
+ * route out of it when it takes it out of the tree.
+ *
+ * The table costs 64 MB, and 1 KB more for each /24 with longer routes
+ * in it, which only a large table pays for: it isn't built until the
+ * tree holds fib_minroutes routes, and until then fib_lookup() looks
+ * in the tree.  Once built it stays.  A route with a mask that isn't a
+ * prefix can't be put in it; the first one turns the table off, and
+ * lookups go back to the tree.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <net/route.h>
+#include <net/radix.h>
+
+#include <netinet/in.h>
+
+#define	FIB_EXT		0x80000000	/* names a tbl8 group */
+#define	FIB_VALID	0x40000000	/* names a route */
+#define	FIB_DEPTH(e)	(((e) >> 24) & 0x3f)
+#define	FIB_IDX(e)	((e) & 0xffffff)
+#define	FIB_ENTRY(i, d)	(FIB_VALID | (u_long)(d) << 24 | (i))
+
+#define	FIB_TBL24SIZE	(1 << 24)
+#define	FIB_MINRTS	256		/* fib_rts[] to start with */
+#define	FIB_MINGROUPS	64		/* tbl8 groups to start with */
+#define	FIB_MINROUTES	4096		/* routes to build the table for */
+
+int	fib_active = 1;			/* rtalloc1() may use the table */
+int	fib_minroutes = FIB_MINROUTES;	/* patchable */
+u_long	fib_memuse;			/* bytes held */
+
+static int fib_nroutes;			/* AF_INET routes in the tree */
+
+static u_long *fib_tbl24;
+static u_long *fib_tbl8;
+static int fib_ngroups;			/* groups fib_tbl8 has room for */
+static int fib_usedgroups;		/* groups ever handed out */
+static int fib_freegroup = -1;		/* freed groups, linked by entry 0 */
+static struct rtentry **fib_rts;	/* index 0 is not used */
+static int *fib_freerts;		/* stack of free indices */
+static int fib_nrts, fib_nfreerts, fib_usedrts;
+
+static int fib_alloc __P((void));
+static void fib_build __P((void));
+static struct rtentry *fib_cover __P((u_long, int));
+static int fib_group __P((u_long));
+static int fib_grow __P((caddr_t *, int, int));
+static void fib_insert __P((struct rtentry *));
+static int fib_masklen __P((struct sockaddr *));
+static struct rtentry *fib_match __P((u_long));
+static void fib_off __P((void));
+static void fib_update __P((u_long, int, u_long, u_long));
+static int fib_walkadd __P((struct radix_node *, void *));
+
+/*
+ * Make room for n bytes at *p, which holds old bytes.
+ */
+static int
+fib_grow(p, old, n)
+	caddr_t *p;
+	int old, n;
+{
+	caddr_t np;
+
+	if ((np = malloc((u_long)n, M_RTABLE, M_NOWAIT)) == NULL)
+		return (ENOBUFS);
+	if (*p) {
+		bcopy(*p, np, old);
+		free(*p, M_RTABLE);
+	}
+	*p = np;
+	fib_memuse += n - old;
+	return (0);
+}
+
+static int
+fib_alloc()
+{
+
+	if (fib_grow((caddr_t *)&fib_tbl24, 0,
+	    FIB_TBL24SIZE * sizeof (u_long)))
+		return (ENOBUFS);
+	bzero((caddr_t)fib_tbl24, FIB_TBL24SIZE * sizeof (u_long));
+	return (0);
+}
+
+/*
+ * Give up on the table: rtalloc1() goes back to the tree.
+ */
+static void
+fib_off()
+{
+
+	fib_active = 0;
+	if (fib_tbl24) {
+		free(fib_tbl24, M_RTABLE);
+		fib_tbl24 = NULL;
+	}
+	if (fib_tbl8) {
+		free(fib_tbl8, M_RTABLE);
+		fib_tbl8 = NULL;
+	}
+	if (fib_rts) {
+		free(fib_rts, M_RTABLE);
+		free(fib_freerts, M_RTABLE);
+		fib_rts = NULL;
+		fib_freerts = NULL;
+	}
+	fib_memuse = 0;
+}
+
+/*
+ * Length of the prefix mask m, 32 for none (a host route), or -1 if
+ * it isn't a prefix.  Masks in the tree have their trailing zeroes
+ * trimmed off by sa_len.
+ */
+static int
+fib_masklen(m)
+	struct sockaddr *m;
+{
+	register u_char *cp;
+	register int i, len = 0;
+	u_char b;
+
+	if (m == NULL)
+		return (32);
+	cp = (u_char *)&((struct sockaddr_in *)m)->sin_addr;
+	for (i = 0; i < 4; i++) {
+		b = cp + i < (u_char *)m + m->sa_len ? cp[i] : 0;
+		if (b == 0xff) {
+			len += 8;
+			continue;
+		}
+		while (b & 0x80) {
+			len++;
+			b <<= 1;
+		}
+		if (b)
+			return (-1);
+		for (i++; i < 4; i++)
+			if (cp + i < (u_char *)m + m->sa_len && cp[i])
+				return (-1);
+	}
+	return (len);
+}
+
+/*
+ * The group for the /24 holding a (host order), split off its tbl24
+ * entry if it has none yet.  -1 if there is no memory for it.
+ */
+static int
+fib_group(a)
+	u_long a;
+{
+	register u_long *e = &fib_tbl24[a >> 8], *g;
+	register int i, n;
+
+	if (*e & FIB_EXT)
+		return (FIB_IDX(*e));
+	if ((n = fib_freegroup) >= 0)
+		fib_freegroup = fib_tbl8[n << 8];
+	else {
+		if (fib_usedgroups == fib_ngroups) {
+			i = fib_ngroups ? 2 * fib_ngroups : FIB_MINGROUPS;
+			if (fib_grow((caddr_t *)&fib_tbl8,
+			    fib_ngroups * 256 * sizeof (u_long),
+			    i * 256 * sizeof (u_long)))
+				return (-1);
+			fib_ngroups = i;
+		}
+		n = fib_usedgroups++;
+	}
+	g = &fib_tbl8[n << 8];
+	for (i = 0; i < 256; i++)
+		g[i] = *e;
+	*e = FIB_EXT | n;
+	return (n);
+}
+
+/*
+ * Over the addresses of prefix a/len (host order), replace the
+ * entries equal to from with to; if from is 0, those of routes no
+ * longer than len.
+ */
+static void
+fib_update(a, len, from, to)
+	u_long a, from, to;
+	int len;
+{
+	register u_long *e, *elim, *g, *glim;
+	int n;
+
+	if (len > 24) {
+		if ((n = fib_group(a)) < 0) {
+			fib_off();
+			return;
+		}
+		e = &fib_tbl8[n << 8 | (a & 0xff)];
+		elim = e + (1 << (32 - len));
+		for (; e < elim; e++)
+			if (from ? *e == from : FIB_DEPTH(*e) <= len)
+				*e = to;
+		return;
+	}
+	e = &fib_tbl24[a >> 8];
+	elim = e + (1 << (24 - len));
+	for (; e < elim; e++) {
+		if ((*e & FIB_EXT) == 0) {
+			if (from ? *e == from : FIB_DEPTH(*e) <= len)
+				*e = to;
+			continue;
+		}
+		g = &fib_tbl8[FIB_IDX(*e) << 8];
+		for (glim = g + 256; g < glim; g++)
+			if (from ? *g == from : FIB_DEPTH(*g) <= len)
+				*g = to;
+	}
+}
+
+/*
+ * The longest route in the tree shorter than a/len that covers it.
+ * Usually the best match for a is, unless a longer route holds a.
+ */
+static struct rtentry *
+fib_cover(a, len)
+	u_long a;
+	int len;
+{
+	register struct radix_node_head *rnh = rt_tables[AF_INET];
+	register struct radix_node *rn;
+	struct sockaddr_in dst, mask;
+
+	bzero((caddr_t)&dst, sizeof (dst));
+	dst.sin_len = sizeof (dst);
+	dst.sin_family = AF_INET;
+	dst.sin_addr.s_addr = htonl(a);
+	rn = rnh->rnh_matchaddr(&dst, rnh);
+	if (rn == NULL || (rn->rn_flags & RNF_ROOT))
+		return (NULL);
+	if (fib_masklen(rt_mask((struct rtentry *)rn)) < len)
+		return (((struct rtentry *)rn)->rt_fibidx ?
+		    (struct rtentry *)rn : NULL);
+	mask = dst;
+	while (--len >= 0) {
+		mask.sin_addr.s_addr = len ? htonl(0xffffffff << (32 - len)) : 0;
+		dst.sin_addr.s_addr = htonl(a) & mask.sin_addr.s_addr;
+		rn = rnh->rnh_lookup(&dst, &mask, rnh);
+		if (rn && (rn->rn_flags & RNF_ROOT) == 0 &&
+		    ((struct rtentry *)rn)->rt_fibidx)
+			return ((struct rtentry *)rn);
+	}
+	return (NULL);
+}
+
+/*
+ * Put rt, in the tree, in the table.
+ */
+static void
+fib_insert(rt)
+	register struct rtentry *rt;
+{
+	u_long a;
+	int len, i;
+
+	len = fib_masklen(rt_mask(rt));
+	if (fib_nfreerts)
+		i = fib_freerts[--fib_nfreerts];
+	else {
+		if (fib_usedrts == fib_nrts) {
+			i = fib_nrts ? 2 * fib_nrts : FIB_MINRTS;
+			if (fib_grow((caddr_t *)&fib_rts,
+			    fib_nrts * sizeof (*fib_rts),
+			    i * sizeof (*fib_rts)) ||
+			    fib_grow((caddr_t *)&fib_freerts,
+			    fib_nrts * sizeof (*fib_freerts),
+			    i * sizeof (*fib_freerts))) {
+				fib_off();
+				return;
+			}
+			fib_nrts = i;
+			if (fib_usedrts == 0)
+				fib_usedrts = 1;
+		}
+		i = fib_usedrts++;
+	}
+	fib_rts[i] = rt;
+	rt->rt_fibidx = i;
+	a = ntohl(((struct sockaddr_in *)rt_key(rt))->sin_addr.s_addr);
+	fib_update(a, len, (u_long)0, FIB_ENTRY(i, len));
+}
+
+/*
+ * rn_walktree() callback for fib_build().
+ */
+static int
+fib_walkadd(rn, w)
+	struct radix_node *rn;
+	void *w;
+{
+
+	fib_insert((struct rtentry *)rn);
+	return (!fib_active);
+}
+
+/*
+ * Build the table from the routes in the tree.
+ */
+static void
+fib_build()
+{
+	register struct radix_node_head *rnh = rt_tables[AF_INET];
+
+	if (fib_alloc()) {
+		fib_off();
+		return;
+	}
+	(void)rnh->rnh_walktree(rnh, fib_walkadd, (void *)0);
+}
+
+/*
+ * Count rt, just added to the tree, and put it in the table once
+ * there is one.
+ */
+void
+fib_add(rt)
+	register struct rtentry *rt;
+{
+
+	if (!fib_active || rt_key(rt)->sa_family != AF_INET)
+		return;
+	if (fib_masklen(rt_mask(rt)) < 0) {
+		fib_off();
+		return;
+	}
+	fib_nroutes++;
+	if (fib_tbl24)
+		fib_insert(rt);
+	else if (fib_nroutes >= fib_minroutes)
+		fib_build();
+}
+
+/*
+ * Take rt, just deleted from the tree, out of the table.
+ */
+void
+fib_delete(rt)
+	register struct rtentry *rt;
+{
+	register struct rtentry *cover;
+	register u_long *g;
+	u_long a, to = 0;
+	int len, i, j;
+
+	if (!fib_active || rt_key(rt)->sa_family != AF_INET)
+		return;
+	fib_nroutes--;
+	if ((i = rt->rt_fibidx) == 0)
+		return;
+	len = fib_masklen(rt_mask(rt));
+	a = ntohl(((struct sockaddr_in *)rt_key(rt))->sin_addr.s_addr);
+	if ((cover = fib_cover(a, len)) != NULL)
+		to = FIB_ENTRY(cover->rt_fibidx, fib_masklen(rt_mask(cover)));
+	fib_update(a, len, FIB_ENTRY(i, len), to);
+	if (!fib_active)
+		return;
+	fib_rts[i] = NULL;
+	fib_freerts[fib_nfreerts++] = i;
+	rt->rt_fibidx = 0;
+
+	/*
+	 * A group left with the same entry throughout goes back
+	 * into tbl24.
+	 */
+	if (len > 24 && (fib_tbl24[a >> 8] & FIB_EXT)) {
+		i = FIB_IDX(fib_tbl24[a >> 8]);
+		g = &fib_tbl8[i << 8];
+		for (j = 1; j < 256; j++)
+			if (g[j] != g[0])
+				return;
+		fib_tbl24[a >> 8] = g[0];
+		g[0] = fib_freegroup;
+		fib_freegroup = i;
+	}
+}
+
+/*
+ * The route for dst, in network order, from the tree.
+ */
+static struct rtentry *
+fib_match(dst)
+	u_long dst;
+{
+	register struct radix_node_head *rnh = rt_tables[AF_INET];
+	register struct radix_node *rn;
+	struct sockaddr_in sin;
+
+	bzero((caddr_t)&sin, sizeof (sin));
+	sin.sin_len = sizeof (sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = dst;
+	if (rnh == NULL || (rn = rnh->rnh_matchaddr(&sin, rnh)) == NULL ||
+	    (rn->rn_flags & RNF_ROOT))
+		return (NULL);
+	return ((struct rtentry *)rn);
+}
+
+/*
+ * The route for dst, in network order, or 0.
+ */
+struct rtentry *
+fib_lookup(dst)
+	u_long dst;
+{
+	register u_long a = ntohl(dst), e;
+
+	if (fib_tbl24 == NULL)
+		return (fib_match(dst));
+	e = fib_tbl24[a >> 8];
+	if (e & FIB_EXT)
+		e = fib_tbl8[FIB_IDX(e) << 8 | (a & 0xff)];
+	return ((e & FIB_VALID) ? fib_rts[FIB_IDX(e)] : NULL);
+}
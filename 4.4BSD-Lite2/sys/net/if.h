@@ -243,7 +243,7 @@ struct ifaddr {
 	struct	ifaddr *ifa_next;	/* next address for interface */
 	void	(*ifa_rtrequest)();	/* check or clean routes (+ or -)'d */
 	u_short	ifa_flags;		/* mostly rt_flags for cloning */
-	short	ifa_refcnt;		/* extra to malloc for link info */
+	int	ifa_refcnt;		/* extra to malloc for link info */
 	int	ifa_metric;		/* cost of going out this interface */
 #ifdef notdef
 	struct	rtentry *ifa_rt;	/* XXXX for ROUTETOIF ????? */
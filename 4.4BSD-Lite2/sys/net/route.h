@@ -92,7 +92,7 @@ struct rtentry {
 #define	rt_mask(r)	((struct sockaddr *)((r)->rt_nodes->rn_mask))
 	struct	sockaddr *rt_gateway;	/* value */
 	short	rt_flags;		/* up/down?, host/net */
-	short	rt_refcnt;		/* # held references */
+	int	rt_refcnt;		/* # held references */
 	u_long	rt_use;			/* raw # packets forwarded */
 	struct	ifnet *rt_ifp;		/* the answer: interface to use */
 	struct	ifaddr *rt_ifa;		/* the answer: interface to use */
@@ -100,6 +100,7 @@ struct rtentry {
 	caddr_t	rt_llinfo;		/* pointer to link level info cache */
 	struct	rt_metrics rt_rmx;	/* metrics used by rx'ing protocols */
 	struct	rtentry *rt_gwroute;	/* implied entry for gatewayed routes */
+	int	rt_fibidx;		/* index in the IPv4 FIB, 0 if not in it */
 };
 
 /*
@@ -234,9 +235,14 @@ struct route_cb {
 struct	route_cb route_cb;
 struct	rtstat	rtstat;
 struct	radix_node_head *rt_tables[AF_MAX+1];
+extern	int fib_active;
 
 struct socket;
 
+void	 fib_add __P((struct rtentry *));
+void	 fib_delete __P((struct rtentry *));
+struct rtentry *
+	 fib_lookup __P((u_long));
 void	 route_init __P((void));
 int	 route_output __P((struct mbuf *, struct socket *));
 int	 route_usrreq __P((struct socket *,
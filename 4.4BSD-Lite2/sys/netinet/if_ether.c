@@ -72,13 +72,26 @@
 
 
 /* timer values */
-int	arpt_prune = (5*60*1);	/* walk list every 5 minutes */
+int	arpt_prune = (5*60*1);	/* look again at entries in use every 5 minutes */
 int	arpt_keep = (20*60);	/* once resolved, good for 20 more minutes */
 int	arpt_down = 20;		/* once declared down, don't send for 20 secs */
 #define	rt_expire rt_rmx.rmx_expire
 
+/*
+ * Entries are hashed by address, so that arplookup() needn't go
+ * through the routing table, and each has its own callout to age it:
+ * arptimer() runs for an entry when it may be due to go, rather than
+ * for the whole list every arpt_prune seconds.  The callout is not
+ * moved when an entry is refreshed; it finds the entry still good and
+ * goes again for the time left.
+ */
+#define	ARP_HASH(a)	((ntohl(a) ^ ntohl(a) >> 16) & arp_hashmask)
+
+static	void arp_init __P((void));
+static	long arp_deadline __P((struct llinfo_arp *));
+static	void arp_settimer __P((struct llinfo_arp *, long));
 static	void arprequest __P((struct arpcom *, u_long *, u_long *, u_char *));
-static	void arptfree __P((struct llinfo_arp *));
+static	int arptfree __P((struct llinfo_arp *));
 static	void arptimer __P((void *));
 static	struct llinfo_arp *arplookup __P((u_long, int, int));
 static	void in_arpinput __P((struct mbuf *));
@@ -87,28 +100,81 @@ extern	struct ifnet loif;
 // extern struct timeval time;
 struct	llinfo_arp llinfo_arp = {&llinfo_arp, &llinfo_arp};
 struct	ifqueue arpintrq = {0, 0, 0, 50};
+struct	arpstat arpstat;
 int	arp_inuse, arp_allocated, arp_intimer;
 int	arp_maxtries = 5;
+int	arp_maxhold = 16;	/* packets held for an unresolved entry */
+int	arp_hashsize = 4096;	/* buckets in the address hash */
 int	useloopback = 1;	/* use loopback interface for local traffic */
 int	arpinit_done = 0;
 
+static	LIST_HEAD(, llinfo_arp) *arp_hashtbl;
+static	u_long arp_hashmask;
+
+static void
+arp_init()
+{
+
+	arpinit_done = 1;
+	arp_hashtbl = hashinit(arp_hashsize, M_RTABLE, &arp_hashmask);
+}
+
+/*
+ * When la may go, in seconds, or 0 if it is permanent.  A resolved
+ * entry goes when it expires; one that isn't, arpt_down seconds
+ * after the last request for it, or after it stops being rejected.
+ */
+static long
+arp_deadline(la)
+	register struct llinfo_arp *la;
+{
+	register struct rtentry *rt = la->la_rt;
+
+	if (rt->rt_expire == 0)
+		return (0);
+	if (SDL(rt->rt_gateway)->sdl_alen != 0)
+		return (rt->rt_expire);
+	return (rt->rt_expire + arpt_down);
+}
+
+/*
+ * See that arptimer() looks at la no later than when.  A callout due
+ * sooner is left alone, since it goes again for the time left.
+ */
+static void
+arp_settimer(la, when)
+	register struct llinfo_arp *la;
+	long when;
+{
+
+	if (when == 0 || (la->la_timeout && la->la_timeout <= when))
+		return;
+	if (la->la_timeout)
+		untimeout(arptimer, (caddr_t)la);
+	la->la_timeout = when;
+	timeout(arptimer, (caddr_t)la, (int)(when - time.tv_sec) * hz);
+}
+
 /*
- * Timeout routine.  Age arp_tab entries periodically.
+ * Timeout routine.  Free la if it is due, or wait for the time left.
  */
-/* ARGSUSED */
 static void
-arptimer(ignored_arg)
-	void *ignored_arg;
+arptimer(arg)
+	void *arg;
 {
 	int s = splnet();
-	register struct llinfo_arp *la = llinfo_arp.la_next;
-
-	timeout(arptimer, (caddr_t)0, arpt_prune * hz);
-	while (la != &llinfo_arp) {
-		register struct rtentry *rt = la->la_rt;
-		la = la->la_next;
-		if (rt->rt_expire && rt->rt_expire <= time.tv_sec)
-			arptfree(la->la_prev); /* timer has expired, clear */
+	register struct llinfo_arp *la = arg;
+	long when;
+
+	la->la_timeout = 0;
+	when = arp_deadline(la);
+	if (when > time.tv_sec)
+		arp_settimer(la, when);
+	else if (when != 0) {
+		arpstat.as_timeouts++;
+		/* still in use: only invalidated, look again later */
+		if (arptfree(la) == 0)
+			arp_settimer(la, time.tv_sec + arpt_prune);
 	}
 	splx(s);
 }
@@ -124,12 +190,11 @@ arp_rtrequest(req, rt, sa)
 {
 	register struct sockaddr *gate = rt->rt_gateway;
 	register struct llinfo_arp *la = (struct llinfo_arp *)rt->rt_llinfo;
+	register struct mbuf *m;
 	static struct sockaddr_dl null_sdl = {sizeof(null_sdl), AF_LINK};
 
-	if (!arpinit_done) {
-		arpinit_done = 1;
-		timeout(arptimer, (caddr_t)0, hz);
-	}
+	if (!arpinit_done)
+		arp_init();
 	if (rt->rt_flags & RTF_GATEWAY)
 		return;
 	switch (req) {
@@ -187,6 +252,11 @@ arp_rtrequest(req, rt, sa)
 		la->la_rt = rt;
 		rt->rt_flags |= RTF_LLINFO;
 		insque(la, &llinfo_arp);
+		/* proxy entries are found through the routing table */
+		if (rt_key(rt)->sa_len < sizeof(struct sockaddr_inarp) ||
+		    (SRP(rt_key(rt))->sin_other & SIN_PROXY) == 0)
+			LIST_INSERT_HEAD(&arp_hashtbl[ARP_HASH(
+			    SIN(rt_key(rt))->sin_addr.s_addr)], la, la_hash);
 		if (SIN(rt_key(rt))->sin_addr.s_addr ==
 		    (IA_SIN(rt->rt_ifa))->sin_addr.s_addr) {
 		    /*
@@ -206,6 +276,7 @@ arp_rtrequest(req, rt, sa)
 				rt->rt_ifp = &loif;
 
 		}
+		arp_settimer(la, arp_deadline(la));
 		break;
 
 	case RTM_DELETE:
@@ -213,10 +284,17 @@ arp_rtrequest(req, rt, sa)
 			break;
 		arp_inuse--;
 		remque(la);
+		if (la->la_hash.le_prev)
+			LIST_REMOVE(la, la_hash);
+		if (la->la_timeout)
+			untimeout(arptimer, (caddr_t)la);
 		rt->rt_llinfo = 0;
 		rt->rt_flags &= ~RTF_LLINFO;
-		if (la->la_hold)
-			m_freem(la->la_hold);
+		while ((m = la->la_hold) != NULL) {
+			la->la_hold = m->m_nextpkt;
+			m_freem(m);
+			arpstat.as_dropped++;
+		}
 		Free((caddr_t)la);
 	}
 }
@@ -270,6 +348,7 @@ arprequest(ac, sip, tip, enaddr)
 	bcopy((caddr_t)tip, (caddr_t)ea->arp_tpa, sizeof(ea->arp_tpa));
 	sa.sa_family = AF_UNSPEC;
 	sa.sa_len = sizeof(sa);
+	arpstat.as_txrequests++;
 	(*ac->ac_if.if_output)(&ac->ac_if, m, &sa, (struct rtentry *)0);
 }
 
@@ -277,8 +356,8 @@ arprequest(ac, sip, tip, enaddr)
  * Resolve an IP address into an ethernet address.  If success,
  * desten is filled in.  If there is no entry in arptab,
  * set one up and broadcast a request for the IP address.
- * Hold onto this mbuf and resend it once the address
- * is finally resolved.  A return value of 1 indicates
+ * Hold onto this mbuf, with up to arp_maxhold others, and
+ * resend them once the address is finally resolved.  A return value of 1 indicates
  * that desten has been filled in and the packet should be sent
  * normally; a 0 return indicates that the packet has been
  * taken over here, either now or for later transmission.
@@ -292,6 +371,7 @@ arpresolve(ac, rt, m, dst, desten)
 	register u_char *desten;
 {
 	register struct llinfo_arp *la;
+	register struct mbuf *n;
 	struct sockaddr_dl *sdl;
 
 	if (m->m_flags & M_BCAST) {	/* broadcast */
@@ -326,12 +406,23 @@ arpresolve(ac, rt, m, dst, desten)
 	}
 	/*
 	 * There is an arptab entry, but no ethernet address
-	 * response yet.  Replace the held mbuf with this
-	 * latest one.
+	 * response yet.  Queue this mbuf behind those held,
+	 * dropping the oldest if there are too many.
 	 */
+	while (la->la_numheld >= arp_maxhold && la->la_hold) {
+		n = la->la_hold;
+		la->la_hold = n->m_nextpkt;
+		la->la_numheld--;
+		m_freem(n);
+		arpstat.as_dropped++;
+	}
+	m->m_nextpkt = 0;
 	if (la->la_hold)
-		m_freem(la->la_hold);
-	la->la_hold = m;
+		la->la_holdtail->m_nextpkt = m;
+	else
+		la->la_hold = m;
+	la->la_holdtail = m;
+	la->la_numheld++;
 	if (rt->rt_expire) {
 		rt->rt_flags &= ~RTF_REJECT;
 		if (la->la_asked == 0 || rt->rt_expire != time.tv_sec) {
@@ -343,7 +434,7 @@ arpresolve(ac, rt, m, dst, desten)
 				rt->rt_expire += arpt_down;
 				la->la_asked = 0;
 			}
-
+			arp_settimer(la, arp_deadline(la));
 		}
 	}
 	return (0);
@@ -366,6 +457,7 @@ arpintr()
 		splx(s);
 		if (m == 0 || (m->m_flags & M_PKTHDR) == 0)
 			panic("arpintr");
+		arpstat.as_received++;
 		if (m->m_len >= sizeof(struct arphdr) &&
 		    (ar = mtod(m, struct arphdr *)) &&
 		    ntohs(ar->ar_hrd) == ARPHRD_ETHER &&
@@ -410,10 +502,15 @@ in_arpinput(m)
 	struct sockaddr_dl *sdl;
 	struct sockaddr sa;
 	struct in_addr isaddr, itaddr, myaddr;
+	struct mbuf *hold;
 	int op;
 
 	ea = mtod(m, struct ether_arp *);
 	op = ntohs(ea->arp_op);
+	if (op == ARPOP_REQUEST)
+		arpstat.as_rxrequests++;
+	else if (op == ARPOP_REPLY)
+		arpstat.as_rxreplies++;
 	bcopy((caddr_t)ea->arp_spa, (caddr_t)&isaddr, sizeof (isaddr));
 	bcopy((caddr_t)ea->arp_tpa, (caddr_t)&itaddr, sizeof (itaddr));
 	for (ia = in_ifaddr; ia; ia = ia->ia_next)
@@ -437,6 +534,7 @@ in_arpinput(m)
 		goto out;
 	}
 	if (isaddr.s_addr == myaddr.s_addr) {
+		arpstat.as_dupips++;
 		log(LOG_ERR,
 		   "duplicate IP address %x!! sent from ethernet address: %s\n",
 		   ntohl(isaddr.s_addr), ether_sprintf(ea->arp_sha));
@@ -451,14 +549,21 @@ in_arpinput(m)
 			    ntohl(isaddr.s_addr), ether_sprintf(ea->arp_sha));
 		bcopy((caddr_t)ea->arp_sha, LLADDR(sdl),
 			    sdl->sdl_alen = sizeof(ea->arp_sha));
-		if (rt->rt_expire)
+		if (rt->rt_expire) {
 			rt->rt_expire = time.tv_sec + arpt_keep;
+			arp_settimer(la, rt->rt_expire);
+		}
 		rt->rt_flags &= ~RTF_REJECT;
 		la->la_asked = 0;
-		if (la->la_hold) {
-			(*ac->ac_if.if_output)(&ac->ac_if, la->la_hold,
-				rt_key(rt), rt);
-			la->la_hold = 0;
+		hold = la->la_hold;
+		la->la_hold = la->la_holdtail = 0;
+		la->la_numheld = 0;
+		while (hold) {
+			struct mbuf *next = hold->m_nextpkt;
+
+			hold->m_nextpkt = 0;
+			(*ac->ac_if.if_output)(&ac->ac_if, hold, rt_key(rt), rt);
+			hold = next;
 		}
 	}
 reply:
@@ -494,14 +599,16 @@ reply:
 	eh->ether_type = ETHERTYPE_ARP;
 	sa.sa_family = AF_UNSPEC;
 	sa.sa_len = sizeof(sa);
+	arpstat.as_txreplies++;
 	(*ac->ac_if.if_output)(&ac->ac_if, m, &sa, (struct rtentry *)0);
 	return;
 }
 
 /*
- * Free an arp entry.
+ * Free an arp entry.  Returns 0 if the route is still referenced
+ * and the entry was only invalidated.
  */
-static void
+static int
 arptfree(la)
 	register struct llinfo_arp *la;
 {
@@ -514,10 +621,11 @@ arptfree(la)
 		sdl->sdl_alen = 0;
 		la->la_asked = 0;
 		rt->rt_flags &= ~RTF_REJECT;
-		return;
+		return (0);
 	}
 	rtrequest(RTM_DELETE, rt_key(rt), (struct sockaddr *)0, rt_mask(rt),
 			0, (struct rtentry **)0);
+	return (1);
 }
 /*
  * Lookup or enter a new address in arptab.
@@ -528,8 +636,17 @@ arplookup(addr, create, proxy)
 	int create, proxy;
 {
 	register struct rtentry *rt;
+	register struct llinfo_arp *la;
 	static struct sockaddr_inarp sin = {sizeof(sin), AF_INET };
 
+	if (!proxy && arp_hashtbl) {
+		for (la = arp_hashtbl[ARP_HASH(addr)].lh_first; la;
+		    la = la->la_hash.le_next)
+			if (SIN(rt_key(la->la_rt))->sin_addr.s_addr == addr)
+				return (la);
+		if (!create)
+			return (0);
+	}
 	sin.sin_addr.s_addr = addr;
 	sin.sin_other = proxy ? SIN_PROXY : 0;
 	rt = rtalloc1((struct sockaddr *)&sin, create);
@@ -33,6 +33,8 @@
  *	@(#)if_ether.h	8.3 (Berkeley) 5/2/95
  */
 
+#include <sys/queue.h>
+
 /*
  * Structure of a 10Mb/s Ethernet header.
  */
@@ -119,9 +121,27 @@ struct llinfo_arp {
 	struct	llinfo_arp *la_next;
 	struct	llinfo_arp *la_prev;
 	struct	rtentry *la_rt;
-	struct	mbuf *la_hold;		/* last packet until resolved/timeout */
+	struct	mbuf *la_hold;		/* packets until resolved/timeout */
 	long	la_asked;		/* last time we QUERIED for this addr */
 #define la_timer la_rt->rt_rmx.rmx_expire /* deletion time in seconds */
+	LIST_ENTRY(llinfo_arp) la_hash;	/* address hash chain */
+	struct	mbuf *la_holdtail;	/* last packet on la_hold */
+	int	la_numheld;		/* packets on la_hold */
+	long	la_timeout;		/* when arptimer() looks, 0 if it won't */
+};
+
+/*
+ * ARP statistics.
+ */
+struct	arpstat {
+	u_long	as_received;		/* packets received */
+	u_long	as_rxrequests;		/* requests received */
+	u_long	as_rxreplies;		/* replies received */
+	u_long	as_txrequests;		/* requests sent */
+	u_long	as_txreplies;		/* replies sent */
+	u_long	as_dropped;		/* held packets dropped */
+	u_long	as_timeouts;		/* entries timed out */
+	u_long	as_dupips;		/* our address claimed by another */
 };
 
 struct sockaddr_inarp {
@@ -147,6 +167,7 @@ u_char	ether_ipmulticast_max[6];
 struct	ifqueue arpintrq;
 
 struct	llinfo_arp llinfo_arp;		/* head of the llinfo queue */
+struct	arpstat arpstat;
 
 void	arp_rtrequest __P((int, struct rtentry *, struct sockaddr *));
 void	arpintr __P((void));
@@ -234,6 +234,9 @@ struct ip_mreq {
 int	 in_broadcast __P((struct in_addr, struct ifnet *));
 int	 in_canforward __P((struct in_addr));
 int	 in_cksum __P((struct mbuf *, int));
+int	 in_cksum_select __P((int));
+int	 in_cksum_update __P((u_int, u_int, u_int));
+int	 in_cksum_update32 __P((u_int, u_int32_t, u_int32_t));
 int	 in_localaddr __P((struct in_addr));
 u_long	 in_netof __P((struct in_addr));
 void	 in_socktrim __P((struct sockaddr_in *));
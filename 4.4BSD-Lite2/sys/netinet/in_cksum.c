@@ -33,118 +33,343 @@
  *	@(#)in_cksum.c	8.1 (Berkeley) 6/10/93
  */
 
+
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/mbuf.h>
 
 /*
- * Checksum routine for Internet Protocol family headers (Portable Version).
+ * Checksum routine for Internet Protocol family headers.
  *
  * This routine is very heavily used in the network
  * code and should be modified for each CPU to be as fast as possible.
+ *
+ * Each buffer of the chain is summed on its own, and the sum of a
+ * buffer that starts at an odd offset into the data is byte swapped
+ * before it is added in.  The bulk of a buffer is summed as 32 bit
+ * words into a 64 bit accumulator, so carries only need folding at
+ * the end; on x86 the loop is replaced at first use by an SSE2 or
+ * AVX2 version when the CPU has one.
+ */
+
+#define SWAP16(x)	((((x) << 8) | ((x) >> 8)) & 0xffff)
+#define REDUCE(s)	{ s = (s >> 16) + (s & 0xffff); s += s >> 16; s &= 0xffff; }
+#define REDUCE64(s, sum) { \
+	u_int hi = (sum) >> 32; \
+	s = (u_int)(sum) + hi; \
+	if (s < hi) \
+		s++; \
+	REDUCE(s); \
+}
+
+typedef u_quad_t (*cksumwords_t) __P((const u_int32_t *, int));
+
+static u_quad_t	in_cksum_probe __P((const u_int32_t *, int));
+static u_quad_t	in_cksum_words __P((const u_int32_t *, int));
+static u_int	in_cksumdata __P((const u_char *, int));
+
+static cksumwords_t in_cksumwords = in_cksum_probe;
+
+#define	CKSUM_SMALL	64	/* shorter data isn't worth a vector loop */
+
+/*
+ * Sum nwords 32 bit words.
+ */
+static u_quad_t
+in_cksum_words(w, nwords)
+	register const u_int32_t *w;
+	register int nwords;
+{
+	register u_quad_t sum = 0;
+
+	while ((nwords -= 8) >= 0) {
+		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
+		sum += w[4]; sum += w[5]; sum += w[6]; sum += w[7];
+		w += 8;
+	}
+	nwords += 8;
+	while (--nwords >= 0)
+		sum += *w++;
+	return (sum);
+}
+
+#if defined(__GNUC__) && defined(__i386__)
+/*
+ * The vector loops add the two 16 bit halves of every 32 bit lane
+ * separately, so a lane grows by at most 2 * 0xffff per vector and
+ * is emptied into the 64 bit sum every CKSUM_VBLOCK vectors.  Either
+ * way the sum is the same modulo 0xffff, which is all that matters.
+ */
+#define	CKSUM_VBLOCK	4096
+
+typedef u_int32_t v4u32 __attribute__((vector_size(16)));
+typedef u_int32_t v8u32 __attribute__((vector_size(32)));
+
+static u_quad_t __attribute__((target("sse2")))
+in_cksum_sse2(w, nwords)
+	register const u_int32_t *w;
+	register int nwords;
+{
+	u_quad_t sum = 0;
+	register const v4u32 *v;
+	v4u32 a0, a1, x, y;
+	int n;
+
+	for (; nwords > 0 && ((u_long)w & 15); nwords--)
+		sum += *w++;
+	v = (const v4u32 *)w;
+	while (nwords >= 8) {
+		n = min(nwords / 8, CKSUM_VBLOCK);
+		nwords -= n * 8;
+		a0 = a1 = (v4u32){ 0, 0, 0, 0 };
+		while (--n >= 0) {
+			x = v[0];
+			y = v[1];
+			a0 += (x & 0xffff) + (x >> 16);
+			a1 += (y & 0xffff) + (y >> 16);
+			v += 2;
+		}
+		a0 += a1;	/* at most 2 * CKSUM_VBLOCK * 2 * 0xffff */
+		sum += (u_quad_t)a0[0] + a0[1] + a0[2] + a0[3];
+	}
+	return (sum + in_cksum_words((const u_int32_t *)v, nwords));
+}
+
+static u_quad_t __attribute__((target("avx2")))
+in_cksum_avx2(w, nwords)
+	register const u_int32_t *w;
+	register int nwords;
+{
+	u_quad_t sum = 0;
+	register const v8u32 *v;
+	v8u32 a0, a1, x, y;
+	int n;
+
+	for (; nwords > 0 && ((u_long)w & 31); nwords--)
+		sum += *w++;
+	v = (const v8u32 *)w;
+	while (nwords >= 16) {
+		n = min(nwords / 16, CKSUM_VBLOCK);
+		nwords -= n * 16;
+		a0 = a1 = (v8u32){ 0, 0, 0, 0, 0, 0, 0, 0 };
+		while (--n >= 0) {
+			x = v[0];
+			y = v[1];
+			a0 += (x & 0xffff) + (x >> 16);
+			a1 += (y & 0xffff) + (y >> 16);
+			v += 2;
+		}
+		a0 += a1;
+		sum += (u_quad_t)a0[0] + a0[1] + a0[2] + a0[3] +
+		    a0[4] + a0[5] + a0[6] + a0[7];
+	}
+	return (sum + in_cksum_words((const u_int32_t *)v, nwords));
+}
+
+static void
+cpuid(leaf, regs)
+	u_int leaf, *regs;
+{
+	__asm __volatile("cpuid"
+	    : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+	    : "a" (leaf), "c" (0));
+}
+
+/*
+ * Return the best variant the CPU supports: 0 for plain words,
+ * 1 for SSE2, 2 for AVX2.
  */
+static int
+in_cksum_cpu()
+{
+	u_int r[4], xcr0, xcr0hi;
 
-#define ADDCARRY(x)  (x > 65535 ? x -= 65535 : x)
-#define REDUCE {l_util.l = sum; sum = l_util.s[0] + l_util.s[1]; ADDCARRY(sum);}
+	cpuid(0, r);
+	if (r[0] < 1)
+		return (0);
+	cpuid(1, r);
+	if ((r[3] & (1 << 26)) == 0)		/* SSE2 */
+		return (0);
+	if ((r[2] & (1 << 27)) == 0)		/* OSXSAVE */
+		return (1);
+	__asm __volatile(".byte 0x0f, 0x01, 0xd0"	/* xgetbv */
+	    : "=a" (xcr0), "=d" (xcr0hi) : "c" (0));
+	if ((xcr0 & 6) != 6)			/* XMM and YMM state */
+		return (1);
+	cpuid(0, r);
+	if (r[0] < 7)
+		return (1);
+	cpuid(7, r);
+	return ((r[1] & (1 << 5)) ? 2 : 1);	/* AVX2 */
+}
+
+static cksumwords_t in_cksum_impls[] =
+	{ in_cksum_words, in_cksum_sse2, in_cksum_avx2 };
+#else
+static int
+in_cksum_cpu()
+{
+	return (0);
+}
+
+static cksumwords_t in_cksum_impls[] = { in_cksum_words };
+#endif
 
+/*
+ * Use variant impl of the word summing loop, or the best one the CPU
+ * has if impl is negative or not supported.  Returns the one chosen.
+ */
 int
-in_cksum(m, len)
-	register struct mbuf *m;
-	register int len;
+in_cksum_select(impl)
+	int impl;
+{
+	int best = in_cksum_cpu();
+
+	if (impl < 0 || impl > best)
+		impl = best;
+	in_cksumwords = in_cksum_impls[impl];
+	return (impl);
+}
+
+static u_quad_t
+in_cksum_probe(w, nwords)
+	const u_int32_t *w;
+	int nwords;
 {
-	register u_short *w;
-	register int sum = 0;
-	register int mlen = 0;
-	int byte_swapped = 0;
+	(void)in_cksum_select(-1);
+	return ((*in_cksumwords)(w, nwords));
+}
 
+/*
+ * Sum len bytes at cp, as 16 bit words starting at an even offset.
+ */
+static __inline u_int
+in_cksumdata(cp, len)
+	register const u_char *cp;
+	register int len;
+{
+	register u_quad_t sum = 0;
+	register const u_short *w;
+	register u_int ssum = 0;
+	u_int first = 0;
+	int swapped = 0;
 	union {
-		char	c[2];
+		u_char	c[2];
 		u_short	s;
 	} s_util;
-	union {
-		u_short s[2];
-		long	l;
-	} l_util;
 
-	for (;m && len; m = m->m_next) {
-		if (m->m_len == 0)
-			continue;
-		w = mtod(m, u_short *);
-		if (mlen == -1) {
-			/*
-			 * The first byte of this mbuf is the continuation
-			 * of a word spanning between this mbuf and the
-			 * last mbuf.
-			 *
-			 * s_util.c[0] is already saved when scanning previous 
-			 * mbuf.
-			 */
-			s_util.c[1] = *(char *)w;
-			sum += s_util.s;
-			w = (u_short *)((char *)w + 1);
-			mlen = m->m_len - 1;
-			len--;
-		} else
-			mlen = m->m_len;
-		if (len < mlen)
-			mlen = len;
-		len -= mlen;
+	if (len <= 0)
+		return (0);
+	if ((u_long)cp & 1) {
 		/*
-		 * Force to even boundary.
+		 * Sum the rest from the next, aligned, byte: its
+		 * words are the real ones with the bytes swapped.
 		 */
-		if ((1 & (int) w) && (mlen > 0)) {
-			REDUCE;
-			sum <<= 8;
-			s_util.c[0] = *(u_char *)w;
-			w = (u_short *)((char *)w + 1);
-			mlen--;
-			byte_swapped = 1;
-		}
-		/*
-		 * Unroll the loop to make overhead from
-		 * branches &c small.
-		 */
-		while ((mlen -= 32) >= 0) {
-			sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-			sum += w[4]; sum += w[5]; sum += w[6]; sum += w[7];
-			sum += w[8]; sum += w[9]; sum += w[10]; sum += w[11];
-			sum += w[12]; sum += w[13]; sum += w[14]; sum += w[15];
-			w += 16;
-		}
-		mlen += 32;
-		while ((mlen -= 8) >= 0) {
-			sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-			w += 4;
+		s_util.c[0] = *cp++;
+		s_util.c[1] = 0;
+		first = s_util.s;
+		len--;
+		swapped = 1;
+	}
+	if (len >= CKSUM_SMALL) {
+		if ((u_long)cp & 2) {
+			sum += *(u_short *)cp;
+			cp += 2;
+			len -= 2;
 		}
-		mlen += 8;
-		if (mlen == 0 && byte_swapped == 0)
+		sum += (*in_cksumwords)((const u_int32_t *)cp, len >> 2);
+		cp += len & ~3;
+		len &= 3;
+	}
+	/*
+	 * What is left is short enough to sum 16 bits at a time
+	 * without overflowing 32 bits.
+	 */
+	w = (const u_short *)cp;
+	while ((len -= 32) >= 0) {
+		ssum += w[0]; ssum += w[1]; ssum += w[2]; ssum += w[3];
+		ssum += w[4]; ssum += w[5]; ssum += w[6]; ssum += w[7];
+		ssum += w[8]; ssum += w[9]; ssum += w[10]; ssum += w[11];
+		ssum += w[12]; ssum += w[13]; ssum += w[14]; ssum += w[15];
+		w += 16;
+	}
+	len += 32;
+	while ((len -= 8) >= 0) {
+		ssum += w[0]; ssum += w[1]; ssum += w[2]; ssum += w[3];
+		w += 4;
+	}
+	len += 8;
+	while ((len -= 2) >= 0)
+		ssum += *w++;
+	if (len == -1) {
+		s_util.c[0] = *(u_char *)w;
+		s_util.c[1] = 0;
+		ssum += s_util.s;
+	}
+	if (sum) {
+		sum += ssum;
+		REDUCE64(ssum, sum);
+	} else
+		REDUCE(ssum);
+	if (swapped) {
+		ssum = SWAP16(ssum) + first;
+		REDUCE(ssum);
+	}
+	return (ssum);
+}
+
+int
+in_cksum(m, len)
+	register struct mbuf *m;
+	register int len;
+{
+	register u_int sum = 0;
+	register int mlen;
+	register u_int partial;
+	int odd = 0;
+
+	for (; m && len; m = m->m_next) {
+		if (m->m_len == 0)
 			continue;
-		REDUCE;
-		while ((mlen -= 2) >= 0) {
-			sum += *w++;
-		}
-		if (byte_swapped) {
-			REDUCE;
-			sum <<= 8;
-			byte_swapped = 0;
-			if (mlen == -1) {
-				s_util.c[1] = *(char *)w;
-				sum += s_util.s;
-				mlen = 0;
-			} else
-				mlen = -1;
-		} else if (mlen == -1)
-			s_util.c[0] = *(char *)w;
+		mlen = min(m->m_len, len);
+		partial = in_cksumdata(mtod(m, u_char *), mlen);
+		if (odd)
+			partial = SWAP16(partial);
+		sum += partial;
+		odd ^= mlen & 1;
+		len -= mlen;
 	}
 	if (len)
 		printf("cksum: out of data\n");
-	if (mlen == -1) {
-		/* The last mbuf has odd # of bytes. Follow the
-		   standard (the odd byte may be shifted left by 8 bits
-		   or not as determined by endian-ness of the machine) */
-		s_util.c[1] = 0;
-		sum += s_util.s;
-	}
-	REDUCE;
+	REDUCE(sum);
 	return (~sum & 0xffff);
 }
+
+/*
+ * Incremental update of checksum cksum for a 16 bit word of the
+ * summed data changing from old to new (RFC 1624, eqn. 3).  The
+ * words are taken as they lie in memory, like in_cksum() does.
+ */
+int
+in_cksum_update(cksum, old, new)
+	u_int cksum, old, new;
+{
+	register u_int sum;
+
+	sum = (~cksum & 0xffff) + (~old & 0xffff) + (new & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+	return (~sum & 0xffff);
+}
+
+/*
+ * Same for a 32 bit field, such as an address.
+ */
+int
+in_cksum_update32(cksum, old, new)
+	u_int cksum;
+	u_int32_t old, new;
+{
+	cksum = in_cksum_update(cksum, old >> 16, new >> 16);
+	return (in_cksum_update(cksum, old & 0xffff, new & 0xffff));
+}
@@ -57,6 +57,28 @@
 
 struct	in_addr zeroin_addr;
 
+static int in_pcbmatch __P((struct inpcb *,
+	    struct in_addr, u_int, struct in_addr, u_int));
+static void in_pcbunhash __P((struct inpcb *));
+
+/*
+ * Attach lookup hashes to the chain of pcb's at head.
+ * Must be called before the first in_pcballoc() on the chain.
+ */
+void
+in_pcbhashinit(head, size)
+	struct inpcb *head;
+	int size;
+{
+	register struct inpcbhash *ih;
+
+	MALLOC(ih, struct inpcbhash *, sizeof(*ih), M_PCB, M_WAITOK);
+	ih->ih_conn = hashinit(size, M_PCB, &ih->ih_connmask);
+	ih->ih_listen = hashinit(size, M_PCB, &ih->ih_listenmask);
+	ih->ih_port = hashinit(size, M_PCB, &ih->ih_portmask);
+	head->inp_hashinfo = ih;
+}
+
 int
 in_pcballoc(so, head)
 	struct socket *so;
@@ -69,6 +91,7 @@ in_pcballoc(so, head)
 		return (ENOBUFS);
 	bzero((caddr_t)inp, sizeof(*inp));
 	inp->inp_head = head;
+	inp->inp_hashinfo = head->inp_hashinfo;
 	inp->inp_socket = so;
 	insque(inp, head);
 	so->so_pcb = (caddr_t)inp;
@@ -147,26 +170,25 @@ in_pcbbind(inp, nam)
 		} while (in_pcblookup(head,
 			    zeroin_addr, 0, inp->inp_laddr, lport, wild));
 	inp->inp_lport = lport;
+	in_pcbrehash(inp);
 	return (0);
 }
 
 /*
- * Connect from a socket to a specified address.
- * Both address and port must be specified in argument sin.
- * If don't have a local address for this socket yet,
- * then pick one.
+ * Check a foreign address for in_pcbconnect(), and if the socket
+ * has no local address yet pick the one it would connect from,
+ * returned in *plocal_sin; udp_sendmmsg() uses it for datagrams
+ * sent without connecting.  Both address and port must be
+ * specified in argument sin.
  */
 int
-in_pcbconnect(inp, nam)
+in_pcbladdr(inp, sin, plocal_sin)
 	register struct inpcb *inp;
-	struct mbuf *nam;
+	register struct sockaddr_in *sin;
+	struct sockaddr_in **plocal_sin;
 {
 	struct in_ifaddr *ia;
-	struct sockaddr_in *ifaddr;
-	register struct sockaddr_in *sin = mtod(nam, struct sockaddr_in *);
 
-	if (nam->m_len != sizeof (*sin))
-		return (EINVAL);
 	if (sin->sin_family != AF_INET)
 		return (EAFNOSUPPORT);
 	if (sin->sin_port == 0)
@@ -255,8 +277,30 @@ in_pcbconnect(inp, nam)
 					return (EADDRNOTAVAIL);
 			}
 		}
-		ifaddr = (struct sockaddr_in *)&ia->ia_addr;
+		*plocal_sin = (struct sockaddr_in *)&ia->ia_addr;
 	}
+	return (0);
+}
+
+/*
+ * Connect from a socket to a specified address.
+ * Both address and port must be specified in argument sin.
+ * If don't have a local address for this socket yet,
+ * then pick one.
+ */
+int
+in_pcbconnect(inp, nam)
+	register struct inpcb *inp;
+	struct mbuf *nam;
+{
+	struct sockaddr_in *ifaddr;
+	register struct sockaddr_in *sin = mtod(nam, struct sockaddr_in *);
+	int error;
+
+	if (nam->m_len != sizeof (*sin))
+		return (EINVAL);
+	if ((error = in_pcbladdr(inp, sin, &ifaddr)) != 0)
+		return (error);
 	if (in_pcblookup(inp->inp_head,
 	    sin->sin_addr,
 	    sin->sin_port,
@@ -271,6 +315,7 @@ in_pcbconnect(inp, nam)
 	}
 	inp->inp_faddr = sin->sin_addr;
 	inp->inp_fport = sin->sin_port;
+	in_pcbrehash(inp);
 	return (0);
 }
 
@@ -281,6 +326,7 @@ in_pcbdisconnect(inp)
 
 	inp->inp_faddr.s_addr = INADDR_ANY;
 	inp->inp_fport = 0;
+	in_pcbrehash(inp);
 	if (inp->inp_socket->so_state & SS_NOFDREF)
 		in_pcbdetach(inp);
 }
@@ -298,6 +344,7 @@ in_pcbdetach(inp)
 	if (inp->inp_route.ro_rt)
 		rtfree(inp->inp_route.ro_rt);
 	ip_freemoptions(inp->inp_moptions);
+	in_pcbunhash(inp);
 	remque(inp);
 	FREE(inp, M_PCB);
 }
@@ -450,6 +497,94 @@ in_rtchange(inp, errno)
 	}
 }
 
+/*
+ * Put a pcb on the hash chains its current addresses and ports
+ * call for.  Must be called at splnet whenever code outside this
+ * file changes inp_laddr, inp_lport, inp_faddr or inp_fport.
+ */
+void
+in_pcbrehash(inp)
+	register struct inpcb *inp;
+{
+	register struct inpcbhash *ih = inp->inp_hashinfo;
+	register struct inpcbhead *hp;
+
+	if (ih == NULL)
+		return;
+	in_pcbunhash(inp);
+	if (inp->inp_lport == 0)
+		return;
+	hp = &ih->ih_port[INP_PORTHASH(inp->inp_lport, ih->ih_portmask)];
+	LIST_INSERT_HEAD(hp, inp, inp_portlist);
+	if (inp->inp_faddr.s_addr != INADDR_ANY)
+		hp = &ih->ih_conn[INP_CONNHASH(inp->inp_faddr.s_addr,
+		    inp->inp_fport, inp->inp_laddr.s_addr, inp->inp_lport,
+		    ih->ih_connmask)];
+	else
+		hp = &ih->ih_listen[INP_PORTHASH(inp->inp_lport,
+		    ih->ih_listenmask)];
+	LIST_INSERT_HEAD(hp, inp, inp_hash);
+}
+
+static void
+in_pcbunhash(inp)
+	register struct inpcb *inp;
+{
+
+	if (inp->inp_hash.le_prev) {
+		LIST_REMOVE(inp, inp_hash);
+		inp->inp_hash.le_prev = NULL;
+	}
+	if (inp->inp_portlist.le_prev) {
+		LIST_REMOVE(inp, inp_portlist);
+		inp->inp_portlist.le_prev = NULL;
+	}
+}
+
+/*
+ * Count the wildcards needed for inp to match the given addresses,
+ * or return -1 if it cannot match at all.
+ */
+static int
+in_pcbmatch(inp, faddr, fport_arg, laddr, lport_arg)
+	register struct inpcb *inp;
+	struct in_addr faddr, laddr;
+	u_int fport_arg, lport_arg;
+{
+	u_short fport = fport_arg, lport = lport_arg;
+	int wildcard = 0;
+
+	if (inp->inp_lport != lport)
+		return (-1);
+	if (inp->inp_laddr.s_addr != INADDR_ANY) {
+		if (laddr.s_addr == INADDR_ANY)
+			wildcard++;
+		else if (inp->inp_laddr.s_addr != laddr.s_addr)
+			return (-1);
+	} else {
+		if (laddr.s_addr != INADDR_ANY)
+			wildcard++;
+	}
+	if (inp->inp_faddr.s_addr != INADDR_ANY) {
+		if (faddr.s_addr == INADDR_ANY)
+			wildcard++;
+		else if (inp->inp_faddr.s_addr != faddr.s_addr ||
+		    inp->inp_fport != fport)
+			return (-1);
+	} else {
+		if (faddr.s_addr != INADDR_ANY)
+			wildcard++;
+	}
+	return (wildcard);
+}
+
+/*
+ * Find the pcb best matching the given addresses, preferring the
+ * one needing the fewest wildcards.  On a chain with hashes, a fully
+ * specified lookup (the input demux case) probes the connection hash
+ * and then the listen hash; anything else walks the pcb's bound to
+ * lport on the port hash.
+ */
 struct inpcb *
 in_pcblookup(head, faddr, fport_arg, laddr, lport_arg, flags)
 	struct inpcb *head;
@@ -458,33 +593,53 @@ in_pcblookup(head, faddr, fport_arg, laddr, lport_arg, flags)
 	int flags;
 {
 	register struct inpcb *inp, *match = 0;
+	register struct inpcbhash *ih = head->inp_hashinfo;
 	int matchwild = 3, wildcard;
 	u_short fport = fport_arg, lport = lport_arg;
 
-	for (inp = head->inp_next; inp != head; inp = inp->inp_next) {
-		if (inp->inp_lport != lport)
-			continue;
-		wildcard = 0;
-		if (inp->inp_laddr.s_addr != INADDR_ANY) {
-			if (laddr.s_addr == INADDR_ANY)
-				wildcard++;
-			else if (inp->inp_laddr.s_addr != laddr.s_addr)
+	if (ih == NULL) {
+		for (inp = head->inp_next; inp != head; inp = inp->inp_next) {
+			wildcard = in_pcbmatch(inp, faddr, fport, laddr, lport);
+			if (wildcard < 0 ||
+			    (wildcard && (flags & INPLOOKUP_WILDCARD) == 0))
 				continue;
-		} else {
-			if (laddr.s_addr != INADDR_ANY)
-				wildcard++;
+			if (wildcard < matchwild) {
+				match = inp;
+				matchwild = wildcard;
+				if (matchwild == 0)
+					break;
+			}
 		}
-		if (inp->inp_faddr.s_addr != INADDR_ANY) {
-			if (faddr.s_addr == INADDR_ANY)
-				wildcard++;
-			else if (inp->inp_faddr.s_addr != faddr.s_addr ||
-			    inp->inp_fport != fport)
+		return (match);
+	}
+	if (faddr.s_addr != INADDR_ANY && laddr.s_addr != INADDR_ANY) {
+		inp = ih->ih_conn[INP_CONNHASH(faddr.s_addr, fport,
+		    laddr.s_addr, lport, ih->ih_connmask)].lh_first;
+		for (; inp; inp = inp->inp_hash.le_next)
+			if (inp->inp_faddr.s_addr == faddr.s_addr &&
+			    inp->inp_fport == fport &&
+			    inp->inp_laddr.s_addr == laddr.s_addr &&
+			    inp->inp_lport == lport)
+				return (inp);
+		if ((flags & INPLOOKUP_WILDCARD) == 0)
+			return (0);
+		inp = ih->ih_listen[INP_PORTHASH(lport,
+		    ih->ih_listenmask)].lh_first;
+		for (; inp; inp = inp->inp_hash.le_next) {
+			if (inp->inp_lport != lport)
 				continue;
-		} else {
-			if (faddr.s_addr != INADDR_ANY)
-				wildcard++;
+			if (inp->inp_laddr.s_addr == laddr.s_addr)
+				return (inp);
+			if (inp->inp_laddr.s_addr == INADDR_ANY && match == 0)
+				match = inp;
 		}
-		if (wildcard && (flags & INPLOOKUP_WILDCARD) == 0)
+		return (match);
+	}
+	inp = ih->ih_port[INP_PORTHASH(lport, ih->ih_portmask)].lh_first;
+	for (; inp; inp = inp->inp_portlist.le_next) {
+		wildcard = in_pcbmatch(inp, faddr, fport, laddr, lport);
+		if (wildcard < 0 ||
+		    (wildcard && (flags & INPLOOKUP_WILDCARD) == 0))
 			continue;
 		if (wildcard < matchwild) {
 			match = inp;
@@ -33,6 +33,10 @@
  *	@(#)in_pcb.h	8.1 (Berkeley) 6/10/93
  */
 
+#include <sys/queue.h>
+
+LIST_HEAD(inpcbhead, inpcb);
+
 /*
  * Common structure pcb for internet protocol implementation.
  * Here are stored pointers to local and foreign host table
@@ -45,6 +49,9 @@ struct inpcb {
 					/* pointers to other pcb's */
 	struct	inpcb *inp_head;	/* pointer back to chain of inpcb's
 					   for this protocol */
+	struct	inpcbhash *inp_hashinfo; /* lookup hashes of the chain */
+	LIST_ENTRY(inpcb) inp_hash;	/* connection or listen hash chain */
+	LIST_ENTRY(inpcb) inp_portlist;	/* local port hash chain */
 	struct	in_addr inp_faddr;	/* foreign host table entry */
 	u_short	inp_fport;		/* foreign port */
 	struct	in_addr inp_laddr;	/* local host table entry */
@@ -61,6 +68,29 @@ struct inpcb {
 	struct	ip_moptions *inp_moptions; /* IP multicast options */
 };
 
+/*
+ * Lookup hashes for a protocol's chain of inpcb's, hung off the
+ * list head by in_pcbhashinit().  A connected pcb (foreign address
+ * set) lives on ih_conn, keyed by the whole 4-tuple; a bound but
+ * unconnected one lives on ih_listen, keyed by local port.  Every
+ * bound pcb is also on ih_port, which in_pcbbind() searches for
+ * conflicts.
+ */
+struct inpcbhash {
+	struct	inpcbhead *ih_conn;	/* (faddr, fport, laddr, lport) */
+	u_long	ih_connmask;
+	struct	inpcbhead *ih_listen;	/* lport, faddr == INADDR_ANY */
+	u_long	ih_listenmask;
+	struct	inpcbhead *ih_port;	/* lport */
+	u_long	ih_portmask;
+};
+
+#define	INP_CONNHASH(faddr, fport, laddr, lport, mask) \
+	(((faddr) ^ ((faddr) >> 16) ^ (laddr) ^ \
+	    ntohs((u_short)((fport) ^ (lport)))) & (mask))
+#define	INP_PORTHASH(lport, mask) \
+	(ntohs((u_short)(lport)) & (mask))
+
 /* flags in inp_flags: */
 #define	INP_RECVOPTS		0x01	/* receive incoming IP options */
 #define	INP_RECVRETOPTS		0x02	/* receive IP options for reply */
@@ -80,11 +110,15 @@ int	 in_pcbbind __P((struct inpcb *, struct mbuf *));
 int	 in_pcbconnect __P((struct inpcb *, struct mbuf *));
 void	 in_pcbdetach __P((struct inpcb *));
 void	 in_pcbdisconnect __P((struct inpcb *));
+void	 in_pcbhashinit __P((struct inpcb *, int));
+int	 in_pcbladdr __P((struct inpcb *,
+	    struct sockaddr_in *, struct sockaddr_in **));
 struct inpcb *
 	 in_pcblookup __P((struct inpcb *,
 	    struct in_addr, u_int, struct in_addr, u_int, int));
 void	 in_pcbnotify __P((struct inpcb *, struct sockaddr *,
 	    u_int, struct in_addr, u_int, int, void (*)(struct inpcb *, int)));
+void	 in_pcbrehash __P((struct inpcb *));
 void	 in_rtchange __P((struct inpcb *, int));
 void	 in_setpeeraddr __P((struct inpcb *, struct mbuf *));
 void	 in_setsockaddr __P((struct inpcb *, struct mbuf *));
@@ -46,6 +46,7 @@
 
 #include <net/if.h>
 #include <net/route.h>
+#include <net/netisr.h>
 
 #include <netinet/in.h>
 #include <netinet/in_systm.h>
@@ -54,6 +55,9 @@
 #include <netinet/in_var.h>
 #include <netinet/ip_var.h>
 #include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
 
 #ifndef	IPFORWARDING
 #ifdef GATEWAY
@@ -74,8 +78,12 @@ int	ipprintfs = 0;
 
 extern	struct domain inetdomain;
 extern	struct protosw inetsw[];
+extern	int tcp_do_gro;
 u_char	ip_protox[IPPROTO_MAX];
 int	ipqmaxlen = IFQ_MAXLEN;
+int	ipintr_budget = IPINTR_BUDGET;		/* datagrams per ipintr() */
+int	ip_reass_maxmem = 4 * 1024 * 1024;	/* fragment storage held at most */
+int	ip_maxfragsperpacket = 64;		/* fragments of one datagram */
 struct	in_ifaddr *in_ifaddr;			/* first inet address */
 struct	ifqueue ipintrq;
 
@@ -100,6 +108,25 @@ u_long	*ip_ifmatrix;
 #endif
 
 static void save_rte __P((u_char *, struct in_addr));
+
+/*
+ * Reassembly queues hash on (src, dst, id, proto).  Besides the ipq
+ * list, oldest first, for ip_slowtimo() to time them out from the
+ * front, they are kept least recently used first, to reclaim from
+ * when the fragments held take more than ip_reass_maxmem.
+ */
+#define	IPREASS_NHASH	1024
+#define	IPREASS_HASH(src, dst, id, p) \
+	(((src) ^ (dst) ^ ((id) << 16 | (p))) * 0x9e3779b1 >> 16 & ipq_hashmask)
+
+static	LIST_HEAD(ipqhead, ipq) *ipq_hashtbl;
+static	u_long ipq_hashmask;
+static	TAILQ_HEAD(, ipq) ipq_lru;
+static	u_long ip_reass_ticks;		/* ip_slowtimo() calls */
+
+static int ip_reass_mbsize __P((struct mbuf *));
+static void ip_reass_trim __P((struct ipq *));
+static void ipq_remove __P((struct ipq *));
 /*
  * IP initialization: fill in IP protocol switch table.
  * All protocols not implemented in kernel go to raw IP protocol handler.
@@ -121,6 +148,8 @@ ip_init()
 		    pr->pr_protocol && pr->pr_protocol != IPPROTO_RAW)
 			ip_protox[pr->pr_protocol] = pr - inetsw;
 	ipq.next = ipq.prev = &ipq;
+	ipq_hashtbl = hashinit(IPREASS_NHASH, M_FTABLE, &ipq_hashmask);
+	TAILQ_INIT(&ipq_lru);
 	ip_id = time.tv_sec & 0xffff;
 	ipintrq.ifq_maxlen = ipqmaxlen;
 #ifdef GATEWAY
@@ -136,31 +165,83 @@ struct	route ipforward_rt;
 void ip_intercept(struct mbuf *m);
 
 /*
- * Ip input routine.  Checksum and byte swap header.  If fragmented
- * try to reassemble.  Process options.  Pass to next level.
+ * The last destination an ipintr() call found to be one of our
+ * addresses.  The packets of a batch are mostly for one address, and
+ * the list can't change while it runs.
+ */
+static	struct in_addr ip_lastours;
+
+#ifdef __GNUC__
+#define	IP_PREFETCH(p)	__builtin_prefetch(p)
+#else
+#define	IP_PREFETCH(p)
+#endif
+
+static void ip_input __P((struct mbuf *));
+
+/*
+ * IP software interrupt.  Take datagrams off ipintrq IPINTR_BATCH at a
+ * time and pass each to ip_input(), with the header of the next on its
+ * way into the cache.  Past ipintr_budget datagrams, leave the rest
+ * for another call, with NETISR_IP set, so that a busy interface or a
+ * loopback exchange can't keep its caller from the timers.
  */
 void
 ipintr()
 {
-	register struct ip *ip;
+	struct mbuf *batch[IPINTR_BATCH];
+	register struct mbuf *m;
+	int budget = ipintr_budget, n, i, s;
+
+	netisr &= ~(1 << NETISR_IP);
+	ip_lastours.s_addr = INADDR_ANY;
+	for (;;) {
+		n = 0;
+		s = splimp();
+		while (n < IPINTR_BATCH && n < budget) {
+			IF_DEQUEUE(&ipintrq, m);
+			if (m == 0)
+				break;
+			batch[n++] = m;
+		}
+		splx(s);
+		if (n == 0) {
+			/*
+			 * End of the batch, or of the budget: pass up the
+			 * segments held for coalescing.  What they send
+			 * may come back to us.
+			 */
+			if (tcp_gro_flush() && budget > 0)
+				continue;
+			break;
+		}
+		budget -= n;
+		for (i = 0; i < n; i++) {
+			if (i + 1 < n)
+				IP_PREFETCH(mtod(batch[i + 1], caddr_t));
+			ip_input(batch[i]);
+		}
+	}
+	if (ipintrq.ifq_head)
+		schednetisr(NETISR_IP);
+}
+
+/*
+ * Ip input routine.  Checksum and byte swap header.  If fragmented
+ * try to reassemble.  Process options.  Pass to next level.
+ */
+static void
+ip_input(m)
 	register struct mbuf *m;
+{
+	register struct ip *ip;
 	register struct ipq *fp;
 	register struct in_ifaddr *ia;
-	int hlen, s;
+	int hlen;
 
-next:
-	/*
-	 * Get next datagram off input queue and get IP header
-	 * in first mbuf.
-	 */
-	s = splimp();
-	IF_DEQUEUE(&ipintrq, m);
-	splx(s);
-	if (m == 0)
-		return;
 #ifdef	DIAGNOSTIC
 	if ((m->m_flags & M_PKTHDR) == 0)
-		panic("ipintr no HDR");
+		panic("ip_input no HDR");
 #endif
 	ip_intercept(m);
 	/*
@@ -173,7 +254,7 @@ next:
 	if (m->m_len < sizeof (struct ip) &&
 	    (m = m_pullup(m, sizeof (struct ip))) == 0) {
 		ipstat.ips_toosmall++;
-		goto next;
+		return;
 	}
 	ip = mtod(m, struct ip *);
 	if (ip->ip_v != IPVERSION) {
@@ -188,11 +269,11 @@ next:
 	if (hlen > m->m_len) {
 		if ((m = m_pullup(m, hlen)) == 0) {
 			ipstat.ips_badhlen++;
-			goto next;
+			return;
 		}
 		ip = mtod(m, struct ip *);
 	}
-	if ( (ip->ip_sum = in_cksum(m, hlen)) != 0) {
+	if (in_cksum(m, hlen) != 0) {
 		ipstat.ips_badsum++;
 		goto bad;
 	}
@@ -234,16 +315,21 @@ next:
 	 */
 	ip_nhops = 0;		/* for source routed packets */
 	if (hlen > sizeof (struct ip) && ip_dooptions(m))
-		goto next;
+		return;
 
 	/*
 	 * Check our list of addresses, to see if the packet is for us.
 	 */
+	if (ip->ip_dst.s_addr == ip_lastours.s_addr &&
+	    ip_lastours.s_addr != INADDR_ANY)
+		goto ours;
 	for (ia = in_ifaddr; ia; ia = ia->ia_next) {
 #define	satosin(sa)	((struct sockaddr_in *)(sa))
 
-		if (IA_SIN(ia)->sin_addr.s_addr == ip->ip_dst.s_addr)
+		if (IA_SIN(ia)->sin_addr.s_addr == ip->ip_dst.s_addr) {
+			ip_lastours = ip->ip_dst;
 			goto ours;
+		}
 		if (
 #ifdef	DIRECTED_BROADCAST
 		    ia->ia_ifp == m->m_pkthdr.rcvif &&
@@ -289,7 +375,7 @@ next:
 			if (ip_mforward(m, m->m_pkthdr.rcvif) != 0) {
 				ipstat.ips_cantforward++;
 				m_freem(m);
-				goto next;
+				return;
 			}
 			ip->ip_id = ntohs(ip->ip_id);
 
@@ -311,7 +397,7 @@ next:
 		if (inm == NULL) {
 			ipstat.ips_cantforward++;
 			m_freem(m);
-			goto next;
+			return;
 		}
 		goto ours;
 	}
@@ -328,7 +414,7 @@ next:
 		m_freem(m);
 	} else
 		ip_forward(m, 0);
-	goto next;
+	return;
 
 ours:
 	/*
@@ -342,7 +428,7 @@ ours:
 		if (m->m_flags & M_EXT) {		/* XXX */
 			if ((m = m_pullup(m, sizeof (struct ip))) == 0) {
 				ipstat.ips_toosmall++;
-				goto next;
+				return;
 			}
 			ip = mtod(m, struct ip *);
 		}
@@ -350,7 +436,9 @@ ours:
 		 * Look for queue of fragments
 		 * of this datagram.
 		 */
-		for (fp = ipq.next; fp != &ipq; fp = fp->next)
+		for (fp = ipq_hashtbl[IPREASS_HASH(ip->ip_src.s_addr,
+		    ip->ip_dst.s_addr, ip->ip_id, ip->ip_p)].lh_first; fp;
+		    fp = fp->ipq_hash.le_next)
 			if (ip->ip_id == fp->ipq_id &&
 			    ip->ip_src.s_addr == fp->ipq_src.s_addr &&
 			    ip->ip_dst.s_addr == fp->ipq_dst.s_addr &&
@@ -379,7 +467,7 @@ found:
 			ipstat.ips_fragments++;
 			ip = ip_reass((struct ipasfrag *)ip, fp);
 			if (ip == 0)
-				goto next;
+				return;
 			ipstat.ips_reassembled++;
 			m = dtom(ip);
 		} else
@@ -392,11 +480,13 @@ found:
 	 * Switch out to protocol's input routine.
 	 */
 	ipstat.ips_delivered++;
-	(*inetsw[ip_protox[ip->ip_p]].pr_input)(m, hlen);
-	goto next;
+	if (ip->ip_p == IPPROTO_TCP && tcp_do_gro)
+		tcp_gro(m, hlen);
+	else
+		(*inetsw[ip_protox[ip->ip_p]].pr_input)(m, hlen);
+	return;
 bad:
 	m_freem(m);
-	goto next;
 }
 
 /*
@@ -404,6 +494,12 @@ bad:
  * reassemble it into whole datagram.  If a chain for
  * reassembly of this datagram already exists, then it
  * is given as fp; otherwise have to make a chain.
+ *
+ * Fragments are kept in order of offset, trimmed so that they
+ * don't overlap.  They usually come in order, or in reverse order,
+ * so the place for one is looked for from the end of the chain,
+ * after a look at its start.  The datagram is complete when the
+ * data held adds up to the length the last fragment gave.
  */
 struct ip *
 ip_reass(ip, fp)
@@ -430,23 +526,55 @@ ip_reass(ip, fp)
 		if ((t = m_get(M_DONTWAIT, MT_FTABLE)) == NULL)
 			goto dropfrag;
 		fp = mtod(t, struct ipq *);
-		insque(fp, &ipq);
-		fp->ipq_ttl = IPFRAGTTL;
+		insque(fp, ipq.prev);
 		fp->ipq_p = ip->ip_p;
 		fp->ipq_id = ip->ip_id;
 		fp->ipq_next = fp->ipq_prev = (struct ipasfrag *)fp;
 		fp->ipq_src = ((struct ip *)ip)->ip_src;
 		fp->ipq_dst = ((struct ip *)ip)->ip_dst;
-		q = (struct ipasfrag *)fp;
-		goto insert;
+		LIST_INSERT_HEAD(&ipq_hashtbl[IPREASS_HASH(fp->ipq_src.s_addr,
+		    fp->ipq_dst.s_addr, fp->ipq_id, fp->ipq_p)], fp, ipq_hash);
+		TAILQ_INSERT_TAIL(&ipq_lru, fp, ipq_lru);
+		fp->ipq_expire = ip_reass_ticks + IPFRAGTTL;
+		fp->ipq_nfrags = 0;
+		fp->ipq_nbytes = 0;
+		fp->ipq_total = -1;
+		fp->ipq_mbcnt = MSIZE;
+		ip_reass_mbcnt += MSIZE;
+		ipstat.ips_fragqueues++;
+	} else if (fp->ipq_lru.tqe_next) {
+		TAILQ_REMOVE(&ipq_lru, fp, ipq_lru);
+		TAILQ_INSERT_TAIL(&ipq_lru, fp, ipq_lru);
 	}
 
+	/*
+	 * The last fragment fixes the length; what doesn't fit
+	 * it is bad.
+	 */
+	next = ip->ip_off + ip->ip_len;
+	if ((ip->ipf_mff & 1) == 0) {
+		if (fp->ipq_total >= 0 && fp->ipq_total != next)
+			goto dropfrag;
+		q = fp->ipq_prev;
+		if (q != (struct ipasfrag *)fp && q->ip_off + q->ip_len > next)
+			goto dropfrag;
+		fp->ipq_total = next;
+	} else if (fp->ipq_total >= 0 && next > fp->ipq_total)
+		goto dropfrag;
+	if (fp->ipq_nfrags >= ip_maxfragsperpacket)
+		goto dropfrag;
+
 	/*
 	 * Find a segment which begins after this one does.
 	 */
-	for (q = fp->ipq_next; q != (struct ipasfrag *)fp; q = q->ipf_next)
-		if (q->ip_off > ip->ip_off)
-			break;
+	q = fp->ipq_prev;
+	if (q == (struct ipasfrag *)fp || q->ip_off <= ip->ip_off)
+		q = (struct ipasfrag *)fp;
+	else if (fp->ipq_next->ip_off > ip->ip_off)
+		q = fp->ipq_next;
+	else
+		while (q->ipf_prev->ip_off > ip->ip_off)
+			q = q->ipf_prev;
 
 	/*
 	 * If there is a preceding segment, it may provide some of
@@ -473,28 +601,36 @@ ip_reass(ip, fp)
 		if (i < q->ip_len) {
 			q->ip_len -= i;
 			q->ip_off += i;
+			fp->ipq_nbytes -= i;
 			m_adj(dtom(q), i);
 			break;
 		}
 		q = q->ipf_next;
+		fp->ipq_nbytes -= q->ipf_prev->ip_len;
+		fp->ipq_nfrags--;
+		i = ip_reass_mbsize(dtom(q->ipf_prev));
+		fp->ipq_mbcnt -= i;
+		ip_reass_mbcnt -= i;
 		m_freem(dtom(q->ipf_prev));
 		ip_deq(q->ipf_prev);
 	}
 
-insert:
 	/*
 	 * Stick new segment in its place;
 	 * check for complete reassembly.
 	 */
 	ip_enq(ip, q->ipf_prev);
-	next = 0;
-	for (q = fp->ipq_next; q != (struct ipasfrag *)fp; q = q->ipf_next) {
-		if (q->ip_off != next)
-			return (0);
-		next += q->ip_len;
-	}
-	if (q->ipf_prev->ipf_mff & 1)
+	fp->ipq_nbytes += ip->ip_len;
+	fp->ipq_nfrags++;
+	i = ip_reass_mbsize(m);
+	fp->ipq_mbcnt += i;
+	ip_reass_mbcnt += i;
+	if (fp->ipq_nbytes != fp->ipq_total) {
+		if (ip_reass_mbcnt > ip_reass_maxmem)
+			ip_reass_trim(fp);
 		return (0);
+	}
+	next = fp->ipq_total;
 
 	/*
 	 * Reassembly is complete; concatenate fragments.
@@ -522,8 +658,7 @@ insert:
 	ip->ipf_mff &= ~1;
 	((struct ip *)ip)->ip_src = fp->ipq_src;
 	((struct ip *)ip)->ip_dst = fp->ipq_dst;
-	remque(fp);
-	(void) m_free(dtom(fp));
+	ipq_remove(fp);
 	m = dtom(ip);
 	m->m_len += (ip->ip_hl << 2);
 	m->m_data -= (ip->ip_hl << 2);
@@ -539,9 +674,65 @@ insert:
 dropfrag:
 	ipstat.ips_fragdropped++;
 	m_freem(m);
+	if (fp && fp->ipq_nfrags == 0)
+		ipq_remove(fp);
 	return (0);
 }
 
+/*
+ * The mbuf storage of chain m.
+ */
+static int
+ip_reass_mbsize(m)
+	register struct mbuf *m;
+{
+	register int n = 0;
+
+	for (; m; m = m->m_next) {
+		n += MSIZE;
+		if (m->m_flags & M_EXT)
+			n += m->m_ext.ext_size;
+	}
+	return (n);
+}
+
+/*
+ * Free the least recently used queues but fp until the fragments
+ * held fit in ip_reass_maxmem; then fp, if they still don't.
+ */
+static void
+ip_reass_trim(fp)
+	struct ipq *fp;
+{
+	register struct ipq *q;
+
+	while (ip_reass_mbcnt > ip_reass_maxmem) {
+		if ((q = ipq_lru.tqh_first) == fp)
+			q = fp->ipq_lru.tqe_next;
+		if (q == NULL)
+			q = fp;
+		ipstat.ips_fragevicted += q->ipq_nfrags;
+		ip_freef(q);
+		if (q == fp)
+			break;
+	}
+}
+
+/*
+ * Take a reassembly header off the lists and free it.
+ */
+static void
+ipq_remove(fp)
+	register struct ipq *fp;
+{
+
+	remque(fp);
+	LIST_REMOVE(fp, ipq_hash);
+	TAILQ_REMOVE(&ipq_lru, fp, ipq_lru);
+	ip_reass_mbcnt -= fp->ipq_mbcnt;
+	(void) m_free(dtom(fp));
+}
+
 /*
  * Free a fragment reassembly header and all
  * associated datagrams.
@@ -557,8 +748,7 @@ ip_freef(fp)
 		ip_deq(q);
 		m_freem(dtom(q));
 	}
-	remque(fp);
-	(void) m_free(dtom(fp));
+	ipq_remove(fp);
 }
 
 /*
@@ -591,7 +781,8 @@ ip_deq(p)
 /*
  * IP timer processing;
  * if a timer expires on a reassembly
- * queue, discard it.
+ * queue, discard it.  The queues are oldest
+ * first, so only those due are looked at.
  */
 void
 ip_slowtimo()
@@ -599,18 +790,16 @@ ip_slowtimo()
 	register struct ipq *fp;
 	int s = splnet();
 
+	ip_reass_ticks++;
 	fp = ipq.next;
 	if (fp == 0) {
 		splx(s);
 		return;
 	}
-	while (fp != &ipq) {
-		--fp->ipq_ttl;
-		fp = fp->next;
-		if (fp->prev->ipq_ttl == 0) {
-			ipstat.ips_fragtimeout++;
-			ip_freef(fp->prev);
-		}
+	while ((fp = ipq.next) != &ipq &&
+	    (long)(ip_reass_ticks - fp->ipq_expire) >= 0) {
+		ipstat.ips_fragtimeout++;
+		ip_freef(fp);
 	}
 	splx(s);
 }
@@ -1003,6 +1192,7 @@ ip_forward(m, srcrt)
 	register struct rtentry *rt;
 	int error, type = 0, code;
 	struct mbuf *mcopy;
+	u_short ttlp;
 	n_long dest;
 	struct ifnet *destifp;
 
@@ -1022,7 +1212,13 @@ ip_forward(m, srcrt)
 		icmp_error(m, ICMP_TIMXCEED, ICMP_TIMXCEED_INTRANS, dest, 0);
 		return;
 	}
+	/*
+	 * Patch the header checksum for the new ttl rather than
+	 * have ip_output compute it again.
+	 */
+	ttlp = *(u_short *)&ip->ip_ttl;
 	ip->ip_ttl -= IPTTLDEC;
+	ip->ip_sum = in_cksum_update(ip->ip_sum, ttlp, *(u_short *)&ip->ip_ttl);
 
 	sin = (struct sockaddr_in *)&ipforward_rt.ro_dst;
 	if ((rt = ipforward_rt.ro_rt) == 0 ||
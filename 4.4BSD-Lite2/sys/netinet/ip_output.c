@@ -51,6 +51,9 @@
 #include <netinet/in_pcb.h>
 #include <netinet/in_var.h>
 #include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
 
 #ifdef vax
 #include <machine/mtpr.h>
@@ -278,14 +281,42 @@ ip_output(m0, opt, ro, flags, imo)
 		m->m_flags &= ~M_BCAST;
 
 sendit:
+	/*
+	 * A large send from tcp_output(): cut it into segments
+	 * the interface takes and send them in order.
+	 */
+	if (m->m_flags & M_TSO) {
+		m->m_flags &= ~M_TSO;
+		if ((m0 = tcp_segment(m, ifp->if_mtu)) == 0) {
+			error = ENOBUFS;
+			ipstat.ips_odropped++;
+			goto done;
+		}
+		for (m = m0; m; m = m0) {
+			m0 = m->m_nextpkt;
+			m->m_nextpkt = 0;
+			if (error == 0)
+				error = (*ifp->if_output)(ifp, m,
+				    (struct sockaddr *)dst, ro->ro_rt);
+			else
+				m_freem(m);
+		}
+		goto done;
+	}
 	/*
 	 * If small enough for interface, can just send directly.
 	 */
 	if ((u_short)ip->ip_len <= ifp->if_mtu) {
 		ip->ip_len = htons((u_short)ip->ip_len);
 		ip->ip_off = htons((u_short)ip->ip_off);
-		ip->ip_sum = 0;
-		ip->ip_sum = in_cksum(m, hlen);
+		/*
+		 * ip_forward keeps the checksum of a header without
+		 * options up to date; options may have been rewritten.
+		 */
+		if ((flags & IP_FORWARDING) == 0 || hlen > sizeof (struct ip)) {
+			ip->ip_sum = 0;
+			ip->ip_sum = in_cksum(m, hlen);
+		}
 		error = (*ifp->if_output)(ifp, m,
 				(struct sockaddr *)dst, ro->ro_rt);
 		goto done;
@@ -33,6 +33,8 @@
  *	@(#)ip_var.h	8.2 (Berkeley) 1/9/95
  */
 
+#include <sys/queue.h>
+
 /*
  * Overlay for ip header used by other protocols (tcp, udp).
  */
@@ -48,17 +50,25 @@ struct ipovly {
 /*
  * Ip reassembly queue structure.  Each fragment
  * being reassembled is attached to one of these structures.
- * They are timed out after ipq_ttl drops to 0, and may also
- * be reclaimed if memory becomes tight.
+ * They are found through a hash of (src, dst, id, proto),
+ * timed out IPFRAGTTL slow timeouts after the first fragment
+ * came, and the least recently used are reclaimed when the
+ * fragments held take more than ip_reass_maxmem.
  */
 struct ipq {
-	struct	ipq *next,*prev;	/* to other reass headers */
-	u_char	ipq_ttl;		/* time for reass q to live */
+	struct	ipq *next,*prev;	/* to other reass headers, oldest first */
+	u_char	ipq_nfrags;		/* fragments held */
 	u_char	ipq_p;			/* protocol of this fragment */
 	u_short	ipq_id;			/* sequence id for reassembly */
 	struct	ipasfrag *ipq_next,*ipq_prev;
 					/* to ip headers of fragments */
 	struct	in_addr ipq_src,ipq_dst;
+	LIST_ENTRY(ipq) ipq_hash;	/* hash chain */
+	TAILQ_ENTRY(ipq) ipq_lru;	/* least recently used first */
+	u_long	ipq_expire;		/* ip_slowtimo() tick it times out at */
+	int	ipq_nbytes;		/* data held, fragments don't overlap */
+	int	ipq_total;		/* datagram length, -1 until the last */
+	int	ipq_mbcnt;		/* mbuf storage held, header included */
 };
 
 /*
@@ -138,6 +148,8 @@ struct	ipstat {
 	u_long	ips_noroute;		/* packets discarded due to no route */
 	u_long	ips_badvers;		/* ip version != 4 */
 	u_long	ips_rawout;		/* total raw ip packets generated */
+	u_long	ips_fragevicted;	/* frags dropped for ip_reass_maxmem */
+	u_long	ips_fragqueues;		/* reassembly queues made */
 };
 
 #ifdef KERNEL
@@ -149,8 +161,14 @@ struct	ipstat {
 
 struct	ipstat	ipstat;
 struct	ipq	ipq;			/* ip reass. queue */
+int	ip_reass_mbcnt;			/* mbuf storage held by it */
+int	ip_reass_maxmem;		/* most it may hold */
 u_short	ip_id;				/* ip packet ctr, for ids */
 int	ip_defttl;			/* default IP ttl */
+int	ipintr_budget;			/* datagrams per ipintr() at most */
+
+#define	IPINTR_BATCH	32		/* taken off ipintrq at once */
+#define	IPINTR_BUDGET	256		/* default for ipintr_budget */
 
 int	 in_control __P((struct socket *, u_long, caddr_t, struct ifnet *));
 int	 ip_ctloutput __P((int, struct socket *, int, int, struct mbuf **));
@@ -108,3 +108,6 @@ struct tcphdr {
  */
 #define	TCP_NODELAY	0x01	/* don't delay send to coalesce packets */
 #define	TCP_MAXSEG	0x02	/* set maximum segment size */
+#define	TCP_CONGESTION	0x40	/* congestion control module, by name */
+
+#define	TCP_CA_NAME_MAX	16	/* longest TCP_CONGESTION name */
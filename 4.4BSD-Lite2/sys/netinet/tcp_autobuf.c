@@ -0,0 +1,177 @@
+/*
+ * Socket buffers sized by TCP.
+ *
+ * A connection's buffers used to stay at what soreserve() gave them,
+ * tcp_sendspace and tcp_recvspace, whatever the path: a long fat pipe
+ * was limited to a buffer per round trip, and an idle connection held
+ * as much as a busy one.  Buffers left at those defaults are marked
+ * SB_AUTOSIZE and sized here instead; SO_SNDBUF and SO_RCVBUF take
+ * the mark off again.
+ *
+ * The receive buffer is measured in rounds: a round ends when the
+ * right edge of the window offered at its start is received, which
+ * takes a round trip at least.  The shortest round is taken as the
+ * round trip time, and the data received over the round gives the
+ * delivery rate; the buffer grows to twice their product, so that
+ * the sender has room to speed up before the window limits it again.
+ * The window scale asked for in the SYN allows for tcp_autorcvbuf_max,
+ * the most it grows to.
+ *
+ * The send buffer grows to twice snd_cwnd, or twice the largest window
+ * the peer has offered if that's less, when an ack finds it nearly
+ * full: a window in flight, and one more for the application to have
+ * written ahead.  A send buffer the application doesn't keep full has
+ * no use for more.
+ *
+ * Buffers grow only within sb_budget, the space all sockbufs may
+ * reserve between them; sbstat counts it as mbstat counts mbufs.
+ * Once more than that is reserved, as by sockets sized by hand,
+ * tcp_slowtimo() calls tcp_sbreclaim() each tick, which takes every
+ * autosized buffer back to its default, in whole segments as tcp_mss()
+ * leaves it, or to what it holds if that's more.  A window already
+ * offered isn't taken back: tcp_output() never moves rcv_adv left, and
+ * tcp_input() takes what arrives within it even past sb_hiwat, so the
+ * peer may still send it.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
+
+int	tcp_do_autorcvbuf = 1;
+int	tcp_do_autosndbuf = 1;
+u_long	tcp_autorcvbuf_max = 2*1024*1024;
+u_long	tcp_autosndbuf_max = 2*1024*1024;
+
+extern	u_long tcp_sendspace, tcp_recvspace;
+
+static void tcp_sbgrow __P((struct sockbuf *, u_long, u_long));
+
+/*
+ * Grow sb toward size, as far as limit and sb_budget allow.
+ */
+static void
+tcp_sbgrow(sb, size, limit)
+	register struct sockbuf *sb;
+	u_long size, limit;
+{
+
+	if (size > limit)
+		size = limit;
+	if (size <= sb->sb_hiwat)
+		return;
+	if (!sbcangrow(sb, size)) {
+		sbstat.sb_denied++;
+		return;
+	}
+	if (sbreserve(sb, size))
+		sbstat.sb_grown++;
+}
+
+/*
+ * In-order data has moved rcv_nxt; if that ends a round, size the
+ * receive buffer to what the round took, and begin the next.
+ */
+void
+tcp_rcvbuf_autosize(tp)
+	register struct tcpcb *tp;
+{
+	struct sockbuf *sb = &tp->t_inpcb->inp_socket->so_rcv;
+	u_long now = TCP_CC_USEC(), dur, rtt, bytes, ratio, limit;
+
+	if (tp->rcv_rndstart) {
+		if (SEQ_LT(tp->rcv_nxt, tp->rcv_rndend))
+			return;
+		dur = now - tp->rcv_rndstart;
+		if (dur == 0)
+			dur = 1;
+		if (tp->rcv_rtt == 0 || dur < tp->rcv_rtt)
+			tp->rcv_rtt = dur;
+
+		/*
+		 * Twice the rate of the round times the round trip:
+		 * twice the bytes, scaled by rtt/dur in 1024ths.
+		 */
+		for (rtt = tp->rcv_rtt; rtt >= 1 << 20; rtt >>= 1)
+			dur >>= 1;
+		ratio = (rtt << 10) / dur;
+		bytes = tp->rcv_nxt - tp->rcv_rndseq;
+		limit = min(tcp_autorcvbuf_max,
+		    (u_long)TCP_MAXWIN << tp->rcv_scale);
+		tcp_sbgrow(sb, ((bytes >> 4) * ratio) >> 5, limit);
+	}
+	tp->rcv_rndstart = now;
+	tp->rcv_rndseq = tp->rcv_nxt;
+	if (SEQ_GT(tp->rcv_adv, tp->rcv_nxt))
+		tp->rcv_rndend = tp->rcv_adv;
+	else
+		tp->rcv_rndend = tp->rcv_nxt + 1;
+}
+
+/*
+ * An ack has come, and is about to take what it acks from the send
+ * buffer; if the application has kept it nearly full, let it hold
+ * two windows.
+ */
+void
+tcp_sndbuf_autosize(tp)
+	register struct tcpcb *tp;
+{
+	struct sockbuf *sb = &tp->t_inpcb->inp_socket->so_snd;
+
+	if (sb->sb_cc < sb->sb_hiwat - sb->sb_hiwat / 8)
+		return;
+	tcp_sbgrow(sb, 2 * min(tp->snd_cwnd, tp->max_sndwnd),
+	    tcp_autosndbuf_max);
+}
+
+/*
+ * Called from tcp_slowtimo() while more than sb_budget is reserved:
+ * take the autosized buffers back as far as they can go.
+ */
+void
+tcp_sbreclaim()
+{
+	register struct inpcb *inp;
+	register struct tcpcb *tp;
+	struct socket *so;
+	u_long size;
+
+	for (inp = tcb.inp_next; inp != &tcb; inp = inp->inp_next) {
+		if ((tp = intotcpcb(inp)) == NULL)
+			continue;
+		so = inp->inp_socket;
+		if (so->so_snd.sb_flags & SB_AUTOSIZE) {
+			size = max(so->so_snd.sb_cc,
+			    roundup(tcp_sendspace, tp->t_maxseg));
+			if (size < so->so_snd.sb_hiwat &&
+			    sbreserve(&so->so_snd, size))
+				sbstat.sb_shrunk++;
+		}
+		if (so->so_rcv.sb_flags & SB_AUTOSIZE) {
+			size = max(so->so_rcv.sb_cc,
+			    roundup(tcp_recvspace, tp->t_maxseg));
+			if (size < so->so_rcv.sb_hiwat &&
+			    sbreserve(&so->so_rcv, size))
+				sbstat.sb_shrunk++;
+		}
+	}
+}
@@ -0,0 +1,233 @@
+/*
+ * A congestion control modelled on BBR: the window follows an
+ * estimate of the path's bandwidth-delay product instead of backing
+ * off on loss.
+ *
+ * A round lasts until the first byte sent after it began is acked,
+ * one round trip, and gives a delivery rate sample (bytes acked over
+ * the round's duration) and a round trip time sample.  The bottleneck
+ * bandwidth is the highest rate of the last BBR_BWROUNDS rounds and
+ * the propagation delay the lowest round trip of the last
+ * BBR_MINRTTWIN microseconds; their product is the BDP.
+ *
+ * STARTUP doubles the window each round, as slow start does, until
+ * the bandwidth stops growing by a quarter for three rounds.  DRAIN
+ * then holds the window at one BDP until what is in flight fits in
+ * it, and PROBE_BW cycles the window through 5/4, 3/4 and six rounds
+ * of 1 BDP: the first probes for more bandwidth, the second empties
+ * the queue the probe built, so the round trip samples see the
+ * propagation delay again.
+ *
+ * This stack has no pacing, so the window alone limits what is in
+ * flight; a few segments are allowed above the BDP for acks that
+ * come back together.  Losses are repaired by the usual recovery
+ * but don't shrink the model, so random loss on a long fat pipe
+ * costs retransmissions, not throughput.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+#include <sys/errno.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
+
+#define	BBR_BWROUNDS	10		/* rounds in the bandwidth filter */
+#define	BBR_MINRTTWIN	10000000	/* us the min rtt is good for */
+#define	BBR_EXTRA	3		/* segments above the BDP */
+#define	BBR_CYCLE	8		/* rounds in a PROBE_BW cycle */
+
+#define	BBR_STARTUP	0
+#define	BBR_DRAIN	1
+#define	BBR_PROBE_BW	2
+
+/* window gains in PROBE_BW, in quarters of the BDP */
+static int bbr_gain[BBR_CYCLE] = { 5, 3, 4, 4, 4, 4, 4, 4 };
+
+struct bbr {
+	int	bb_mode;		/* BBR_STARTUP, ... */
+	int	bb_cycle;		/* index into bbr_gain[] */
+	u_long	bb_bw[BBR_BWROUNDS];	/* rate of the last rounds, bytes/s */
+	u_long	bb_btlbw;		/* highest of bb_bw[] */
+	u_long	bb_minrtt;		/* us, 0 before the first sample */
+	u_long	bb_minrttstamp;		/* when bb_minrtt was taken */
+	u_long	bb_round;		/* rounds so far */
+	tcp_seq	bb_roundend;		/* the round ends when past this is acked */
+	u_long	bb_roundstart;		/* TCP_CC_USEC() it began */
+	u_long	bb_delivered;		/* bytes acked in the round */
+	u_long	bb_fullbw;		/* btlbw when it last grew by 1/4 */
+	int	bb_fullbwcnt;		/* rounds since */
+};
+
+static int tcp_bbr_init __P((struct tcpcb *));
+static void tcp_bbr_destroy __P((struct tcpcb *));
+static void tcp_bbr_ack_received __P((struct tcpcb *, u_long));
+static void tcp_bbr_dupack __P((struct tcpcb *));
+static void tcp_bbr_rto __P((struct tcpcb *));
+static void bbr_round __P((struct tcpcb *, struct bbr *, tcp_seq));
+static u_long bbr_bdp __P((struct bbr *));
+
+struct tcp_cc tcp_bbr = {
+	"bbr",
+	tcp_bbr_init,
+	tcp_bbr_destroy,
+	tcp_bbr_ack_received,
+	tcp_bbr_dupack,
+	tcp_bbr_rto,
+	NULL,			/* the model still holds after idle */
+};
+
+static int
+tcp_bbr_init(tp)
+	struct tcpcb *tp;
+{
+	struct bbr *bb;
+
+	bb = malloc(sizeof(*bb), M_PCB, M_NOWAIT);
+	if (bb == NULL)
+		return (ENOBUFS);
+	bzero((caddr_t)bb, sizeof(*bb));
+	bb->bb_mode = BBR_STARTUP;
+	tp->t_ccstate = (caddr_t)bb;
+	return (0);
+}
+
+static void
+tcp_bbr_destroy(tp)
+	struct tcpcb *tp;
+{
+
+	free(tp->t_ccstate, M_PCB);
+}
+
+static u_long
+bbr_bdp(bb)
+	register struct bbr *bb;
+{
+
+	return ((u_quad_t)bb->bb_btlbw * bb->bb_minrtt / 1000000);
+}
+
+/*
+ * An ack past bb_roundend ends a round: take its samples and move
+ * the state machine on.  The next round ends with the ack of what
+ * this ack lets us send; what is outstanding now went out earlier
+ * and would make the round look shorter than a round trip.
+ */
+static void
+bbr_round(tp, bb, ack)
+	register struct tcpcb *tp;
+	register struct bbr *bb;
+	tcp_seq ack;
+{
+	u_long now = TCP_CC_USEC(), rtt = now - bb->bb_roundstart;
+	register int i;
+
+	if (bb->bb_round > 0 && rtt > 0) {
+		i = bb->bb_round % BBR_BWROUNDS;
+		bb->bb_bw[i] = (u_quad_t)bb->bb_delivered * 1000000 / rtt;
+		bb->bb_btlbw = 0;
+		for (i = 0; i < BBR_BWROUNDS; i++)
+			if (bb->bb_bw[i] > bb->bb_btlbw)
+				bb->bb_btlbw = bb->bb_bw[i];
+		if (bb->bb_minrtt == 0 || rtt <= bb->bb_minrtt ||
+		    now - bb->bb_minrttstamp > BBR_MINRTTWIN) {
+			bb->bb_minrtt = rtt;
+			bb->bb_minrttstamp = now;
+		}
+	}
+	bb->bb_round++;
+	bb->bb_roundend = tp->snd_max;
+	bb->bb_roundstart = now;
+	bb->bb_delivered = 0;
+
+	switch (bb->bb_mode) {
+
+	case BBR_STARTUP:
+		if (bb->bb_btlbw >= bb->bb_fullbw / 4 * 5) {
+			bb->bb_fullbw = bb->bb_btlbw;
+			bb->bb_fullbwcnt = 0;
+		} else if (++bb->bb_fullbwcnt >= 3)
+			bb->bb_mode = BBR_DRAIN;
+		break;
+
+	case BBR_DRAIN:
+		if (tp->snd_max - ack <= bbr_bdp(bb)) {
+			bb->bb_mode = BBR_PROBE_BW;
+			bb->bb_cycle = 2;
+		}
+		break;
+
+	case BBR_PROBE_BW:
+		bb->bb_cycle = (bb->bb_cycle + 1) % BBR_CYCLE;
+		break;
+	}
+}
+
+static void
+tcp_bbr_ack_received(tp, acked)
+	register struct tcpcb *tp;
+	u_long acked;
+{
+	register struct bbr *bb = (struct bbr *)tp->t_ccstate;
+	tcp_seq ack = tp->snd_una + acked;
+	u_long cw = tp->snd_cwnd, target;
+
+	bb->bb_delivered += acked;
+	if (bb->bb_round == 0 || SEQ_GT(ack, bb->bb_roundend))
+		bbr_round(tp, bb, ack);
+
+	if (bb->bb_mode == BBR_STARTUP)
+		cw += acked;
+	else {
+		target = bbr_bdp(bb);
+		if (bb->bb_mode == BBR_PROBE_BW)
+			target = target / 4 * bbr_gain[bb->bb_cycle];
+		target += BBR_EXTRA * tp->t_maxseg;
+		/* climb back after a timeout as slow start would */
+		cw = cw + acked < target ? cw + acked : target;
+	}
+	tp->snd_cwnd = min(cw, TCP_MAXWIN<<tp->snd_scale);
+}
+
+/*
+ * Loss is not taken as congestion: recovery starts with the window
+ * the model gives.
+ */
+static void
+tcp_bbr_dupack(tp)
+	register struct tcpcb *tp;
+{
+
+	tp->snd_ssthresh = max(tp->snd_cwnd, 2 * tp->t_maxseg);
+}
+
+/*
+ * After a timeout nothing is known to be in flight; start from one
+ * segment and let the acks open the window back up to the model.
+ */
+static void
+tcp_bbr_rto(tp)
+	register struct tcpcb *tp;
+{
+
+	tcp_bbr_dupack(tp);
+	tp->snd_cwnd = tp->t_maxseg;
+}
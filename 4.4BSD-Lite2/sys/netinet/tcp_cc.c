@@ -0,0 +1,183 @@
+/*
+ * The congestion control modules, and Reno, the default: slow start,
+ * then one segment more a round trip, and ssthresh at half the
+ * window on loss (RFC 5681).
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+#include <sys/errno.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
+
+static void tcp_reno_ack_received __P((struct tcpcb *, u_long));
+static void tcp_reno_dupack __P((struct tcpcb *));
+static void tcp_reno_rto __P((struct tcpcb *));
+static void tcp_reno_after_idle __P((struct tcpcb *));
+
+struct tcp_cc tcp_reno = {
+	"reno",
+	NULL,
+	NULL,
+	tcp_reno_ack_received,
+	tcp_reno_dupack,
+	tcp_reno_rto,
+	tcp_reno_after_idle,
+};
+
+struct tcp_cc *tcp_ccs[] = { &tcp_reno, &tcp_cubic, &tcp_bbr, NULL };
+struct tcp_cc *tcp_cc_default = &tcp_reno;
+
+/*
+ * Find a module by name; the name need not be NUL terminated
+ * within len.
+ */
+struct tcp_cc *
+tcp_cc_lookup(name, len)
+	char *name;
+	int len;
+{
+	register struct tcp_cc **ccp;
+	register char *cp;
+	register int i;
+
+	for (ccp = tcp_ccs; *ccp; ccp++) {
+		cp = (*ccp)->cc_name;
+		for (i = 0; i < len && name[i] && cp[i] == name[i]; i++)
+			;
+		if (cp[i] == 0 && (i == len || name[i] == 0))
+			return (*ccp);
+	}
+	return (NULL);
+}
+
+/*
+ * Put tp under module cc, detaching the one it had.  If cc can't
+ * set up, tp falls back to Reno.
+ */
+int
+tcp_cc_attach(tp, cc)
+	register struct tcpcb *tp;
+	struct tcp_cc *cc;
+{
+	int error;
+
+	tcp_cc_detach(tp);
+	tp->t_cc = cc;
+	if (cc->cc_init && (error = (*cc->cc_init)(tp))) {
+		tp->t_cc = &tcp_reno;
+		return (error);
+	}
+	return (0);
+}
+
+void
+tcp_cc_detach(tp)
+	register struct tcpcb *tp;
+{
+
+	if (tp->t_cc && tp->t_cc->cc_destroy)
+		(*tp->t_cc->cc_destroy)(tp);
+	tp->t_cc = NULL;
+	tp->t_ccstate = NULL;
+}
+
+/*
+ * When new data is acked, open the congestion window.
+ * If the window gives us less than ssthresh packets
+ * in flight, open exponentially (maxseg per packet).
+ * Otherwise open linearly: maxseg per window
+ * (maxseg * (maxseg / cwnd) per packet).
+ * Hold it during SACK recovery.
+ */
+static void
+tcp_reno_ack_received(tp, acked)
+	register struct tcpcb *tp;
+	u_long acked;
+{
+	register u_int cw = tp->snd_cwnd;
+	register u_int incr = tp->t_maxseg;
+
+	if (tp->t_flags & TF_SACKRECOVERY)
+		return;
+	if (cw > tp->snd_ssthresh)
+		incr = incr * incr / cw;
+	tp->snd_cwnd = min(cw + incr, TCP_MAXWIN<<tp->snd_scale);
+}
+
+/*
+ * For a threshhold, we use half the current window
+ * size, truncated to a multiple of the mss.
+ *
+ * (the minimum cwnd that will give us exponential
+ * growth is 2 mss.  We don't allow the threshhold
+ * to go below this.)
+ */
+static void
+tcp_reno_dupack(tp)
+	register struct tcpcb *tp;
+{
+	u_int win = min(tp->snd_wnd, tp->snd_cwnd) / 2 / tp->t_maxseg;
+
+	if (win < 2)
+		win = 2;
+	tp->snd_ssthresh = win * tp->t_maxseg;
+}
+
+/*
+ * Close the congestion window down to one segment
+ * (we'll open it by one segment for each ack we get).
+ * Since we probably have a window's worth of unacked
+ * data accumulated, this "slow start" keeps us from
+ * dumping all that data as back-to-back packets (which
+ * might overwhelm an intermediate gateway).
+ *
+ * There are two phases to the opening: Initially we
+ * open by one mss on each ack.  This makes the window
+ * size increase exponentially with time.  If the
+ * window is larger than the path can handle, this
+ * exponential growth results in dropped packet(s)
+ * almost immediately.  To get more time between
+ * drops but still "push" the network to take advantage
+ * of improving conditions, we switch from exponential
+ * to linear window opening at some threshhold size,
+ * the one tcp_reno_dupack() picks.
+ */
+static void
+tcp_reno_rto(tp)
+	register struct tcpcb *tp;
+{
+
+	tcp_reno_dupack(tp);
+	tp->snd_cwnd = tp->t_maxseg;
+}
+
+/*
+ * We have been idle for "a while" and no acks are
+ * expected to clock out any data we send --
+ * slow start to get ack "clock" running again.
+ */
+static void
+tcp_reno_after_idle(tp)
+	register struct tcpcb *tp;
+{
+
+	tp->snd_cwnd = tp->t_maxseg;
+}
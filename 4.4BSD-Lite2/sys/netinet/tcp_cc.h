@@ -0,0 +1,39 @@
+/*
+ * Congestion control modules.
+ *
+ * Each connection points at the module governing its snd_cwnd and
+ * snd_ssthresh.  Loss detection and recovery stay in tcp_input() and
+ * tcp_output(); they call the module when data is acked, when
+ * duplicate acks or SACKs start a recovery, when the retransmit timer
+ * fires and when sending resumes after an idle period.  cc_init,
+ * cc_destroy and cc_after_idle may be null.  The TCP_CONGESTION
+ * socket option selects a module by name.
+ */
+struct tcp_cc {
+	char	*cc_name;
+	int	(*cc_init)		/* attach, set up t_ccstate */
+		    __P((struct tcpcb *));
+	void	(*cc_destroy)		/* detach, free t_ccstate */
+		    __P((struct tcpcb *));
+	void	(*cc_ack_received)	/* acked bytes, before snd_una moves */
+		    __P((struct tcpcb *, u_long));
+	void	(*cc_dupack)		/* recovery starts: set ssthresh */
+		    __P((struct tcpcb *));
+	void	(*cc_rto)		/* retransmit timeout */
+		    __P((struct tcpcb *));
+	void	(*cc_after_idle)	/* sending after an idle period */
+		    __P((struct tcpcb *));
+};
+
+/* Microseconds on the system clock, for timing within a connection. */
+#define	TCP_CC_USEC()	((u_long)time.tv_sec * 1000000 + time.tv_usec)
+
+#ifdef KERNEL
+extern	struct tcp_cc tcp_reno, tcp_cubic, tcp_bbr;
+extern	struct tcp_cc *tcp_cc_default;
+
+int	 tcp_cc_attach __P((struct tcpcb *, struct tcp_cc *));
+void	 tcp_cc_detach __P((struct tcpcb *));
+struct tcp_cc *
+	 tcp_cc_lookup __P((char *, int));
+#endif
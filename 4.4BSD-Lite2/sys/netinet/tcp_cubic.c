@@ -0,0 +1,203 @@
+/*
+ * CUBIC congestion control, RFC 8312.
+ *
+ * Past ssthresh the window follows a cubic function of the time since
+ * the last reduction, W(t) = C (t - K)^3 + Wmax: it climbs quickly
+ * back towards the window where the loss happened, flattens out
+ * around it, then probes further up.  Growth depends on time, not on
+ * the ack rate, so long round trip times don't slow it down the way
+ * they do one segment a round trip.  Where Reno would do better, on
+ * short round trips, the window follows Reno's estimate instead.
+ *
+ * All arithmetic is integer: windows in bytes, time in milliseconds,
+ * C = 0.4 and beta = 0.7 scaled by 1024.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+#include <sys/errno.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
+
+#define	CUBIC_BETA	717		/* 0.7, window kept on loss */
+#define	CUBIC_ALPHA	541		/* 3 (1 - beta) / (1 + beta) */
+#define	CUBIC_MAXT	100000		/* ms, bounds (t - K)^3 */
+
+struct cubic {
+	u_long	cu_wmax;		/* window before the last reduction */
+	u_long	cu_origin;		/* the plateau of the curve */
+	u_long	cu_k;			/* ms from the epoch to the plateau */
+	u_long	cu_epoch;		/* TCP_CC_USEC() at the start of the
+					 * curve, 0 before it starts
+					 */
+	u_long	cu_west;		/* Reno's window over the same time */
+};
+
+static int tcp_cubic_init __P((struct tcpcb *));
+static void tcp_cubic_destroy __P((struct tcpcb *));
+static void tcp_cubic_ack_received __P((struct tcpcb *, u_long));
+static void tcp_cubic_dupack __P((struct tcpcb *));
+static void tcp_cubic_rto __P((struct tcpcb *));
+static void tcp_cubic_after_idle __P((struct tcpcb *));
+static u_long cubic_cbrt __P((u_quad_t));
+
+struct tcp_cc tcp_cubic = {
+	"cubic",
+	tcp_cubic_init,
+	tcp_cubic_destroy,
+	tcp_cubic_ack_received,
+	tcp_cubic_dupack,
+	tcp_cubic_rto,
+	tcp_cubic_after_idle,
+};
+
+static int
+tcp_cubic_init(tp)
+	struct tcpcb *tp;
+{
+	struct cubic *cu;
+
+	cu = malloc(sizeof(*cu), M_PCB, M_NOWAIT);
+	if (cu == NULL)
+		return (ENOBUFS);
+	bzero((caddr_t)cu, sizeof(*cu));
+	tp->t_ccstate = (caddr_t)cu;
+	return (0);
+}
+
+static void
+tcp_cubic_destroy(tp)
+	struct tcpcb *tp;
+{
+
+	free(tp->t_ccstate, M_PCB);
+}
+
+/*
+ * Integer cube root, rounded down.
+ */
+static u_long
+cubic_cbrt(v)
+	u_quad_t v;
+{
+	register u_long x = 0, b;
+
+	for (b = 1 << 20; b; b >>= 1)
+		if ((u_quad_t)(x + b) * (x + b) * (x + b) <= v)
+			x += b;
+	return (x);
+}
+
+static void
+tcp_cubic_ack_received(tp, acked)
+	register struct tcpcb *tp;
+	u_long acked;
+{
+	register struct cubic *cu = (struct cubic *)tp->t_ccstate;
+	u_long cw = tp->snd_cwnd, mss = tp->t_maxseg, target, now;
+	u_quad_t delta;
+	long t;
+
+	if (tp->t_flags & TF_SACKRECOVERY)
+		return;
+	if (cw <= tp->snd_ssthresh) {
+		/* slow start, as Reno */
+		tp->snd_cwnd = min(cw + mss, TCP_MAXWIN<<tp->snd_scale);
+		return;
+	}
+	now = TCP_CC_USEC();
+	if (cu->cu_epoch == 0) {
+		cu->cu_epoch = now ? now : 1;
+		if (cw < cu->cu_wmax) {
+			/* K = cbrt((Wmax - cwnd) / C), in segments */
+			cu->cu_k = cubic_cbrt((u_quad_t)(cu->cu_wmax - cw) *
+			    10000000000ULL / (4 * mss));
+			cu->cu_origin = cu->cu_wmax;
+		} else {
+			cu->cu_k = 0;
+			cu->cu_origin = cw;
+		}
+		cu->cu_west = cw;
+	}
+
+	/* W(t) = C (t - K)^3 + origin */
+	t = (now - cu->cu_epoch) / 1000 - cu->cu_k;
+	if (t > CUBIC_MAXT)
+		t = CUBIC_MAXT;
+	else if (t < -CUBIC_MAXT)
+		t = -CUBIC_MAXT;
+	delta = (u_quad_t)(t < 0 ? -t : t);
+	delta = delta * delta * delta * 4 / 10000 * mss / 1000000;
+	if (t >= 0)
+		target = cu->cu_origin + delta;
+	else
+		target = delta < cu->cu_origin ? cu->cu_origin - delta : 0;
+
+	/* the window Reno would have, growing a segment per round trip */
+	cu->cu_west += (u_quad_t)CUBIC_ALPHA * mss * acked / 1024 / cw;
+	if (target < cu->cu_west)
+		target = cu->cu_west;
+
+	if (target > cw) {
+		if (target > cw + cw / 2)
+			target = cw + cw / 2;
+		cw += (u_quad_t)(target - cw) * acked / cw;
+	}
+	tp->snd_cwnd = min(cw, TCP_MAXWIN<<tp->snd_scale);
+}
+
+/*
+ * A loss: remember the window for the curve to return to, lower if
+ * it was already below the previous one, so that flows leaving room
+ * converge faster, and keep beta of it.
+ */
+static void
+tcp_cubic_dupack(tp)
+	register struct tcpcb *tp;
+{
+	register struct cubic *cu = (struct cubic *)tp->t_ccstate;
+	u_long win = min(tp->snd_wnd, tp->snd_cwnd);
+
+	cu->cu_epoch = 0;
+	if (win < cu->cu_wmax)
+		cu->cu_wmax = win / 2048 * (1024 + CUBIC_BETA);
+	else
+		cu->cu_wmax = win;
+	tp->snd_ssthresh = max(win / 1024 * CUBIC_BETA, 2 * tp->t_maxseg);
+}
+
+static void
+tcp_cubic_rto(tp)
+	register struct tcpcb *tp;
+{
+
+	tcp_cubic_dupack(tp);
+	tp->snd_cwnd = tp->t_maxseg;
+}
+
+static void
+tcp_cubic_after_idle(tp)
+	register struct tcpcb *tp;
+{
+
+	((struct cubic *)tp->t_ccstate)->cu_epoch = 0;
+	tp->snd_cwnd = tp->t_maxseg;
+}
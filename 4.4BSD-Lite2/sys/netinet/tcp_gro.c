@@ -0,0 +1,266 @@
+/*
+ * Receive coalescing: the in-order data segments of a flow that
+ * arrive in one ipintr() batch are merged into one large segment, so
+ * that tcp_input() looks up the pcb, appends to the socket buffer and
+ * decides on an ack once for all of them.
+ *
+ * ipintr() hands TCP segments to tcp_gro() instead of tcp_input().  A
+ * segment with data, no flags but ACK and PSH, no IP options and no
+ * TCP option but the RFC 1323 appendix A timestamp is held in a small
+ * table of flows.  The next segment of the flow is appended to it if
+ * it starts where the held data ends, acks the same sequence and
+ * echoes the same timestamp.  The merged segment keeps the first
+ * header, whose timestamp is the one ts_recent must take, with the
+ * last window and PSH if any of them had it.
+ *
+ * A segment that can't be appended first pushes what its flow holds
+ * up to tcp_input(), so the flow's segments are seen in the order they
+ * came.  A PSH ends the merge, and tcp_gro_flush() pushes everything
+ * up when ipintrq runs dry, at the end of the batch.
+ *
+ * The merged segment has no checksum of its own, so each segment's
+ * is checked as it is taken; M_CSUMOK tells tcp_input() it was, and
+ * tcp_input() clears it before the mbuf can be reused for a reply.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcpip.h>
+
+#define	TCP_GRO_FLOWS	8		/* flows held at once */
+#define	TCP_GRO_MAXLEN	0x7fff		/* ti_len is a short */
+
+struct tcp_gro {
+	struct	mbuf *g_head;		/* first segment, 0 if the slot is free */
+	struct	mbuf *g_tail;		/* last mbuf of the chain */
+	tcp_seq	g_nxt;			/* where the next segment must start */
+	int	g_len;			/* data held */
+	int	g_off;			/* TCP header length */
+};
+
+static struct tcp_gro tcp_gro_tab[TCP_GRO_FLOWS];
+static int tcp_gro_held;		/* slots in use */
+static int tcp_gro_evict;		/* next to go when all are */
+
+static int tcp_gro_cksum __P((struct mbuf *, int));
+static void tcp_gro_deliver __P((struct tcp_gro *));
+static struct tcp_gro *tcp_gro_lookup __P((struct tcpiphdr *));
+
+/*
+ * The TCP checksum of the segment in m, tlen bytes past the IP
+ * header; 0 if it is good.  The pseudo-header is built over the IP
+ * header as tcp_input() does, and the header put back after.
+ */
+static int
+tcp_gro_cksum(m, tlen)
+	struct mbuf *m;
+	int tlen;
+{
+	register struct tcpiphdr *ti = mtod(m, struct tcpiphdr *);
+	struct ip save;
+	int sum;
+
+	save = *(struct ip *)ti;
+	ti->ti_next = ti->ti_prev = 0;
+	ti->ti_x1 = 0;
+	ti->ti_len = htons((u_short)tlen);
+	sum = in_cksum(m, sizeof (struct ip) + tlen);
+	*(struct ip *)ti = save;
+	return (sum);
+}
+
+static struct tcp_gro *
+tcp_gro_lookup(ti)
+	register struct tcpiphdr *ti;
+{
+	register struct tcp_gro *g;
+	register struct tcpiphdr *hti;
+
+	if (tcp_gro_held == 0)
+		return (NULL);
+	for (g = tcp_gro_tab; g < &tcp_gro_tab[TCP_GRO_FLOWS]; g++) {
+		if (g->g_head == NULL)
+			continue;
+		hti = mtod(g->g_head, struct tcpiphdr *);
+		if (hti->ti_src.s_addr == ti->ti_src.s_addr &&
+		    hti->ti_dst.s_addr == ti->ti_dst.s_addr &&
+		    hti->ti_sport == ti->ti_sport &&
+		    hti->ti_dport == ti->ti_dport)
+			return (g);
+	}
+	return (NULL);
+}
+
+/*
+ * Pass what g holds up to tcp_input() and free the slot.
+ */
+static void
+tcp_gro_deliver(g)
+	register struct tcp_gro *g;
+{
+	register struct mbuf *m = g->g_head;
+
+	mtod(m, struct ip *)->ip_len = g->g_off + g->g_len;
+	g->g_head = g->g_tail = NULL;
+	tcp_gro_held--;
+	tcp_input(m, sizeof (struct ip));
+}
+
+/*
+ * Take a TCP segment from ipintr(), with ip_len in host order and
+ * not counting the IP header, as tcp_input() wants it.
+ */
+void
+tcp_gro(m, iphlen)
+	register struct mbuf *m;
+	int iphlen;
+{
+	register struct tcpiphdr *ti, *hti;
+	register struct tcp_gro *g;
+	register struct mbuf *n;
+	u_char *optp = NULL;
+	int tlen, off, len;
+
+	if (iphlen > sizeof (struct ip)) {
+		/* the ports are past the options; keep it simple */
+		tcp_gro_flush();
+		tcp_input(m, iphlen);
+		return;
+	}
+	if (m->m_len < sizeof (struct tcpiphdr) &&
+	    (m = m_pullup(m, sizeof (struct tcpiphdr))) == 0) {
+		tcpstat.tcps_rcvtotal++;
+		tcpstat.tcps_rcvshort++;
+		return;
+	}
+	ti = mtod(m, struct tcpiphdr *);
+	tlen = ((struct ip *)ti)->ip_len;
+	off = ti->ti_off << 2;
+	g = tcp_gro_lookup(ti);
+
+	/*
+	 * Is it a segment we can merge?
+	 */
+	if (off < sizeof (struct tcphdr) || off >= tlen ||
+	    (ti->ti_flags & ~TH_PUSH) != TH_ACK)
+		goto pass;
+	if (off > sizeof (struct tcphdr)) {
+		if (off != sizeof (struct tcphdr) + TCPOLEN_TSTAMP_APPA)
+			goto pass;
+		if (m->m_len < sizeof (struct ip) + off) {
+			if ((m = m_pullup(m, sizeof (struct ip) + off)) == 0) {
+				tcpstat.tcps_rcvtotal++;
+				tcpstat.tcps_rcvshort++;
+				return;
+			}
+			ti = mtod(m, struct tcpiphdr *);
+		}
+		optp = mtod(m, u_char *) + sizeof (struct tcpiphdr);
+		if (*(u_long *)optp != htonl(TCPOPT_TSTAMP_HDR))
+			goto pass;
+	}
+	if (tcp_gro_cksum(m, tlen) != 0)
+		goto pass;		/* tcp_input() will count it */
+	len = tlen - off;
+
+	if (g) {
+		hti = mtod(g->g_head, struct tcpiphdr *);
+		if (ntohl(ti->ti_seq) != g->g_nxt ||
+		    ti->ti_ack != hti->ti_ack || off != g->g_off ||
+		    off + g->g_len + len > TCP_GRO_MAXLEN)
+			goto newflow;
+		if (optp) {
+			u_char *hoptp = (u_char *)(hti + 1);
+
+			if (*(u_long *)(optp + 8) != *(u_long *)(hoptp + 8) ||
+			    (int)(ntohl(*(u_long *)(optp + 4)) -
+			    ntohl(*(u_long *)(hoptp + 4))) < 0)
+				goto newflow;
+		}
+
+		/*
+		 * Append the data, and take the window and PSH.
+		 */
+		m->m_data += sizeof (struct ip) + off;
+		m->m_len -= sizeof (struct ip) + off;
+		g->g_tail->m_next = m;
+		for (n = m; n->m_next; n = n->m_next)
+			;
+		g->g_tail = n;
+		g->g_head->m_pkthdr.len += len;
+		g->g_len += len;
+		g->g_nxt += len;
+		hti->ti_win = ti->ti_win;
+		hti->ti_flags |= ti->ti_flags;
+		tcpstat.tcps_rcvcoalesced++;
+		if (ti->ti_flags & TH_PUSH)
+			tcp_gro_deliver(g);
+		return;
+	}
+
+newflow:
+	if (g)
+		tcp_gro_deliver(g);
+	m->m_flags |= M_CSUMOK;
+	if (ti->ti_flags & TH_PUSH) {
+		tcp_input(m, iphlen);
+		return;
+	}
+	if (tcp_gro_held == TCP_GRO_FLOWS) {
+		g = &tcp_gro_tab[tcp_gro_evict++ % TCP_GRO_FLOWS];
+		tcp_gro_deliver(g);
+	} else
+		for (g = tcp_gro_tab; g->g_head; g++)
+			;
+	for (n = m; n->m_next; n = n->m_next)
+		;
+	g->g_head = m;
+	g->g_tail = n;
+	g->g_nxt = ntohl(ti->ti_seq) + len;
+	g->g_len = len;
+	g->g_off = off;
+	tcp_gro_held++;
+	return;
+
+pass:
+	if (g)
+		tcp_gro_deliver(g);
+	tcp_input(m, iphlen);
+}
+
+/*
+ * End of a batch: pass up everything held.  Returns how many
+ * segments went up; their acks may have queued more input.
+ */
+int
+tcp_gro_flush()
+{
+	register struct tcp_gro *g;
+	int n = 0;
+
+	if (tcp_gro_held == 0)
+		return (0);
+	for (g = tcp_gro_tab; g < &tcp_gro_tab[TCP_GRO_FLOWS]; g++)
+		if (g->g_head) {
+			tcp_gro_deliver(g);
+			n++;
+		}
+	return (n);
+}
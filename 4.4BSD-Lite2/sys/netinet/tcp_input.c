@@ -58,12 +58,12 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/tcpip.h>
 #include <netinet/tcp_debug.h>
 
 int	tcprexmtthresh = 3;
 struct	tcpiphdr tcp_saveti;
-struct	inpcb *tcp_last_inpcb = &tcb;
 
 extern u_long sb_max;
 
@@ -83,13 +83,17 @@ extern u_long sb_max;
  * and the queue is empty), avoiding linkage into and removal
  * from the queue and repetition of various conversions.
  * Set DELACK for segments received in order, but ack immediately
- * when segments are out of order (so fast retransmit can work).
+ * when segments are out of order (so fast retransmit can work),
+ * or when tcp_gro() merged more than one segment.
  */
 #define	TCP_REASS(tp, ti, m, so, flags) { \
 	if ((ti)->ti_seq == (tp)->rcv_nxt && \
-	    (tp)->seg_next == (struct tcpiphdr *)(tp) && \
+	    (tp)->t_segqlen == 0 && \
 	    (tp)->t_state == TCPS_ESTABLISHED) { \
-		tp->t_flags |= TF_DELACK; \
+		if ((ti)->ti_len > (tp)->t_maxseg) \
+			(tp)->t_flags |= TF_ACKNOW; \
+		else \
+			TCP_SET_DELACK(tp); \
 		(tp)->rcv_nxt += (ti)->ti_len; \
 		flags = (ti)->ti_flags & TH_FIN; \
 		tcpstat.tcps_rcvpack++;\
@@ -103,110 +107,6 @@ extern u_long sb_max;
 }
 #ifndef TUBA_INCLUDE
 
-int
-tcp_reass(tp, ti, m)
-	register struct tcpcb *tp;
-	register struct tcpiphdr *ti;
-	struct mbuf *m;
-{
-	register struct tcpiphdr *q;
-	struct socket *so = tp->t_inpcb->inp_socket;
-	int flags;
-
-	/*
-	 * Call with ti==0 after become established to
-	 * force pre-ESTABLISHED data up to user socket.
-	 */
-	if (ti == 0)
-		goto present;
-
-	/*
-	 * Find a segment which begins after this one does.
-	 */
-	for (q = tp->seg_next; q != (struct tcpiphdr *)tp;
-	    q = (struct tcpiphdr *)q->ti_next)
-		if (SEQ_GT(q->ti_seq, ti->ti_seq))
-			break;
-
-	/*
-	 * If there is a preceding segment, it may provide some of
-	 * our data already.  If so, drop the data from the incoming
-	 * segment.  If it provides all of our data, drop us.
-	 */
-	if ((struct tcpiphdr *)q->ti_prev != (struct tcpiphdr *)tp) {
-		register int i;
-		q = (struct tcpiphdr *)q->ti_prev;
-		/* conversion to int (in i) handles seq wraparound */
-		i = q->ti_seq + q->ti_len - ti->ti_seq;
-		if (i > 0) {
-			if (i >= ti->ti_len) {
-				tcpstat.tcps_rcvduppack++;
-				tcpstat.tcps_rcvdupbyte += ti->ti_len;
-				m_freem(m);
-				return (0);
-			}
-			m_adj(m, i);
-			ti->ti_len -= i;
-			ti->ti_seq += i;
-		}
-		q = (struct tcpiphdr *)(q->ti_next);
-	}
-	tcpstat.tcps_rcvoopack++;
-	tcpstat.tcps_rcvoobyte += ti->ti_len;
-	REASS_MBUF(ti) = m;		/* XXX */
-
-	/*
-	 * While we overlap succeeding segments trim them or,
-	 * if they are completely covered, dequeue them.
-	 */
-	while (q != (struct tcpiphdr *)tp) {
-		register int i = (ti->ti_seq + ti->ti_len) - q->ti_seq;
-		if (i <= 0)
-			break;
-		if (i < q->ti_len) {
-			q->ti_seq += i;
-			q->ti_len -= i;
-			m_adj(REASS_MBUF(q), i);
-			break;
-		}
-		q = (struct tcpiphdr *)q->ti_next;
-		m = REASS_MBUF((struct tcpiphdr *)q->ti_prev);
-		remque(q->ti_prev);
-		m_freem(m);
-	}
-
-	/*
-	 * Stick new segment in its place.
-	 */
-	insque(ti, q->ti_prev);
-
-present:
-	/*
-	 * Present data to user, advancing rcv_nxt through
-	 * completed sequence space.
-	 */
-	if (TCPS_HAVERCVDSYN(tp->t_state) == 0)
-		return (0);
-	ti = tp->seg_next;
-	if (ti == (struct tcpiphdr *)tp || ti->ti_seq != tp->rcv_nxt)
-		return (0);
-	if (tp->t_state == TCPS_SYN_RECEIVED && ti->ti_len)
-		return (0);
-	do {
-		tp->rcv_nxt += ti->ti_len;
-		flags = ti->ti_flags & TH_FIN;
-		remque(ti);
-		m = REASS_MBUF(ti);
-		ti = (struct tcpiphdr *)ti->ti_next;
-		if (so->so_state & SS_CANTRCVMORE)
-			m_freem(m);
-		else
-			sbappend(&so->so_rcv, m);
-	} while (ti != (struct tcpiphdr *)tp && ti->ti_seq == tp->rcv_nxt);
-	sorwakeup(so);
-	return (flags);
-}
-
 /*
  * TCP input routine, follows pages 65-76 of the
  * protocol specification dated September, 1981 very closely.
@@ -226,9 +126,8 @@ tcp_input(m, iphlen)
 	struct socket *so;
 	int todrop, acked, ourfinisacked, needoutput = 0;
 	short ostate;
-	struct in_addr laddr;
-	int dropsocket = 0;
 	int iss = 0;
+	int error;
 	u_long tiwin, ts_val, ts_ecr;
 	int ts_present = 0;
 
@@ -257,7 +156,15 @@ tcp_input(m, iphlen)
 	ti->ti_x1 = 0;
 	ti->ti_len = (u_short)tlen;
 	HTONS(ti->ti_len);
-	if ( (ti->ti_sum = in_cksum(m, len)) != 0) {
+	if (m->m_flags & M_CSUMOK) {
+		/*
+		 * tcp_gro() checked it.  Take the mark off, since
+		 * tcp_respond() may send this mbuf back out, and over
+		 * loopback into tcp_input() again.
+		 */
+		m->m_flags &= ~M_CSUMOK;
+		ti->ti_sum = 0;
+	} else if ( (ti->ti_sum = in_cksum(m, len)) != 0) {
 		tcpstat.tcps_rcvbadsum++;
 		goto drop;
 	}
@@ -316,17 +223,17 @@ tcp_input(m, iphlen)
 	 * Locate pcb for segment.
 	 */
 findpcb:
-	inp = tcp_last_inpcb;
-	if (inp->inp_lport != ti->ti_dport ||
-	    inp->inp_fport != ti->ti_sport ||
-	    inp->inp_faddr.s_addr != ti->ti_src.s_addr ||
-	    inp->inp_laddr.s_addr != ti->ti_dst.s_addr) {
-		inp = in_pcblookup(&tcb, ti->ti_src, ti->ti_sport,
-		    ti->ti_dst, ti->ti_dport, INPLOOKUP_WILDCARD);
-		if (inp)
-			tcp_last_inpcb = inp;
-		++tcpstat.tcps_pcbcachemiss;
-	}
+	inp = in_pcblookup(&tcb, ti->ti_src, ti->ti_sport,
+	    ti->ti_dst, ti->ti_dport, INPLOOKUP_WILDCARD);
+
+	/*
+	 * A connection closed in TIME_WAIT has only a TIME_WAIT entry
+	 * left, which tcp_twcheck() answers for.  A SYN that ends one
+	 * goes on to the listener.
+	 */
+	if ((inp == 0 || inp->inp_faddr.s_addr == INADDR_ANY) &&
+	    tcp_twcheck(ti, optp, optlen, ts_present, ts_val, &iss))
+		goto drop;
 
 	/*
 	 * If the state is CLOSED (i.e., TCB does not exist) then
@@ -355,46 +262,36 @@ findpcb:
 			tcp_saveti = *ti;
 		}
 		if (so->so_options & SO_ACCEPTCONN) {
-			if ((tiflags & (TH_RST|TH_ACK|TH_SYN)) != TH_SYN) {
-				/*
-				 * Note: dropwithreset makes sure we don't
-				 * send a reset in response to a RST.
-				 */
-				if (tiflags & TH_ACK) {
-					tcpstat.tcps_badsyn++;
-					goto dropwithreset;
-				}
+			/*
+			 * A listening socket has its handshakes kept in
+			 * the SYN cache.  A SYN is answered from there;
+			 * an ACK that completes one brings the socket
+			 * for it, in SYN_RECEIVED, to go on with here.
+			 * Note: dropwithreset makes sure we don't
+			 * send a reset in response to a RST.
+			 */
+			if ((tiflags & (TH_RST|TH_ACK|TH_SYN)) == TH_SYN) {
+				tcp_syncache_add(so, m, optp, optlen, iss);
 				goto drop;
 			}
-			so = sonewconn(so, 0);
-			if (so == 0)
+			if (tiflags & TH_RST) {
+				tcp_syncache_reset(ti);
 				goto drop;
-			/*
-			 * This is ugly, but ....
-			 *
-			 * Mark socket as temporary until we're
-			 * committed to keeping it.  The code at
-			 * ``drop'' and ``dropwithreset'' check the
-			 * flag dropsocket to see if the temporary
-			 * socket created here should be discarded.
-			 * We mark the socket as discardable until
-			 * we're committed to it below in TCPS_LISTEN.
-			 */
-			dropsocket++;
-			inp = (struct inpcb *)so->so_pcb;
-			inp->inp_laddr = ti->ti_dst;
-			inp->inp_lport = ti->ti_dport;
-#if BSD>=43
-			inp->inp_options = ip_srcroute();
-#endif
+			}
+			if ((tiflags & TH_ACK) == 0)
+				goto drop;
+			if (tiflags & TH_SYN)
+				error = ENOENT;
+			else
+				error = tcp_syncache_get(&so, ti);
+			if (error == ENOENT) {
+				tcpstat.tcps_badsyn++;
+				goto dropwithreset;
+			}
+			if (error)
+				goto drop;
+			inp = sotoinpcb(so);
 			tp = intotcpcb(inp);
-			tp->t_state = TCPS_LISTEN;
-
-			/* Compute proper scaling value from buffer space
-			 */
-			while (tp->request_r_scale < TCP_MAX_WINSHIFT &&
-			   TCP_MAXWIN << tp->request_r_scale < so->so_rcv.sb_hiwat)
-				tp->request_r_scale++;
 		}
 	}
 
@@ -402,14 +299,14 @@ findpcb:
 	 * Segment received on connection.
 	 * Reset idle time and keep-alive timer.
 	 */
-	tp->t_idle = 0;
-	tp->t_timer[TCPT_KEEP] = tcp_keepidle;
+	tp->t_rcvtime = tcp_now;
+	TCP_TIMER_ARM(tp, TCPT_KEEP, tcp_keepidle);
 
 	/*
-	 * Process options if not in LISTEN state,
-	 * else do it below (after getting remote address).
+	 * Process options.
 	 */
-	if (optp && tp->t_state != TCPS_LISTEN)
+	tp->t_flags &= ~TF_SACKNEW;
+	if (optp)
 		tcp_dooptions(tp, optp, optlen, ti,
 			&ts_present, &ts_val, &ts_ecr);
 
@@ -432,7 +329,8 @@ findpcb:
 	    (!ts_present || TSTMP_GEQ(ts_val, tp->ts_recent)) &&
 	    ti->ti_seq == tp->rcv_nxt &&
 	    tiwin && tiwin == tp->snd_wnd &&
-	    tp->snd_nxt == tp->snd_max) {
+	    tp->snd_nxt == tp->snd_max &&
+	    (tp->t_flags & TF_SACKRECOVERY) == 0) {
 
 		/* 
 		 * If last ACK falls within this segment's sequence numbers,
@@ -456,12 +354,16 @@ findpcb:
 					tcp_xmit_timer(tp, tcp_now-ts_ecr+1);
 				else if (tp->t_rtt &&
 					    SEQ_GT(ti->ti_ack, tp->t_rtseq))
-					tcp_xmit_timer(tp, tp->t_rtt);
+					tcp_xmit_timer(tp, TCP_RTT(tp));
 				acked = ti->ti_ack - tp->snd_una;
 				tcpstat.tcps_rcvackpack++;
 				tcpstat.tcps_rcvackbyte += acked;
+				if (so->so_snd.sb_flags & SB_AUTOSIZE)
+					tcp_sndbuf_autosize(tp);
 				sbdrop(&so->so_snd, acked);
 				tp->snd_una = ti->ti_ack;
+				if (tp->snd_nsacked)
+					tcp_sack_prune(tp);
 				m_freem(m);
 
 				/*
@@ -474,9 +376,10 @@ findpcb:
 				 * decide between more output or persist.
 				 */
 				if (tp->snd_una == tp->snd_max)
-					tp->t_timer[TCPT_REXMT] = 0;
-				else if (tp->t_timer[TCPT_PERSIST] == 0)
-					tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+					TCP_TIMER_DISARM(tp, TCPT_REXMT);
+				else if (!TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
+					TCP_TIMER_ARM(tp, TCPT_REXMT,
+					    tp->t_rxtcur);
 
 				if (so->so_snd.sb_flags & SB_NOTIFY)
 					sowwakeup(so);
@@ -485,7 +388,7 @@ findpcb:
 				return;
 			}
 		} else if (ti->ti_ack == tp->snd_una &&
-		    tp->seg_next == (struct tcpiphdr *)tp &&
+		    tp->t_segqlen == 0 &&
 		    ti->ti_len <= sbspace(&so->so_rcv)) {
 			/*
 			 * this is a pure, in-sequence data packet
@@ -494,6 +397,8 @@ findpcb:
 			 */
 			++tcpstat.tcps_preddat;
 			tp->rcv_nxt += ti->ti_len;
+			if (so->so_rcv.sb_flags & SB_AUTOSIZE)
+				tcp_rcvbuf_autosize(tp);
 			tcpstat.tcps_rcvpack++;
 			tcpstat.tcps_rcvbyte += ti->ti_len;
 			/*
@@ -504,7 +409,15 @@ findpcb:
 			m->m_len -= sizeof(struct tcpiphdr)+off-sizeof(struct tcphdr);
 			sbappend(&so->so_rcv, m);
 			sorwakeup(so);
-			tp->t_flags |= TF_DELACK;
+			/*
+			 * Segments merged by tcp_gro() are acked at
+			 * once, as every second segment would be.
+			 */
+			if (ti->ti_len > tp->t_maxseg) {
+				tp->t_flags |= TF_ACKNOW;
+				(void) tcp_output(tp);
+			} else
+				TCP_SET_DELACK(tp);
 			return;
 		}
 	}
@@ -531,83 +444,6 @@ findpcb:
 
 	switch (tp->t_state) {
 
-	/*
-	 * If the state is LISTEN then ignore segment if it contains an RST.
-	 * If the segment contains an ACK then it is bad and send a RST.
-	 * If it does not contain a SYN then it is not interesting; drop it.
-	 * Don't bother responding if the destination was a broadcast.
-	 * Otherwise initialize tp->rcv_nxt, and tp->irs, select an initial
-	 * tp->iss, and send a segment:
-	 *     <SEQ=ISS><ACK=RCV_NXT><CTL=SYN,ACK>
-	 * Also initialize tp->snd_nxt to tp->iss+1 and tp->snd_una to tp->iss.
-	 * Fill in remote peer address fields if not previously specified.
-	 * Enter SYN_RECEIVED state, and process any other fields of this
-	 * segment in this state.
-	 */
-	case TCPS_LISTEN: {
-		struct mbuf *am;
-		register struct sockaddr_in *sin;
-
-#ifdef already_done
-		if (tiflags & TH_RST)
-			goto drop;
-		if (tiflags & TH_ACK)
-			goto dropwithreset;
-		if ((tiflags & TH_SYN) == 0)
-			goto drop;
-#endif
-		/*
-		 * RFC1122 4.2.3.10, p. 104: discard bcast/mcast SYN
-		 * in_broadcast() should never return true on a received
-		 * packet with M_BCAST not set.
-		 */
-		if (m->m_flags & (M_BCAST|M_MCAST) ||
-		    IN_MULTICAST(ntohl(ti->ti_dst.s_addr)))
-			goto drop;
-		am = m_get(M_DONTWAIT, MT_SONAME);	/* XXX */
-		if (am == NULL)
-			goto drop;
-		am->m_len = sizeof (struct sockaddr_in);
-		sin = mtod(am, struct sockaddr_in *);
-		sin->sin_family = AF_INET;
-		sin->sin_len = sizeof(*sin);
-		sin->sin_addr = ti->ti_src;
-		sin->sin_port = ti->ti_sport;
-		bzero((caddr_t)sin->sin_zero, sizeof(sin->sin_zero));
-		laddr = inp->inp_laddr;
-		if (inp->inp_laddr.s_addr == INADDR_ANY)
-			inp->inp_laddr = ti->ti_dst;
-		if (in_pcbconnect(inp, am)) {
-			inp->inp_laddr = laddr;
-			(void) m_free(am);
-			goto drop;
-		}
-		(void) m_free(am);
-		tp->t_template = tcp_template(tp);
-		if (tp->t_template == 0) {
-			tp = tcp_drop(tp, ENOBUFS);
-			dropsocket = 0;		/* socket is already gone */
-			goto drop;
-		}
-		if (optp)
-			tcp_dooptions(tp, optp, optlen, ti,
-				&ts_present, &ts_val, &ts_ecr);
-		if (iss)
-			tp->iss = iss;
-		else
-			tp->iss = tcp_iss;
-		tcp_iss += TCP_ISSINCR/4;
-		tp->irs = ti->ti_seq;
-		tcp_sendseqinit(tp);
-		tcp_rcvseqinit(tp);
-		tp->t_flags |= TF_ACKNOW;
-		tp->t_state = TCPS_SYN_RECEIVED;
-		tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT;
-		dropsocket = 0;		/* committed to socket */
-		tcpstat.tcps_accepts++;
-		goto trimthenstep6;
-		}
-
 	/*
 	 * If the state is SYN_SENT:
 	 *	if seg contains an ACK, but not for our SYN, drop the input.
@@ -637,7 +473,7 @@ findpcb:
 			if (SEQ_LT(tp->snd_nxt, tp->snd_una))
 				tp->snd_nxt = tp->snd_una;
 		}
-		tp->t_timer[TCPT_REXMT] = 0;
+		TCP_TIMER_DISARM(tp, TCPT_REXMT);
 		tp->irs = ti->ti_seq;
 		tcp_rcvseqinit(tp);
 		tp->t_flags |= TF_ACKNOW;
@@ -658,11 +494,10 @@ findpcb:
 			 * use its rtt as our initial srtt & rtt var.
 			 */
 			if (tp->t_rtt)
-				tcp_xmit_timer(tp, tp->t_rtt);
+				tcp_xmit_timer(tp, TCP_RTT(tp));
 		} else
 			tp->t_state = TCPS_SYN_RECEIVED;
 
-trimthenstep6:
 		/*
 		 * Advance ti->ti_seq to correspond to first data byte.
 		 * If data, trim to stay within window,
@@ -929,7 +764,9 @@ trimthenstep6:
 	case TCPS_TIME_WAIT:
 
 		if (SEQ_LEQ(ti->ti_ack, tp->snd_una)) {
-			if (ti->ti_len == 0 && tiwin == tp->snd_wnd) {
+			if (ti->ti_len == 0 &&
+			    (tiwin == tp->snd_wnd ||
+			    (tp->t_flags & TF_SACKNEW))) {
 				tcpstat.tcps_rcvdupack++;
 				/*
 				 * If we have outstanding data (other than
@@ -955,20 +792,45 @@ trimthenstep6:
 				 * to keep a constant cwnd packets in the
 				 * network.
 				 */
-				if (tp->t_timer[TCPT_REXMT] == 0 ||
+				/*
+				 * With SACK, the scoreboard drives
+				 * recovery instead (RFC 6675).  It starts
+				 * as well once enough above the first hole
+				 * has been SACKed.  An ack that changes
+				 * the window still counts if it SACKs new
+				 * data (RFC 6675 section 2), as a draining
+				 * receiver's do; a bare window update
+				 * doesn't.  cwnd drops to
+				 * ssthresh once, and tcp_output() sends
+				 * while the data in flight is below it,
+				 * filling holes before new data.
+				 */
+				if (!TCP_TIMER_ISARMED(tp, TCPT_REXMT) ||
 				    ti->ti_ack != tp->snd_una)
 					tp->t_dupacks = 0;
-				else if (++tp->t_dupacks == tcprexmtthresh) {
+				else if (tp->t_flags & TF_SACKRECOVERY) {
+					needoutput = 1;
+					break;
+				} else if (++tp->t_dupacks == tcprexmtthresh ||
+				    (TCP_SACK_ENABLED(tp) &&
+				    tp->snd_nxt == tp->snd_max &&
+				    tcp_sack_firstlost(tp))) {
 					tcp_seq onxt = tp->snd_nxt;
-					u_int win =
-					    min(tp->snd_wnd, tp->snd_cwnd) / 2 /
-						tp->t_maxseg;
-
-					if (win < 2)
-						win = 2;
-					tp->snd_ssthresh = win * tp->t_maxseg;
-					tp->t_timer[TCPT_REXMT] = 0;
+
+					(*tp->t_cc->cc_dupack)(tp);
 					tp->t_rtt = 0;
+					if (TCP_SACK_ENABLED(tp) &&
+					    tp->snd_nxt == tp->snd_max) {
+						/* the timer keeps running */
+						tcpstat.tcps_sackrecovery++;
+						tp->t_flags |= TF_SACKRECOVERY;
+						tp->snd_recover = tp->snd_max;
+						tp->snd_rxmit = tp->snd_una;
+						tp->snd_cwnd = tp->snd_ssthresh;
+						needoutput = 1;
+						break;
+					}
+					TCP_TIMER_DISARM(tp, TCPT_REXMT);
 					tp->snd_nxt = ti->ti_ack;
 					tp->snd_cwnd = tp->t_maxseg;
 					(void) tcp_output(tp);
@@ -987,10 +849,21 @@ trimthenstep6:
 			break;
 		}
 		/*
+		 * An ack for everything outstanding when SACK recovery
+		 * began ends it; a partial ack keeps it going, with
+		 * the holes below the ack filled.
 		 * If the congestion window was inflated to account
 		 * for the other side's cached packets, retract it.
 		 */
-		if (tp->t_dupacks > tcprexmtthresh &&
+		if (tp->t_flags & TF_SACKRECOVERY) {
+			if (SEQ_GEQ(ti->ti_ack, tp->snd_recover))
+				tp->t_flags &= ~TF_SACKRECOVERY;
+			else {
+				if (SEQ_LT(tp->snd_rxmit, ti->ti_ack))
+					tp->snd_rxmit = ti->ti_ack;
+				needoutput = 1;
+			}
+		} else if (tp->t_dupacks > tcprexmtthresh &&
 		    tp->snd_cwnd > tp->snd_ssthresh)
 			tp->snd_cwnd = tp->snd_ssthresh;
 		tp->t_dupacks = 0;
@@ -1014,7 +887,7 @@ trimthenstep6:
 		if (ts_present)
 			tcp_xmit_timer(tp, tcp_now-ts_ecr+1);
 		else if (tp->t_rtt && SEQ_GT(ti->ti_ack, tp->t_rtseq))
-			tcp_xmit_timer(tp,tp->t_rtt);
+			tcp_xmit_timer(tp, TCP_RTT(tp));
 
 		/*
 		 * If all outstanding data is acked, stop retransmit
@@ -1023,25 +896,17 @@ trimthenstep6:
 		 * timer, using current (possibly backed-off) value.
 		 */
 		if (ti->ti_ack == tp->snd_max) {
-			tp->t_timer[TCPT_REXMT] = 0;
+			TCP_TIMER_DISARM(tp, TCPT_REXMT);
 			needoutput = 1;
-		} else if (tp->t_timer[TCPT_PERSIST] == 0)
-			tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+		} else if (!TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
+			TCP_TIMER_ARM(tp, TCPT_REXMT, tp->t_rxtcur);
 		/*
-		 * When new data is acked, open the congestion window.
-		 * If the window gives us less than ssthresh packets
-		 * in flight, open exponentially (maxseg per packet).
-		 * Otherwise open linearly: maxseg per window
-		 * (maxseg * (maxseg / cwnd) per packet).
+		 * When new data is acked, let the congestion
+		 * control open the congestion window.
 		 */
-		{
-		register u_int cw = tp->snd_cwnd;
-		register u_int incr = tp->t_maxseg;
-
-		if (cw > tp->snd_ssthresh)
-			incr = incr * incr / cw;
-		tp->snd_cwnd = min(cw + incr, TCP_MAXWIN<<tp->snd_scale);
-		}
+		(*tp->t_cc->cc_ack_received)(tp, (u_long)acked);
+		if (so->so_snd.sb_flags & SB_AUTOSIZE)
+			tcp_sndbuf_autosize(tp);
 		if (acked > so->so_snd.sb_cc) {
 			tp->snd_wnd -= so->so_snd.sb_cc;
 			sbdrop(&so->so_snd, (int)so->so_snd.sb_cc);
@@ -1056,6 +921,8 @@ trimthenstep6:
 		tp->snd_una = ti->ti_ack;
 		if (SEQ_LT(tp->snd_nxt, tp->snd_una))
 			tp->snd_nxt = tp->snd_una;
+		if (tp->snd_nsacked)
+			tcp_sack_prune(tp);
 
 		switch (tp->t_state) {
 
@@ -1075,7 +942,7 @@ trimthenstep6:
 				 */
 				if (so->so_state & SS_CANTRCVMORE) {
 					soisdisconnected(so);
-					tp->t_timer[TCPT_2MSL] = tcp_maxidle;
+					TCP_TIMER_ARM(tp, TCPT_2MSL, tcp_maxidle);
 				}
 				tp->t_state = TCPS_FIN_WAIT_2;
 			}
@@ -1091,7 +958,7 @@ trimthenstep6:
 			if (ourfinisacked) {
 				tp->t_state = TCPS_TIME_WAIT;
 				tcp_canceltimers(tp);
-				tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+				TCP_TIMER_ARM(tp, TCPT_2MSL, 2 * TCPTV_MSL);
 				soisdisconnected(so);
 			}
 			break;
@@ -1115,7 +982,7 @@ trimthenstep6:
 		 * it and restart the finack timer.
 		 */
 		case TCPS_TIME_WAIT:
-			tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+			TCP_TIMER_ARM(tp, TCPT_2MSL, 2 * TCPTV_MSL);
 			goto dropafterack;
 		}
 	}
@@ -1213,6 +1080,8 @@ dodata:							/* XXX */
 	if ((ti->ti_len || (tiflags&TH_FIN)) &&
 	    TCPS_HAVERCVDFIN(tp->t_state) == 0) {
 		TCP_REASS(tp, ti, m, so, tiflags);
+		if (so->so_rcv.sb_flags & SB_AUTOSIZE)
+			tcp_rcvbuf_autosize(tp);
 		/*
 		 * Note the amount of data that peer has sent into
 		 * our window, in order to estimate the sender's
@@ -1261,7 +1130,7 @@ dodata:							/* XXX */
 		case TCPS_FIN_WAIT_2:
 			tp->t_state = TCPS_TIME_WAIT;
 			tcp_canceltimers(tp);
-			tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+			TCP_TIMER_ARM(tp, TCPT_2MSL, 2 * TCPTV_MSL);
 			soisdisconnected(so);
 			break;
 
@@ -1269,7 +1138,7 @@ dodata:							/* XXX */
 		 * In TIME_WAIT state restart the 2 MSL time_wait timer.
 		 */
 		case TCPS_TIME_WAIT:
-			tp->t_timer[TCPT_2MSL] = 2 * TCPTV_MSL;
+			TCP_TIMER_ARM(tp, TCPT_2MSL, 2 * TCPTV_MSL);
 			break;
 		}
 	}
@@ -1281,6 +1150,13 @@ dodata:							/* XXX */
 	 */
 	if (needoutput || (tp->t_flags & TF_ACKNOW))
 		(void) tcp_output(tp);
+
+	/*
+	 * Once its socket is closed, a connection in TIME_WAIT needs
+	 * no more than a TIME_WAIT entry.
+	 */
+	if (tp->t_state == TCPS_TIME_WAIT && (so->so_state & SS_NOFDREF))
+		(void) tcp_twstart(tp);
 	return;
 
 dropafterack:
@@ -1312,9 +1188,6 @@ dropwithreset:
 		tcp_respond(tp, ti, m, ti->ti_seq+ti->ti_len, (tcp_seq)0,
 		    TH_RST|TH_ACK);
 	}
-	/* destroy temporarily created socket */
-	if (dropsocket)
-		(void) soabort(so);
 	return;
 
 drop:
@@ -1324,9 +1197,6 @@ drop:
 	if (tp && (tp->t_inpcb->inp_socket->so_options & SO_DEBUG))
 		tcp_trace(TA_DROP, ostate, tp, &tcp_saveti, 0);
 	m_freem(m);
-	/* destroy temporarily created socket */
-	if (dropsocket)
-		(void) soabort(so);
 	return;
 #ifndef TUBA_INCLUDE
 }
@@ -1378,6 +1248,22 @@ tcp_dooptions(tp, cp, cnt, ti, ts_present, ts_val, ts_ecr)
 			tp->requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
 			break;
 
+		case TCPOPT_SACK_PERMITTED:
+			if (optlen != TCPOLEN_SACK_PERMITTED)
+				continue;
+			if (!(ti->ti_flags & TH_SYN))
+				continue;
+			tp->t_flags |= TF_SACK_PERMIT;
+			break;
+
+		case TCPOPT_SACK:
+			if (!TCP_SACK_ENABLED(tp) ||
+			    (ti->ti_flags & (TH_SYN|TH_ACK)) != TH_ACK)
+				continue;
+			if (tcp_sack_update(tp, cp, optlen, ti->ti_ack))
+				tp->t_flags |= TF_SACKNEW;
+			break;
+
 		case TCPOPT_TIMESTAMP:
 			if (optlen != TCPOLEN_TIMESTAMP)
 				continue;
@@ -55,15 +55,17 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/tcpip.h>
 #include <netinet/tcp_debug.h>
 
 #ifdef notyet
 extern struct mbuf *m_copypack();
 #endif
+extern int tcp_do_tso;
 
 
-#define MAX_TCPOPTLEN	32	/* max # bytes that go in options */
+#define MAX_TCPOPTLEN	40	/* max # bytes that go in options */
 
 /*
  * Tcp output routine: figure out what should be sent and send it.
@@ -79,7 +81,9 @@ tcp_output(tp)
 	register struct tcpiphdr *ti;
 	u_char opt[MAX_TCPOPTLEN];
 	unsigned optlen, hdrlen;
-	int idle, sendalot;
+	int idle, sendalot, sack_rxmit, tso;
+	tcp_seq sack_seq;
+	long sack_len;
 
 	/*
 	 * Determine length of data that should be transmitted,
@@ -88,18 +92,37 @@ tcp_output(tp)
 	 * to send, then transmit; otherwise, investigate further.
 	 */
 	idle = (tp->snd_max == tp->snd_una);
-	if (idle && tp->t_idle >= tp->t_rxtcur)
+	if (idle && TCP_IDLE(tp) >= tp->t_rxtcur && tp->t_cc->cc_after_idle)
 		/*
 		 * We have been idle for "a while" and no acks are
-		 * expected to clock out any data we send --
-		 * slow start to get ack "clock" running again.
+		 * expected to clock out any data we send.
 		 */
-		tp->snd_cwnd = tp->t_maxseg;
+		(*tp->t_cc->cc_after_idle)(tp);
 again:
 	sendalot = 0;
+	sack_rxmit = 0;
+	tso = 0;
 	off = tp->snd_nxt - tp->snd_una;
 	win = min(tp->snd_wnd, tp->snd_cwnd);
 
+	/*
+	 * In SACK recovery snd_nxt stays at snd_max, and we may send
+	 * while the data in flight is a segment below cwnd: first
+	 * the lowest lost hole, else new data.
+	 */
+	if (tp->t_flags & TF_SACKRECOVERY) {
+		long avail = tp->snd_cwnd -
+		    tcp_sack_pipe(tp, &sack_seq, &sack_len);
+
+		if (avail < tp->t_maxseg)
+			avail = 0;
+		if (avail && sack_len) {
+			sack_rxmit = 1;
+			off = sack_seq - tp->snd_una;
+		} else
+			win = min(tp->snd_wnd, off + avail);
+	}
+
 	flags = tcp_outflags[tp->t_state];
 	/*
 	 * If in persist timeout with window of 0, send 1 byte.
@@ -129,12 +152,15 @@ again:
 				flags &= ~TH_FIN;
 			win = 1;
 		} else {
-			tp->t_timer[TCPT_PERSIST] = 0;
+			TCP_TIMER_DISARM(tp, TCPT_PERSIST);
 			tp->t_rxtshift = 0;
 		}
 	}
 
-	len = min(so->so_snd.sb_cc, win) - off;
+	if (sack_rxmit)
+		len = min(sack_len, so->so_snd.sb_cc - off);
+	else
+		len = min(so->so_snd.sb_cc, win) - off;
 
 	if (len < 0) {
 		/*
@@ -149,15 +175,31 @@ again:
 		 */
 		len = 0;
 		if (win == 0) {
-			tp->t_timer[TCPT_REXMT] = 0;
+			TCP_TIMER_DISARM(tp, TCPT_REXMT);
 			tp->snd_nxt = tp->snd_una;
 		}
 	}
+	/*
+	 * More than a segment of new data, or of a retransmission
+	 * after a timeout, can go to ip_output() in one large send
+	 * that tcp_segment() cuts up at the interface; the length
+	 * is settled once the options are known.
+	 */
 	if (len > tp->t_maxseg) {
-		len = tp->t_maxseg;
-		sendalot = 1;
+		if (tcp_do_tso && !sack_rxmit && !tp->t_force &&
+		    (flags & (TH_SYN|TH_RST)) == 0 &&
+		    tp->t_inpcb->inp_options == 0 &&
+		    SEQ_LEQ(tp->snd_up, tp->snd_nxt))
+			tso = 1;
+		else {
+			len = tp->t_maxseg;
+			sendalot = 1;
+		}
 	}
-	if (SEQ_LT(tp->snd_nxt + len, tp->snd_una + so->so_snd.sb_cc))
+	if (sack_rxmit) {
+		flags &= ~TH_FIN;
+		sendalot = 1;
+	} else if (SEQ_LT(tp->snd_nxt + len, tp->snd_una + so->so_snd.sb_cc))
 		flags &= ~TH_FIN;
 
 	win = sbspace(&so->so_rcv);
@@ -173,7 +215,7 @@ again:
 	 * to send into a small window), then must resend.
 	 */
 	if (len) {
-		if (len == tp->t_maxseg)
+		if (len >= tp->t_maxseg)
 			goto send;
 		if ((idle || tp->t_flags & TF_NODELAY) &&
 		    len + off >= so->so_snd.sb_cc)
@@ -182,7 +224,7 @@ again:
 			goto send;
 		if (len >= tp->max_sndwnd / 2)
 			goto send;
-		if (SEQ_LT(tp->snd_nxt, tp->snd_max))
+		if (SEQ_LT(tp->snd_nxt, tp->snd_max) || sack_rxmit)
 			goto send;
 	}
 
@@ -235,12 +277,12 @@ again:
 	 *	(re)transmitting	and thereby not persisting
 	 *
 	 * tp->t_timer[TCPT_PERSIST]
-	 *	is set when we are in persist state.
+	 *	is armed when we are in persist state.
 	 * tp->t_force
 	 *	is set when we are called to send a persist packet.
 	 * tp->t_timer[TCPT_REXMT]
-	 *	is set when we are retransmitting
-	 * The output side is idle when both timers are zero.
+	 *	is armed when we are retransmitting
+	 * The output side is idle when neither timer is armed.
 	 *
 	 * If send window is too small, there is data to transmit, and no
 	 * retransmit or persist is pending, then go to persist state.
@@ -248,8 +290,8 @@ again:
 	 * if window is nonzero, transmit what we can,
 	 * otherwise force out a byte.
 	 */
-	if (so->so_snd.sb_cc && tp->t_timer[TCPT_REXMT] == 0 &&
-	    tp->t_timer[TCPT_PERSIST] == 0) {
+	if (so->so_snd.sb_cc && !TCP_TIMER_ISARMED(tp, TCPT_REXMT) &&
+	    !TCP_TIMER_ISARMED(tp, TCPT_PERSIST)) {
 		tp->t_rxtshift = 0;
 		tcp_setpersist(tp);
 	}
@@ -291,6 +333,16 @@ send:
 					tp->request_r_scale);
 				optlen += 4;
 			}
+			if ((tp->t_flags & TF_REQ_SACK) &&
+			    ((flags & TH_ACK) == 0 ||
+			    (tp->t_flags & TF_SACK_PERMIT))) {
+				*((u_long *) (opt + optlen)) = htonl(
+					TCPOPT_NOP << 24 |
+					TCPOPT_NOP << 16 |
+					TCPOPT_SACK_PERMITTED << 8 |
+					TCPOLEN_SACK_PERMITTED);
+				optlen += 4;
+			}
 		}
  	}
  
@@ -312,13 +364,42 @@ send:
  		optlen += TCPOLEN_TSTAMP_APPA;
  	}
 
+	/*
+	 * Tell the peer what is waiting in the reassembly queue.
+	 */
+	if (TCP_SACK_ENABLED(tp) && (flags & (TH_SYN|TH_RST)) == 0 &&
+	    tp->t_segqlen > 0)
+		optlen += tcp_sack_option(tp, opt + optlen,
+		    MAX_TCPOPTLEN - optlen);
+
  	hdrlen += optlen;
  
+	/*
+	 * A large send carries whole segments and must fit in one
+	 * IP packet; a short tail goes out, or waits, on its own
+	 * as it would have without it.
+	 */
+	if (tso) {
+		long maxlen;
+
+		tso = tp->t_maxseg - optlen;
+		maxlen = (IP_MAXPACKET - hdrlen) / tso * tso;
+		if (len > maxlen || len % tso) {
+			if (len > maxlen)
+				len = maxlen;
+			len -= len % tso;
+			sendalot = 1;
+			flags &= ~TH_FIN;
+		}
+		if (len <= tso)
+			tso = 0;
+	}
+
 	/*
 	 * Adjust data length if insertion of options will
 	 * bump the packet length beyond the t_maxseg length.
 	 */
-	if (len > tp->t_maxseg - optlen) {
+	if (tso == 0 && len > tp->t_maxseg - optlen) {
 		len = tp->t_maxseg - optlen;
 		sendalot = 1;
 		flags &= ~TH_FIN;
@@ -338,11 +419,16 @@ send:
 	if (len) {
 		if (tp->t_force && len == 1)
 			tcpstat.tcps_sndprobe++;
-		else if (SEQ_LT(tp->snd_nxt, tp->snd_max)) {
+		else if (sack_rxmit) {
 			tcpstat.tcps_sndrexmitpack++;
 			tcpstat.tcps_sndrexmitbyte += len;
+			tcpstat.tcps_sackrexmitpack++;
+			tcpstat.tcps_sackrexmitbyte += len;
+		} else if (SEQ_LT(tp->snd_nxt, tp->snd_max)) {
+			tcpstat.tcps_sndrexmitpack += tso ? howmany(len, tso) : 1;
+			tcpstat.tcps_sndrexmitbyte += len;
 		} else {
-			tcpstat.tcps_sndpack++;
+			tcpstat.tcps_sndpack += tso ? howmany(len, tso) : 1;
 			tcpstat.tcps_sndbyte += len;
 		}
 #ifdef notyet
@@ -405,6 +491,10 @@ send:
 		m->m_len = hdrlen;
 	}
 	m->m_pkthdr.rcvif = (struct ifnet *)0;
+	if (tso) {
+		m->m_flags |= M_TSO;
+		m->m_pkthdr.tso_segsz = tso;
+	}
 	ti = mtod(m, struct tcpiphdr *);
 	if (tp->t_template == 0)
 		panic("tcp_output");
@@ -431,7 +521,10 @@ send:
 	 * case, since we know we aren't doing a retransmission.
 	 * (retransmit and persist are mutually exclusive...)
 	 */
-	if (len || (flags & (TH_SYN|TH_FIN)) || tp->t_timer[TCPT_PERSIST])
+	if (sack_rxmit)
+		ti->ti_seq = htonl(sack_seq);
+	else if (len || (flags & (TH_SYN|TH_FIN)) ||
+	    TCP_TIMER_ISARMED(tp, TCPT_PERSIST))
 		ti->ti_seq = htonl(tp->snd_nxt);
 	else
 		ti->ti_seq = htonl(tp->snd_max);
@@ -466,42 +559,50 @@ send:
 
 	/*
 	 * Put TCP length in extended header, and then
-	 * checksum extended header and data.
+	 * checksum extended header and data.  tcp_segment()
+	 * sums each segment of a large send instead.
 	 */
 	if (len + optlen)
 		ti->ti_len = htons((u_short)(sizeof (struct tcphdr) +
 		    optlen + len));
-	ti->ti_sum = in_cksum(m, (int)(hdrlen + len));
+	if (tso == 0)
+		ti->ti_sum = in_cksum(m, (int)(hdrlen + len));
 
 	/*
 	 * In transmit state, time the transmission and arrange for
 	 * the retransmit.  In persist state, just set snd_max.
 	 */
-	if (tp->t_force == 0 || tp->t_timer[TCPT_PERSIST] == 0) {
+	if (tp->t_force == 0 || !TCP_TIMER_ISARMED(tp, TCPT_PERSIST)) {
 		tcp_seq startseq = tp->snd_nxt;
 
 		/*
 		 * Advance snd_nxt over sequence space of this segment.
+		 * A hole filled in SACK recovery moves snd_rxmit instead.
 		 */
-		if (flags & (TH_SYN|TH_FIN)) {
-			if (flags & TH_SYN)
-				tp->snd_nxt++;
-			if (flags & TH_FIN) {
-				tp->snd_nxt++;
-				tp->t_flags |= TF_SENTFIN;
+		if (sack_rxmit)
+			tp->snd_rxmit = sack_seq + len;
+		else {
+			if (flags & (TH_SYN|TH_FIN)) {
+				if (flags & TH_SYN)
+					tp->snd_nxt++;
+				if (flags & TH_FIN) {
+					tp->snd_nxt++;
+					tp->t_flags |= TF_SENTFIN;
+				}
 			}
-		}
-		tp->snd_nxt += len;
-		if (SEQ_GT(tp->snd_nxt, tp->snd_max)) {
-			tp->snd_max = tp->snd_nxt;
-			/*
-			 * Time this transmission if not a retransmission and
-			 * not currently timing anything.
-			 */
-			if (tp->t_rtt == 0) {
-				tp->t_rtt = 1;
-				tp->t_rtseq = startseq;
-				tcpstat.tcps_segstimed++;
+			tp->snd_nxt += len;
+			if (SEQ_GT(tp->snd_nxt, tp->snd_max)) {
+				tp->snd_max = tp->snd_nxt;
+				/*
+				 * Time this transmission if not a retransmission
+				 * and not currently timing anything.
+				 */
+				if (tp->t_rtt == 0) {
+					tp->t_rtt = 1;
+					tp->t_rtttime = tcp_now;
+					tp->t_rtseq = startseq;
+					tcpstat.tcps_segstimed++;
+				}
 			}
 		}
 
@@ -513,11 +614,11 @@ send:
 		 * Initialize shift counter which is used for backoff
 		 * of retransmit time.
 		 */
-		if (tp->t_timer[TCPT_REXMT] == 0 &&
+		if (!TCP_TIMER_ISARMED(tp, TCPT_REXMT) &&
 		    tp->snd_nxt != tp->snd_una) {
-			tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
-			if (tp->t_timer[TCPT_PERSIST]) {
-				tp->t_timer[TCPT_PERSIST] = 0;
+			TCP_TIMER_ARM(tp, TCPT_REXMT, tp->t_rxtcur);
+			if (TCP_TIMER_ISARMED(tp, TCPT_PERSIST)) {
+				TCP_TIMER_DISARM(tp, TCPT_PERSIST);
 				tp->t_rxtshift = 0;
 			}
 		}
@@ -568,7 +669,11 @@ out:
 		}
 		return (error);
 	}
-	tcpstat.tcps_sndtotal++;
+	if (tso) {
+		tcpstat.tcps_sndtotal += howmany(len, tso);
+		tcpstat.tcps_sndtso++;
+	} else
+		tcpstat.tcps_sndtotal++;
 
 	/*
 	 * Data sent (as far as we can tell).
@@ -579,7 +684,8 @@ out:
 	if (win > 0 && SEQ_GT(tp->rcv_nxt+win, tp->rcv_adv))
 		tp->rcv_adv = tp->rcv_nxt + win;
 	tp->last_ack_sent = tp->rcv_nxt;
-	tp->t_flags &= ~(TF_ACKNOW|TF_DELACK);
+	tp->t_flags &= ~TF_ACKNOW;
+	TCP_CLR_DELACK(tp);
 	if (sendalot)
 		goto again;
 	return (0);
@@ -590,15 +696,145 @@ tcp_setpersist(tp)
 	register struct tcpcb *tp;
 {
 	register int t = ((tp->t_srtt >> 2) + tp->t_rttvar) >> 1;
+	int tt;
 
-	if (tp->t_timer[TCPT_REXMT])
+	if (TCP_TIMER_ISARMED(tp, TCPT_REXMT))
 		panic("tcp_output REXMT");
 	/*
 	 * Start/restart persistance timer.
 	 */
-	TCPT_RANGESET(tp->t_timer[TCPT_PERSIST],
-	    t * tcp_backoff[tp->t_rxtshift],
+	TCPT_RANGESET(tt, t * tcp_backoff[tp->t_rxtshift],
 	    TCPTV_PERSMIN, TCPTV_PERSMAX);
+	TCP_TIMER_ARM(tp, TCPT_PERSIST, tt);
 	if (tp->t_rxtshift < TCP_MAXRXTSHIFT)
 		tp->t_rxtshift++;
 }
+
+/*
+ * Cut a large send from tcp_output() into segments of at most
+ * m_pkthdr.tso_segsz bytes of data that fit the interface mtu.
+ * ip_output() has filled in the IP header, ip_len and ip_off still
+ * in host order, and the headers are whole in the first mbuf.
+ * Each segment gets a copy of them with its own sequence number,
+ * IP id and checksums; only the last keeps FIN and PUSH.  Data
+ * mbufs move to the segments as they are, and an mbuf a boundary
+ * cuts through is shared, so each byte is touched once, to be
+ * summed.  Returns the segments linked by m_nextpkt, or 0 if out
+ * of mbufs; m is freed either way.
+ */
+struct mbuf *
+tcp_segment(m, mtu)
+	register struct mbuf *m;
+	int mtu;
+{
+	struct ip *ip = mtod(m, struct ip *);
+	register struct tcpiphdr *ti;
+	register struct mbuf *src, *n, *d;
+	struct mbuf *top = 0, **mnext = &top, **np, **sp;
+	struct ip save;
+	int hlen, thlen, seg, left, len, resid, chunk, soff, nseg;
+	tcp_seq seq;
+
+	hlen = ip->ip_hl << 2;
+	thlen = ((struct tcphdr *)((caddr_t)ip + hlen))->th_off << 2;
+#ifdef DIAGNOSTIC
+	if (hlen != sizeof (struct ip) || m->m_len < hlen + thlen)
+		panic("tcp_segment");
+#endif
+	seg = min(m->m_pkthdr.tso_segsz, mtu - hlen - thlen);
+	left = (u_short)ip->ip_len - hlen - thlen;
+	seq = ntohl(((struct tcpiphdr *)ip)->ti_seq);
+	if (m->m_len > hlen + thlen) {
+		src = m;
+		soff = hlen + thlen;
+		sp = 0;
+	} else {
+		src = m->m_next;
+		soff = 0;
+		sp = &m->m_next;
+	}
+
+	for (nseg = 0; left > 0; nseg++) {
+		len = min(seg, left);
+		MGETHDR(n, M_DONTWAIT, MT_HEADER);
+		if (n == 0)
+			goto bad;
+		*mnext = n;
+		mnext = &n->m_nextpkt;
+		n->m_data += max_linkhdr;
+		n->m_len = hlen + thlen;
+		n->m_pkthdr.len = hlen + thlen + len;
+		n->m_pkthdr.rcvif = (struct ifnet *)0;
+		bcopy((caddr_t)ip, mtod(n, caddr_t), (unsigned)(hlen + thlen));
+
+		np = &n->m_next;
+		for (resid = len; resid > 0; resid -= chunk) {
+			if (src == 0)
+				panic("tcp_segment: short");
+			chunk = min(resid, src->m_len - soff);
+			if (soff == 0 && chunk == src->m_len && sp) {
+				*sp = src->m_next;
+				src->m_next = 0;
+				*np = src;
+				np = &src->m_next;
+				src = *sp;
+				continue;
+			}
+			MGET(d, M_DONTWAIT, src->m_type);
+			if (d == 0)
+				goto bad;
+			if (src->m_flags & M_EXT) {
+				d->m_data = src->m_data + soff;
+				MEXTREF(src);
+				d->m_ext = src->m_ext;
+				d->m_flags |= M_EXT;
+			} else
+				bcopy(mtod(src, caddr_t) + soff, mtod(d, caddr_t),
+				    (unsigned)chunk);
+			d->m_len = chunk;
+			*np = d;
+			np = &d->m_next;
+			if ((soff += chunk) == src->m_len) {
+				sp = &src->m_next;
+				src = src->m_next;
+				soff = 0;
+			}
+		}
+
+		/*
+		 * Sum the segment with the pseudo-header overlaid
+		 * on the IP header, as tcp_output() does, then put
+		 * the IP header back and sum that.
+		 */
+		ti = mtod(n, struct tcpiphdr *);
+		ti->ti_seq = htonl(seq);
+		if (len < left)
+			ti->ti_flags &= ~(TH_FIN|TH_PUSH);
+		save = *(struct ip *)ti;
+		ti->ti_next = ti->ti_prev = 0;
+		ti->ti_x1 = 0;
+		ti->ti_len = htons((u_short)(thlen + len));
+		ti->ti_sum = 0;
+		ti->ti_sum = in_cksum(n, hlen + thlen + len);
+		*(struct ip *)ti = save;
+		((struct ip *)ti)->ip_len = htons((u_short)n->m_pkthdr.len);
+		((struct ip *)ti)->ip_off = htons((u_short)save.ip_off);
+		((struct ip *)ti)->ip_id = htons(ntohs(save.ip_id) + nseg);
+		((struct ip *)ti)->ip_sum = 0;
+		((struct ip *)ti)->ip_sum = in_cksum(n, hlen);
+		seq += len;
+		left -= len;
+	}
+	/* ip_output() took the first id */
+	ip_id += nseg - 1;
+	m_freem(m);
+	return (top);
+
+bad:
+	m_freem(m);
+	while ((n = top)) {
+		top = n->m_nextpkt;
+		m_freem(n);
+	}
+	return (0);
+}
@@ -0,0 +1,266 @@
+/*
+ * The TCP reassembly queue.
+ *
+ * Out of order data waits in tp->t_segq[], an array of disjoint
+ * ranges in sequence order.  Ranges that touch are merged, so there
+ * is one entry per run of data between holes, and the data of each
+ * is a single mbuf chain.  A segment is placed by binary search and
+ * joins the ranges it meets by linking chains, never by copying, so
+ * it costs O(log n) in the number of holes, whatever the order the
+ * segments come in.
+ *
+ * The mbuf storage queued is kept in t_segqmbcnt.  It is bounded by
+ * the receive buffer's sb_mbmax, the storage the data could take up
+ * once it is in the socket; beyond that, segments that do not fill
+ * the first hole are dropped, to be retransmitted.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcpip.h>
+
+static int tcp_reass_open __P((struct tcpcb *, int));
+static void tcp_reass_close __P((struct tcpcb *, int, int));
+
+/*
+ * Index of the first range that ends at or after seq.
+ */
+int
+tcp_reass_find(tp, seq)
+	struct tcpcb *tp;
+	tcp_seq seq;
+{
+	register struct tcpqent *q = tp->t_segq;
+	register int lo = 0, hi = tp->t_segqlen, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (SEQ_LT(q[mid].tqe_end, seq))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*
+ * Open a slot at index i, doubling the array when it is full.
+ */
+static int
+tcp_reass_open(tp, i)
+	register struct tcpcb *tp;
+	int i;
+{
+	struct tcpqent *q;
+	int size;
+
+	if (tp->t_segqlen == tp->t_segqsize) {
+		size = tp->t_segqsize ? 2 * tp->t_segqsize : TCP_REASS_MINQ;
+		q = malloc(size * sizeof(*q), M_PCB, M_NOWAIT);
+		if (q == NULL)
+			return (ENOBUFS);
+		if (tp->t_segq) {
+			bcopy((caddr_t)tp->t_segq, (caddr_t)q,
+			    tp->t_segqlen * sizeof(*q));
+			free(tp->t_segq, M_PCB);
+		}
+		tp->t_segq = q;
+		tp->t_segqsize = size;
+	}
+	q = &tp->t_segq[i];
+	ovbcopy((caddr_t)q, (caddr_t)(q + 1),
+	    (tp->t_segqlen - i) * sizeof(*q));
+	tp->t_segqlen++;
+	return (0);
+}
+
+/*
+ * Remove the n slots from index i.
+ */
+static void
+tcp_reass_close(tp, i, n)
+	register struct tcpcb *tp;
+	int i, n;
+{
+	register struct tcpqent *q = &tp->t_segq[i];
+
+	if (n == 0)
+		return;
+	tp->t_segqlen -= n;
+	ovbcopy((caddr_t)(q + n), (caddr_t)q,
+	    (tp->t_segqlen - i) * sizeof(*q));
+}
+
+/*
+ * Insert segment ti into reassembly queue of tcp with
+ * control block tp.  Return TH_FIN if reassembly now includes
+ * a segment with FIN.  Call with ti==0 after become established
+ * to force pre-ESTABLISHED data up to user socket.
+ */
+int
+tcp_reass(tp, ti, m)
+	register struct tcpcb *tp;
+	register struct tcpiphdr *ti;
+	struct mbuf *m;
+{
+	register struct tcpqent *q;
+	register struct mbuf *n;
+	struct socket *so = tp->t_inpcb->inp_socket;
+	struct tcpqent new;
+	int i, j, left, right, over;
+
+	if (ti == 0)
+		goto present;
+
+	new.tqe_m = m;
+	new.tqe_mbcnt = 0;
+	for (n = m; n; n = n->m_next) {
+		new.tqe_last = n;
+		new.tqe_mbcnt += MSIZE;
+		if (n->m_flags & M_EXT)
+			new.tqe_mbcnt += n->m_ext.ext_size;
+	}
+	if (ti->ti_seq != tp->rcv_nxt &&
+	    tp->t_segqmbcnt + new.tqe_mbcnt > so->so_rcv.sb_mbmax) {
+		tcpstat.tcps_rcvreassfull++;
+		m_freem(m);
+		return (0);
+	}
+
+	/*
+	 * If the range before this segment provides some of our
+	 * data already, drop that from the segment; if it provides
+	 * all of our data, drop us.  Either way the two join.
+	 */
+	i = tcp_reass_find(tp, ti->ti_seq);
+	q = &tp->t_segq[i];
+	left = i < tp->t_segqlen && SEQ_LEQ(q->tqe_start, ti->ti_seq);
+	if (left) {
+		/* conversion to int (in over) handles seq wraparound */
+		over = q->tqe_end - ti->ti_seq;
+		if (over > 0) {
+			if (over >= ti->ti_len) {
+				tcpstat.tcps_rcvduppack++;
+				tcpstat.tcps_rcvdupbyte += ti->ti_len;
+				m_freem(m);
+				return (0);
+			}
+			m_adj(m, over);
+			ti->ti_len -= over;
+			ti->ti_seq += over;
+		}
+	}
+	tcpstat.tcps_rcvoopack++;
+	tcpstat.tcps_rcvoobyte += ti->ti_len;
+	tp->rcv_lastsack = ti->ti_seq;
+	new.tqe_start = ti->ti_seq;
+	new.tqe_end = ti->ti_seq + ti->ti_len;
+	new.tqe_flags = ti->ti_flags & TH_FIN;
+
+	/*
+	 * Ranges this segment covers are dropped.  One it overlaps
+	 * or touches at its end is trimmed and joins it.
+	 */
+	right = 0;
+	for (j = left ? i + 1 : i; j < tp->t_segqlen; j++) {
+		q = &tp->t_segq[j];
+		if (SEQ_GT(q->tqe_start, new.tqe_end))
+			break;
+		if (SEQ_GT(q->tqe_end, new.tqe_end)) {
+			m_adj(q->tqe_m, new.tqe_end - q->tqe_start);
+			q->tqe_start = new.tqe_end;
+			right = 1;
+			break;
+		}
+		if (q->tqe_end == new.tqe_end)
+			new.tqe_flags |= q->tqe_flags;
+		tp->t_segqmbcnt -= q->tqe_mbcnt;
+		m_freem(q->tqe_m);
+	}
+
+	tp->t_segqmbcnt += new.tqe_mbcnt;
+	if (left) {
+		q = &tp->t_segq[i];
+		q->tqe_last->m_next = new.tqe_m;
+		new.tqe_start = q->tqe_start;
+		new.tqe_m = q->tqe_m;
+		new.tqe_mbcnt += q->tqe_mbcnt;
+	}
+	if (right) {
+		q = &tp->t_segq[j];
+		new.tqe_last->m_next = q->tqe_m;
+		new.tqe_end = q->tqe_end;
+		new.tqe_last = q->tqe_last;
+		new.tqe_mbcnt += q->tqe_mbcnt;
+		new.tqe_flags = q->tqe_flags;
+		j++;
+	}
+	if (j == i && tcp_reass_open(tp, i)) {
+		tp->t_segqmbcnt -= new.tqe_mbcnt;
+		m_freem(m);
+		return (0);
+	}
+	tp->t_segq[i] = new;
+	if (j > i)
+		tcp_reass_close(tp, i + 1, j - i - 1);
+
+present:
+	/*
+	 * Present data to user, advancing rcv_nxt through
+	 * completed sequence space.  Ranges don't touch, so
+	 * at most the first one can go.
+	 */
+	if (TCPS_HAVERCVDSYN(tp->t_state) == 0 || tp->t_segqlen == 0)
+		return (0);
+	q = tp->t_segq;
+	if (q->tqe_start != tp->rcv_nxt)
+		return (0);
+	if (tp->t_state == TCPS_SYN_RECEIVED && q->tqe_end != q->tqe_start)
+		return (0);
+	new = *q;
+	tcp_reass_close(tp, 0, 1);
+	tp->t_segqmbcnt -= new.tqe_mbcnt;
+	tp->rcv_nxt = new.tqe_end;
+	if (so->so_state & SS_CANTRCVMORE)
+		m_freem(new.tqe_m);
+	else
+		sbappend(&so->so_rcv, new.tqe_m);
+	sorwakeup(so);
+	return (new.tqe_flags);
+}
+
+/*
+ * Free the reassembly queue, on close or when mbufs run short.
+ */
+void
+tcp_reass_flush(tp)
+	register struct tcpcb *tp;
+{
+	register int i;
+
+	for (i = 0; i < tp->t_segqlen; i++)
+		m_freem(tp->t_segq[i].tqe_m);
+	if (tp->t_segq)
+		free(tp->t_segq, M_PCB);
+	tp->t_segq = NULL;
+	tp->t_segqlen = tp->t_segqsize = 0;
+	tp->t_segqmbcnt = 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Selective acknowledgements, RFC 2018, and the loss recovery of
+ * RFC 6675 built on them.
+ *
+ * The receiver reports the blocks its reassembly queue holds, the
+ * block with the latest segment first.  The sender merges the blocks
+ * it gets into a scoreboard of SACKed ranges above snd_una.  Once in
+ * recovery, tcp_output() asks tcp_sack_pipe() how much is in flight
+ * and which hole to fill next, so several losses in one window are
+ * repaired in about one round trip instead of one per round trip.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcpip.h>
+
+extern int tcprexmtthresh;
+
+/*
+ * Merge [start, end) into the scoreboard, and return whether it
+ * covered anything that wasn't SACKed yet.  When it is full, the
+ * highest block is forgotten; that only makes the sender more
+ * conservative.
+ */
+static int tcp_sack_add __P((struct tcpcb *, tcp_seq, tcp_seq));
+
+static int
+tcp_sack_add(tp, start, end)
+	register struct tcpcb *tp;
+	tcp_seq start, end;
+{
+	register struct sackblk *sb = tp->snd_sacked;
+	register int i, j, k, n = tp->snd_nsacked;
+
+	/* blocks i..j-1 overlap or touch the new one */
+	for (i = 0; i < n && SEQ_LT(sb[i].end, start); i++)
+		;
+	if (i < n && SEQ_LEQ(sb[i].start, start) && SEQ_GEQ(sb[i].end, end))
+		return (0);
+	for (j = i; j < n && SEQ_LEQ(sb[j].start, end); j++) {
+		if (SEQ_LT(sb[j].start, start))
+			start = sb[j].start;
+		if (SEQ_GT(sb[j].end, end))
+			end = sb[j].end;
+	}
+	if (j == i) {
+		if (n == TCP_SACK_MAXBLKS) {
+			if (i == n)
+				return (0);
+			n--;
+		}
+		for (k = n; k > i; k--)
+			sb[k] = sb[k - 1];
+		n++;
+	} else {
+		for (k = j; k < n; k++)
+			sb[i + 1 + k - j] = sb[k];
+		n -= j - i - 1;
+	}
+	sb[i].start = start;
+	sb[i].end = end;
+	tp->snd_nsacked = n;
+	return (1);
+}
+
+/*
+ * Take in a SACK option, cp pointing at its kind byte, and return
+ * whether it SACKed new data.  Blocks at or below the cumulative ack,
+ * or beyond what was sent, are ignored.
+ */
+int
+tcp_sack_update(tp, cp, optlen, ack)
+	struct tcpcb *tp;
+	u_char *cp;
+	int optlen;
+	tcp_seq ack;
+{
+	tcp_seq start, end;
+	int new = 0;
+
+	if (optlen < 2 + 8 || (optlen - 2) % 8 ||
+	    SEQ_LT(ack, tp->snd_una) || SEQ_GT(ack, tp->snd_max))
+		return (0);
+	for (cp += 2, optlen -= 2; optlen > 0; cp += 8, optlen -= 8) {
+		bcopy((char *)cp, (char *)&start, sizeof(start));
+		bcopy((char *)cp + 4, (char *)&end, sizeof(end));
+		NTOHL(start);
+		NTOHL(end);
+		if (SEQ_LEQ(end, start) || SEQ_LEQ(end, ack) ||
+		    SEQ_GT(end, tp->snd_max))
+			continue;
+		if (SEQ_LT(start, ack))
+			start = ack;
+		new |= tcp_sack_add(tp, start, end);
+	}
+	return (new);
+}
+
+/*
+ * Forget what snd_una has passed.
+ */
+void
+tcp_sack_prune(tp)
+	register struct tcpcb *tp;
+{
+	register struct sackblk *sb = tp->snd_sacked;
+	register int i, n = tp->snd_nsacked;
+
+	for (i = 0; i < n && SEQ_LEQ(sb[i].end, tp->snd_una); i++)
+		;
+	if (i > 0) {
+		n -= i;
+		bcopy((char *)&sb[i], (char *)sb, n * sizeof(*sb));
+		tp->snd_nsacked = n;
+	}
+	if (n > 0 && SEQ_LT(sb[0].start, tp->snd_una))
+		sb[0].start = tp->snd_una;
+}
+
+/*
+ * RFC 6675's IsLost(snd_una): more than tcprexmtthresh - 1 segments'
+ * worth has been SACKed above the first hole.
+ */
+int
+tcp_sack_firstlost(tp)
+	register struct tcpcb *tp;
+{
+	register int i;
+	long sacked = 0;
+
+	for (i = 0; i < tp->snd_nsacked; i++)
+		sacked += tp->snd_sacked[i].end - tp->snd_sacked[i].start;
+	return (sacked > (tcprexmtthresh - 1) * tp->t_maxseg);
+}
+
+/*
+ * Estimate the data in flight during recovery, RFC 6675's pipe:
+ * what was sent, less what was SACKed, less the lost data not yet
+ * retransmitted.  A hole counts as lost once more than
+ * tcprexmtthresh - 1 segments' worth above it has been SACKed; the
+ * first hole is lost as soon as recovery starts.  *seqp and *lenp
+ * get the lowest lost range above snd_rxmit, *lenp is 0 if none.
+ */
+long
+tcp_sack_pipe(tp, seqp, lenp)
+	register struct tcpcb *tp;
+	tcp_seq *seqp;
+	long *lenp;
+{
+	register struct sackblk *sb = tp->snd_sacked;
+	register int i;
+	long sacked = 0, lost = 0;
+	tcp_seq start;
+
+	*lenp = 0;
+	for (i = tp->snd_nsacked - 1; i >= 0; i--) {
+		sacked += sb[i].end - sb[i].start;
+		if (i > 0 && sacked <= (tcprexmtthresh - 1) * tp->t_maxseg)
+			continue;
+		start = i > 0 ? sb[i - 1].end : tp->snd_una;
+		if (SEQ_LT(start, tp->snd_rxmit))
+			start = tp->snd_rxmit;
+		if (SEQ_LT(start, sb[i].start)) {
+			lost += sb[i].start - start;
+			*seqp = start;
+			*lenp = sb[i].start - start;
+		}
+	}
+	return (tp->snd_max - tp->snd_una - sacked - lost);
+}
+
+/*
+ * Build a SACK option from the reassembly queue in at most space
+ * bytes at cp, returning its length.  Each range of the queue is one
+ * block.  The block with the latest segment goes first (RFC 2018,
+ * section 4), the lowest others follow in sequence order.
+ */
+int
+tcp_sack_option(tp, cp, space)
+	struct tcpcb *tp;
+	u_char *cp;
+	int space;
+{
+	struct tcpqent *blk[TCP_SACK_MAXOPT];
+	register struct tcpqent *q = tp->t_segq;
+	register u_long *lp;
+	int i, last, n, max;
+
+	max = (space - 4) / 8;
+	if (max > TCP_SACK_MAXOPT)
+		max = TCP_SACK_MAXOPT;
+	if (max <= 0)
+		return (0);
+	n = 0;
+	last = tcp_reass_find(tp, tp->rcv_lastsack);
+	if (last < tp->t_segqlen &&
+	    SEQ_LEQ(q[last].tqe_start, tp->rcv_lastsack) &&
+	    SEQ_LT(tp->rcv_lastsack, q[last].tqe_end))
+		blk[n++] = &q[last];
+	else
+		last = -1;
+	for (i = 0; i < tp->t_segqlen && n < max; i++)
+		if (i != last)
+			blk[n++] = &q[i];
+	if (n == 0)
+		return (0);
+	tcpstat.tcps_sacksndblk += n;
+	lp = (u_long *)cp;
+	*lp++ = htonl(TCPOPT_NOP << 24 | TCPOPT_NOP << 16 |
+	    TCPOPT_SACK << 8 | (2 + 8 * n));
+	for (i = 0; i < n; i++) {
+		*lp++ = htonl(blk[i]->tqe_start);
+		*lp++ = htonl(blk[i]->tqe_end);
+	}
+	return (4 + 8 * n);
+}
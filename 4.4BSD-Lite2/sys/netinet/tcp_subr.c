@@ -57,14 +57,20 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/tcpip.h>
 
 /* patchable/settable parameters for tcp */
 int 	tcp_mssdflt = TCP_MSS;
 int 	tcp_rttdflt = TCPTV_SRTTDFLT / PR_SLOWHZ;
 int	tcp_do_rfc1323 = 1;
+int	tcp_do_sack = 1;
+int	tcp_do_tso = 1;
+int	tcp_do_gro = 1;
 
-extern	struct inpcb *tcp_last_inpcb;
+#ifndef TCBHASHSIZE
+#define	TCBHASHSIZE	4096
+#endif
 
 /*
  * Tcp initialization
@@ -75,6 +81,10 @@ tcp_init()
 
 	tcp_iss = random();	/* wrong, but better than a constant */
 	tcb.inp_next = tcb.inp_prev = &tcb;
+	in_pcbhashinit(&tcb, TCBHASHSIZE);
+	LIST_INIT(&tcp_delacks);
+	tcp_syncache_init();
+	tcp_twinit();
 	if (max_protohdr < sizeof(struct tcpiphdr))
 		max_protohdr = sizeof(struct tcpiphdr);
 	if (max_linkhdr + sizeof(struct tcpiphdr) > MHLEN)
@@ -213,13 +223,13 @@ tcp_newtcpcb(inp)
 	if (tp == NULL)
 		return ((struct tcpcb *)0);
 	bzero((char *) tp, sizeof(struct tcpcb));
-    // 都指向自己
-	tp->seg_next = tp->seg_prev = (struct tcpiphdr *)tp;
     // 设置tcp segment最大为512
 	tp->t_maxseg = tcp_mssdflt;
 
     // 打开rfc1323
 	tp->t_flags = tcp_do_rfc1323 ? (TF_REQ_SCALE|TF_REQ_TSTMP) : 0;
+	if (tcp_do_sack)
+		tp->t_flags |= TF_REQ_SACK;
     // 设置通用的控制块
 	tp->t_inpcb = inp;
 	/*
@@ -230,6 +240,7 @@ tcp_newtcpcb(inp)
 	tp->t_srtt = TCPTV_SRTTBASE;
 	tp->t_rttvar = tcp_rttdflt * PR_SLOWHZ << 2;
 	tp->t_rttmin = TCPTV_MIN;
+	tp->t_rcvtime = tcp_now;
 	TCPT_RANGESET(tp->t_rxtcur,
 	    ((TCPTV_SRTTBASE >> 2) + (TCPTV_SRTTDFLT << 2)) >> 1,
 	    TCPTV_MIN, TCPTV_REXMTMAX);
@@ -237,6 +248,10 @@ tcp_newtcpcb(inp)
 	tp->snd_cwnd = TCP_MAXWIN << TCP_MAX_WINSHIFT;
     // 14 个 65536
 	tp->snd_ssthresh = TCP_MAXWIN << TCP_MAX_WINSHIFT;
+	if (tcp_cc_attach(tp, tcp_cc_default)) {
+		free(tp, M_PCB);
+		return ((struct tcpcb *)0);
+	}
     // ttl设置
 	inp->inp_ip.ip_ttl = ip_defttl;
     // 通用控制块指向了自己
@@ -278,10 +293,8 @@ struct tcpcb *
 tcp_close(tp)
 	register struct tcpcb *tp;
 {
-	register struct tcpiphdr *t;
 	struct inpcb *inp = tp->t_inpcb;
 	struct socket *so = inp->inp_socket;
-	register struct mbuf *m;
 #ifdef RTV_RTT
 	register struct rtentry *rt;
 
@@ -353,21 +366,15 @@ tcp_close(tp)
 	}
 #endif /* RTV_RTT */
 	/* free the reassembly queue, if any */
-	t = tp->seg_next;
-	while (t != (struct tcpiphdr *)tp) {
-		t = (struct tcpiphdr *)t->ti_next;
-		m = REASS_MBUF((struct tcpiphdr *)t->ti_prev);
-		remque(t->ti_prev);
-		m_freem(m);
-	}
+	tcp_reass_flush(tp);
+	tcp_cc_detach(tp);
 	if (tp->t_template)
 		(void) m_free(dtom(tp->t_template));
+	tcp_canceltimers(tp);
+	TCP_CLR_DELACK(tp);
 	free(tp, M_PCB);
 	inp->inp_ppcb = 0;
 	soisdisconnected(so);
-	/* clobber input pcb cache if we're closing the cached connection */
-	if (inp == tcp_last_inpcb)
-		tcp_last_inpcb = &tcb;
 	in_pcbdetach(inp);
 	tcpstat.tcps_closed++;
 	return ((struct tcpcb *)0);
@@ -376,7 +383,16 @@ tcp_close(tp)
 void
 tcp_drain()
 {
+	register struct inpcb *inp;
+	register struct tcpcb *tp;
 
+	/*
+	 * Out of order data can be dropped without harm,
+	 * the peer will send it again.
+	 */
+	for (inp = tcb.inp_next; inp != &tcb; inp = inp->inp_next)
+		if ((tp = intotcpcb(inp)) != NULL && tp->t_segqlen)
+			tcp_reass_flush(tp);
 }
 
 /*
@@ -0,0 +1,674 @@
+/*
+ * The SYN cache: the passive half of the handshake without a socket.
+ *
+ * A SYN for a listening socket used to make a socket, an inpcb and a
+ * tcpcb at once, and queue it on the listener's so_q0 until the ACK
+ * came; a flood of SYNs from addresses that never answer filled so_q0
+ * and kept real connections out.  Now tcp_syncache_add() keeps what
+ * the handshake needs in a small struct syncache, sends the SYN-ACK
+ * itself, and tcp_syncache_get() makes the socket only when the ACK
+ * for it arrives, already in SYN_RECEIVED, for tcp_input() to carry
+ * on with as before.
+ *
+ * Entries are hashed on the connection's addresses and ports, with a
+ * secret drawn at boot in the hash so that nobody can aim their SYNs
+ * at one chain.  Each entry is also on the time queue for the number
+ * of times its SYN-ACK has been sent: all entries on a queue wait the
+ * same time, so each queue is in expiry order and tcp_syncache_timer()
+ * looks only at the heads.  The SYN-ACK goes again after 3, 6 and
+ * 12 seconds, and the entry goes 24 seconds after the last.
+ *
+ * There are at most tcp_syncache_limit entries, and at most
+ * tcp_syncache_bucketlimit on a chain.  Past either, and if
+ * tcp_syncookies is set, the SYN-ACK carries a cookie as its
+ * sequence number and nothing is kept: the ACK brings the cookie
+ * back and the connection is made from it.  The cookie is
+ *
+ *	bits 31-8	a keyed hash of the addresses, the ports, the
+ *			peer's ISN and the time below
+ *	bits 7-3	tcp_now in periods of SYN_COOKIE_PERIOD, mod 32
+ *	bits 2-0	the MSS offered, rounded down to syn_cookie_mss[]
+ *
+ * and is good for the period it was made in and the next.  There is
+ * no room in it for window scaling, SACK or timestamps, so a SYN-ACK
+ * with a cookie doesn't offer them.  The hash is a multiply-and-xor
+ * mix over a secret, not a cryptographic MAC; a blind ACK has one
+ * chance in 2^24 of opening a connection.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/protosw.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcpip.h>
+
+#define	TCP_SYNCACHE_HASHSIZE	4096	/* chains */
+#define	TCP_SYNCACHE_REXMTS	3	/* times the SYN-ACK is sent again */
+
+#define	SYN_COOKIE_PERIOD	(64*PR_SLOWHZ)	/* a cookie's time unit */
+
+int	tcp_syncache_limit = 32768;	/* entries at most */
+int	tcp_syncache_bucketlimit = 30;	/* entries on a chain at most */
+int	tcp_syncookies = 1;		/* answer with cookies past those */
+
+struct syncache {
+	LIST_ENTRY(syncache) sc_hash;	/* hash chain */
+	TAILQ_ENTRY(syncache) sc_timeq;	/* on syn_cache_timeq[sc_rxtshift] */
+	struct	in_addr sc_src;		/* the peer */
+	struct	in_addr sc_dst;		/* us */
+	u_short	sc_sport;
+	u_short	sc_dport;
+	tcp_seq	sc_irs;			/* the peer's ISN */
+	tcp_seq	sc_iss;			/* ours */
+	u_long	sc_tsrecent;		/* timestamp in the SYN */
+	u_long	sc_expire;		/* tcp_now when the timer goes */
+	struct	mbuf *sc_ipopts;	/* source route to answer by */
+	u_short	sc_peermss;		/* MSS offered, 0 if none */
+	u_short	sc_ourmss;		/* MSS we offer */
+	u_short	sc_wnd;			/* window in the SYN-ACK */
+	u_char	sc_rxtshift;		/* SYN-ACKs sent, less one */
+	u_char	sc_requested_s_scale;	/* the peer's window shift */
+	u_char	sc_request_r_scale;	/* ours */
+	u_char	sc_flags;
+};
+
+#define	SCF_SCALE	0x01		/* both do window scaling */
+#define	SCF_TSTMP	0x02		/* both do timestamps */
+#define	SCF_SACK	0x04		/* both do SACK */
+
+static LIST_HEAD(syncachehead, syncache) *syn_cache_hashtbl;
+static u_long syn_cache_hashmask;
+static TAILQ_HEAD(, syncache) syn_cache_timeq[TCP_SYNCACHE_REXMTS + 1];
+static int syn_cache_count;		/* entries */
+static u_long syn_cache_secret[3];	/* chains; cookies */
+
+extern int tcp_mssdflt;
+
+/* MSS a cookie can carry; 536 is assumed when none was offered */
+static const u_short syn_cookie_mss[8] = {
+	216, 536, 1024, 1220, 1380, 1440, 1460, 8960
+};
+
+#define	SYN_MIX(h, w) { \
+	(h) = ((h) ^ (w)) * 0x9e3779b1; \
+	(h) ^= (h) >> 15; \
+}
+
+static struct syncache *syn_cache_lookup __P((struct tcpiphdr *,
+	    struct syncachehead **, int *));
+static void syn_cache_free __P((struct syncache *));
+static void syn_cache_options __P((struct tcpcb *, struct syncache *,
+	    u_char *, int));
+static u_short syn_cache_mss __P((struct in_addr));
+static void syn_cache_respond __P((struct syncache *));
+static struct socket *syn_cache_socket __P((struct socket *,
+	    struct syncache *));
+static u_long syn_cookie_hash __P((struct syncache *, u_long));
+static tcp_seq syn_cookie __P((struct syncache *));
+static int syn_cookie_check __P((struct syncache *, tcp_seq));
+
+void
+tcp_syncache_init()
+{
+	int i;
+
+	syn_cache_hashtbl = hashinit(TCP_SYNCACHE_HASHSIZE, M_SYNCACHE,
+	    &syn_cache_hashmask);
+	for (i = 0; i <= TCP_SYNCACHE_REXMTS; i++)
+		TAILQ_INIT(&syn_cache_timeq[i]);
+	for (i = 0; i < 3; i++)
+		syn_cache_secret[i] = random() ^ random() << 16;
+}
+
+/*
+ * The entry for the connection ti is on, if any.  The chain it would
+ * be on is left in *headp and the entries on it counted in *lenp.
+ */
+static struct syncache *
+syn_cache_lookup(ti, headp, lenp)
+	register struct tcpiphdr *ti;
+	struct syncachehead **headp;
+	int *lenp;
+{
+	register struct syncache *sc;
+	u_long h = syn_cache_secret[0];
+	int n = 0;
+
+	SYN_MIX(h, ti->ti_src.s_addr);
+	SYN_MIX(h, ti->ti_dst.s_addr);
+	SYN_MIX(h, (u_long)ti->ti_sport << 16 | ti->ti_dport);
+	*headp = &syn_cache_hashtbl[h & syn_cache_hashmask];
+	for (sc = (*headp)->lh_first; sc; sc = sc->sc_hash.le_next, n++)
+		if (sc->sc_src.s_addr == ti->ti_src.s_addr &&
+		    sc->sc_dst.s_addr == ti->ti_dst.s_addr &&
+		    sc->sc_sport == ti->ti_sport &&
+		    sc->sc_dport == ti->ti_dport)
+			break;
+	if (lenp)
+		*lenp = n;
+	return (sc);
+}
+
+static void
+syn_cache_free(sc)
+	register struct syncache *sc;
+{
+
+	LIST_REMOVE(sc, sc_hash);
+	TAILQ_REMOVE(&syn_cache_timeq[sc->sc_rxtshift], sc, sc_timeq);
+	if (sc->sc_ipopts)
+		(void) m_free(sc->sc_ipopts);
+	FREE(sc, M_SYNCACHE);
+	syn_cache_count--;
+}
+
+/*
+ * Take what the SYN offers, as tcp_dooptions() would, then keep what
+ * the listener tp asks for too.
+ */
+static void
+syn_cache_options(tp, sc, cp, cnt)
+	struct tcpcb *tp;
+	register struct syncache *sc;
+	register u_char *cp;
+	int cnt;
+{
+	u_short mss;
+	int opt, optlen;
+
+	for (; cnt > 0; cnt -= optlen, cp += optlen) {
+		opt = cp[0];
+		if (opt == TCPOPT_EOL)
+			break;
+		if (opt == TCPOPT_NOP)
+			optlen = 1;
+		else {
+			optlen = cp[1];
+			if (optlen <= 0)
+				break;
+		}
+		switch (opt) {
+
+		default:
+			continue;
+
+		case TCPOPT_MAXSEG:
+			if (optlen != TCPOLEN_MAXSEG)
+				continue;
+			bcopy((char *)cp + 2, (char *)&mss, sizeof(mss));
+			sc->sc_peermss = ntohs(mss);
+			break;
+
+		case TCPOPT_WINDOW:
+			if (optlen != TCPOLEN_WINDOW)
+				continue;
+			sc->sc_flags |= SCF_SCALE;
+			sc->sc_requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
+			break;
+
+		case TCPOPT_SACK_PERMITTED:
+			if (optlen != TCPOLEN_SACK_PERMITTED)
+				continue;
+			sc->sc_flags |= SCF_SACK;
+			break;
+
+		case TCPOPT_TIMESTAMP:
+			if (optlen != TCPOLEN_TIMESTAMP)
+				continue;
+			sc->sc_flags |= SCF_TSTMP;
+			bcopy((char *)cp + 2, (char *)&sc->sc_tsrecent,
+			    sizeof(sc->sc_tsrecent));
+			NTOHL(sc->sc_tsrecent);
+			break;
+		}
+	}
+	if (tp->t_flags & TF_NOOPT)
+		sc->sc_flags = 0;
+	if ((tp->t_flags & TF_REQ_SCALE) == 0)
+		sc->sc_flags &= ~SCF_SCALE;
+	if ((tp->t_flags & TF_REQ_TSTMP) == 0)
+		sc->sc_flags &= ~SCF_TSTMP;
+	if ((tp->t_flags & TF_REQ_SACK) == 0)
+		sc->sc_flags &= ~SCF_SACK;
+}
+
+/*
+ * The MSS to offer dst, as tcp_mss() works it out for a SYN.
+ */
+static u_short
+syn_cache_mss(dst)
+	struct in_addr dst;
+{
+	struct route ro;
+	register struct rtentry *rt;
+	int mss;
+
+	bzero((caddr_t)&ro, sizeof(ro));
+	ro.ro_dst.sa_family = AF_INET;
+	ro.ro_dst.sa_len = sizeof(ro.ro_dst);
+	((struct sockaddr_in *)&ro.ro_dst)->sin_addr = dst;
+	rtalloc(&ro);
+	if ((rt = ro.ro_rt) == NULL)
+		return (tcp_mssdflt);
+#ifdef RTV_MTU
+	if (rt->rt_rmx.rmx_mtu)
+		mss = rt->rt_rmx.rmx_mtu - sizeof(struct tcpiphdr);
+	else
+#endif
+	{
+		mss = rt->rt_ifp->if_mtu - sizeof(struct tcpiphdr);
+		if (mss > MCLBYTES)
+			mss &= ~(MCLBYTES-1);
+		if (!in_localaddr(dst))
+			mss = min(mss, tcp_mssdflt);
+	}
+	RTFREE(rt);
+	return (max(mss, 32));
+}
+
+/*
+ * Send the SYN-ACK for sc, with the options agreed on.
+ */
+static void
+syn_cache_respond(sc)
+	register struct syncache *sc;
+{
+	register struct mbuf *m;
+	register struct tcpiphdr *ti;
+	u_char *opt;
+	u_short mss;
+	int optlen, tlen;
+
+	m = m_gethdr(M_DONTWAIT, MT_HEADER);
+	if (m == NULL)
+		return;
+	optlen = TCPOLEN_MAXSEG;
+	if (sc->sc_flags & SCF_SCALE)
+		optlen += 4;
+	if (sc->sc_flags & SCF_SACK)
+		optlen += 4;
+	if (sc->sc_flags & SCF_TSTMP)
+		optlen += TCPOLEN_TSTAMP_APPA;
+	tlen = sizeof (struct tcpiphdr) + optlen;
+	m->m_data += max_linkhdr;
+	m->m_len = tlen;
+	m->m_pkthdr.len = tlen;
+	m->m_pkthdr.rcvif = (struct ifnet *) 0;
+	ti = mtod(m, struct tcpiphdr *);
+	bzero((caddr_t)ti, sizeof (struct tcpiphdr));
+	ti->ti_pr = IPPROTO_TCP;
+	ti->ti_len = htons((u_short)(sizeof (struct tcphdr) + optlen));
+	ti->ti_src = sc->sc_dst;
+	ti->ti_dst = sc->sc_src;
+	ti->ti_sport = sc->sc_dport;
+	ti->ti_dport = sc->sc_sport;
+	ti->ti_seq = htonl(sc->sc_iss);
+	ti->ti_ack = htonl(sc->sc_irs + 1);
+	ti->ti_off = (sizeof (struct tcphdr) + optlen) >> 2;
+	ti->ti_flags = TH_SYN|TH_ACK;
+	ti->ti_win = htons(sc->sc_wnd);
+
+	opt = (u_char *)(ti + 1);
+	opt[0] = TCPOPT_MAXSEG;
+	opt[1] = TCPOLEN_MAXSEG;
+	mss = htons(sc->sc_ourmss);
+	bcopy((caddr_t)&mss, (caddr_t)(opt + 2), sizeof(mss));
+	opt += TCPOLEN_MAXSEG;
+	if (sc->sc_flags & SCF_SCALE) {
+		*((u_long *)opt) = htonl(TCPOPT_NOP << 24 |
+		    TCPOPT_WINDOW << 16 | TCPOLEN_WINDOW << 8 |
+		    sc->sc_request_r_scale);
+		opt += 4;
+	}
+	if (sc->sc_flags & SCF_SACK) {
+		*((u_long *)opt) = htonl(TCPOPT_NOP << 24 |
+		    TCPOPT_NOP << 16 | TCPOPT_SACK_PERMITTED << 8 |
+		    TCPOLEN_SACK_PERMITTED);
+		opt += 4;
+	}
+	if (sc->sc_flags & SCF_TSTMP) {
+		u_long *lp = (u_long *)opt;
+
+		*lp++ = htonl(TCPOPT_TSTAMP_HDR);
+		*lp++ = htonl(tcp_now);
+		*lp   = htonl(sc->sc_tsrecent);
+	}
+
+	ti->ti_sum = in_cksum(m, tlen);
+	((struct ip *)ti)->ip_len = tlen;
+	((struct ip *)ti)->ip_ttl = ip_defttl;
+	tcpstat.tcps_sndtotal++;
+	tcpstat.tcps_sndctrl++;
+	(void) ip_output(m, sc->sc_ipopts, (struct route *)0, 0,
+	    (struct ip_moptions *)0);
+}
+
+/*
+ * A SYN in m for the listening socket so.  Answer it from an entry,
+ * or with a cookie if there is no room for one.  iss, if not 0, is
+ * the ISS to use, for a SYN that ended a TIME_WAIT.  m is left to the
+ * caller.
+ */
+void
+tcp_syncache_add(so, m, optp, optlen, iss)
+	struct socket *so;
+	struct mbuf *m;
+	u_char *optp;
+	int optlen;
+	tcp_seq iss;
+{
+	register struct tcpiphdr *ti = mtod(m, struct tcpiphdr *);
+	register struct syncache *sc;
+	struct syncache scs;
+	struct syncachehead *head;
+	int len;
+
+	/*
+	 * RFC1122 4.2.3.10, p. 104: discard bcast/mcast SYN
+	 * in_broadcast() should never return true on a received
+	 * packet with M_BCAST not set.
+	 */
+	if (m->m_flags & (M_BCAST|M_MCAST) ||
+	    IN_MULTICAST(ntohl(ti->ti_dst.s_addr)))
+		return;
+
+	/*
+	 * The SYN again: our SYN-ACK was lost, or is on its way.  One
+	 * with another ISN is the peer's connect() started over; the
+	 * entry is stale, and this SYN gets a new one.
+	 */
+	if ((sc = syn_cache_lookup(ti, &head, &len)) != NULL) {
+		if (sc->sc_irs == ti->ti_seq) {
+			tcpstat.tcps_sc_dupsyn++;
+			syn_cache_respond(sc);
+			return;
+		}
+		tcpstat.tcps_sc_restarted++;
+		syn_cache_free(sc);
+		(void) syn_cache_lookup(ti, &head, &len);
+	}
+
+	bzero((caddr_t)&scs, sizeof(scs));
+	scs.sc_src = ti->ti_src;
+	scs.sc_dst = ti->ti_dst;
+	scs.sc_sport = ti->ti_sport;
+	scs.sc_dport = ti->ti_dport;
+	scs.sc_irs = ti->ti_seq;
+	scs.sc_ourmss = syn_cache_mss(ti->ti_src);
+	scs.sc_wnd = min(so->so_rcv.sb_hiwat, TCP_MAXWIN);
+	while (scs.sc_request_r_scale < TCP_MAX_WINSHIFT &&
+	    TCP_MAXWIN << scs.sc_request_r_scale < TCP_RCVBUF_MAX(so))
+		scs.sc_request_r_scale++;
+	if (optp)
+		syn_cache_options(sototcpcb(so), &scs, optp, optlen);
+
+	sc = NULL;
+	if (syn_cache_count < tcp_syncache_limit &&
+	    len < tcp_syncache_bucketlimit)
+		MALLOC(sc, struct syncache *, sizeof(*sc), M_SYNCACHE,
+		    M_NOWAIT);
+	if (sc == NULL) {
+		tcpstat.tcps_sc_overflow++;
+		if (!tcp_syncookies)
+			return;
+		scs.sc_flags = 0;
+		scs.sc_iss = syn_cookie(&scs);
+#if BSD>=43
+		scs.sc_ipopts = ip_srcroute();
+#endif
+		syn_cache_respond(&scs);
+		if (scs.sc_ipopts)
+			(void) m_free(scs.sc_ipopts);
+		tcpstat.tcps_sc_sendcookie++;
+		return;
+	}
+
+	*sc = scs;
+	if (iss)
+		sc->sc_iss = iss;
+	else
+		sc->sc_iss = tcp_iss;
+	tcp_iss += TCP_ISSINCR/4;
+#if BSD>=43
+	sc->sc_ipopts = ip_srcroute();
+#endif
+	sc->sc_expire = tcp_now + TCPTV_SRTTDFLT;
+	LIST_INSERT_HEAD(head, sc, sc_hash);
+	TAILQ_INSERT_TAIL(&syn_cache_timeq[0], sc, sc_timeq);
+	syn_cache_count++;
+	tcpstat.tcps_sc_added++;
+	syn_cache_respond(sc);
+}
+
+/*
+ * An ACK without a SYN for the listening socket *sop: if it completes
+ * a handshake we answered, from an entry or with a cookie, make the
+ * socket for it and leave it in *sop, in SYN_RECEIVED, for tcp_input()
+ * to go on with.  Returns ENOENT if it completes none, and the ACK
+ * should be answered with a RST; ENOBUFS if there is no room for the
+ * socket, and the ACK should be dropped.  The entry stays then, so
+ * that its SYN-ACK goes again and asks for another ACK.
+ */
+int
+tcp_syncache_get(sop, ti)
+	struct socket **sop;
+	register struct tcpiphdr *ti;
+{
+	register struct syncache *sc;
+	struct syncache scs;
+	struct syncachehead *head;
+	struct socket *so;
+
+	if ((sc = syn_cache_lookup(ti, &head, (int *)0)) != NULL) {
+		if (ti->ti_ack != sc->sc_iss + 1 ||
+		    ti->ti_seq != sc->sc_irs + 1)
+			return (ENOENT);
+	} else if (tcp_syncookies) {
+		bzero((caddr_t)&scs, sizeof(scs));
+		scs.sc_src = ti->ti_src;
+		scs.sc_dst = ti->ti_dst;
+		scs.sc_sport = ti->ti_sport;
+		scs.sc_dport = ti->ti_dport;
+		scs.sc_irs = ti->ti_seq - 1;
+		if (!syn_cookie_check(&scs, ti->ti_ack - 1))
+			return (ENOENT);
+		scs.sc_wnd = min((*sop)->so_rcv.sb_hiwat, TCP_MAXWIN);
+#if BSD>=43
+		scs.sc_ipopts = ip_srcroute();
+#endif
+		tcpstat.tcps_sc_recvcookie++;
+		sc = &scs;
+	} else
+		return (ENOENT);
+
+	so = syn_cache_socket(*sop, sc);
+	if (sc == &scs) {
+		if (scs.sc_ipopts)
+			(void) m_free(scs.sc_ipopts);
+	} else if (so)
+		syn_cache_free(sc);
+	if (so == NULL)
+		return (ENOBUFS);
+	tcpstat.tcps_sc_completed++;
+	*sop = so;
+	return (0);
+}
+
+/*
+ * The socket for the handshake in sc, on head's so_q0, with its tcpcb
+ * in SYN_RECEIVED as it would be had it sent the SYN-ACK itself.
+ */
+static struct socket *
+syn_cache_socket(head, sc)
+	struct socket *head;
+	register struct syncache *sc;
+{
+	register struct socket *so;
+	register struct inpcb *inp;
+	register struct tcpcb *tp;
+
+	so = sonewconn(head, 0);
+	if (so == NULL) {
+		tcpstat.tcps_listendrop++;
+		return (NULL);
+	}
+	inp = sotoinpcb(so);
+	inp->inp_laddr = sc->sc_dst;
+	inp->inp_lport = sc->sc_dport;
+	inp->inp_faddr = sc->sc_src;
+	inp->inp_fport = sc->sc_sport;
+	in_pcbrehash(inp);
+	inp->inp_options = sc->sc_ipopts;
+	sc->sc_ipopts = NULL;
+	tp = intotcpcb(inp);
+	tp->t_template = tcp_template(tp);
+	if (tp->t_template == 0) {
+		(void) soabort(so);
+		return (NULL);
+	}
+
+	tp->t_flags &= ~(TF_REQ_SCALE|TF_REQ_TSTMP|TF_REQ_SACK);
+	if (sc->sc_flags & SCF_SCALE) {
+		tp->t_flags |= TF_REQ_SCALE|TF_RCVD_SCALE;
+		tp->requested_s_scale = sc->sc_requested_s_scale;
+		tp->request_r_scale = sc->sc_request_r_scale;
+	}
+	if (sc->sc_flags & SCF_TSTMP) {
+		tp->t_flags |= TF_REQ_TSTMP|TF_RCVD_TSTMP;
+		tp->ts_recent = sc->sc_tsrecent;
+		tp->ts_recent_age = tcp_now;
+	}
+	if (sc->sc_flags & SCF_SACK)
+		tp->t_flags |= TF_REQ_SACK|TF_SACK_PERMIT;
+	(void) tcp_mss(tp, sc->sc_peermss);
+
+	tp->iss = sc->sc_iss;
+	tp->irs = sc->sc_irs;
+	tcp_sendseqinit(tp);
+	tcp_rcvseqinit(tp);
+	tp->snd_nxt = tp->snd_max = tp->iss + 1;
+	tp->rcv_adv += sc->sc_wnd;
+	tp->last_ack_sent = tp->rcv_nxt;
+	tp->t_state = TCPS_SYN_RECEIVED;
+	tcpstat.tcps_accepts++;
+	return (so);
+}
+
+/*
+ * A RST for the listening socket: the peer gave up on the handshake.
+ */
+void
+tcp_syncache_reset(ti)
+	register struct tcpiphdr *ti;
+{
+	register struct syncache *sc;
+	struct syncachehead *head;
+
+	if ((sc = syn_cache_lookup(ti, &head, (int *)0)) == NULL)
+		return;
+	if (SEQ_LT(ti->ti_seq, sc->sc_irs + 1) ||
+	    SEQ_GT(ti->ti_seq, sc->sc_irs + 1 + sc->sc_wnd))
+		return;
+	syn_cache_free(sc);
+	tcpstat.tcps_sc_reset++;
+}
+
+/*
+ * Called from tcp_slowtimo(): send the SYN-ACKs due again, and drop
+ * the entries that have had their last, or whose listener has gone.
+ */
+void
+tcp_syncache_timer()
+{
+	register struct syncache *sc;
+	struct inpcb *inp;
+	int i;
+
+	for (i = TCP_SYNCACHE_REXMTS; i >= 0; i--)
+		while ((sc = syn_cache_timeq[i].tqh_first) != NULL &&
+		    (long)(sc->sc_expire - tcp_now) <= 0) {
+			inp = in_pcblookup(&tcb, sc->sc_src, sc->sc_sport,
+			    sc->sc_dst, sc->sc_dport, INPLOOKUP_WILDCARD);
+			if (i == TCP_SYNCACHE_REXMTS || inp == NULL ||
+			    (inp->inp_socket->so_options & SO_ACCEPTCONN) == 0) {
+				syn_cache_free(sc);
+				tcpstat.tcps_sc_timedout++;
+				continue;
+			}
+			TAILQ_REMOVE(&syn_cache_timeq[i], sc, sc_timeq);
+			sc->sc_rxtshift = i + 1;
+			sc->sc_expire = tcp_now +
+			    (TCPTV_SRTTDFLT << sc->sc_rxtshift);
+			TAILQ_INSERT_TAIL(&syn_cache_timeq[i + 1], sc, sc_timeq);
+			syn_cache_respond(sc);
+			tcpstat.tcps_sc_retransmitted++;
+		}
+}
+
+/*
+ * The top 24 bits of a cookie for sc, made in period count.
+ */
+static u_long
+syn_cookie_hash(sc, count)
+	register struct syncache *sc;
+	u_long count;
+{
+	u_long h = syn_cache_secret[1];
+
+	SYN_MIX(h, sc->sc_src.s_addr);
+	SYN_MIX(h, sc->sc_dst.s_addr);
+	SYN_MIX(h, (u_long)sc->sc_sport << 16 | sc->sc_dport);
+	SYN_MIX(h, sc->sc_irs);
+	SYN_MIX(h, count);
+	SYN_MIX(h, syn_cache_secret[2]);
+	return (h & ~0xff);
+}
+
+static tcp_seq
+syn_cookie(sc)
+	register struct syncache *sc;
+{
+	u_long count = tcp_now / SYN_COOKIE_PERIOD;
+	int mss = sc->sc_peermss ? sc->sc_peermss : 536;
+	int i;
+
+	for (i = 7; i > 0 && syn_cookie_mss[i] > mss; i--)
+		continue;
+	return (syn_cookie_hash(sc, count) | (count & 0x1f) << 3 | i);
+}
+
+/*
+ * Whether cookie is one syn_cookie() made for sc this period or the
+ * last; if so, take the MSS it carries.
+ */
+static int
+syn_cookie_check(sc, cookie)
+	register struct syncache *sc;
+	tcp_seq cookie;
+{
+	u_long count = tcp_now / SYN_COOKIE_PERIOD;
+	u_long age = (count - (cookie >> 3)) & 0x1f;
+
+	if (age > 1 || syn_cookie_hash(sc, count - age) != (cookie & ~0xff))
+		return (0);
+	sc->sc_iss = cookie;
+	sc->sc_peermss = syn_cookie_mss[cookie & 7];
+	return (1);
+}
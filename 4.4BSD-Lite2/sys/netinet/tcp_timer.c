@@ -58,6 +58,7 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/tcpip.h>
 
 int	tcp_keepidle = TCPTV_KEEP_IDLE;
@@ -70,71 +71,105 @@ int	tcp_maxidle;
 extern	int tcp_maxpersistidle;
 #endif /* TUBA_INCLUDE */
 
+/*
+ * Armed timers hang off a hashed timing wheel indexed by the
+ * tcp_timer_ticks value they expire at, so a tick only looks at the
+ * timers due then instead of every connection.  The wheel spans
+ * TCP_TIMERWHEEL ticks; that covers every default timeout including
+ * the two hour keepalive, and a longer one just sits in its slot
+ * for extra turns of the wheel.
+ */
+#define	TCP_TIMERWHEEL	16384		/* power of 2 */
+LIST_HEAD(tcptimerhead, tcptimer);
+static struct tcptimerhead tcp_timerwheel[TCP_TIMERWHEEL];
+static u_long tcp_timer_ticks;		/* slow timeouts run so far */
+
+/*
+ * Arm timer to go off nticks slow timeouts from now, or disarm
+ * it if nticks is 0.
+ */
+void
+tcp_timer_arm(tp, timer, nticks)
+	register struct tcpcb *tp;
+	int timer, nticks;
+{
+	register struct tcptimer *tt = &tp->t_timer[timer];
+
+	if (tt->tt_list.le_prev) {
+		if (nticks && tt->tt_expire == tcp_timer_ticks + nticks)
+			return;
+		LIST_REMOVE(tt, tt_list);
+		tt->tt_list.le_prev = NULL;
+	}
+	if (nticks <= 0)
+		return;
+	tt->tt_tp = tp;
+	tt->tt_expire = tcp_timer_ticks + nticks;
+	LIST_INSERT_HEAD(&tcp_timerwheel[tt->tt_expire & (TCP_TIMERWHEEL-1)],
+	    tt, tt_list);
+}
+
 /*
  * Fast timeout routine for processing delayed acks
  */
 void
 tcp_fasttimo()
 {
-	register struct inpcb *inp;
 	register struct tcpcb *tp;
 	int s = splnet();
 
-	inp = tcb.inp_next;
-	if (inp)
-	for (; inp != &tcb; inp = inp->inp_next)
-		if ((tp = (struct tcpcb *)inp->inp_ppcb) &&
-		    (tp->t_flags & TF_DELACK)) {
-			tp->t_flags &= ~TF_DELACK;
-			tp->t_flags |= TF_ACKNOW;
-			tcpstat.tcps_delack++;
-			(void) tcp_output(tp);
-		}
+	while ((tp = tcp_delacks.lh_first) != NULL) {
+		TCP_CLR_DELACK(tp);
+		tp->t_flags |= TF_ACKNOW;
+		tcpstat.tcps_delack++;
+		(void) tcp_output(tp);
+	}
 	splx(s);
 }
 
 /*
  * Tcp protocol timeout routine called every 500 ms.
- * Updates the timers in all active tcb's and
- * causes finite state machine actions if timers expire.
+ * Runs the timers that expire on this tick and
+ * causes finite state machine actions.
  */
 void
 tcp_slowtimo()
 {
-	register struct inpcb *ip, *ipnxt;
+	register struct tcptimer *tt, *ttnxt;
 	register struct tcpcb *tp;
+	struct tcptimerhead expired;
 	int s = splnet();
-	register int i;
 
 	tcp_maxidle = tcp_keepcnt * tcp_keepintvl;
+	tcp_timer_ticks++;
 	/*
-	 * Search through tcb's and update active timers.
+	 * Move the timers due now off the wheel first, so that
+	 * timers armed or canceled by the handlers don't disturb
+	 * the walk.
 	 */
-	ip = tcb.inp_next;
-	if (ip == 0) {
-		splx(s);
-		return;
+	LIST_INIT(&expired);
+	tt = tcp_timerwheel[tcp_timer_ticks & (TCP_TIMERWHEEL-1)].lh_first;
+	for (; tt; tt = ttnxt) {
+		ttnxt = tt->tt_list.le_next;
+		if (tt->tt_expire != tcp_timer_ticks)
+			continue;
+		LIST_REMOVE(tt, tt_list);
+		LIST_INSERT_HEAD(&expired, tt, tt_list);
 	}
-	for (; ip != &tcb; ip = ipnxt) {
-		ipnxt = ip->inp_next;
-		tp = intotcpcb(ip);
-		if (tp == 0 || tp->t_state == TCPS_LISTEN)
+	while ((tt = expired.lh_first) != NULL) {
+		LIST_REMOVE(tt, tt_list);
+		tt->tt_list.le_prev = NULL;
+		tp = tt->tt_tp;
+		if (tp->t_state == TCPS_LISTEN)
 			continue;
-		for (i = 0; i < TCPT_NTIMERS; i++) {
-			if (tp->t_timer[i] && --tp->t_timer[i] == 0) {
-				(void) tcp_usrreq(tp->t_inpcb->inp_socket,
-				    PRU_SLOWTIMO, (struct mbuf *)0,
-				    (struct mbuf *)i, (struct mbuf *)0);
-				if (ipnxt->inp_prev != ip)
-					goto tpgone;
-			}
-		}
-		tp->t_idle++;
-		if (tp->t_rtt)
-			tp->t_rtt++;
-tpgone:
-		;
+		(void) tcp_usrreq(tp->t_inpcb->inp_socket,
+		    PRU_SLOWTIMO, (struct mbuf *)0,
+		    (struct mbuf *)(tt - tp->t_timer), (struct mbuf *)0);
 	}
+	tcp_syncache_timer();
+	tcp_twtimer();
+	if (sbpressure())
+		tcp_sbreclaim();
 	tcp_iss += TCP_ISSINCR/PR_SLOWHZ;		/* increment iss */
 #ifdef TCP_COMPAT_42
 	if ((int)tcp_iss < 0)
@@ -155,7 +190,7 @@ tcp_canceltimers(tp)
 	register int i;
 
 	for (i = 0; i < TCPT_NTIMERS; i++)
-		tp->t_timer[i] = 0;
+		TCP_TIMER_DISARM(tp, i);
 }
 
 int	tcp_backoff[TCP_MAXRXTSHIFT + 1] =
@@ -183,8 +218,8 @@ tcp_timers(tp, timer)
 	 */
 	case TCPT_2MSL:
 		if (tp->t_state != TCPS_TIME_WAIT &&
-		    tp->t_idle <= tcp_maxidle)
-			tp->t_timer[TCPT_2MSL] = tcp_keepintvl;
+		    TCP_IDLE(tp) <= tcp_maxidle)
+			TCP_TIMER_ARM(tp, TCPT_2MSL, tcp_keepintvl);
 		else
 			tp = tcp_close(tp);
 		break;
@@ -206,7 +241,7 @@ tcp_timers(tp, timer)
 		rexmt = TCP_REXMTVAL(tp) * tcp_backoff[tp->t_rxtshift];
 		TCPT_RANGESET(tp->t_rxtcur, rexmt,
 		    tp->t_rttmin, TCPTV_REXMTMAX);
-		tp->t_timer[TCPT_REXMT] = tp->t_rxtcur;
+		TCP_TIMER_ARM(tp, TCPT_REXMT, tp->t_rxtcur);
 		/*
 		 * If losing, let the lower level know and try for
 		 * a better route.  Also, if we backed off this far,
@@ -221,42 +256,22 @@ tcp_timers(tp, timer)
 			tp->t_srtt = 0;
 		}
 		tp->snd_nxt = tp->snd_una;
+		/*
+		 * Go back N: the peer may have discarded what it SACKed
+		 * (RFC 2018, section 8), so forget the scoreboard.
+		 */
+		tp->t_flags &= ~TF_SACKRECOVERY;
+		tp->snd_nsacked = 0;
 		/*
 		 * If timing a segment in this window, stop the timer.
 		 */
 		tp->t_rtt = 0;
 		/*
-		 * Close the congestion window down to one segment
-		 * (we'll open it by one segment for each ack we get).
-		 * Since we probably have a window's worth of unacked
-		 * data accumulated, this "slow start" keeps us from
-		 * dumping all that data as back-to-back packets (which
-		 * might overwhelm an intermediate gateway).
-		 *
-		 * There are two phases to the opening: Initially we
-		 * open by one mss on each ack.  This makes the window
-		 * size increase exponentially with time.  If the
-		 * window is larger than the path can handle, this
-		 * exponential growth results in dropped packet(s)
-		 * almost immediately.  To get more time between 
-		 * drops but still "push" the network to take advantage
-		 * of improving conditions, we switch from exponential
-		 * to linear window opening at some threshhold size.
-		 * For a threshhold, we use half the current window
-		 * size, truncated to a multiple of the mss.
-		 *
-		 * (the minimum cwnd that will give us exponential
-		 * growth is 2 mss.  We don't allow the threshhold
-		 * to go below this.)
+		 * Let the congestion control close the window;
+		 * Reno slow starts from one segment.
 		 */
-		{
-		u_int win = min(tp->snd_wnd, tp->snd_cwnd) / 2 / tp->t_maxseg;
-		if (win < 2)
-			win = 2;
-		tp->snd_cwnd = tp->t_maxseg;
-		tp->snd_ssthresh = win * tp->t_maxseg;
+		(*tp->t_cc->cc_rto)(tp);
 		tp->t_dupacks = 0;
-		}
 		(void) tcp_output(tp);
 		break;
 
@@ -274,8 +289,8 @@ tcp_timers(tp, timer)
 		 * backoff that we would use if retransmitting.
 		 */
 		if (tp->t_rxtshift == TCP_MAXRXTSHIFT &&
-		    (tp->t_idle >= tcp_maxpersistidle ||
-		    tp->t_idle >= TCP_REXMTVAL(tp) * tcp_totbackoff)) {
+		    (TCP_IDLE(tp) >= tcp_maxpersistidle ||
+		    TCP_IDLE(tp) >= TCP_REXMTVAL(tp) * tcp_totbackoff)) {
 			tcpstat.tcps_persistdrop++;
 			tp = tcp_drop(tp, ETIMEDOUT);
 			break;
@@ -296,7 +311,7 @@ tcp_timers(tp, timer)
 			goto dropit;
 		if (tp->t_inpcb->inp_socket->so_options & SO_KEEPALIVE &&
 		    tp->t_state <= TCPS_CLOSE_WAIT) {
-		    	if (tp->t_idle >= tcp_keepidle + tcp_maxidle)
+		    	if (TCP_IDLE(tp) >= tcp_keepidle + tcp_maxidle)
 				goto dropit;
 			/*
 			 * Send a packet designed to force a response
@@ -322,9 +337,9 @@ tcp_timers(tp, timer)
 			tcp_respond(tp, tp->t_template, (struct mbuf *)NULL,
 			    tp->rcv_nxt, tp->snd_una - 1, 0);
 #endif
-			tp->t_timer[TCPT_KEEP] = tcp_keepintvl;
+			TCP_TIMER_ARM(tp, TCPT_KEEP, tcp_keepintvl);
 		} else
-			tp->t_timer[TCPT_KEEP] = tcp_keepidle;
+			TCP_TIMER_ARM(tp, TCPT_KEEP, tcp_keepidle);
 		break;
 	dropit:
 		tcpstat.tcps_keepdrops++;
@@ -0,0 +1,377 @@
+/*
+ * TIME_WAIT without a socket.
+ *
+ * A connection we closed first waits 2MSL in TIME_WAIT, to answer a
+ * FIN sent again and to keep its sequence space from the next
+ * connection between the same ports.  It used to do so with its
+ * socket, inpcb and tcpcb, on the tcb list that every lookup walks;
+ * a server making many short connections had most of its pcbs there.
+ * Now, once the socket has been closed, tcp_twstart() keeps what the
+ * state needs in a struct tcptw and lets the rest go with tcp_close().
+ * A connection in TIME_WAIT whose socket is still open keeps its
+ * tcpcb, as do any past tcp_tw_limit.
+ *
+ * Entries are hashed on the connection's addresses and ports, and
+ * are all on one queue in the order they were made or last had their
+ * timer restarted; since all wait the same 2MSL, tcp_twtimer() looks
+ * only at its head.  tcp_input() comes to tcp_twcheck() with a
+ * segment that matches no connected pcb, which answers it as
+ * TIME_WAIT in tcp_input() would:
+ *
+ *	a RST in the window ends the entry;
+ *	a SYN above rcv_nxt ends it and goes to the listener, with
+ *	    an ISS past anything the old connection sent;
+ *	a FIN sent again is acked, and the timer restarted;
+ *	any other SYN, or ACK but a duplicate one, is acked.
+ *
+ * Timestamps are checked and sent as they were on the connection.
+ * A connect() to the peer of an entry takes its place in the same
+ * way, through tcp_twreuse().
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+#include <sys/mbuf.h>
+#include <sys/protosw.h>
+#include <sys/socket.h>
+#include <sys/socketvar.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip_var.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_fsm.h>
+#include <netinet/tcp_seq.h>
+#include <netinet/tcp_timer.h>
+#include <netinet/tcp_var.h>
+#include <netinet/tcpip.h>
+
+#define	TCP_TW_HASHSIZE		4096	/* chains */
+
+#define TSTMP_LT(a,b)	((int)((a)-(b)) < 0)
+
+int	tcp_tw_limit = 32768;		/* entries at most */
+
+struct tcptw {
+	LIST_ENTRY(tcptw) tw_hash;	/* hash chain */
+	TAILQ_ENTRY(tcptw) tw_timeq;	/* on tw_timeq */
+	struct	in_addr tw_laddr;
+	struct	in_addr tw_faddr;
+	u_short	tw_lport;
+	u_short	tw_fport;
+	tcp_seq	tw_rcv_nxt;		/* past the peer's FIN */
+	tcp_seq	tw_snd_nxt;		/* past ours */
+	u_long	tw_tsrecent;		/* timestamp to echo */
+	u_long	tw_expire;		/* tcp_now when the 2MSL is up */
+	u_short	tw_win;			/* window to offer, scaled */
+	u_char	tw_rcv_scale;		/* its scale */
+	u_char	tw_flags;
+};
+
+#define	TWF_TSTMP	0x01		/* both do timestamps */
+
+static LIST_HEAD(tcptwhead, tcptw) *tw_hashtbl;
+static u_long tw_hashmask;
+static TAILQ_HEAD(, tcptw) tw_timeq;
+static int tw_count;		/* entries */
+
+#define	TW_HASH(faddr, fport, laddr, lport) \
+	(&tw_hashtbl[INP_CONNHASH((faddr).s_addr, fport, \
+	    (laddr).s_addr, lport, tw_hashmask)])
+
+static struct tcptw *tw_lookup __P((struct in_addr, u_int,
+	    struct in_addr, u_int));
+static void tw_free __P((struct tcptw *));
+static void tw_respond __P((struct tcptw *));
+
+void
+tcp_twinit()
+{
+
+	tw_hashtbl = hashinit(TCP_TW_HASHSIZE, M_TCPTW,
+	    &tw_hashmask);
+	TAILQ_INIT(&tw_timeq);
+}
+
+static struct tcptw *
+tw_lookup(faddr, fport_arg, laddr, lport_arg)
+	struct in_addr faddr, laddr;
+	u_int fport_arg, lport_arg;
+{
+	register struct tcptw *tw;
+	u_short fport = fport_arg, lport = lport_arg;
+
+	if (tw_count == 0)
+		return (NULL);
+	tw = TW_HASH(faddr, fport, laddr, lport)->lh_first;
+	for (; tw; tw = tw->tw_hash.le_next)
+		if (tw->tw_faddr.s_addr == faddr.s_addr &&
+		    tw->tw_laddr.s_addr == laddr.s_addr &&
+		    tw->tw_fport == fport &&
+		    tw->tw_lport == lport)
+			break;
+	return (tw);
+}
+
+static void
+tw_free(tw)
+	register struct tcptw *tw;
+{
+
+	LIST_REMOVE(tw, tw_hash);
+	TAILQ_REMOVE(&tw_timeq, tw, tw_timeq);
+	FREE(tw, M_TCPTW);
+	tw_count--;
+}
+
+/*
+ * tp has entered TIME_WAIT and its socket is going.  Keep what the
+ * state needs in an entry and close tp; returns what tcp_close()
+ * does, or tp itself if there is no room for an entry.
+ */
+struct tcpcb *
+tcp_twstart(tp)
+	register struct tcpcb *tp;
+{
+	register struct inpcb *inp = tp->t_inpcb;
+	register struct tcptw *tw;
+	long win;
+
+	if (tw_count >= tcp_tw_limit)
+		return (tp);
+	MALLOC(tw, struct tcptw *, sizeof(*tw), M_TCPTW, M_NOWAIT);
+	if (tw == NULL)
+		return (tp);
+	tw->tw_laddr = inp->inp_laddr;
+	tw->tw_faddr = inp->inp_faddr;
+	tw->tw_lport = inp->inp_lport;
+	tw->tw_fport = inp->inp_fport;
+	tw->tw_rcv_nxt = tp->rcv_nxt;
+	tw->tw_snd_nxt = tp->snd_max;
+	tw->tw_flags = 0;
+	tw->tw_tsrecent = 0;
+	if ((tp->t_flags & (TF_REQ_TSTMP|TF_RCVD_TSTMP)) ==
+	    (TF_REQ_TSTMP|TF_RCVD_TSTMP)) {
+		tw->tw_flags |= TWF_TSTMP;
+		tw->tw_tsrecent = tp->ts_recent;
+	}
+	win = tp->rcv_adv - tp->rcv_nxt;
+	if (win < 0)
+		win = 0;
+	if (win > (long)TCP_MAXWIN << tp->rcv_scale)
+		win = (long)TCP_MAXWIN << tp->rcv_scale;
+	tw->tw_win = win >> tp->rcv_scale;
+	tw->tw_rcv_scale = tp->rcv_scale;
+	tw->tw_expire = tcp_now + 2 * TCPTV_MSL;
+	LIST_INSERT_HEAD(TW_HASH(tw->tw_faddr, tw->tw_fport,
+	    tw->tw_laddr, tw->tw_lport), tw, tw_hash);
+	TAILQ_INSERT_TAIL(&tw_timeq, tw, tw_timeq);
+	tw_count++;
+	tcpstat.tcps_tw_added++;
+	return (tcp_close(tp));
+}
+
+/*
+ * Send the ACK for tw: rcv_nxt, with a timestamp if the connection
+ * had them.
+ */
+static void
+tw_respond(tw)
+	register struct tcptw *tw;
+{
+	register struct mbuf *m;
+	register struct tcpiphdr *ti;
+	int optlen, tlen;
+
+	m = m_gethdr(M_DONTWAIT, MT_HEADER);
+	if (m == NULL)
+		return;
+	optlen = 0;
+	if (tw->tw_flags & TWF_TSTMP)
+		optlen = TCPOLEN_TSTAMP_APPA;
+	tlen = sizeof (struct tcpiphdr) + optlen;
+	m->m_data += max_linkhdr;
+	m->m_len = tlen;
+	m->m_pkthdr.len = tlen;
+	m->m_pkthdr.rcvif = (struct ifnet *) 0;
+	ti = mtod(m, struct tcpiphdr *);
+	bzero((caddr_t)ti, sizeof (struct tcpiphdr));
+	ti->ti_pr = IPPROTO_TCP;
+	ti->ti_len = htons((u_short)(sizeof (struct tcphdr) + optlen));
+	ti->ti_src = tw->tw_laddr;
+	ti->ti_dst = tw->tw_faddr;
+	ti->ti_sport = tw->tw_lport;
+	ti->ti_dport = tw->tw_fport;
+	ti->ti_seq = htonl(tw->tw_snd_nxt);
+	ti->ti_ack = htonl(tw->tw_rcv_nxt);
+	ti->ti_off = (sizeof (struct tcphdr) + optlen) >> 2;
+	ti->ti_flags = TH_ACK;
+	ti->ti_win = htons(tw->tw_win);
+	if (tw->tw_flags & TWF_TSTMP) {
+		u_long *lp = (u_long *)(ti + 1);
+
+		*lp++ = htonl(TCPOPT_TSTAMP_HDR);
+		*lp++ = htonl(tcp_now);
+		*lp   = htonl(tw->tw_tsrecent);
+	}
+
+	ti->ti_sum = in_cksum(m, tlen);
+	((struct ip *)ti)->ip_len = tlen;
+	((struct ip *)ti)->ip_ttl = ip_defttl;
+	tcpstat.tcps_sndtotal++;
+	tcpstat.tcps_sndacks++;
+	(void) ip_output(m, (struct mbuf *)0, (struct route *)0, 0,
+	    (struct ip_moptions *)0);
+}
+
+/*
+ * A segment ti, in host order, that matched no connected pcb: if it
+ * is for an entry, answer it as TIME_WAIT would.  Returns 1 if that
+ * is all, and the segment should be dropped; 0 if tcp_input() should
+ * go on with it, as when there is no entry, or a SYN has ended one.
+ * The SYN is then to be answered with *issp as our ISS.  optp and
+ * optlen are the options not yet parsed, and ts_present and ts_val
+ * the timestamp, as tcp_input() has them.
+ */
+int
+tcp_twcheck(ti, optp, optlen, ts_present, ts_val, issp)
+	register struct tcpiphdr *ti;
+	u_char *optp;
+	int optlen, ts_present;
+	u_long ts_val;
+	int *issp;
+{
+	register struct tcptw *tw;
+	int tiflags = ti->ti_flags;
+	int cnt, opt, olen;
+	long win;
+
+	tw = tw_lookup(ti->ti_src, ti->ti_sport, ti->ti_dst, ti->ti_dport);
+	if (tw == NULL)
+		return (0);
+
+	if (optp && (tw->tw_flags & TWF_TSTMP))
+		for (cnt = optlen; cnt > 0; cnt -= olen, optp += olen) {
+			opt = optp[0];
+			if (opt == TCPOPT_EOL)
+				break;
+			if (opt == TCPOPT_NOP)
+				olen = 1;
+			else {
+				olen = optp[1];
+				if (olen <= 0)
+					break;
+			}
+			if (opt == TCPOPT_TIMESTAMP &&
+			    olen == TCPOLEN_TIMESTAMP) {
+				ts_present = 1;
+				bcopy((char *)optp + 2, (char *)&ts_val,
+				    sizeof(ts_val));
+				NTOHL(ts_val);
+			}
+		}
+	if ((tw->tw_flags & TWF_TSTMP) == 0)
+		ts_present = 0;
+
+	/*
+	 * A RST in the window closes the connection, as in any other
+	 * state; one outside it is dropped.
+	 */
+	if (tiflags & TH_RST) {
+		win = (long)tw->tw_win << tw->tw_rcv_scale;
+		if (SEQ_GEQ(ti->ti_seq, tw->tw_rcv_nxt) &&
+		    SEQ_LT(ti->ti_seq, tw->tw_rcv_nxt + max(win, 1))) {
+			tw_free(tw);
+			tcpstat.tcps_tw_reset++;
+		}
+		return (1);
+	}
+
+	/* RFC 1323 PAWS */
+	if (ts_present && TSTMP_LT(ts_val, tw->tw_tsrecent)) {
+		tcpstat.tcps_rcvduppack++;
+		tcpstat.tcps_pawsdrop++;
+		tw_respond(tw);
+		return (1);
+	}
+
+	/*
+	 * A new connection request above the old sequence numbers
+	 * ends TIME_WAIT; the listener, if any, takes it from here.
+	 */
+	if ((tiflags & (TH_SYN|TH_ACK)) == TH_SYN &&
+	    SEQ_GT(ti->ti_seq, tw->tw_rcv_nxt)) {
+		*issp = tw->tw_snd_nxt + TCP_ISSINCR;
+		tw_free(tw);
+		tcpstat.tcps_tw_reused++;
+		return (0);
+	}
+
+	if ((tiflags & (TH_SYN|TH_ACK)) == 0)
+		return (1);
+
+	/*
+	 * The peer's FIN again: our ACK of it was lost.  Ack it and
+	 * restart the 2MSL.
+	 */
+	if (tiflags & TH_FIN) {
+		if (ts_present && ti->ti_seq + 1 == tw->tw_rcv_nxt)
+			tw->tw_tsrecent = ts_val;
+		TAILQ_REMOVE(&tw_timeq, tw, tw_timeq);
+		tw->tw_expire = tcp_now + 2 * TCPTV_MSL;
+		TAILQ_INSERT_TAIL(&tw_timeq, tw, tw_timeq);
+		tw_respond(tw);
+		return (1);
+	}
+
+	/* ack anything but a duplicate ACK, lest we get into ACK wars */
+	if (ti->ti_len || (tiflags & TH_SYN) || ti->ti_seq != tw->tw_rcv_nxt) {
+		tcpstat.tcps_rcvduppack++;
+		tcpstat.tcps_rcvdupbyte += ti->ti_len;
+		tw_respond(tw);
+	}
+	return (1);
+}
+
+/*
+ * inp is connecting to the peer of an entry: end it, and return the
+ * ISS for inp, past anything the old connection sent; 0 if there is
+ * no entry.
+ */
+tcp_seq
+tcp_twreuse(inp)
+	register struct inpcb *inp;
+{
+	register struct tcptw *tw;
+	tcp_seq iss;
+
+	tw = tw_lookup(inp->inp_faddr, inp->inp_fport,
+	    inp->inp_laddr, inp->inp_lport);
+	if (tw == NULL)
+		return (0);
+	iss = tw->tw_snd_nxt + TCP_ISSINCR;
+	tw_free(tw);
+	tcpstat.tcps_tw_reused++;
+	return (iss);
+}
+
+/*
+ * Called from tcp_slowtimo(): drop the entries whose 2MSL is up.
+ */
+void
+tcp_twtimer()
+{
+	register struct tcptw *tw;
+
+	while ((tw = tw_timeq.tqh_first) != NULL &&
+	    (long)(tw->tw_expire - tcp_now) <= 0) {
+		tw_free(tw);
+		tcpstat.tcps_tw_expired++;
+	}
+}
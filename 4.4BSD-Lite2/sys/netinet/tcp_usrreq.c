@@ -56,6 +56,7 @@
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
 #include <netinet/tcp_var.h>
+#include <netinet/tcp_cc.h>
 #include <netinet/tcpip.h>
 #include <netinet/tcp_debug.h>
 
@@ -160,6 +161,8 @@ tcp_usrreq(so, req, m, nam, control)
 			tp = tcp_disconnect(tp);
 		else
 			tp = tcp_close(tp);
+		if (tp && tp->t_state == TCPS_TIME_WAIT)
+			tp = tcp_twstart(tp);
 		break;
 
 	/*
@@ -205,13 +208,16 @@ tcp_usrreq(so, req, m, nam, control)
 		}
 		/* Compute window scaling to request.  */
 		while (tp->request_r_scale < TCP_MAX_WINSHIFT &&
-		    (TCP_MAXWIN << tp->request_r_scale) < so->so_rcv.sb_hiwat)
+		    (TCP_MAXWIN << tp->request_r_scale) < TCP_RCVBUF_MAX(so))
 			tp->request_r_scale++;
 		soisconnecting(so);
 		tcpstat.tcps_connattempt++;
 		tp->t_state = TCPS_SYN_SENT;
-		tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT;
-		tp->iss = tcp_iss; tcp_iss += TCP_ISSINCR/4;
+		TCP_TIMER_ARM(tp, TCPT_KEEP, TCPTV_KEEP_INIT);
+		tp->iss = tcp_twreuse(inp);
+		if (tp->iss == 0)
+			tp->iss = tcp_iss;
+		tcp_iss += TCP_ISSINCR/4;
 		tcp_sendseqinit(tp);
 		error = tcp_output(tp);
 		break;
@@ -362,6 +368,7 @@ tcp_ctloutput(op, so, level, optname, mp)
 	register struct tcpcb *tp;
 	register struct mbuf *m;
 	register int i;
+	struct tcp_cc *cc;
 
 	s = splnet();
 	inp = sotoinpcb(so);
@@ -400,6 +407,16 @@ tcp_ctloutput(op, so, level, optname, mp)
 				error = EINVAL;
 			break;
 
+		case TCP_CONGESTION:
+			if (m == NULL)
+				error = EINVAL;
+			else if ((cc = tcp_cc_lookup(mtod(m, char *),
+			    m->m_len)) == NULL)
+				error = ENOENT;
+			else if (cc != tp->t_cc)
+				error = tcp_cc_attach(tp, cc);
+			break;
+
 		default:
 			error = ENOPROTOOPT;
 			break;
@@ -419,6 +436,12 @@ tcp_ctloutput(op, so, level, optname, mp)
 		case TCP_MAXSEG:
 			*mtod(m, int *) = tp->t_maxseg;
 			break;
+		case TCP_CONGESTION:
+			for (i = 0; tp->t_cc->cc_name[i]; i++)
+				;
+			m->m_len = i + 1;
+			bcopy(tp->t_cc->cc_name, mtod(m, caddr_t), m->m_len);
+			break;
 		default:
 			error = ENOPROTOOPT;
 			break;
@@ -450,6 +473,10 @@ tcp_attach(so)
 		error = soreserve(so, tcp_sendspace, tcp_recvspace);
 		if (error)
 			return (error);
+		if (tcp_do_autosndbuf)
+			so->so_snd.sb_flags |= SB_AUTOSIZE;
+		if (tcp_do_autorcvbuf)
+			so->so_rcv.sb_flags |= SB_AUTOSIZE;
 	}
     // 分配inpcb
     // 并初始化
@@ -37,17 +37,58 @@
  * Kernel variables for tcp.
  */
 
+/*
+ * A tcp timer.  An armed timer sits on the timer wheel slot for the
+ * tick it expires at; see tcp_timer.c.
+ */
+struct tcptimer {
+	LIST_ENTRY(tcptimer) tt_list;	/* wheel slot, or expired list */
+	u_long	tt_expire;		/* tcp_timer_ticks when it fires */
+	struct	tcpcb *tt_tp;		/* back pointer */
+};
+
+/*
+ * A range of sequence space, [start, end).  The sender's scoreboard
+ * keeps the ranges the peer has SACKed above snd_una, sorted and
+ * disjoint; the holes between them are what may need retransmitting.
+ */
+struct sackblk {
+	tcp_seq	start;
+	tcp_seq	end;
+};
+#define	TCP_SACK_MAXBLKS	32	/* scoreboard size */
+#define	TCP_SACK_MAXOPT		4	/* blocks in one SACK option */
+
+/*
+ * A range of out of order data in the reassembly queue.  The ranges
+ * of a connection are disjoint and do not touch, kept in sequence
+ * order in an array; the data of each is one mbuf chain.
+ */
+struct tcpqent {
+	tcp_seq	tqe_start;		/* first sequence number */
+	tcp_seq	tqe_end;		/* past the last one */
+	struct	mbuf *tqe_m;		/* the data */
+	struct	mbuf *tqe_last;		/* last mbuf of tqe_m */
+	u_long	tqe_mbcnt;		/* mbuf storage of tqe_m */
+	int	tqe_flags;		/* TH_FIN if a FIN follows */
+};
+#define	TCP_REASS_MINQ	8		/* initial size of t_segq[] */
+
 /*
  * Tcp control block, one per tcp; fields:
  */
 
 struct tcpcb {
-	struct	tcpiphdr *seg_next;	/* sequencing queue */
-	struct	tcpiphdr *seg_prev;
+	struct	tcpqent *t_segq;	/* reassembly queue */
+	int	t_segqlen;		/* ranges in t_segq[] */
+	int	t_segqsize;		/* room in t_segq[] */
+	u_long	t_segqmbcnt;		/* mbuf storage queued, bounded
+					 * by so_rcv.sb_mbmax
+					 */
     // 保持当前一个tcp的状态，
     // 包含状态转义图中的状态CLOSED
 	short	t_state;		/* state of this connection */
-	short	t_timer[TCPT_NTIMERS];	/* tcp timers */
+	struct	tcptimer t_timer[TCPT_NTIMERS];	/* tcp timers */
 	short	t_rxtshift;		/* log(2) of rexmt exp. backoff */
 	short	t_rxtcur;		/* current retransmit value */
 	short	t_dupacks;		/* consecutive dup acks recd */
@@ -64,9 +105,13 @@ struct tcpcb {
 #define	TF_REQ_TSTMP	0x0080		/* have/will request timestamps */
 #define	TF_RCVD_TSTMP	0x0100		/* a timestamp was received in SYN */
 #define	TF_SACK_PERMIT	0x0200		/* other side said I could SACK */
+#define	TF_REQ_SACK	0x0400		/* have/will request SACK */
+#define	TF_SACKRECOVERY	0x0800		/* in SACK loss recovery */
+#define	TF_SACKNEW	0x1000		/* this segment SACKed new data */
 
 	struct	tcpiphdr *t_template;	/* skeletal packet for transmit */
 	struct	inpcb *t_inpcb;		/* back pointer to internet pcb */
+	LIST_ENTRY(tcpcb) t_delack;	/* on tcp_delacks while TF_DELACK */
 /*
  * The following fields are used as in the protocol specification.
  * See RFC783, Dec. 1981, page 21.
@@ -99,12 +144,15 @@ struct tcpcb {
 					 * for slow start exponential to
 					 * linear switch
 					 */
+	struct	tcp_cc *t_cc;		/* congestion control module */
+	caddr_t	t_ccstate;		/* its state for this connection */
 /*
  * transmit timing stuff.  See below for scale of srtt and rttvar.
  * "Variance" is actually smoothed difference.
  */
-	u_short	t_idle;			/* inactivity time */
-	short	t_rtt;			/* round trip time */
+	u_long	t_rcvtime;		/* tcp_now at last segment received */
+	short	t_rtt;			/* nonzero if timing a segment */
+	u_long	t_rtttime;		/* tcp_now when timing started */
 	tcp_seq	t_rtseq;		/* sequence number being timed */
 	short	t_srtt;			/* smoothed round-trip time */
 	short	t_rttvar;		/* variance in round-trip time */
@@ -127,13 +175,70 @@ struct tcpcb {
 	u_long	ts_recent_age;		/* when last updated */
 	tcp_seq	last_ack_sent;
 
+/* RFC 2018 SACK and RFC 6675 loss recovery */
+	struct	sackblk snd_sacked[TCP_SACK_MAXBLKS];	/* scoreboard */
+	int	snd_nsacked;		/* blocks in snd_sacked[] */
+	tcp_seq	snd_recover;		/* snd_max when recovery began */
+	tcp_seq	snd_rxmit;		/* highest retransmitted in recovery */
+	tcp_seq	rcv_lastsack;		/* latest out of order segment */
+
+/* socket buffer autosizing; a round ends when rcv_rndend is received */
+	tcp_seq	rcv_rndseq;		/* rcv_nxt when the round began */
+	tcp_seq	rcv_rndend;		/* rcv_adv then */
+	u_long	rcv_rndstart;		/* TCP_CC_USEC() then */
+	u_long	rcv_rtt;		/* shortest round, us */
+
 /* TUBA stuff */
 	caddr_t	t_tuba_pcb;		/* next level down pcb for TCP over z */
 };
 
 #define	intotcpcb(ip)	((struct tcpcb *)(ip)->inp_ppcb)
+#define	TCP_SACK_ENABLED(tp) \
+	(((tp)->t_flags & (TF_REQ_SACK|TF_SACK_PERMIT|TF_NOOPT)) == \
+	    (TF_REQ_SACK|TF_SACK_PERMIT))
 #define	sototcpcb(so)	(intotcpcb(sotoinpcb(so)))
 
+/*
+ * The most so's receive buffer may come to hold, which the window
+ * scale asked for in a SYN must allow for.
+ */
+#define	TCP_RCVBUF_MAX(so) \
+	((so)->so_rcv.sb_flags & SB_AUTOSIZE ? \
+	    max((so)->so_rcv.sb_hiwat, tcp_autorcvbuf_max) : \
+	    (so)->so_rcv.sb_hiwat)
+
+/*
+ * Timer access.  Arming with zero ticks disarms, as storing zero
+ * into the old t_timer[] counters did.
+ */
+#define	TCP_TIMER_ARM(tp, timer, nticks) tcp_timer_arm((tp), (timer), (nticks))
+#define	TCP_TIMER_DISARM(tp, timer)	tcp_timer_arm((tp), (timer), 0)
+#define	TCP_TIMER_ISARMED(tp, timer) \
+	((tp)->t_timer[(timer)].tt_list.le_prev != NULL)
+
+/* Ticks since the last segment was received, in PR_SLOWHZ units. */
+#define	TCP_IDLE(tp)	(tcp_now - (tp)->t_rcvtime)
+
+/* Round trip time of the segment being timed, 1 if sent this tick. */
+#define	TCP_RTT(tp)	((int)(tcp_now - (tp)->t_rtttime) + 1)
+
+/*
+ * Delayed acks.  A connection is on tcp_delacks exactly while
+ * TF_DELACK is set, so tcp_fasttimo() need not scan every tcb.
+ */
+#define	TCP_SET_DELACK(tp) { \
+	if (((tp)->t_flags & TF_DELACK) == 0) { \
+		(tp)->t_flags |= TF_DELACK; \
+		LIST_INSERT_HEAD(&tcp_delacks, (tp), t_delack); \
+	} \
+}
+#define	TCP_CLR_DELACK(tp) { \
+	if ((tp)->t_flags & TF_DELACK) { \
+		(tp)->t_flags &= ~TF_DELACK; \
+		LIST_REMOVE((tp), t_delack); \
+	} \
+}
+
 /*
  * The smoothed round-trip time and estimated variance
  * are stored as fixed point numbers scaled by the values below.
@@ -164,16 +269,6 @@ struct tcpcb {
 #define	TCP_REXMTVAL(tp) \
 	(((tp)->t_srtt >> TCP_RTT_SHIFT) + (tp)->t_rttvar)
 
-/* XXX
- * We want to avoid doing m_pullup on incoming packets but that
- * means avoiding dtom on the tcp reassembly code.  That in turn means
- * keeping an mbuf pointer in the reassembly queue (since we might
- * have a cluster).  As a quick hack, the source & destination
- * port numbers (which are no longer needed once we've located the
- * tcpcb) are overlayed with an mbuf pointer.
- */
-#define REASS_MBUF(ti) (*(struct mbuf **)&((ti)->ti_t))
-
 /*
  * TCP statistics.
  * Many of these should be kept per connection,
@@ -234,12 +329,45 @@ struct	tcpstat {
 	u_long	tcps_pcbcachemiss;
 	u_long	tcps_persistdrop;	/* timeout in persist state */
 	u_long	tcps_badsyn;		/* bogus SYN, e.g. premature ACK */
+	u_long	tcps_sackrecovery;	/* SACK recovery episodes */
+	u_long	tcps_sackrexmitpack;	/* segments retransmitted from holes */
+	u_long	tcps_sackrexmitbyte;	/* bytes retransmitted from holes */
+	u_long	tcps_sacksndblk;	/* SACK blocks sent */
+	u_long	tcps_rcvreassfull;	/* out-of-order packets dropped
+					 * for want of queue space
+					 */
+	u_long	tcps_sndtso;		/* large sends cut into segments */
+	u_long	tcps_rcvcoalesced;	/* segments merged into the one before */
+	u_long	tcps_sc_added;		/* SYN cache entries made */
+	u_long	tcps_sc_completed;	/* connections made from the cache */
+	u_long	tcps_sc_timedout;	/* entries dropped unanswered */
+	u_long	tcps_sc_overflow;	/* SYNs with no room in the cache */
+	u_long	tcps_sc_reset;		/* entries dropped by a RST */
+	u_long	tcps_sc_retransmitted;	/* SYN-ACKs sent again */
+	u_long	tcps_sc_dupsyn;		/* SYNs for an entry already made */
+	u_long	tcps_sc_restarted;	/* entries replaced by a new ISN */
+	u_long	tcps_sc_sendcookie;	/* SYN-ACKs sent with a cookie */
+	u_long	tcps_sc_recvcookie;	/* connections made from a cookie */
+	u_long	tcps_listendrop;	/* handshakes dropped, so_q0 full */
+	u_long	tcps_tw_added;		/* connections put in TIME_WAIT entries */
+	u_long	tcps_tw_expired;	/* entries whose 2MSL was up */
+	u_long	tcps_tw_reused;		/* entries ended by a new connection */
+	u_long	tcps_tw_reset;		/* entries ended by a RST */
 };
 
 #ifdef KERNEL
 struct	inpcb tcb;		/* head of queue of active tcpcb's */
 struct	tcpstat tcpstat;	/* tcp statistics */
 u_long	tcp_now;		/* for RFC 1323 timestamps */
+LIST_HEAD(tcpcbhead, tcpcb) tcp_delacks;	/* tcb's with TF_DELACK set */
+int	tcp_syncache_limit;	/* SYN cache entries at most */
+int	tcp_syncache_bucketlimit;	/* on one chain at most */
+int	tcp_syncookies;		/* answer with cookies past those */
+int	tcp_tw_limit;		/* TIME_WAIT entries at most */
+int	tcp_do_autorcvbuf;	/* size receive buffers to the path */
+int	tcp_do_autosndbuf;	/* and send buffers to the window */
+u_long	tcp_autorcvbuf_max;	/* the most they grow to */
+u_long	tcp_autosndbuf_max;
 
 int	 tcp_attach __P((struct socket *));
 void	 tcp_canceltimers __P((struct tcpcb *));
@@ -255,6 +383,8 @@ void	 tcp_dooptions __P((struct tcpcb *,
 	    u_char *, int, struct tcpiphdr *, int *, u_long *, u_long *));
 void	 tcp_drain __P((void));
 void	 tcp_fasttimo __P((void));
+void	 tcp_gro __P((struct mbuf *, int));
+int	 tcp_gro_flush __P((void));
 void	 tcp_init __P((void));
 void	 tcp_input __P((struct mbuf *, int));
 int	 tcp_mss __P((struct tcpcb *, u_int));
@@ -265,16 +395,42 @@ int	 tcp_output __P((struct tcpcb *));
 void	 tcp_pulloutofband __P((struct socket *,
 	    struct tcpiphdr *, struct mbuf *));
 void	 tcp_quench __P((struct inpcb *, int));
+void	 tcp_rcvbuf_autosize __P((struct tcpcb *));
 int	 tcp_reass __P((struct tcpcb *, struct tcpiphdr *, struct mbuf *));
+int	 tcp_reass_find __P((struct tcpcb *, tcp_seq));
+void	 tcp_reass_flush __P((struct tcpcb *));
+int	 tcp_sack_firstlost __P((struct tcpcb *));
+int	 tcp_sack_option __P((struct tcpcb *, u_char *, int));
+long	 tcp_sack_pipe __P((struct tcpcb *, tcp_seq *, long *));
+void	 tcp_sack_prune __P((struct tcpcb *));
+int	 tcp_sack_update __P((struct tcpcb *, u_char *, int, tcp_seq));
+void	 tcp_sbreclaim __P((void));
+struct mbuf *
+	 tcp_segment __P((struct mbuf *, int));
 void	 tcp_respond __P((struct tcpcb *,
 	    struct tcpiphdr *, struct mbuf *, u_long, u_long, int));
 void	 tcp_setpersist __P((struct tcpcb *));
 void	 tcp_slowtimo __P((void));
+void	 tcp_sndbuf_autosize __P((struct tcpcb *));
+void	 tcp_syncache_add __P((struct socket *,
+	    struct mbuf *, u_char *, int, tcp_seq));
+int	 tcp_syncache_get __P((struct socket **, struct tcpiphdr *));
+void	 tcp_syncache_init __P((void));
+void	 tcp_syncache_reset __P((struct tcpiphdr *));
+void	 tcp_syncache_timer __P((void));
 struct tcpiphdr *
 	 tcp_template __P((struct tcpcb *));
+void	 tcp_timer_arm __P((struct tcpcb *, int, int));
 struct tcpcb *
 	 tcp_timers __P((struct tcpcb *, int));
 void	 tcp_trace __P((int, int, struct tcpcb *, struct tcpiphdr *, int));
+int	 tcp_twcheck __P((struct tcpiphdr *,
+	    u_char *, int, int, u_long, int *));
+void	 tcp_twinit __P((void));
+tcp_seq	 tcp_twreuse __P((struct inpcb *));
+struct tcpcb *
+	 tcp_twstart __P((struct tcpcb *));
+void	 tcp_twtimer __P((void));
 struct tcpcb *
 	 tcp_usrclosed __P((struct tcpcb *));
 int	 tcp_usrreq __P((struct socket *,
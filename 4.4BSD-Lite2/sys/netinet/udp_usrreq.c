@@ -40,6 +40,8 @@
 #include <sys/protosw.h>
 #include <sys/socket.h>
 #include <sys/socketvar.h>
+#include <sys/proc.h>
+#include <sys/uio.h>
 #include <sys/errno.h>
 #include <sys/stat.h>
 
@@ -66,16 +68,22 @@ int	udpcksum = 0;		/* XXX */
 #endif
 
 struct	sockaddr_in udp_in = { sizeof(udp_in), AF_INET };
-struct	inpcb *udp_last_inpcb = &udb;
+
+#ifndef UDBHASHSIZE
+#define	UDBHASHSIZE	512
+#endif
 
 static	void udp_detach __P((struct inpcb *));
 static	void udp_notify __P((struct inpcb *, int));
 static	struct mbuf *udp_saveopt __P((caddr_t, int, int));
+static	int udp_uiotombuf __P((struct uio *, struct mbuf **));
+int	uiomove __P((caddr_t, int, struct uio *));
 
 void
 udp_init()
 {
 	udb.inp_next = udb.inp_prev = &udb;
+	in_pcbhashinit(&udb, UDBHASHSIZE);
 }
 
 void
@@ -242,17 +250,8 @@ udp_input(m, iphlen)
 	/*
 	 * Locate pcb for datagram.
 	 */
-	inp = udp_last_inpcb;
-	if (inp->inp_lport != uh->uh_dport ||
-	    inp->inp_fport != uh->uh_sport ||
-	    inp->inp_faddr.s_addr != ip->ip_src.s_addr ||
-	    inp->inp_laddr.s_addr != ip->ip_dst.s_addr) {
-		inp = in_pcblookup(&udb, ip->ip_src, uh->uh_sport,
-		    ip->ip_dst, uh->uh_dport, INPLOOKUP_WILDCARD);
-		if (inp)
-			udp_last_inpcb = inp;
-		udpstat.udpps_pcbcachemiss++;
-	}
+	inp = in_pcblookup(&udb, ip->ip_src, uh->uh_sport,
+	    ip->ip_dst, uh->uh_dport, INPLOOKUP_WILDCARD);
 	if (inp == 0) {
 		udpstat.udps_noport++;
 		if (m->m_flags & (M_BCAST | M_MCAST)) {
@@ -453,6 +452,7 @@ udp_output(inp, m, addr, control)
 	if (addr) {
 		in_pcbdisconnect(inp);
 		inp->inp_laddr = laddr;
+		in_pcbrehash(inp);
 		splx(s);
 	}
 	return (error);
@@ -462,6 +462,186 @@ release:
 	return (error);
 }
 
+/*
+ * Copy a datagram in from uio, as sosend() does, leaving room in
+ * front of it for the headers.
+ */
+static int
+udp_uiotombuf(uio, mp)
+	register struct uio *uio;
+	struct mbuf **mp;
+{
+	register struct mbuf *m;
+	struct mbuf *top = 0, **mpp = &top;
+	int len, mlen, error;
+
+	do {
+		if (top == 0) {
+			MGETHDR(m, M_WAIT, MT_DATA);
+			mlen = MHLEN;
+			m->m_pkthdr.len = 0;
+			m->m_pkthdr.rcvif = (struct ifnet *)0;
+		} else {
+			MGET(m, M_WAIT, MT_DATA);
+			mlen = MLEN;
+		}
+		if (uio->uio_resid >= MINCLSIZE)
+			MCLGET(m, M_WAIT);
+		if (m->m_flags & M_EXT) {
+			if (top == 0) {
+				len = min(MCLBYTES - max_hdr, uio->uio_resid);
+				m->m_data += max_hdr;
+			} else
+				len = min(MCLBYTES, uio->uio_resid);
+		} else {
+			len = min(mlen, uio->uio_resid);
+			if (top == 0 && len < mlen)
+				MH_ALIGN(m, len);
+		}
+		error = uiomove(mtod(m, caddr_t), len, uio);
+		m->m_len = len;
+		*mpp = m;
+		top->m_pkthdr.len += len;
+		mpp = &m->m_next;
+	} while (error == 0 && uio->uio_resid > 0);
+	if (error) {
+		m_freem(top);
+		top = 0;
+	}
+	*mp = top;
+	return (error);
+}
+
+/*
+ * Send n datagrams, each as sosend() and udp_output() would, and
+ * return in *countp how many went.  msg_name and msg_iov are in the
+ * kernel, as sendit() leaves them; the data is the user's.
+ *
+ * All are copied in first and then sent under one splnet(), with
+ * what they share done once: the header is filled in from a template
+ * kept for each run of datagrams to one destination, and inp_route
+ * holds the route for the run.  An unconnected socket takes its source
+ * address from in_pcbladdr() rather than connecting and disconnecting
+ * around each datagram, which looked up and rehashed the pcb.
+ */
+int
+udp_sendmmsg(so, msgs, n, countp)
+	struct socket *so;
+	struct mmsghdr *msgs;
+	int n, *countp;
+{
+	register struct inpcb *inp = sotoinpcb(so);
+	register struct mmsghdr *mp;
+	register struct udpiphdr *ui;
+	struct udpiphdr hdr;
+	struct sockaddr_in *sin, *ifaddr;
+	struct mbuf *m, *top = 0, **mpp = &top;
+	struct uio auio;
+	int i, len, s, error = 0, cerror = 0;
+
+	*countp = 0;
+	if (inp == NULL)
+		return (EINVAL);
+	for (mp = msgs; mp < msgs + n; mp++) {
+		auio.uio_iov = mp->msg_hdr.msg_iov;
+		auio.uio_iovcnt = mp->msg_hdr.msg_iovlen;
+		auio.uio_segflg = UIO_USERSPACE;
+		auio.uio_rw = UIO_WRITE;
+		auio.uio_procp = curproc;
+		auio.uio_offset = 0;
+		auio.uio_resid = 0;
+		for (i = 0; i < auio.uio_iovcnt; i++)
+			if ((auio.uio_resid += auio.uio_iov[i].iov_len) < 0) {
+				cerror = EINVAL;
+				break;
+			}
+		if (cerror == 0 && auio.uio_resid > so->so_snd.sb_hiwat)
+			cerror = EMSGSIZE;
+		if (cerror || (cerror = udp_uiotombuf(&auio, &m)) != 0)
+			break;
+		*mpp = m;
+		mpp = &m->m_nextpkt;
+	}
+
+	bzero((caddr_t)&hdr, sizeof (hdr));
+	hdr.ui_pr = IPPROTO_UDP;
+	s = splnet();
+	if (so->so_state & SS_CANTSENDMORE)
+		error = EPIPE;
+	else if (so->so_error)
+		error = so->so_error;
+	else if (inp->inp_lport == 0)
+		error = in_pcbbind(inp, (struct mbuf *)0);
+	hdr.ui_sport = inp->inp_lport;
+	if (inp->inp_faddr.s_addr != INADDR_ANY) {
+		hdr.ui_src = inp->inp_laddr;
+		hdr.ui_dst = inp->inp_faddr;
+		hdr.ui_dport = inp->inp_fport;
+	}
+	for (mp = msgs; (m = top) != 0; mp++) {
+		top = m->m_nextpkt;
+		m->m_nextpkt = 0;
+		if (error) {
+			m_freem(m);
+			continue;
+		}
+		sin = (struct sockaddr_in *)mp->msg_hdr.msg_name;
+		if (sin == 0) {
+			if (inp->inp_faddr.s_addr == INADDR_ANY)
+				error = EDESTADDRREQ;
+		} else if (inp->inp_faddr.s_addr != INADDR_ANY)
+			error = EISCONN;
+		else if (mp->msg_hdr.msg_namelen != sizeof (*sin) ||
+		    sin->sin_len != sizeof (*sin))
+			error = EINVAL;
+		else if (sin->sin_family != AF_INET)
+			error = EAFNOSUPPORT;
+		else if (hdr.ui_dport == 0 ||
+		    sin->sin_addr.s_addr != hdr.ui_dst.s_addr ||
+		    sin->sin_port != hdr.ui_dport) {
+			if ((error = in_pcbladdr(inp, sin, &ifaddr)) == 0) {
+				if (inp->inp_laddr.s_addr != INADDR_ANY)
+					hdr.ui_src = inp->inp_laddr;
+				else
+					hdr.ui_src = ifaddr->sin_addr;
+				hdr.ui_dst = sin->sin_addr;
+				hdr.ui_dport = sin->sin_port;
+			}
+		}
+		if (error) {
+			m_freem(m);
+			continue;
+		}
+		len = m->m_pkthdr.len;
+		M_PREPEND(m, sizeof (struct udpiphdr), M_DONTWAIT);
+		if (m == 0) {
+			error = ENOBUFS;
+			continue;
+		}
+		ui = mtod(m, struct udpiphdr *);
+		*ui = hdr;
+		ui->ui_len = htons((u_short)len + sizeof (struct udphdr));
+		ui->ui_ulen = ui->ui_len;
+		if (udpcksum) {
+		    if ((ui->ui_sum = in_cksum(m, sizeof (struct udpiphdr) + len)) == 0)
+			ui->ui_sum = 0xffff;
+		}
+		((struct ip *)ui)->ip_len = sizeof (struct udpiphdr) + len;
+		((struct ip *)ui)->ip_ttl = inp->inp_ip.ip_ttl;	/* XXX */
+		((struct ip *)ui)->ip_tos = inp->inp_ip.ip_tos;	/* XXX */
+		udpstat.udps_opackets++;
+		error = ip_output(m, inp->inp_options, &inp->inp_route,
+		    so->so_options & (SO_DONTROUTE | SO_BROADCAST),
+		    inp->inp_moptions);
+		if (error == 0) {
+			mp->msg_len = len;
+			(*countp)++;
+		}
+	}
+	splx(s);
+	return (error ? error : cerror);
+}
+
 u_long	udp_sendspace = 9216;		/* really max datagram size */
 u_long	udp_recvspace = 40 * (1024 + sizeof(struct sockaddr_in));
 					/* 40 1K datagrams */
@@ -548,6 +728,7 @@ udp_usrreq(so, req, m, addr, control)
 		s = splnet();
 		in_pcbdisconnect(inp);
 		inp->inp_laddr.s_addr = INADDR_ANY;
+		in_pcbrehash(inp);
 		splx(s);
 		so->so_state &= ~SS_ISCONNECTED;		/* XXX */
 		break;
@@ -610,8 +791,6 @@ udp_detach(inp)
 {
 	int s = splnet();
 
-	if (inp == udp_last_inpcb)
-		udp_last_inpcb = &udb;
 	in_pcbdetach(inp);
 	splx(s);
 }
@@ -86,6 +86,7 @@ void	 udp_init __P((void));
 void	 udp_input __P((struct mbuf *, int));
 int	 udp_output __P((struct inpcb *,
 	    struct mbuf *, struct mbuf *, struct mbuf *));
+int	 udp_sendmmsg __P((struct socket *, struct mmsghdr *, int, int *));
 int	 udp_sysctl __P((int *, u_int, void *, size_t *, void *, size_t));
 int	 udp_usrreq __P((struct socket *,
 	    int, struct mbuf *, struct mbuf *, struct mbuf *));
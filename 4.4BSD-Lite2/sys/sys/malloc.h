@@ -109,6 +109,8 @@
 #define M_NFSRVDESC	59	/* NFS server socket descriptor */
 #define M_NFSDIROFF	60	/* NFS directory offset data */
 #define M_NFSBIGFH	61	/* NFS version 3 file handle */
+#define M_SYNCACHE	62	/* TCP SYN cache entries */
+#define M_TCPTW		63	/* TCP TIME_WAIT entries */
 #define	M_TEMP		74	/* misc temporary data buffers */
 #define	M_LAST		75	/* Must be last type + 1 */
 
@@ -175,7 +177,8 @@
 	"NFSV3 srvdesc",/* 59 M_NFSRVDESC */ \
 	"NFSV3 diroff",	/* 60 M_NFSDIROFF */ \
 	"NFSV3 bigfh",	/* 61 M_NFSBIGFH */ \
-	NULL, NULL, \
+	"syncache",	/* 62 M_SYNCACHE */ \
+	"tcptw",	/* 63 M_TCPTW */ \
 	NULL, NULL, NULL, NULL, NULL, \
 	NULL, NULL, NULL, NULL, NULL, \
 	"temp",		/* 74 M_TEMP */ \
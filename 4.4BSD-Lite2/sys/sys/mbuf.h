@@ -77,6 +77,7 @@ struct m_hdr {
 struct	pkthdr {
 	struct	ifnet *rcvif;		/* rcv interface */
 	int	len;			/* total packet length */
+	u_short	tso_segsz;		/* data per segment, if M_TSO */
 };
 
 /* description of external storage mapped into mbuf, valid if M_EXT set */
@@ -84,6 +85,8 @@ struct m_ext {
 	caddr_t	ext_buf;		/* start of buffer */
 	void	(*ext_free)();		/* free routine if not the usual */
 	u_int	ext_size;		/* size of buffer, for ext_free */
+	u_int	*ext_refcnt;		/* references, if ext_free */
+	void	*ext_arg;		/* for ext_free */
 };
 
 struct mbuf {
@@ -121,6 +124,8 @@ struct mbuf {
 /* mbuf pkthdr flags, also in m_flags */
 #define	M_BCAST		0x0100	/* send/received as link-level broadcast */
 #define	M_MCAST		0x0200	/* send/received as link-level multicast */
+#define	M_TSO		0x0400	/* TCP send larger than a segment */
+#define	M_CSUMOK	0x0800	/* TCP checksum already verified */
 
 /* flags copied when copying m_pkthdr */
 #define	M_COPYFLAGS	(M_PKTHDR|M_EOR|M_BCAST|M_MCAST)
@@ -159,6 +164,32 @@ struct mbuf {
 	  splx(ms); \
 	}
 
+/*
+ * Mbufs and clusters are kept on free lists, which m_mballoc() and
+ * m_clalloc() refill from mb_map MBGROWSIZE bytes at a time.
+ * Mbufs never go back to mb_map, so they stay MSIZE aligned for
+ * dtom(), and clusters stay MCLBYTES aligned for mtocl().
+ */
+#define	MBGROWSIZE	(64 * 1024)
+
+/*
+ * MBALLOC(struct mbuf *m, int how) takes an mbuf off the free list.
+ */
+#define	MBALLOC(m, how) \
+	MBUFLOCK( \
+	  if (mmbfree) \
+		mbstat.m_mbhits++; \
+	  else { \
+		mbstat.m_mbmisses++; \
+		(void)m_mballoc(MBGROWSIZE / MSIZE, (how)); \
+	  } \
+	  if (((m) = mmbfree) != 0) { \
+		mmbfree = (m)->m_next; \
+		if (mbstat.m_mbufs - --mbstat.m_mbfree > mbstat.m_mbhiwat) \
+			mbstat.m_mbhiwat = mbstat.m_mbufs - mbstat.m_mbfree; \
+	  } \
+	)
+
 /*
  * mbuf allocation/deallocation macros:
  *
@@ -170,7 +201,7 @@ struct mbuf {
  * and internal data.
  */
 #define	MGET(m, how, type) { \
-	MALLOC((m), struct mbuf *, MSIZE, mbtypes[type], (how)); \
+	MBALLOC((m), (how)); \
 	if (m) { \
 		(m)->m_type = (type); \
 		MBUFLOCK(mbstat.m_mtypes[type]++;) \
@@ -183,7 +214,7 @@ struct mbuf {
 }
 
 #define	MGETHDR(m, how, type) { \
-	MALLOC((m), struct mbuf *, MSIZE, mbtypes[type], (how)); \
+	MBALLOC((m), (how)); \
 	if (m) { \
 		(m)->m_type = (type); \
 		MBUFLOCK(mbstat.m_mtypes[type]++;) \
@@ -214,12 +245,17 @@ union mcluster {
 
 #define	MCLALLOC(p, how) \
 	MBUFLOCK( \
-	  if (mclfree == 0) \
-		(void)m_clalloc(1, (how)); \
+	  if (mclfree) \
+		mbstat.m_clhits++; \
+	  else { \
+		mbstat.m_clmisses++; \
+		(void)m_clalloc(MBGROWSIZE / CLBYTES, (how)); \
+	  } \
 	  if (((p) = (caddr_t)mclfree) != 0) { \
 		++mclrefcnt[mtocl(p)]; \
-		mbstat.m_clfree--; \
 		mclfree = ((union mcluster *)(p))->mcl_next; \
+		if (mbstat.m_clusters - --mbstat.m_clfree > mbstat.m_clhiwat) \
+			mbstat.m_clhiwat = mbstat.m_clusters - mbstat.m_clfree; \
 	  } \
 	)
 
@@ -229,9 +265,45 @@ union mcluster {
 		(m)->m_data = (m)->m_ext.ext_buf; \
 		(m)->m_flags |= M_EXT; \
 		(m)->m_ext.ext_size = MCLBYTES;  \
+		(m)->m_ext.ext_free = NULL; \
 	  } \
 	}
 
+/*
+ * MEXTADD(struct mbuf *m, caddr_t buf, u_int size, void (*free)(),
+ *     u_int *refcnt, void *arg)
+ * attaches storage owned by someone else to m.  All mbufs sharing it
+ * count in *refcnt; when the last is freed, free(buf, size, arg) is
+ * called.  The caller holds one reference of its own and drops it
+ * with MEXTUNREF() once it is done adding.
+ *
+ * MEXTREF(m) adds a reference to the external storage of m, cluster
+ * or not, for another mbuf that is to share it.
+ */
+#define	MEXTADD(m, buf, size, free, refcnt, arg) \
+	{ (m)->m_data = (m)->m_ext.ext_buf = (caddr_t)(buf); \
+	  (m)->m_flags |= M_EXT; \
+	  (m)->m_ext.ext_size = (size); \
+	  (m)->m_ext.ext_free = (free); \
+	  (m)->m_ext.ext_refcnt = (refcnt); \
+	  (m)->m_ext.ext_arg = (arg); \
+	  MBUFLOCK(++*(refcnt);) \
+	}
+
+#define	MEXTREF(m) \
+	MBUFLOCK( \
+	  if ((m)->m_ext.ext_free) \
+		++*(m)->m_ext.ext_refcnt; \
+	  else \
+		++mclrefcnt[mtocl((m)->m_ext.ext_buf)]; \
+	)
+
+#define	MEXTUNREF(buf, size, free, refcnt, arg) \
+	MBUFLOCK( \
+	  if (--*(refcnt) == 0) \
+		(*(free))((caddr_t)(buf), (size), (arg)); \
+	)
+
 #define	MCLFREE(p) \
 	MBUFLOCK ( \
 	  if (--mclrefcnt[mtocl(p)] == 0) { \
@@ -246,29 +318,20 @@ union mcluster {
  * Free a single mbuf and associated external storage.
  * Place the successor, if any, in n.
  */
-#ifdef notyet
-#define	MFREE(m, n) \
+#define	MFREE(m, nn) \
 	{ MBUFLOCK(mbstat.m_mtypes[(m)->m_type]--;) \
 	  if ((m)->m_flags & M_EXT) { \
 		if ((m)->m_ext.ext_free) \
-			(*((m)->m_ext.ext_free))((m)->m_ext.ext_buf, \
-			    (m)->m_ext.ext_size); \
+			MEXTUNREF((m)->m_ext.ext_buf, (m)->m_ext.ext_size, \
+			    (m)->m_ext.ext_free, (m)->m_ext.ext_refcnt, \
+			    (m)->m_ext.ext_arg) \
 		else \
 			MCLFREE((m)->m_ext.ext_buf); \
 	  } \
-	  (n) = (m)->m_next; \
-	  FREE((m), mbtypes[(m)->m_type]); \
-	}
-#else /* notyet */
-#define	MFREE(m, nn) \
-	{ MBUFLOCK(mbstat.m_mtypes[(m)->m_type]--;) \
-	  if ((m)->m_flags & M_EXT) { \
-		MCLFREE((m)->m_ext.ext_buf); \
-	  } \
 	  (nn) = (m)->m_next; \
-	  FREE((m), mbtypes[(m)->m_type]); \
+	  MBUFLOCK((m)->m_type = MT_FREE; (m)->m_next = mmbfree; \
+	    mmbfree = (m); mbstat.m_mbfree++;) \
 	}
-#endif
 
 /*
  * Copy mbuf pkthdr from from to to.
@@ -350,6 +413,13 @@ struct mbstat {
 	u_long	m_drops;	/* times failed to find space */
 	u_long	m_wait;		/* times waited for space */
 	u_long	m_drain;	/* times drained protocols for space */
+	u_long	m_mbfree;	/* free mbufs */
+	u_long	m_mbhits;	/* mbufs found on the free list */
+	u_long	m_mbmisses;	/* times the mbuf free list was empty */
+	u_long	m_mbhiwat;	/* most mbufs in use */
+	u_long	m_clhits;	/* clusters found on the free list */
+	u_long	m_clmisses;	/* times the cluster free list was empty */
+	u_long	m_clhiwat;	/* most clusters in use */
 	u_short	m_mtypes[256];	/* type specific mbuf allocations */
 };
 
@@ -359,6 +429,7 @@ extern	char *mclrefcnt;		/* cluster reference counts */
 struct	mbstat mbstat;
 extern	int nmbclusters;
 union	mcluster *mclfree;
+struct	mbuf *mmbfree;
 int	max_linkhdr;			/* largest link-level header */
 int	max_protohdr;			/* largest protocol header */
 int	max_hdr;			/* largest link+protocol header */
@@ -378,6 +449,7 @@ struct	mbuf *m_retryhdr __P((int, int));
 void	m_adj __P((struct mbuf *, int));
 void	m_cat __P((struct mbuf *, struct mbuf *));
 int	m_clalloc __P((int, int));
+int	m_mballoc __P((int, int));
 int	m_copydata __P((struct mbuf *, int, int, caddr_t));
 void	m_freem __P((struct mbuf *));
 void	m_reclaim __P((void));
@@ -235,9 +235,10 @@ struct sockproto {
 }
 
 /*
- * Maximum queue length specifiable by listen.
+ * Maximum queue length specifiable by listen, by default; the
+ * kernel's somaxconn may be raised past it.
  */
-#define	SOMAXCONN	5
+#define	SOMAXCONN	128
 
 /*
  * Message header for recvmsg and sendmsg calls.
@@ -253,6 +254,15 @@ struct msghdr {
 	int	msg_flags;		/* flags on received message */
 };
 
+/*
+ * A vector of these is sent or received a datagram each at once,
+ * see udp_sendmmsg() and soreceivemmsg().
+ */
+struct mmsghdr {
+	struct	msghdr msg_hdr;		/* the message */
+	u_int	msg_len;		/* bytes sent or received */
+};
+
 #define	MSG_OOB		0x1		/* process out-of-band data */
 #define	MSG_PEEK	0x2		/* peek at incoming message */
 #define	MSG_DONTROUTE	0x4		/* send without using routing tables */
@@ -33,6 +33,7 @@
  *	@(#)socketvar.h	8.3 (Berkeley) 2/19/95
  */
 
+#include <sys/queue.h>
 #include <sys/select.h>			/* for struct selinfo */
 
 /*
@@ -74,13 +75,15 @@ struct socket {
     // 接受socket的最后一个
 	struct	socket *so_head;	/* back pointer to accept socket */
     // 部分连接
-	struct	socket *so_q0;		/* queue of partial connections */
-	struct	socket *so_q;		/* queue of incoming connections */
-	short	so_q0len;		/* partials on so_q0 */
-	short	so_qlen;		/* number of connections on so_q */
+	TAILQ_HEAD(, socket) so_q0;	/* queue of partial connections */
+	TAILQ_HEAD(, socket) so_q;	/* queue of incoming connections */
+	TAILQ_ENTRY(socket) so_list;	/* on head's so_q0 or so_q */
+	short	so_qstate;		/* which of them, SQ_* below */
+	int	so_q0len;		/* partials on so_q0 */
+	int	so_qlen;		/* number of connections on so_q */
 
     // 可以使用listen来改变的值
-	short	so_qlimit;		/* max number queued connections */
+	int	so_qlimit;		/* max number queued connections */
     // close, accpet, listen 等的超时时间
 	short	so_timeo;		/* connection timeout */
 
@@ -105,13 +108,14 @@ struct socket {
 		short	sb_flags;	/* flags, see below */
 		short	sb_timeo;	/* timeout for read/write */
 	} so_rcv, so_snd;
-#define	SB_MAX		(256*1024)	/* default for max chars in sockbuf */
+#define	SB_MAX		(4*1024*1024)	/* default for max chars in sockbuf */
 #define	SB_LOCK		0x01		/* lock on data queue */
 #define	SB_WANT		0x02		/* someone is waiting to lock */
 #define	SB_WAIT		0x04		/* someone is waiting for data/space */
 #define	SB_SEL		0x08		/* someone is selecting */
 #define	SB_ASYNC	0x10		/* ASYNC I/O, need signals */
 #define	SB_NOTIFY	(SB_WAIT|SB_SEL|SB_ASYNC)
+#define	SB_AUTOSIZE	0x20		/* the protocol sizes it */
 #define	SB_NOINTR	0x40		/* operations not interruptible */
 
 	caddr_t	so_tpcb;		/* Wisc. protocol control block XXX */
@@ -135,6 +139,25 @@ struct socket {
 #define	SS_ASYNC		0x200	/* async i/o notify */
 #define	SS_ISCONFIRMING		0x400	/* deciding to accept connection req */
 
+/*
+ * Queue a socket is on, in so_qstate.
+ */
+#define	SQ_INCOMP		0x01	/* on so_q0 */
+#define	SQ_COMP			0x02	/* on so_q */
+
+/*
+ * Socket buffer space, as sbreserve() and sbrelease() count it.  The
+ * buffers a protocol sizes itself (SB_AUTOSIZE) grow only while all
+ * reserved stays within sb_budget, and are to shrink when it doesn't.
+ */
+struct sbstat {
+	u_long	sb_reserved;	/* sb_hiwat of all sockbufs */
+	u_long	sb_reshiwat;	/* most reserved at once */
+	u_long	sb_grown;	/* times a buffer was grown */
+	u_long	sb_shrunk;	/* times shrunk for the budget */
+	u_long	sb_denied;	/* growths refused by the budget */
+};
+#define	SB_BUDGET	(32*1024*1024)	/* default for sb_budget */
 
 /*
  * Macros for sockets and socket buffering.
@@ -154,6 +177,13 @@ struct socket {
 #define	sosendallatonce(so) \
     ((so)->so_proto->pr_flags & PR_ATOMIC)
 
+/* may sb grow to cc bytes within sb_budget? */
+#define	sbcangrow(sb, cc) \
+    (sbstat.sb_reserved - (sb)->sb_hiwat + (cc) <= sb_budget)
+
+/* is more reserved than sb_budget allows? */
+#define	sbpressure()	(sbstat.sb_reserved > sb_budget)
+
 /* can we read something from so? */
 #define	soreadable(so) \
     ((so)->so_rcv.sb_cc >= (so)->so_rcv.sb_lowat || \
@@ -211,6 +241,9 @@ struct socket {
 
 #ifdef KERNEL
 u_long	sb_max;
+u_long	sb_budget;
+struct	sbstat sbstat;
+int	somaxconn;
 /* to catch callers missing new second argument to sonewconn: */
 #define	sonewconn(head, connstatus)	sonewconn1((head), (connstatus))
 struct	socket *sonewconn1 __P((struct socket *head, int connstatus));
@@ -272,6 +305,8 @@ void	soqinsque __P((struct socket *head, struct socket *so, int q));
 int	soqremque __P((struct socket *so, int q));
 int	soreceive __P((struct socket *so, struct mbuf **paddr, struct uio *uio,
 	    struct mbuf **mp0, struct mbuf **controlp, int *flagsp));
+int	soreceivemmsg __P((struct socket *so, struct mmsghdr *msgs, int n,
+	    int flags, int *countp));
 int	soreserve __P((struct socket *so, u_long sndcc, u_long rcvcc));
 void	sorflush __P((struct socket *so));
 int	sosend __P((struct socket *so, struct mbuf *addr, struct uio *uio,
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Puts el0 (10.0.0.1) on an Ethernet segment of 4096 hosts played by
+// the test through lib/if_eloop.c.  Each host pings us, and the echo
+// replies wait in the ARP entry for its address until the test answers
+// the request.  Then checks that
+//  - every reply goes to its host's Ethernet address,
+//  - an unresolved entry holds the last arp_maxhold packets,
+//  - with the clock run by settime() and callout_run(), entries go
+//    arpt_keep seconds after they were last confirmed, and no sooner,
+//  - an entry never resolved goes, with what it held,
+// and times the ARP replies taken with the table full.
+
+extern int arp_inuse, arp_maxhold, arpt_keep, arpt_down;
+
+enum { NHOSTS = 4096, MYIP = 0x0a000001, HOSTIP = 0x0a010000, NHOLD = 40 };
+
+const unsigned char mymac[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+
+long long clock_sec = 1000000;
+
+// sets the stack's clock and runs the callouts due
+void advance(int sec)
+{
+  clock_sec += sec;
+  settime(clock_sec * 1000000);
+  callout_run(clock_sec * 1000);
+}
+
+void hostmac(unsigned char* mac, int host)
+{
+  unsigned a = host + 2;
+  mac[0] = 0x02;
+  mac[1] = 0;
+  mac[2] = 0;
+  mac[3] = a >> 16;
+  mac[4] = a >> 8;
+  mac[5] = a;
+}
+
+void put32(unsigned char* p, unsigned v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+unsigned get32(const unsigned char* p)
+{
+  return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+unsigned short cksum(const unsigned char* p, int len)
+{
+  unsigned sum = 0;
+  for (int i = 0; i < len; i += 2)
+    sum += p[i] << 8 | (i + 1 < len ? p[i + 1] : 0);
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+// an ICMP echo request from host to us
+void echorequest(int host, int seq)
+{
+  unsigned char f[14 + 20 + 16] = { 0 };
+  unsigned char* ip = f + 14;
+  unsigned char* icmp = ip + 20;
+  unsigned short sum;
+  memcpy(f, mymac, 6);
+  hostmac(f + 6, host);
+  f[12] = 0x08;
+  ip[0] = 0x45;
+  ip[3] = sizeof f - 14;
+  ip[8] = 64;
+  ip[9] = 1;
+  put32(ip + 12, HOSTIP + host);
+  put32(ip + 16, MYIP);
+  sum = cksum(ip, 20);
+  ip[10] = sum >> 8;
+  ip[11] = sum;
+  icmp[0] = 8;
+  icmp[4] = host >> 8;
+  icmp[5] = host;
+  icmp[6] = seq >> 8;
+  icmp[7] = seq;
+  sum = cksum(icmp, 16);
+  icmp[2] = sum >> 8;
+  icmp[3] = sum;
+  el_input((char*)f, sizeof f);
+}
+
+// an ARP reply from host to us
+void arpreply(int host)
+{
+  unsigned char f[14 + 28] = { 0 };
+  unsigned char* ea = f + 14;
+  memcpy(f, mymac, 6);
+  hostmac(f + 6, host);
+  f[12] = 0x08;
+  f[13] = 0x06;
+  ea[1] = 1;     // ARPHRD_ETHER
+  ea[2] = 0x08;  // ETHERTYPE_IP
+  ea[4] = 6;
+  ea[5] = 4;
+  ea[7] = 2;     // ARPOP_REPLY
+  hostmac(ea + 8, host);
+  put32(ea + 14, HOSTIP + host);
+  memcpy(ea + 18, mymac, 6);
+  put32(ea + 24, MYIP);
+  el_input((char*)f, sizeof f);
+}
+
+struct wire
+{
+  int requests;  // ARP requests for a host
+  int replies;   // echo replies, each to the right address
+  int badmac;
+  int lastseq;
+  int asked[NHOSTS + 1];
+} w;
+
+// takes everything off the wire
+void drain()
+{
+  unsigned char f[2048];
+  int len;
+  while ((len = el_dequeue((char*)f, sizeof f)) > 0)
+  {
+    if (f[12] == 0x08 && f[13] == 0x06 && f[14 + 7] == 1)
+    {
+      int host = get32(f + 14 + 24) - HOSTIP;
+      if (host >= 0 && host <= NHOSTS)
+      {
+        w.requests++;
+        w.asked[host]++;
+      }
+    }
+    else if (f[12] == 0x08 && f[13] == 0 && f[14 + 20] == 0)
+    {
+      unsigned char mac[6];
+      int host = get32(f + 14 + 16) - HOSTIP;
+      hostmac(mac, host);
+      if (memcmp(f, mac, 6) != 0)
+        w.badmac++;
+      w.replies++;
+      w.lastseq = f[14 + 26] << 8 | f[14 + 27];
+    }
+  }
+}
+
+double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int fail(const char* what)
+{
+  printf("%s\n", what);
+  printf("requests %d replies %d badmac %d, %d entries, "
+         "arpstat: dropped %lu timeouts %lu\n",
+         w.requests, w.replies, w.badmac, arp_inuse,
+         kstat("as_dropped"), kstat("as_timeouts"));
+  return 1;
+}
+
+int main()
+{
+  elattach(1);
+  el_setqlen(2 * NHOSTS);
+  init();
+  advance(0);
+  setipaddr("el0", MYIP);  // 10.0.0.1/8
+  drain();
+  memset(&w, 0, sizeof w);
+  int base = arp_inuse;
+
+  // every host pings us; one request each, then the replies follow
+  for (int i = 0; i < NHOSTS; ++i)
+    echorequest(i, 0);
+  drain();
+  if (w.requests != NHOSTS || w.replies != 0 || arp_inuse != base + NHOSTS)
+    return fail("one request for each host");
+  for (int i = 0; i < NHOSTS; ++i)
+    arpreply(i);
+  drain();
+  if (w.replies != NHOSTS || w.badmac)
+    return fail("an echo reply to each host");
+  printf("%d neighbours: %lu requests sent, %lu replies taken\n", NHOSTS,
+         kstat("as_txrequests"), kstat("as_rxreplies"));
+
+  // the table is full: the hosts confirm their addresses
+  double start = now();
+  for (int r = 0; r < 16; ++r)
+    for (int i = 0; i < NHOSTS; ++i)
+      arpreply(i);
+  double sec = now() - start;
+  printf("%.0f ns an ARP reply taken with %d neighbours\n",
+         sec * 1e9 / (16 * NHOSTS), NHOSTS);
+
+  // a new host pings many times before it answers
+  memset(&w, 0, sizeof w);
+  unsigned long dropped = kstat("as_dropped");
+  for (int seq = 0; seq < NHOLD; ++seq)
+    echorequest(NHOSTS, seq);
+  drain();
+  if (w.requests != 1 || w.replies != 0 ||
+      kstat("as_dropped") - dropped != NHOLD - arp_maxhold)
+    return fail("one request, the first packets dropped");
+  arpreply(NHOSTS);
+  drain();
+  if (w.replies != arp_maxhold || w.lastseq != NHOLD - 1 || w.badmac)
+    return fail("the last packets held are sent");
+  printf("%d packets for an unresolved host: %d sent, %lu dropped\n",
+         NHOLD, w.replies, kstat("as_dropped") - dropped);
+
+  // half of the hosts confirm halfway through arpt_keep
+  advance(arpt_keep / 2);
+  for (int i = 0; i < NHOSTS; i += 2)
+    arpreply(i);
+  advance(arpt_keep / 2 - 1);
+  if (arp_inuse != base + NHOSTS + 1 || kstat("as_timeouts") != 0)
+    return fail("nothing goes before arpt_keep");
+  advance(1);
+  if (arp_inuse != base + NHOSTS / 2 || kstat("as_timeouts") != NHOSTS / 2 + 1)
+    return fail("the hosts not confirmed go");
+
+  // a host that went is asked for again
+  memset(&w, 0, sizeof w);
+  echorequest(1, 1);
+  drain();
+  if (w.requests != 1 || w.asked[1] != 1)
+    return fail("a host gone is asked for again");
+
+  // it never answers: the packet is held until the entry goes
+  dropped = kstat("as_dropped");
+  for (int i = 0; i < 5; ++i)
+    advance(1);
+  if (arp_inuse != base + NHOSTS / 2 + 1)
+    return fail("an unresolved entry stays arpt_down seconds");
+  advance(arpt_down);
+  if (arp_inuse != base + NHOSTS / 2 || kstat("as_dropped") - dropped != 1)
+    return fail("an unresolved entry goes with what it held");
+
+  // the rest go a whole arpt_keep after they were confirmed
+  advance(arpt_keep / 2 - arpt_down - 5);
+  if (arp_inuse != base)
+    return fail("the confirmed hosts go");
+  printf("aged out: %lu entries, %lu packets dropped in all\n",
+         kstat("as_timeouts"), kstat("as_dropped"));
+  return 0;
+}
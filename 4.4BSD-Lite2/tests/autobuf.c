@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/tcpv2.h"
+
+// Runs bulk transfers over a simulated long fat pipe with the socket
+// buffers left at their 8 KB defaults, and checks that TCP sizes them:
+//  - Set by SO_SNDBUF and SO_RCVBUF the buffers stay as set, and the
+//    transfer is held to a buffer a round trip.
+//  - Left alone both grow toward the path's 625 KB in flight, and the
+//    transfer fills most of the link.
+//  - With sb_budget below what is reserved, the buffers are taken back
+//    to their defaults, though the window already offered is kept; and
+//    with nothing left in the budget they don't grow.
+//
+// The path is tests/cc.c's without the loss and with a 625 KB queue:
+// 100 Mbit/s and 25 ms each way, on a virtual clock.  The receive
+// buffer is let grow to 1 MB, which the path and queue hold, so that
+// Reno can fill the link without losing any of it.
+
+extern unsigned long sb_budget;
+extern unsigned long tcp_autorcvbuf_max;
+extern void tcp_fasttimo();
+extern void tcp_slowtimo();
+
+enum
+{
+  PORT = 1234,
+  MBPS = 100,
+  DELAY = 25000,          // us, each way
+  QUEUE = 625 * 1000,     // bytes
+  SECONDS = 5,
+  RING = 8192,
+  SOL_SOCKET = 0xffff,
+  SO_SNDBUF = 0x1001,     // sys/socket.h
+  SO_RCVBUF = 0x1002,
+};
+
+struct packet
+{
+  long long at;  // when it arrives
+  int len;
+  char data[1600];
+};
+
+// packets in flight in one direction, in order of arrival
+struct link
+{
+  struct packet pkts[RING];
+  int head, tail;
+} fwd, rev;
+
+long long now, linkfree, nextfast, nextslow;
+int drops;
+
+void put(struct link* l, long long at, const char* data, int len)
+{
+  struct packet* p = &l->pkts[l->tail++ % RING];
+  p->at = at;
+  p->len = len;
+  memcpy(p->data, data, len);
+}
+
+// takes what the stack has sent: data to the bottleneck, acks
+// straight onto the return path
+void collect()
+{
+  char pkt[1600];
+  int len;
+  while ((len = pigeon_dequeue(pkt, sizeof pkt)) > 0)
+  {
+    const unsigned char* th = (unsigned char*)pkt + (pkt[0] & 0xf) * 4;
+    if ((th[2] << 8 | th[3]) != PORT)
+    {
+      put(&rev, now + DELAY, pkt, len);
+      continue;
+    }
+    if (linkfree < now)
+      linkfree = now;
+    if ((linkfree - now) * MBPS / 8 > QUEUE)
+    {
+      ++drops;
+      continue;
+    }
+    linkfree += len * 8 / MBPS;
+    put(&fwd, linkfree + DELAY, pkt, len);
+  }
+}
+
+// advances the clock to the next arrival or timer and handles it
+void step()
+{
+  struct link* l = NULL;
+  long long t = nextfast < nextslow ? nextfast : nextslow;
+  if (fwd.head != fwd.tail && fwd.pkts[fwd.head % RING].at < t)
+    t = fwd.pkts[fwd.head % RING].at, l = &fwd;
+  if (rev.head != rev.tail && rev.pkts[rev.head % RING].at < t)
+    t = rev.pkts[rev.head % RING].at, l = &rev;
+  now = t;
+  settime(now);
+  if (l)
+  {
+    struct packet* p = &l->pkts[l->head++ % RING];
+    char addr[4];
+    memcpy(addr, p->data + 12, 4);
+    memcpy(p->data + 12, p->data + 16, 4);
+    memcpy(p->data + 16, addr, 4);
+    inject(p->data, p->len);
+  }
+  else if (t == nextfast)
+  {
+    tcp_fasttimo();
+    nextfast += 200000;
+  }
+  else
+  {
+    tcp_slowtimo();
+    nextslow += 500000;
+  }
+  collect();
+}
+
+// a buffer's sb_hiwat, by SO_SNDBUF or SO_RCVBUF
+unsigned long sbsize(struct socket* so, int optname)
+{
+  int size = 0, len = sizeof size;
+  getsockoptso(so, SOL_SOCKET, optname, &size, &len);
+  return size;
+}
+
+struct socket *client, *server;
+unsigned long snd0, rcv0;  // as the connection began
+
+// the sender's send buffer and the receiver's receive buffer
+void sizes(unsigned long* snd, unsigned long* rcv)
+{
+  *snd = sbsize(client, SO_SNDBUF);
+  *rcv = sbsize(server, SO_RCVBUF);
+}
+
+// connects a new client and server, leaving their buffers as set
+void connect(struct socket* listenso, int sndbuf, int rcvbuf)
+{
+  client = connectto(0xc0a80001, PORT);
+  server = NULL;
+  while (server == NULL)
+  {
+    step();
+    server = acceptso(listenso);
+  }
+  if (sndbuf)
+    setsockoptso(client, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof sndbuf);
+  if (rcvbuf)
+    setsockoptso(server, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+  sizes(&snd0, &rcv0);
+}
+
+// reads what the server has, returns how many bytes or -1 if they
+// aren't the next of the pattern
+int check(long long received)
+{
+  static char buf[1 << 20];
+  int nr = readso(server, buf, sizeof buf);
+  for (int i = 0; i < nr; ++i)
+    if (buf[i] != (char)((received + i) % 251))
+      return -1;
+  return nr > 0 ? nr : 0;
+}
+
+// sends from client to server for SECONDS and waits for the rest to be
+// read, returns the goodput in Mbit/s, or -1 if the data read differs
+double transfer()
+{
+  static char src[2 << 20];
+  for (int i = 0; i < sizeof src; ++i)
+    src[i] = i % 251;
+
+  long long start = now, sent = 0, received = 0;
+  int nr;
+  drops = 0;
+  while (now < start + SECONDS * 1000000LL)
+  {
+    sent += writeso(client, src + sent % 251, 1 << 20);
+    if ((nr = check(received)) < 0)
+      return -1;
+    received += nr;
+    step();
+  }
+  double mbps = received * 8.0 / (now - start);
+  // let the rest arrive and be read: a second without any is the end
+  for (long long idle = now + 1000000; now < idle; step())
+  {
+    if ((nr = check(received)) < 0)
+      return -1;
+    if (nr > 0)
+      idle = now + 1000000;
+    received += nr;
+  }
+  return sent == received ? mbps : -1;
+}
+
+void disconnect()
+{
+  soclose(client);
+  soclose(server);
+  while (fwd.head != fwd.tail || rev.head != rev.tail)
+    step();
+}
+
+int main()
+{
+  unsigned long snd, rcv;
+
+  pigeonattach(1);
+  pigeon_setqlen(RING);
+  init();
+  setipaddr("pg0", 0xc0a80002);  // 192.168.0.2
+  now = 1000000;
+  nextfast = now + 200000;
+  nextslow = now + 500000;
+
+  tcp_autorcvbuf_max = 1024 * 1024;
+  struct socket* listenso = listenon(PORT);
+  printf("%d Mbit/s, %d ms rtt, %d s\n", MBPS, 2 * DELAY / 1000, SECONDS);
+
+  // set by hand to 8 KB: no more than 8 KB a round trip, 1.3 Mbit/s
+  connect(listenso, 8192, 8192);
+  double fixed = transfer();
+  sizes(&snd, &rcv);
+  printf("fixed:  %6.1f Mbit/s, snd %lu rcv %lu\n", fixed, snd, rcv);
+  if (fixed < 0 || fixed > 2 || snd != 8192 || rcv != 8192)
+    return 1;
+  disconnect();
+
+  // autosized
+  connect(listenso, 0, 0);
+  double sized = transfer();
+  sizes(&snd, &rcv);
+  printf("sized:  %6.1f Mbit/s, snd %lu rcv %lu, %d dropped\n", sized, snd,
+         rcv, drops);
+  sbstat_print();
+  if (sized < 50 || snd < 625 * 1000 || rcv < 625 * 1000)
+    return 1;
+  // the sides that don't carry the data stay put
+  if (sbsize(client, SO_RCVBUF) > rcv0 || sbsize(server, SO_SNDBUF) > snd0)
+    return 1;
+
+  // over budget: both buffers go back to their defaults
+  unsigned long shrunk = kstat("sb_shrunk"), denied = kstat("sb_denied");
+  sb_budget = kstat("sb_reserved") / 2;
+  for (long long t = now + 1000000; now < t;)
+    step();
+  sizes(&snd, &rcv);
+  printf("budget %lu, idle: snd %lu rcv %lu, %lu reserved\n", sb_budget, snd,
+         rcv, kstat("sb_reserved"));
+  if (kstat("sb_shrunk") == shrunk || snd > snd0 || rcv > rcv0 ||
+      kstat("sb_reserved") > sb_budget)
+    return 1;
+
+  // with nothing left to grow into, don't grow again
+  sb_budget = kstat("sb_reserved");
+  double tight = transfer();
+  sizes(&snd, &rcv);
+  printf("budget %lu: %6.1f Mbit/s, snd %lu rcv %lu, %lu denied\n",
+         sb_budget, tight, snd, rcv, kstat("sb_denied") - denied);
+  if (tight < 0 || tight > sized / 4 || snd > snd0 || rcv > rcv0 ||
+      kstat("sb_denied") == denied)
+    return 1;
+  disconnect();
+  return 0;
+}
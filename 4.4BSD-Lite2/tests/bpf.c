@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Filter programs compiled by bpf_compile() against bpf_filter().
+//  - Fuzzes: random valid programs over random packets, each packet
+//    both in one buffer and cut into an mbuf chain at random places.
+//    The interpreter and the compiled program must return the same,
+//    and the same for the buffer as for the chain.
+//  - Programs bpf_validate() must refuse are refused by bpf_compile().
+//  - Times tcpdump filters on Ethernet frames, in packets a second,
+//    for both, on a buffer and on an mbuf.
+
+// sys/net/bpf.h
+struct insn
+{
+  unsigned short code;
+  unsigned char jt, jf;
+  int k;
+};
+int bpf_validate(struct insn* f, int len);
+unsigned bpf_filter(struct insn* pc, unsigned char* p, unsigned wirelen,
+                    unsigned buflen);
+void* bpf_compile(struct insn* f, int len);
+unsigned bpf_tfilter(void* code, unsigned char* p, unsigned wirelen,
+                     unsigned buflen);
+void bpf_tfree(void* code);
+
+enum
+{
+  LD = 0x00, LDX = 0x01, ST = 0x02, STX = 0x03, ALU = 0x04, JMP = 0x05,
+  RET = 0x06, MISC = 0x07,
+  W = 0x00, H = 0x08, B = 0x10,
+  IMM = 0x00, ABS = 0x20, IND = 0x40, MEM = 0x60, LEN = 0x80, MSH = 0xa0,
+  DIV = 0x30, LSH = 0x60, RSH = 0x70, NEG = 0x80,
+  JA = 0x00, JEQ = 0x10, JGT = 0x20, JGE = 0x30, JSET = 0x40,
+  K = 0x00, X = 0x08, A = 0x10,
+  MEMWORDS = 16, MAXPKT = 128,
+};
+
+unsigned rs = 1;
+
+unsigned xorshift()
+{
+  rs ^= rs << 13;
+  rs ^= rs >> 17;
+  rs ^= rs << 5;
+  return rs;
+}
+
+double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// an offset into a packet of at most MAXPKT bytes, now and then past it
+int randoff()
+{
+  switch (xorshift() % 16)
+  {
+  case 0:
+    return xorshift();
+  case 1:
+    return -(int)(xorshift() % 8);
+  default:
+    return xorshift() % (MAXPKT + 8);
+  }
+}
+
+// a valid program of n instructions, at least MEMWORDS + 2
+int randprog(struct insn* p, int n)
+{
+  static const unsigned short alu[] = {
+    0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70,
+  };
+  int i = 0;
+
+  // the scratch memory starts out set
+  p[i++] = (struct insn){ LD | IMM, 0, 0, xorshift() };
+  for (int j = 0; j < MEMWORDS; ++j)
+    p[i++] = (struct insn){ ST, 0, 0, j };
+  for (; i < n - 1; ++i)
+  {
+    int left = n - 1 - i;  // room to jump forward
+    struct insn* q = &p[i];
+    q->jt = q->jf = 0;
+    q->k = randoff();
+    switch (xorshift() % 12)
+    {
+    case 0:
+    case 1:
+    case 2:
+      q->code = LD | (unsigned short[]){ W, H, B }[xorshift() % 3] |
+                (xorshift() & 1 ? ABS : IND);
+      if (q->code & IND && xorshift() % 2)
+        q->k = xorshift() % 32;
+      break;
+    case 3:
+      q->code = (unsigned short[]){ LDX | MSH | B, LD | W | LEN, LDX | W | LEN,
+                                    LD | IMM, LDX | IMM }[xorshift() % 5];
+      if (q->code == (LDX | IMM))
+        q->k = xorshift() % 64;
+      break;
+    case 4:
+      q->code = (unsigned short[]){ LD | MEM, LDX | MEM, ST,
+                                    STX }[xorshift() % 4];
+      q->k = xorshift() % MEMWORDS;
+      break;
+    case 5:
+    case 6:
+      q->code = ALU | alu[xorshift() % 8] | (xorshift() & 1 ? X : K);
+      if ((q->code & 0xf0) == LSH || (q->code & 0xf0) == RSH)
+        q->k = xorshift() % 32;
+      else if (q->code == (ALU | DIV | K))
+        q->k = 1 + xorshift() % 16;
+      else if (xorshift() & 1)
+        q->k = xorshift() % 256;
+      break;
+    case 7:
+      q->code = (unsigned short[]){ ALU | NEG, MISC | 0x00,
+                                    MISC | 0x80 }[xorshift() % 3];
+      break;
+    case 8:
+    case 9:
+    case 10:
+      q->code = JMP | (unsigned short[]){ JA, JEQ, JGT, JGE,
+                                          JSET }[xorshift() % 5] |
+                (xorshift() % 3 ? K : X);
+      if ((q->code & 0xf0) == JA)
+      {
+        q->code = JMP | JA;
+        q->k = xorshift() % left;
+      }
+      else
+      {
+        q->jt = xorshift() % left;
+        q->jf = xorshift() % left;
+        if (xorshift() & 1)
+          q->k = xorshift() % 256;
+      }
+      break;
+    default:
+      q->code = RET | (xorshift() & 1 ? A : K);
+      q->k = xorshift() % 3 ? xorshift() % 256 : xorshift();
+      break;
+    }
+  }
+  p[i] = (struct insn){ RET | (xorshift() & 1 ? A : K), 0, 0, xorshift() };
+  return i + 1;
+}
+
+int fuzz(int nprogs, int npkts)
+{
+  struct insn prog[64];
+  unsigned char pkt[MAXPKT];
+  for (int i = 0; i < nprogs; ++i)
+  {
+    int n = randprog(prog, MEMWORDS + 2 + xorshift() % 40);
+    void* code = bpf_compile(prog, n);
+    if (code == NULL)
+    {
+      printf("program %d: not compiled\n", i);
+      return 0;
+    }
+    for (int j = 0; j < npkts; ++j)
+    {
+      int len = 1 + xorshift() % MAXPKT;
+      unsigned wirelen = len + xorshift() % 64;
+      for (int b = 0; b < len; ++b)
+        pkt[b] = xorshift() % 4 ? xorshift() : 0;
+      struct mbuf* m = mkchain((char*)pkt, len, 1 + xorshift() % 48,
+                               xorshift() % 16);
+      unsigned r1 = bpf_filter(prog, pkt, wirelen, len);
+      unsigned r2 = bpf_tfilter(code, pkt, wirelen, len);
+      unsigned r3 = bpf_filter(prog, (unsigned char*)m, wirelen, 0);
+      unsigned r4 = bpf_tfilter(code, (unsigned char*)m, wirelen, 0);
+      m_freem(m);
+      if (r1 != r2 || r1 != r3 || r1 != r4)
+      {
+        printf("program %d packet %d: interpreted %u, chain %u; "
+               "compiled %u, chain %u\n", i, j, r1, r3, r2, r4);
+        for (int k = 0; k < n; ++k)
+          printf("  %3d: 0x%04x %3d %3d %d\n", k, prog[k].code, prog[k].jt,
+                 prog[k].jf, prog[k].k);
+        return 0;
+      }
+    }
+    bpf_tfree(code);
+  }
+  return 1;
+}
+
+// programs to refuse
+int refuse()
+{
+  struct insn bad[][3] = {
+    { { LD | IMM, 0, 0, 0 }, { JMP | JA, 0, 0, -2 }, { RET | K, 0, 0, 0 } },
+    { { LD | IMM, 0, 0, 0 }, { JMP | JEQ, 1, 0, 0 }, { RET | K, 0, 0, 0 } },
+    { { LDX | MEM, 0, 0, MEMWORDS }, { RET | K, 0, 0, 0 }, { RET | K, 0, 0, 0 } },
+    { { STX, 0, 0, -1 }, { RET | K, 0, 0, 0 }, { RET | K, 0, 0, 0 } },
+    { { ALU | DIV | K, 0, 0, 0 }, { RET | K, 0, 0, 0 }, { RET | K, 0, 0, 0 } },
+    { { RET | K, 0, 0, 0 }, { RET | K, 0, 0, 0 }, { LD | IMM, 0, 0, 0 } },
+  };
+  for (int i = 0; i < sizeof bad / sizeof bad[0]; ++i)
+    if (bpf_validate(bad[i], 3) || bpf_compile(bad[i], 3))
+    {
+      printf("bad program %d taken\n", i);
+      return 0;
+    }
+  return !bpf_compile(bad[0], 0);
+}
+
+// tcpdump -d, for IPv4 over Ethernet
+struct insn f_ip[] = {
+  { 0x28, 0, 0, 12 },          // ldh [12]
+  { 0x15, 0, 1, 0x800 },       // jeq #0x800
+  { 0x06, 0, 0, 262144 },      // ret #262144
+  { 0x06, 0, 0, 0 },           // ret #0
+};
+struct insn f_hostudp[] = {     // host 10.0.0.1 and udp
+  { 0x28, 0, 0, 12 },          // ldh [12]
+  { 0x15, 0, 7, 0x800 },       // jeq #0x800
+  { 0x20, 0, 0, 26 },          // ld [26]
+  { 0x15, 2, 0, 0x0a000001 },  // jeq #10.0.0.1
+  { 0x20, 0, 0, 30 },          // ld [30]
+  { 0x15, 0, 3, 0x0a000001 },  // jeq #10.0.0.1
+  { 0x30, 0, 0, 23 },          // ldb [23]
+  { 0x15, 0, 1, 17 },          // jeq #17
+  { 0x06, 0, 0, 262144 },      // ret #262144
+  { 0x06, 0, 0, 0 },           // ret #0
+};
+struct insn f_tcpport[] = {     // tcp port 80
+  { 0x28, 0, 0, 12 },          // ldh [12]
+  { 0x15, 0, 10, 0x800 },      // jeq #0x800
+  { 0x30, 0, 0, 23 },          // ldb [23]
+  { 0x15, 0, 8, 6 },           // jeq #6
+  { 0x28, 0, 0, 20 },          // ldh [20]
+  { 0x45, 6, 0, 0x1fff },      // jset #0x1fff
+  { 0xb1, 0, 0, 14 },          // ldxb 4*([14]&0xf)
+  { 0x48, 0, 0, 14 },          // ldh [x + 14]
+  { 0x15, 2, 0, 80 },          // jeq #80
+  { 0x48, 0, 0, 16 },          // ldh [x + 16]
+  { 0x15, 0, 1, 80 },          // jeq #80
+  { 0x06, 0, 0, 262144 },      // ret #262144
+  { 0x06, 0, 0, 0 },           // ret #0
+};
+struct insn f_syn[] = {         // tcp[tcpflags] & tcp-syn != 0
+  { 0x28, 0, 0, 12 },          // ldh [12]
+  { 0x15, 0, 8, 0x800 },       // jeq #0x800
+  { 0x30, 0, 0, 23 },          // ldb [23]
+  { 0x15, 0, 6, 6 },           // jeq #6
+  { 0x28, 0, 0, 20 },          // ldh [20]
+  { 0x45, 4, 0, 0x1fff },      // jset #0x1fff
+  { 0xb1, 0, 0, 14 },          // ldxb 4*([14]&0xf)
+  { 0x50, 0, 0, 27 },          // ldb [x + 27]
+  { 0x45, 0, 1, 0x02 },        // jset #0x2
+  { 0x06, 0, 0, 262144 },      // ret #262144
+  { 0x06, 0, 0, 0 },           // ret #0
+};
+
+struct
+{
+  const char* name;
+  struct insn* prog;
+  int len;
+} filters[] = {
+  { "ip", f_ip, 4 },
+  { "host 10.0.0.1 and udp", f_hostudp, 10 },
+  { "tcp port 80", f_tcpport, 13 },
+  { "tcp[tcpflags] & tcp-syn != 0", f_syn, 11 },
+};
+
+enum { NFRAMES = 64, FRAMELEN = 14 + 20 + 20 + 6 };
+
+unsigned char frames[NFRAMES][FRAMELEN];
+
+// Ethernet frames of TCP, UDP and ARP, to and from port 80 and others
+void mkframes()
+{
+  for (int i = 0; i < NFRAMES; ++i)
+  {
+    unsigned char* f = frames[i];
+    memset(f, 0, FRAMELEN);
+    f[12] = 0x08;
+    f[13] = i % 8 == 7 ? 0x06 : 0x00;
+    f[14] = 0x45;
+    f[16] = 0;
+    f[17] = FRAMELEN - 14;
+    f[22] = 64;
+    f[23] = i % 4 == 3 ? 17 : 6;
+    f[26] = 10;
+    f[29] = 1 + i % 3;
+    f[30] = 10;
+    f[33] = 3;
+    unsigned short port = i % 3 ? 80 : 1024 + i;
+    f[34] = 0x80;
+    f[35] = i;
+    f[36] = port >> 8;
+    f[37] = port;
+    f[46] = 0x50;
+    f[47] = i % 5 == 0 ? 0x02 : 0x10;
+  }
+}
+
+void bench()
+{
+  enum { ROUNDS = 40000 };
+  struct mbuf* chains[NFRAMES];
+  mkframes();
+  for (int i = 0; i < NFRAMES; ++i)
+    chains[i] = mkchain((char*)frames[i], FRAMELEN, FRAMELEN, 0);
+
+  printf("%-30s %10s %10s %10s %10s\n", "Mpps", "interp", "compiled",
+         "mbuf int", "mbuf comp");
+  for (int f = 0; f < sizeof filters / sizeof filters[0]; ++f)
+  {
+    struct insn* prog = filters[f].prog;
+    void* code = bpf_compile(prog, filters[f].len);
+    double mpps[4];
+    unsigned taken[4] = { 0 };
+    for (int how = 0; how < 4; ++how)
+    {
+      double start = now();
+      for (int r = 0; r < ROUNDS; ++r)
+        for (int i = 0; i < NFRAMES; ++i)
+        {
+          unsigned char* p = how < 2 ? frames[i] : (unsigned char*)chains[i];
+          unsigned buflen = how < 2 ? FRAMELEN : 0;
+          taken[how] += how % 2 ? bpf_tfilter(code, p, FRAMELEN, buflen) != 0
+                                : bpf_filter(prog, p, FRAMELEN, buflen) != 0;
+        }
+      mpps[how] = ROUNDS * NFRAMES / (now() - start) / 1e6;
+    }
+    printf("%-30s %10.1f %10.1f %10.1f %10.1f   (%u of %d taken)\n",
+           filters[f].name, mpps[0], mpps[1], mpps[2], mpps[3],
+           taken[0] / ROUNDS, NFRAMES);
+    if (taken[1] != taken[0] || taken[2] != taken[0] || taken[3] != taken[0])
+      printf("  taken: %u %u %u %u\n", taken[0], taken[1], taken[2],
+             taken[3]);
+    bpf_tfree(code);
+  }
+  for (int i = 0; i < NFRAMES; ++i)
+    m_freem(chains[i]);
+}
+
+int main()
+{
+  init();
+  if (!refuse())
+    return 1;
+  if (!fuzz(20000, 64))
+    return 1;
+  printf("20000 random programs on 64 packets each: compiled and "
+         "interpreted agree\n");
+  bench();
+  return 0;
+}
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// bpf units tapping pg0, opened in-process by lib/bpfdev.c, taking
+// packets from rings of blocks (BIOCSRING).
+//  - Times a packet through pg0 with nobody tapping, with monitors
+//    whose filters take none of it, and with them gone again.
+//  - Monitors with different filters each see, in order and intact,
+//    the packets theirs takes and only those, both ways.
+//  - A reader that gives no block back loses packets, counted as
+//    drops; it gets the blocks in the order they were filled.
+//  - A block not full is handed over timeout ms after its first
+//    packet, with the clock run by settime() and callout_run(); after
+//    BIOCFLUSH, timeout ms after the first packet that follows.
+//  - Times capture into a ring against reading the same with
+//    bpfread().
+
+// sys/net/bpf.h
+struct block_hdr
+{
+  volatile unsigned status;
+  unsigned seq, npkts, offset, len;
+  struct timeval tsfirst, tslast;
+};
+struct bpf_hdr
+{
+  struct timeval tstamp;
+  unsigned caplen, datalen;
+  unsigned short hdrlen;
+};
+struct insn
+{
+  unsigned short code;
+  unsigned char jt, jf;
+  int k;
+};
+enum { BLOCK_KERNEL = 0, BLOCK_USER = 1 };
+#define WORDALIGN(x) (((x) + 3) & ~3)
+
+enum { SRC = 0xc0a80001, DST = 0xc0a80002, OTHER = 0x0a000001 };
+
+// ip[9] == proto
+#define PROTO_IS(proto) \
+  { { 0x30, 0, 0, 9 }, { 0x15, 0, 1, proto }, { 0x06, 0, 0, 0xffff }, \
+    { 0x06, 0, 0, 0 } }
+struct insn udp[] = PROTO_IS(17), none[] = PROTO_IS(99);
+// first 28 bytes only
+struct insn snap28[] = { { 0x06, 0, 0, 28 } };
+
+double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+unsigned short cksum(const unsigned char* p, int len)
+{
+  unsigned sum = 0;
+  for (int i = 0; i < len; i += 2)
+    sum += p[i] << 8 | (i + 1 < len ? p[i + 1] : 0);
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+// a datagram of proto, numbered n, to dst; as it isn't for us and we
+// don't forward, ip_input() drops it
+int mkpacket(unsigned char* pkt, int len, int proto, int n, unsigned dst)
+{
+  unsigned short sum;
+  memset(pkt, 0, len);
+  pkt[0] = 0x45;
+  pkt[2] = len >> 8;
+  pkt[3] = len;
+  pkt[8] = 64;
+  pkt[9] = proto;
+  for (int i = 0; i < 4; ++i)
+  {
+    pkt[12 + i] = SRC >> (24 - 8 * i);
+    pkt[16 + i] = dst >> (24 - 8 * i);
+  }
+  sum = cksum(pkt, 20);
+  pkt[10] = sum >> 8;
+  pkt[11] = sum;
+  for (int i = 20; i < len; ++i)
+    pkt[i] = n + i;
+  pkt[20] = n >> 8;
+  pkt[21] = n;
+  return len;
+}
+
+struct ring
+{
+  char* base;
+  int blocksize, nblocks, cur;
+  unsigned nextseq;
+};
+
+// the block at the reader's cursor, if the kernel has handed it over
+struct block_hdr* ring_block(struct ring* r)
+{
+  struct block_hdr* bb = (struct block_hdr*)(r->base + r->cur * r->blocksize);
+  return bb->status == BLOCK_USER ? bb : NULL;
+}
+
+void ring_release(struct ring* r, struct block_hdr* bb)
+{
+  bb->status = BLOCK_KERNEL;
+  r->cur = (r->cur + 1) % r->nblocks;
+}
+
+// calls fn for each packet in the blocks handed over, and gives them
+// back; returns how many packets, or -1 if a block is out of order
+int ring_drain(struct ring* r,
+               void (*fn)(void* arg, const unsigned char* p, int caplen,
+                          int datalen),
+               void* arg)
+{
+  struct block_hdr* bb;
+  int n = 0;
+  while ((bb = ring_block(r)) != NULL)
+  {
+    if (bb->seq != r->nextseq++)
+      return -1;
+    char* p = (char*)bb + bb->offset;
+    char* end = p + bb->len;
+    for (unsigned i = 0; i < bb->npkts; ++i)
+    {
+      struct bpf_hdr* hp = (struct bpf_hdr*)p;
+      if (p >= end)
+        return -1;
+      if (fn)
+        fn(arg, (unsigned char*)p + hp->hdrlen, hp->caplen, hp->datalen);
+      p += WORDALIGN(hp->hdrlen + hp->caplen);
+      ++n;
+    }
+    ring_release(r, bb);
+  }
+  return n;
+}
+
+int ring_open(struct ring* r, int unit, struct insn* f, int nf, int blocksize,
+              int nblocks, int timeout)
+{
+  int error = 0;
+  memset(r, 0, sizeof *r);
+  r->base = bpf_openring(unit, "pg0", f, nf, blocksize, nblocks, timeout,
+                         &error);
+  r->blocksize = WORDALIGN(blocksize);
+  r->nblocks = nblocks;
+  if (r->base == NULL)
+    printf("bpf%d: error %d\n", unit, error);
+  return r->base != NULL;
+}
+
+long long clock_ms = 1000000;
+
+// sets the stack's clock and runs the callouts due
+void advance(int ms)
+{
+  clock_ms += ms;
+  settime(clock_ms * 1000);
+  callout_run(clock_ms);
+}
+
+// what a monitor should see, and what it did
+struct seen
+{
+  int proto;  // that its filter takes, 0 for all
+  int snap;   // bytes it captures, 0 for all
+  int next;   // number of the packet it should see next
+  int count, bad;
+} seen[3];
+
+int sent[1000];  // protos of the packets by number
+int nsent;
+
+void check(void* arg, const unsigned char* p, int caplen, int datalen)
+{
+  struct seen* s = arg;
+  unsigned char want[1500];
+  while (s->next < nsent && s->proto && sent[s->next] != s->proto)
+    s->next++;
+  int n = s->next++;
+  int len = mkpacket(want, 64 + n % 512, sent[n], n, OTHER);
+  int snap = s->snap && s->snap < len ? s->snap : len;
+  if (n >= nsent || datalen != len || caplen != snap ||
+      memcmp(p, want, snap) != 0)
+    s->bad++;
+  s->count++;
+}
+
+// three monitors: everything, UDP only, the first 28 bytes
+int monitors()
+{
+  struct ring r[3];
+  unsigned char pkt[1500];
+  int want[3] = { 0 };
+  const int protos[] = { 17, 6, 1, 17, 253 };
+
+  if (!ring_open(&r[0], 0, NULL, 0, 8192, 8, 10) ||
+      !ring_open(&r[1], 1, udp, 4, 8192, 8, 10) ||
+      !ring_open(&r[2], 2, snap28, 1, 8192, 8, 10))
+    return 0;
+  advance(0);
+  memset(seen, 0, sizeof seen);
+  seen[1].proto = 17;
+  seen[2].snap = 28;
+  for (nsent = 0; nsent < 1000;)
+  {
+    int proto = protos[nsent % 5];
+    sent[nsent] = proto;
+    inject((char*)pkt, mkpacket(pkt, 64 + nsent % 512, proto, nsent, OTHER));
+    nsent++;
+    want[0]++;
+    want[1] += proto == 17;
+    want[2]++;
+    if (nsent % 37 == 0)
+      for (int i = 0; i < 3; ++i)
+        if (ring_drain(&r[i], check, &seen[i]) < 0)
+          return 0;
+  }
+  // the blocks not full are handed over after the timeout
+  advance(10);
+  for (int i = 0; i < 3; ++i)
+  {
+    unsigned recv, drop;
+    if (ring_drain(&r[i], check, &seen[i]) < 0)
+      return 0;
+    bpf_getstats(i, &recv, &drop);
+    bpf_close(i);
+    printf("monitor %d: %d of %d packets, %d wrong, %u seen, %u dropped\n",
+           i, seen[i].count, want[i], seen[i].bad, recv, drop);
+    if (seen[i].bad || seen[i].count != want[i] || recv != nsent || drop)
+      return 0;
+  }
+  return 1;
+}
+
+// a reader that holds every block
+int drops()
+{
+  struct ring r;
+  unsigned char pkt[100];
+  unsigned recv, drop;
+
+  // 8 packets of 100 bytes a block
+  if (!ring_open(&r, 0, NULL, 0, 1024, 4, 0))
+    return 0;
+  for (int i = 0; i < 100; ++i)
+    inject((char*)pkt, mkpacket(pkt, sizeof pkt, 17, i, OTHER));
+  int got = ring_drain(&r, NULL, NULL);
+  bpf_getstats(0, &recv, &drop);
+  printf("4 blocks held: %d of %u packets taken, %u dropped\n", got, recv,
+         drop);
+  if (got != 32 || recv != 100 || drop != 68)
+    return 0;
+  // the blocks given back fill again, in order; the third is handed
+  // over with the next packet
+  for (int i = 0; i < 24; ++i)
+    inject((char*)pkt, mkpacket(pkt, sizeof pkt, 17, i, OTHER));
+  got = ring_drain(&r, NULL, NULL);
+  bpf_getstats(0, &recv, &drop);
+  bpf_close(0);
+  if (got != 16 || drop != 68 || r.nextseq != 6)
+    return 0;
+  return 1;
+}
+
+// a block handed over timeout ms after its first packet
+int handover()
+{
+  struct ring r;
+  unsigned char pkt[100];
+
+  if (!ring_open(&r, 0, NULL, 0, 4096, 4, 50))
+    return 0;
+  advance(0);
+  inject((char*)pkt, mkpacket(pkt, sizeof pkt, 17, 0, OTHER));
+  advance(30);
+  inject((char*)pkt, mkpacket(pkt, sizeof pkt, 17, 1, OTHER));
+  advance(10);
+  if (ring_block(&r))
+    return 0;
+  advance(10);
+  struct block_hdr* bb = ring_block(&r);
+  if (bb == NULL || bb->npkts != 2)
+    return 0;
+  ring_release(&r, bb);
+  // nothing more is handed over without packets
+  advance(100);
+  if (ring_block(&r))
+    return 0;
+  // a flush starts the block over, and its timeout with its next packet
+  inject((char*)pkt, mkpacket(pkt, sizeof pkt, 17, 2, OTHER));
+  advance(30);
+  bpf_flush(0);
+  inject((char*)pkt, mkpacket(pkt, sizeof pkt, 17, 3, OTHER));
+  advance(30);
+  if (ring_block(&r))
+    return 0;
+  advance(20);
+  bb = ring_block(&r);
+  if (bb == NULL || bb->npkts != 1)
+    return 0;
+  ring_release(&r, bb);
+  bpf_close(0);
+  printf("a block of 2 packets handed over after 50 ms, "
+         "a flushed one 50 ms after the flush\n");
+  return 1;
+}
+
+// ns a packet through pg0, the datagram dropped by ip_input()
+double pass(int n)
+{
+  unsigned char pkt[100];
+  mkpacket(pkt, sizeof pkt, 6, 0, OTHER);
+  double start = now();
+  for (int i = 0; i < n; ++i)
+    inject((char*)pkt, sizeof pkt);
+  return (now() - start) * 1e9 / n;
+}
+
+int cost()
+{
+  struct ring r[4];
+  double idle = pass(200000);
+  for (int i = 0; i < 4; ++i)
+    if (!ring_open(&r[i], i, none, 4, 4096, 4, 0))
+      return 0;
+  double tapped = pass(200000);
+  for (int i = 0; i < 4; ++i)
+    bpf_close(i);
+  double after = pass(200000);
+  printf("a packet through pg0: %.0f ns, %.0f ns with 4 monitors taking "
+         "none of it, %.0f ns after they close\n", idle, tapped, after);
+  return 1;
+}
+
+// ns a packet of len bytes captured and taken by the reader, from a
+// ring, or with bpfread() if ring is 0
+double capture(int ring, int len)
+{
+  enum { BUFSIZE = 32768, BATCH = 32, ROUNDS = 4000 };
+  static char buf[BUFSIZE];
+  unsigned char pkt[1500];
+  struct ring r;
+  long got = 0;
+
+  if (ring ? !ring_open(&r, 0, NULL, 0, BUFSIZE, 16, 0)
+           : bpf_openbuf(0, "pg0", NULL, 0, BUFSIZE) != 0)
+    return -1;
+  mkpacket(pkt, len, 17, 0, OTHER);
+  double start = now();
+  for (int i = 0; i < ROUNDS; ++i)
+  {
+    for (int j = 0; j < BATCH; ++j)
+      inject((char*)pkt, len);
+    if (ring)
+      got += ring_drain(&r, NULL, NULL);
+    else
+    {
+      int n;
+      while ((n = bpf_readbuf(0, buf, sizeof buf)) > 0)
+        for (char* p = buf; p < buf + n; ++got)
+        {
+          struct bpf_hdr* hp = (struct bpf_hdr*)p;
+          p += WORDALIGN(hp->hdrlen + hp->caplen);
+        }
+    }
+  }
+  double sec = now() - start;
+  unsigned recv, drop;
+  bpf_getstats(0, &recv, &drop);
+  bpf_close(0);
+  // a ring holds back the block it is filling
+  if (drop || got < (long)ROUNDS * BATCH - BUFSIZE / len)
+    return -1;
+  return sec * 1e9 / got;
+}
+
+int main()
+{
+  pigeonattach(1);
+  init();
+  setipaddr("pg0", DST);  // 192.168.0.2
+
+  if (!monitors())
+  {
+    printf("monitors saw wrong packets\n");
+    return 1;
+  }
+  if (!drops())
+  {
+    printf("drops miscounted\n");
+    return 1;
+  }
+  if (!handover())
+  {
+    printf("block not handed over on time\n");
+    return 1;
+  }
+  if (!cost())
+    return 1;
+  const int lens[] = { 64, 512, 1500 };
+  for (int i = 0; i < 3; ++i)
+  {
+    double inring = capture(1, lens[i]), read = capture(0, lens[i]);
+    if (inring < 0 || read < 0)
+    {
+      printf("%d bytes: packets lost\n", lens[i]);
+      return 1;
+    }
+    printf("%4d-byte packets: %.0f ns captured into a ring, "
+           "%.0f ns with bpfread()\n", lens[i], inring, read);
+  }
+  return 0;
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/tcpv2.h"
+
+// Runs a bulk transfer over a simulated long fat pipe with each
+// congestion control module and compares the throughput.
+//
+// The path is a 100 Mbit/s bottleneck with a 300 KB drop-tail queue
+// and 25 ms of delay each way, and loses one data packet in 10000 at
+// random: 625 KB in flight to fill it.  As in tests/sack.c the test is
+// the wire, and both ends live in this one stack; it keeps packets in
+// flight on a virtual clock and sets the kernel's time to it.
+
+extern unsigned long tcp_sendspace, tcp_recvspace;
+extern void tcp_fasttimo();
+extern void tcp_slowtimo();
+
+enum
+{
+  PORT = 1234,
+  MBPS = 100,
+  DELAY = 25000,          // us, each way
+  QUEUE = 300 * 1000,     // bytes
+  LOSS = 10000,           // one packet in
+  SECONDS = 20,
+  RING = 8192,
+  IPPROTO_TCP = 6,
+  TCP_CONGESTION = 0x40,  // netinet/tcp.h
+};
+
+struct packet
+{
+  long long at;  // when it arrives
+  int len;
+  char data[1600];
+};
+
+// packets in flight in one direction, in order of arrival
+struct link
+{
+  struct packet pkts[RING];
+  int head, tail;
+} fwd, rev;
+
+long long now, linkfree, nextfast, nextslow;
+unsigned rs = 1;
+int drops;
+
+unsigned xorshift()
+{
+  rs ^= rs << 13;
+  rs ^= rs >> 17;
+  rs ^= rs << 5;
+  return rs;
+}
+
+void put(struct link* l, long long at, const char* data, int len)
+{
+  struct packet* p = &l->pkts[l->tail++ % RING];
+  p->at = at;
+  p->len = len;
+  memcpy(p->data, data, len);
+}
+
+// takes what the stack has sent: data to the bottleneck, acks
+// straight onto the return path
+void collect()
+{
+  char pkt[1600];
+  int len;
+  while ((len = pigeon_dequeue(pkt, sizeof pkt)) > 0)
+  {
+    const unsigned char* th = (unsigned char*)pkt + (pkt[0] & 0xf) * 4;
+    if ((th[2] << 8 | th[3]) != PORT)
+    {
+      put(&rev, now + DELAY, pkt, len);
+      continue;
+    }
+    if (linkfree < now)
+      linkfree = now;
+    if ((linkfree - now) * MBPS / 8 > QUEUE || xorshift() % LOSS == 0)
+    {
+      ++drops;
+      continue;
+    }
+    linkfree += len * 8 / MBPS;
+    put(&fwd, linkfree + DELAY, pkt, len);
+  }
+}
+
+// advances the clock to the next arrival or timer and handles it
+void step()
+{
+  struct link* l = NULL;
+  long long t = nextfast < nextslow ? nextfast : nextslow;
+  if (fwd.head != fwd.tail && fwd.pkts[fwd.head % RING].at < t)
+    t = fwd.pkts[fwd.head % RING].at, l = &fwd;
+  if (rev.head != rev.tail && rev.pkts[rev.head % RING].at < t)
+    t = rev.pkts[rev.head % RING].at, l = &rev;
+  now = t;
+  settime(now);
+  if (l)
+  {
+    struct packet* p = &l->pkts[l->head++ % RING];
+    char addr[4];
+    memcpy(addr, p->data + 12, 4);
+    memcpy(p->data + 12, p->data + 16, 4);
+    memcpy(p->data + 16, addr, 4);
+    inject(p->data, p->len);
+  }
+  else if (t == nextfast)
+  {
+    tcp_fasttimo();
+    nextfast += 200000;
+  }
+  else
+  {
+    tcp_slowtimo();
+    nextslow += 500000;
+  }
+  collect();
+}
+
+// returns the goodput in Mbit/s, or -1 if the data read back differs
+double transfer(struct socket* listenso, const char* cc)
+{
+  static char src[2 << 20], buf[1 << 20];
+  for (int i = 0; i < sizeof src; ++i)
+    src[i] = i % 251;
+
+  struct socket* client = connectto(0xc0a80001, PORT);
+  struct socket* server = NULL;
+  if (setsockoptso(client, IPPROTO_TCP, TCP_CONGESTION, cc, strlen(cc) + 1))
+    return -1;
+  while (server == NULL)
+  {
+    step();
+    server = acceptso(listenso);
+  }
+
+  long long start = now, sent = 0, received = 0;
+  drops = 0;
+  while (now < start + SECONDS * 1000000LL)
+  {
+    sent += writeso(client, src + sent % 251, 1 << 20);
+    int nr = readso(server, buf, sizeof buf);
+    for (int i = 0; i < nr; ++i)
+      if (buf[i] != (char)((received + i) % 251))
+        return -1;
+    if (nr > 0)
+      received += nr;
+    step();
+  }
+  soclose(client);
+  soclose(server);
+  while (fwd.head != fwd.tail || rev.head != rev.tail)
+    step();
+  return received * 8.0 / (now - start);
+}
+
+int main()
+{
+  const char* ccs[] = { "reno", "cubic", "bbr" };
+  double mbps[3];
+
+  pigeonattach(1);
+  pigeon_setqlen(RING);
+  init();
+  setipaddr("pg0", 0xc0a80002);  // 192.168.0.2
+  tcp_sendspace = tcp_recvspace = 1536 * 1024;
+  struct socket* listenso = listenon(PORT);
+  now = 1000000;
+  nextfast = now + 200000;
+  nextslow = now + 500000;
+
+  struct socket* so = connectto(0xc0a80001, PORT);
+  if (setsockoptso(so, IPPROTO_TCP, TCP_CONGESTION, "vegas", 6) == 0)
+  {
+    printf("vegas: accepted\n");
+    return 1;
+  }
+  soclose(so);
+
+  printf("%d Mbit/s, %d ms rtt, 1/%d loss, %d s\n",
+         MBPS, 2 * DELAY / 1000, LOSS, SECONDS);
+  for (int i = 0; i < 3; ++i)
+  {
+    mbps[i] = transfer(listenso, ccs[i]);
+    if (mbps[i] < 0)
+    {
+      printf("%s: transfer failed\n", ccs[i]);
+      return 1;
+    }
+    printf("%-6s %6.1f Mbit/s, %d dropped\n", ccs[i], mbps[i], drops);
+  }
+  // the window must grow faster than a segment a round trip
+  return mbps[1] > mbps[0] && mbps[2] > mbps[0] ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Loads random route tables of 1k, 100k and 800k prefixes, with the
+// prefix lengths spread as in a full BGP table, and compares the radix
+// tree (rn_match()) with the DIR-24-8 FIB in sys/net/fib.c: lookups a
+// second, and memory.  Every lookup must find the same route both
+// ways, with the table full, after half of it is deleted, and with
+// only the default route left.  The FIB isn't built until there are
+// fib_minroutes routes, so the 1k table is looked up in the tree, and
+// before that the routes to the interfaces cost it nothing.
+
+extern unsigned long fib_memuse;
+
+enum
+{
+  GW = 0xc0a80001,
+  NLOOKUP = 1 << 20,
+};
+
+// lengths per 1000 prefixes, /8 to /32
+const int weights[] = {
+  1, 0, 0, 0, 1, 0, 0, 1,          // /8../15
+  14, 8, 14, 27, 45, 50, 110, 100, // /16../23
+  600,                             // /24
+  4, 4, 4, 4, 3, 3, 3, 4,          // /25../32
+};
+
+unsigned rs = 1;
+
+unsigned xorshift()
+{
+  rs ^= rs << 13;
+  rs ^= rs >> 17;
+  rs ^= rs << 5;
+  return rs;
+}
+
+double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+unsigned mask(int len)
+{
+  return len ? 0xffffffff << (32 - len) : 0;
+}
+
+int randlen()
+{
+  int w = xorshift() % 1000;
+  for (int i = 0;; ++i)
+    if ((w -= weights[i]) < 0)
+      return 8 + i;
+}
+
+// half the addresses in a prefix of the table, half anywhere
+void mkaddrs(unsigned* addrs, const unsigned* pfx, const int* lens, int n)
+{
+  for (int i = 0; i < NLOOKUP; ++i)
+  {
+    int j = xorshift() % n;
+    addrs[i] = i & 1 ? xorshift() : pfx[j] | (xorshift() & ~mask(lens[j]));
+  }
+}
+
+int compare(const unsigned* addrs, double* radixsec, double* fibsec)
+{
+  static struct rtentry* want[NLOOKUP];
+  int bad = 0;
+  double start = now();
+  for (int i = 0; i < NLOOKUP; ++i)
+    want[i] = rtlookup_radix(addrs[i]);
+  *radixsec = now() - start;
+  start = now();
+  for (int i = 0; i < NLOOKUP; ++i)
+    bad += rtlookup_fib(addrs[i]) != want[i];
+  *fibsec = now() - start;
+  return bad;
+}
+
+int run(int n)
+{
+  unsigned* pfx = malloc(n * sizeof *pfx);
+  int* lens = malloc(n * sizeof *lens);
+  unsigned* addrs = malloc(NLOOKUP * sizeof *addrs);
+  long radix0 = kmemuse("routetbl") - fib_memuse, fib0 = fib_memuse;
+  double radixsec, fibsec;
+  int added = 0;
+
+  while (added < n)
+  {
+    int len = randlen();
+    unsigned a = xorshift() & mask(len);
+    // keep clear of the routes to the interfaces and the gateway
+    if (a >> 24 == 127 || a >> 24 == 0 || (a & mask(len < 16 ? len : 16)) ==
+        (0xc0a80000 & mask(len < 16 ? len : 16)))
+      continue;
+    if (addroute(a, len, GW) == 0)
+    {
+      pfx[added] = a;
+      lens[added++] = len;
+    }
+  }
+  long radixmem = kmemuse("routetbl") - fib_memuse - radix0;
+  long fibmem = fib_memuse - fib0;
+
+  mkaddrs(addrs, pfx, lens, n);
+  int bad = compare(addrs, &radixsec, &fibsec);
+  printf("%7d prefixes: radix %6.2f M lookups/s %7.1f MB, "
+         "fib %6.2f M lookups/s %7.1f MB\n",
+         n, NLOOKUP / radixsec / 1e6, radixmem / 1e6,
+         NLOOKUP / fibsec / 1e6, (fib0 + fibmem) / 1e6);
+
+  for (int i = 0; i < n; i += 2)
+    if (delroute(pfx[i], lens[i]))
+      bad += 1000000;
+  bad += compare(addrs, &radixsec, &fibsec);
+  for (int i = 1; i < n; i += 2)
+    if (delroute(pfx[i], lens[i]))
+      bad += 1000000;
+  bad += compare(addrs, &radixsec, &fibsec);
+  if (rtlookup_fib(0x08080808) == NULL)
+    ++bad;  // lost the default route
+
+  free(pfx);
+  free(lens);
+  free(addrs);
+  return bad;
+}
+
+int main()
+{
+  pigeonattach(1);
+  init();
+  setipaddr("pg0", 0xc0a80002);  // 192.168.0.2
+  if (addroute(0, 0, GW))
+  {
+    printf("can't add the default route\n");
+    return 1;
+  }
+  if (fib_memuse != 0 ||
+      rtlookup_fib(0x08080808) != rtlookup_radix(0x08080808))
+  {
+    printf("%lu bytes of FIB for a few routes\n", fib_memuse);
+    return 1;
+  }
+
+  const int sizes[] = { 1000, 100000, 800000 };
+  for (int i = 0; i < 3; ++i)
+  {
+    int bad = run(sizes[i]);
+    if (bad)
+    {
+      printf("%d prefixes: %d lookups differ\n", sizes[i], bad);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// IP reassembly under a fragmentation storm, on the pigeon interface.
+//  - Times 8-fragment datagrams sent interleaved, with 16 to 2048 of
+//    them in reassembly at once: the cost of a fragment mustn't grow
+//    with the number of queues.
+//  - Floods first fragments that are never completed, with datagrams
+//    that are sent whole among them: the storage held stays under
+//    ip_reass_maxmem, the least recently used queues go, and the
+//    datagrams still get through.  ip_slowtimo() clears the rest.
+//  - Echo requests cut into fragments of random size, shuffled and
+//    overlapping, must come back as the replies that were asked for.
+
+extern int ip_reass_mbcnt, ip_reass_maxmem;
+extern void ip_slowtimo();
+
+enum { SRC = 0xc0a80001, DST = 0xc0a80002, PROTO = 253, NFRAG = 8 };
+
+unsigned rs = 1;
+
+unsigned xorshift()
+{
+  rs ^= rs << 13;
+  rs ^= rs >> 17;
+  rs ^= rs << 5;
+  return rs;
+}
+
+double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+unsigned short cksum(const unsigned char* p, int len)
+{
+  unsigned sum = 0;
+  for (int i = 0; i < len; i += 2)
+    sum += p[i] << 8 | (i + 1 < len ? p[i + 1] : 0);
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+// sends bytes [off, off + len) of a datagram's payload as a fragment
+void fragment(unsigned src, int id, int proto, const unsigned char* data,
+              int off, int len, int more)
+{
+  unsigned char pkt[1500];
+  unsigned short sum;
+  memset(pkt, 0, 20);
+  pkt[0] = 0x45;
+  pkt[2] = (20 + len) >> 8;
+  pkt[3] = 20 + len;
+  pkt[4] = id >> 8;
+  pkt[5] = id;
+  pkt[6] = (more ? 0x20 : 0) | (off / 8) >> 8;
+  pkt[7] = off / 8;
+  pkt[8] = 64;
+  pkt[9] = proto;
+  for (int i = 0; i < 4; ++i)
+  {
+    pkt[12 + i] = src >> (24 - 8 * i);
+    pkt[16 + i] = DST >> (24 - 8 * i);
+  }
+  sum = cksum(pkt, 20);
+  pkt[10] = sum >> 8;
+  pkt[11] = sum;
+  memcpy(pkt + 20, data + off, len);
+  inject((char*)pkt, 20 + len);
+}
+
+void drainwire()
+{
+  char buf[2048];
+  while (pigeon_dequeue(buf, sizeof buf) > 0)
+    ;
+}
+
+// nq datagrams of NFRAG fragments of fraglen bytes, fragment i of
+// each before fragment i + 1 of any; returns ns a fragment
+double storm(int nq, int fraglen, int rounds)
+{
+  static unsigned char data[NFRAG * 1480];
+  unsigned long before = kstat("ips_reassembled");
+  double start = now();
+  for (int r = 0; r < rounds; ++r)
+    for (int i = 0; i < NFRAG; ++i)
+      for (int q = 0; q < nq; ++q)
+        fragment(0x0a000000 + q, r, PROTO, data, i * fraglen, fraglen,
+                 i < NFRAG - 1);
+  double sec = now() - start;
+  if (kstat("ips_reassembled") - before != (unsigned long)nq * rounds)
+    return -1;
+  return sec * 1e9 / (nq * rounds * NFRAG);
+}
+
+int flood()
+{
+  static unsigned char data[3 * 1480];
+  unsigned long before = kstat("ips_reassembled");
+  int most = 0, ok = 0;
+  for (int i = 0; i < 20000; ++i)
+  {
+    // a first fragment from anywhere, that nothing follows
+    fragment(xorshift(), i, PROTO, data, 0, 1480, 1);
+    if (ip_reass_mbcnt > most)
+      most = ip_reass_mbcnt;
+    if (i % 10 == 0)
+    {
+      for (int j = 0; j < 3; ++j)
+        fragment(SRC, i, PROTO, data, j * 1480, 1480, j < 2);
+      ++ok;
+    }
+  }
+  printf("flood: %lu of %d datagrams through, %lu fragments evicted, "
+         "%d KB held at most, %d KB allowed\n",
+         kstat("ips_reassembled") - before, ok, kstat("ips_fragevicted"),
+         most / 1024, ip_reass_maxmem / 1024);
+  if (most > ip_reass_maxmem || kstat("ips_reassembled") - before != ok ||
+      kstat("ips_fragevicted") == 0)
+    return 0;
+  for (int i = 0; i < 60; ++i)  // IPFRAGTTL
+    ip_slowtimo();
+  if (ip_reass_mbcnt != 0)
+  {
+    printf("%d bytes held after timing out\n", ip_reass_mbcnt);
+    return 0;
+  }
+  return 1;
+}
+
+// an echo request of len bytes in fragments of random size, in random
+// order, some of them twice and some overlapping; the reply must be
+// what was asked for
+int echo(int id, int len)
+{
+  unsigned char req[1400], reply[2048];
+  struct
+  {
+    int off, len;
+  } frags[64];
+  int n = 0;
+
+  req[0] = 8;
+  req[1] = req[2] = req[3] = 0;
+  req[4] = id >> 8;
+  req[5] = id;
+  req[6] = req[7] = 0;
+  for (int i = 8; i < len; ++i)
+    req[i] = xorshift();
+  unsigned short sum = cksum(req, len);
+  req[2] = sum >> 8;
+  req[3] = sum;
+
+  for (int off = 0; off < len;)
+  {
+    int fl = 8 * (1 + xorshift() % 24);
+    if (off + fl > len)
+      fl = len - off;
+    frags[n].off = off;
+    frags[n++].len = fl;
+    off += fl;
+    if (xorshift() % 4 == 0 && off < len)
+      off -= 8;  // overlap the next one
+  }
+  int nfrags = n;
+  for (int i = 0; i < nfrags / 3; ++i)
+    frags[n++] = frags[xorshift() % nfrags];  // duplicates
+  for (int i = n - 1; i > 0; --i)
+  {
+    int j = xorshift() % (i + 1);
+    int o = frags[i].off, l = frags[i].len;
+    frags[i] = frags[j];
+    frags[j].off = o;
+    frags[j].len = l;
+  }
+  for (int i = 0; i < n; ++i)
+    fragment(SRC, id, 1, req, frags[i].off, frags[i].len,
+             frags[i].off + frags[i].len < len);
+
+  int got = 0, rlen;
+  while ((rlen = pigeon_dequeue((char*)reply, sizeof reply)) > 0)
+    if (rlen == 20 + len && reply[9] == 1 && reply[20] == 0 &&
+        memcmp(reply + 24, req + 4, len - 4) == 0)
+      ++got;
+  return got == 1;
+}
+
+int main()
+{
+  pigeonattach(1);
+  pigeon_setqlen(1024);
+  init();
+  setipaddr("pg0", DST);  // 192.168.0.2
+
+  const int nqs[] = { 16, 256, 2048 };
+  for (int i = 0; i < 3; ++i)
+  {
+    double ns = storm(nqs[i], 64, 65536 / nqs[i]);
+    if (ns < 0)
+    {
+      printf("%d queues: datagrams lost\n", nqs[i]);
+      return 1;
+    }
+    printf("%5d datagrams in reassembly: %6.1f ns a fragment\n", nqs[i], ns);
+  }
+  drainwire();
+
+  if (!flood())
+    return 1;
+
+  for (int i = 0; i < 1000; ++i)
+    if (!echo(i, 64 + xorshift() % (1400 - 64)))
+    {
+      printf("echo %d: no reply, or a wrong one\n", i);
+      return 1;
+    }
+  printf("1000 echo requests in shuffled fragments: all replied to\n");
+  return 0;
+}
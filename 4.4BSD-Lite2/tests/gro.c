@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "../lib/tcpv2.h"
+
+// Moves a bulk transfer across the tun interface with receive
+// coalescing off and on, and times the receiving side: tun_input() of
+// the data segments, through to the acks they make.  With coalescing
+// the segments of a batch reach tcp_input() as a few large ones.
+//
+// The test is the wire: what the stack writes to tun0 is read back in
+// batches of up to 64 packets through tun_rxbufs() and tun_input(), as
+// tests/tun.c does from the device, with the addresses swapped so both
+// ends live in this one stack, as in tests/sack.c.  The data must
+// arrive intact.
+
+extern int tcp_do_gro;
+extern unsigned long tcp_sendspace, tcp_recvspace;
+extern unsigned long sb_max;
+extern void tcp_fasttimo();
+
+enum { PORT = 1234, TOTAL = 64 << 20, CHUNK = 1 << 20, BATCH = 64, WIRE = 4096 };
+
+struct packet
+{
+  int len;
+  char data[1500];
+} wire[WIRE], pkts[WIRE];
+int nwire;
+
+struct stats
+{
+  long long recvus;  // in tun_input() with data for the server
+  int segs, acks;
+};
+
+int tun_write(const char* buf, int len)
+{
+  if (nwire == WIRE || len > sizeof wire[0].data)
+    return -1;
+  wire[nwire].len = len;
+  memcpy(wire[nwire++].data, buf, len);
+  return len;
+}
+
+int tun_writev(const struct iovec* iov, int iovcnt)
+{
+  char buf[sizeof wire[0].data];
+  int len = 0;
+  for (int i = 0; i < iovcnt; ++i)
+  {
+    if (len + iov[i].iov_len > sizeof buf)
+      return -1;
+    memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+    len += iov[i].iov_len;
+  }
+  return tun_write(buf, len);
+}
+
+long long now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// reads n packets back in, BATCH at a time, and returns the
+// microseconds spent in tun_input()
+long long deliver(struct packet** list, int n)
+{
+  struct iovec iov[BATCH];
+  int lens[BATCH];
+  long long us = 0;
+  while (n > 0)
+  {
+    int k = tun_rxbufs(iov, n < BATCH ? n : BATCH);
+    for (int i = 0; i < k; ++i)
+    {
+      char* pkt = iov[i].iov_base;
+      memcpy(pkt, list[i]->data, lens[i] = list[i]->len);
+      char addr[4];
+      memcpy(addr, pkt + 12, 4);
+      memcpy(pkt + 12, pkt + 16, 4);
+      memcpy(pkt + 16, addr, 4);
+    }
+    long long start = now();
+    tun_input(lens, k);
+    us += now() - start;
+    list += k;
+    n -= k;
+  }
+  return us;
+}
+
+// takes what is on the wire and delivers it, the client's acks first
+void roundtrip(struct stats* st)
+{
+  static struct packet* toclient[WIRE];
+  static struct packet* toserver[WIRE];
+  int nc = 0, ns = 0, n = nwire;
+  memcpy(pkts, wire, n * sizeof wire[0]);
+  nwire = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    const char* pkt = pkts[i].data;
+    const unsigned char* th = (unsigned char*)pkt + (pkt[0] & 0xf) * 4;
+    int datalen = pkts[i].len - (pkt[0] & 0xf) * 4 - (th[12] >> 4) * 4;
+    if ((th[2] << 8 | th[3]) == PORT)
+    {
+      if (datalen > 0)
+        ++st->segs;
+      toserver[ns++] = &pkts[i];
+    }
+    else
+    {
+      if (datalen == 0)
+        ++st->acks;
+      toclient[nc++] = &pkts[i];
+    }
+  }
+  deliver(toclient, nc);
+  st->recvus += deliver(toserver, ns);
+  tcp_fasttimo();
+}
+
+int transfer(struct socket* listenso, struct stats* st)
+{
+  static char src[CHUNK + 251], buf[CHUNK];
+  for (int i = 0; i < sizeof src; ++i)
+    src[i] = i % 251;
+
+  struct socket* client = connectto(0xc0a80001, PORT);
+  struct socket* server = NULL;
+  while (server == NULL)
+  {
+    roundtrip(st);
+    server = acceptso(listenso);
+  }
+
+  memset(st, 0, sizeof *st);
+  long long sent = 0, received = 0;
+  while (received < TOTAL)
+  {
+    if (sent < TOTAL)
+    {
+      int n = TOTAL - sent < CHUNK ? TOTAL - sent : CHUNK;
+      sent += writeso(client, src + sent % 251, n);
+    }
+    roundtrip(st);
+    int nr = readso(server, buf, sizeof buf);
+    for (int i = 0; i < nr; ++i)
+      if (buf[i] != (char)((received + i) % 251))
+        return 0;
+    if (nr > 0)
+      received += nr;
+  }
+  soclose(client);
+  soclose(server);
+  for (int i = 0; i < 10; ++i)
+    roundtrip(st);
+  return 1;
+}
+
+int main()
+{
+  struct stats st[2];
+
+  tunattach(1);
+  init();
+  setipaddr("tun0", 0xc0a80002);  // 192.168.0.2
+  sb_max = 1024 * 1024;
+  tcp_sendspace = tcp_recvspace = 256 * 1024;
+  struct socket* listenso = listenon(PORT);
+
+  for (int gro = 0; gro < 2; ++gro)
+  {
+    tcp_do_gro = gro;
+    if (!transfer(listenso, &st[gro]))
+    {
+      printf("gro %d: data differs\n", gro);
+      return 1;
+    }
+    printf("gro %d: %d segments, %d acks, %7.1f ns a segment to receive\n",
+           gro, st[gro].segs, st[gro].acks,
+           st[gro].recvus * 1000.0 / st[gro].segs);
+  }
+  printf("%.2fx\n", (double)st[0].recvus / st[1].recvus);
+  return 0;
+}
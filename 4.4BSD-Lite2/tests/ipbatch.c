@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Times small packets into the stack one at a time, with inject(), and
+// BATCH at a time, with inject_batch(): 18-byte UDP datagrams for a
+// bound socket, and 64-byte segments of an established TCP connection.
+// Only the injection is timed; the datagrams and data are read back
+// and checked between batches.  TCP is timed with receive coalescing
+// on and off, since a batch lets it merge the segments.
+//
+// Then checks that ipintr() stops at ipintr_budget datagrams and
+// leaves the rest queued, with NETISR_IP set, for the next call.
+
+extern int ipintr_budget;
+extern int netisr;
+extern int tcp_do_gro;
+extern void tcp_fasttimo();
+
+enum
+{
+  DST = 0xc0a80002,   // 192.168.0.2, pg0
+  SRC = 0xc0a80001,
+  UPORT = 9,
+  TPORT = 1234,
+  PEERPORT = 4321,
+  BATCH = 32,
+  ROUNDS = 20000,
+  ULEN = 18,
+  TLEN = 64,
+  NETISR_IP = 2,      // sys/net/netisr.h
+};
+enum { SYN = 0x02, ACK = 0x10 };
+
+long long now_us()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void put16(unsigned char* p, unsigned v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+void put32(unsigned char* p, unsigned v)
+{
+  put16(p, v >> 16);
+  put16(p + 2, v);
+}
+
+unsigned get32(const unsigned char* p)
+{
+  return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+unsigned sum16(unsigned sum, const unsigned char* p, int len)
+{
+  for (int i = 0; i < len; i += 2)
+    sum += p[i] << 8 | (i + 1 < len ? p[i + 1] : 0);
+  return sum;
+}
+
+unsigned short fold(unsigned sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+// an IP header for len bytes of protocol p, and the sum of the pseudo
+// header for the transport checksum
+unsigned iphdr(unsigned char* pkt, int len, int p)
+{
+  unsigned char pseudo[12] = { 0 };
+  memset(pkt, 0, 20);
+  pkt[0] = 0x45;
+  put16(pkt + 2, len);
+  pkt[8] = 64;
+  pkt[9] = p;
+  put32(pkt + 12, SRC);
+  put32(pkt + 16, DST);
+  put16(pkt + 10, fold(sum16(0, pkt, 20)));
+  memcpy(pseudo, pkt + 12, 8);
+  pseudo[9] = p;
+  put16(pseudo + 10, len - 20);
+  return sum16(0, pseudo, 12);
+}
+
+// datagram i, its payload the number i repeated
+int udp(unsigned char* pkt, unsigned i)
+{
+  unsigned char* uh = pkt + 20;
+  int len = 20 + 8 + ULEN;
+  unsigned sum = iphdr(pkt, len, 17);
+  put16(uh, PEERPORT);
+  put16(uh + 2, UPORT);
+  put16(uh + 4, 8 + ULEN);
+  put16(uh + 6, 0);
+  for (int j = 0; j < ULEN; j += 2)
+    put16(uh + 8 + j, i);
+  put16(uh + 6, fold(sum16(sum, uh, 8 + ULEN)));
+  return len;
+}
+
+// a segment of the peer's, with len bytes of data from seq on, each
+// byte the low bits of its sequence number
+int tcp(unsigned char* pkt, unsigned seq, unsigned ack, int flags, int len)
+{
+  unsigned char* th = pkt + 20;
+  int optlen = flags & SYN ? 4 : 0;
+  int hlen = 20 + optlen;
+  unsigned sum = iphdr(pkt, 20 + hlen + len, 6);
+  memset(th, 0, hlen);
+  put16(th, PEERPORT);
+  put16(th + 2, TPORT);
+  put32(th + 4, seq);
+  put32(th + 8, ack);
+  th[12] = hlen / 4 << 4;
+  th[13] = flags;
+  put16(th + 14, 0xffff);
+  if (flags & SYN)
+    put32(th + 20, 0x020405b4);  // MSS 1460
+  for (int j = 0; j < len; ++j)
+    th[hlen + j] = seq + j;
+  put16(th + 16, fold(sum16(sum, th, hlen + len)));
+  return 20 + hlen + len;
+}
+
+unsigned char pkts[BATCH][1500];
+char* msgs[BATCH];
+int lens[BATCH];
+
+// the TCP connection: the peer's next sequence number and the ack
+unsigned peerseq, peerack;
+struct socket* server;
+
+void drain()
+{
+  char pkt[2048];
+  while (pigeon_dequeue(pkt, sizeof pkt) > 0)
+    ;
+}
+
+int establish(struct socket* listenso)
+{
+  unsigned char pkt[1500];
+  peerseq = 1000000;
+  inject((char*)pkt, tcp(pkt, peerseq++, 0, SYN, 0));
+  if (pigeon_dequeue((char*)pkt, sizeof pkt) <= 0)
+    return -1;
+  peerack = get32(pkt + 20 + 4) + 1;
+  inject((char*)pkt, tcp(pkt, peerseq, peerack, ACK, 0));
+  server = acceptso(listenso);
+  drain();
+  return server ? 0 : -1;
+}
+
+// ns per packet to get n of them in, BATCH at a time; -1 if what was
+// read back is wrong
+double run(int proto, int batched, int n)
+{
+  char buf[4096];
+  long long us = 0;
+  unsigned udpseq = 0;
+  for (int r = 0; r < n / BATCH; ++r)
+  {
+    for (int i = 0; i < BATCH; ++i)
+    {
+      msgs[i] = (char*)pkts[i];
+      if (proto == 17)
+        lens[i] = udp(pkts[i], udpseq + i);
+      else
+        lens[i] = tcp(pkts[i], peerseq + i * TLEN, peerack, ACK, TLEN);
+    }
+    long long t = now_us();
+    if (batched)
+      inject_batch((const char* const*)msgs, lens, BATCH);
+    else
+      for (int i = 0; i < BATCH; ++i)
+        inject(msgs[i], lens[i]);
+    us += now_us() - t;
+
+    if (proto == 17)
+    {
+      for (int i = 0; i < BATCH; ++i, ++udpseq)
+        if (readso(server, buf, sizeof buf) != ULEN ||
+            (unsigned char)buf[1] != (udpseq & 0xff))
+          return -1;
+    }
+    else
+    {
+      int nr = readso(server, buf, sizeof buf);
+      if (nr != BATCH * TLEN)
+        return -1;
+      for (int i = 0; i < nr; ++i)
+        if ((unsigned char)buf[i] != ((peerseq + i) & 0xff))
+          return -1;
+      peerseq += nr;
+      tcp_fasttimo();  // the delayed ack, with the window reopened
+    }
+    drain();
+  }
+  return us * 1000.0 / (n / BATCH * BATCH);
+}
+
+int main()
+{
+  pigeonattach(1);
+  pigeon_setqlen(4096);
+  init();
+  setipaddr("pg0", DST);
+  struct socket* udpso = udpon(UPORT);
+  struct socket* listenso = listenon(TPORT);
+  if (establish(listenso))
+  {
+    printf("handshake failed\n");
+    return 1;
+  }
+  struct socket* tcpso = server;
+  int n = ROUNDS * BATCH;
+
+  // warm up the mbuf free lists, then time
+  server = udpso;
+  run(17, 1, n / 10);
+  double u1 = run(17, 0, n), ub = run(17, 1, n);
+  server = tcpso;
+  run(6, 1, n / 10);
+  double t1 = run(6, 0, n), tb = run(6, 1, n);
+  tcp_do_gro = 0;
+  double t1n = run(6, 0, n), tbn = run(6, 1, n);
+  tcp_do_gro = 1;
+  if (u1 < 0 || ub < 0 || t1 < 0 || tb < 0 || t1n < 0 || tbn < 0)
+  {
+    printf("data differs\n");
+    return 1;
+  }
+  printf("%d packets, %d a batch:        one at a time      batched\n",
+         n, BATCH);
+  printf("udp %2d bytes          %8.1f ns %5.2f Mpps %6.1f ns %5.2f Mpps"
+         "  %.2fx\n", ULEN, u1, 1000 / u1, ub, 1000 / ub, u1 / ub);
+  printf("tcp %2d bytes          %8.1f ns %5.2f Mpps %6.1f ns %5.2f Mpps"
+         "  %.2fx\n", TLEN, t1, 1000 / t1, tb, 1000 / tb, t1 / tb);
+  printf("tcp %2d bytes, no gro  %8.1f ns %5.2f Mpps %6.1f ns %5.2f Mpps"
+         "  %.2fx\n", TLEN, t1n, 1000 / t1n, tbn, 1000 / tbn, t1n / tbn);
+
+  // a budget of 8 leaves 24 of a batch for the next ipintr()
+  ipintr_budget = 8;
+  server = udpso;
+  for (int i = 0; i < BATCH; ++i)
+  {
+    msgs[i] = (char*)pkts[i];
+    lens[i] = udp(pkts[i], i);
+  }
+  int left = inject_batch((const char* const*)msgs, lens, BATCH);
+  printf("budget 8: %d left, NETISR_IP %s\n", left,
+         netisr & 1 << NETISR_IP ? "set" : "clear");
+  if (left != BATCH - 8 || !(netisr & 1 << NETISR_IP))
+    return 1;
+  for (int i = 1; (netisr & 1 << NETISR_IP) && i < BATCH; ++i)
+    ipintr();
+  char buf[64];
+  int got = 0;
+  while (readso(udpso, buf, sizeof buf) == ULEN)
+    ++got;
+  printf("after %d more: %d datagrams\n", (BATCH - 8) / 8, got);
+  return got == BATCH && !(netisr & 1 << NETISR_IP) ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Times mbuf and cluster allocation: one at a time, as a packet is
+// received and consumed, and in bursts, as a socket buffer fills and
+// drains.
+
+enum { M_DONTWAIT = 1, MT_DATA = 1 };
+
+double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+  int iters = argc > 1 ? atoi(argv[1]) : 1000000;
+  const int burst = 4096;
+  struct mbuf** ms = malloc(burst * sizeof ms[0]);
+  char pkt[256] = { 0 };
+
+  init();
+
+  double start = now_sec();
+  for (int i = 0; i < iters; ++i)
+    m_free(m_get(M_DONTWAIT, MT_DATA));
+  printf("m_get/m_free:          %6.1f ns\n", (now_sec() - start) * 1e9 / iters);
+
+  start = now_sec();
+  for (int i = 0; i < iters / burst; ++i)
+  {
+    for (int j = 0; j < burst; ++j)
+      ms[j] = m_get(M_DONTWAIT, MT_DATA);
+    for (int j = 0; j < burst; ++j)
+      m_free(ms[j]);
+  }
+  printf("%d m_get, %d m_free: %6.1f ns per mbuf\n", burst, burst,
+         (now_sec() - start) * 1e9 / (iters / burst * burst));
+
+  // a small packet in a cluster
+  start = now_sec();
+  for (int i = 0; i < iters; ++i)
+    m_freem(mkchain(pkt, sizeof pkt, sizeof pkt, 0));
+  printf("packet in a cluster:   %6.1f ns\n", (now_sec() - start) * 1e9 / iters);
+
+  start = now_sec();
+  for (int i = 0; i < iters / burst; ++i)
+  {
+    for (int j = 0; j < burst; ++j)
+      ms[j] = mkchain(pkt, sizeof pkt, sizeof pkt, 0);
+    for (int j = 0; j < burst; ++j)
+      m_freem(ms[j]);
+  }
+  printf("%d packets in flight: %6.1f ns per packet\n", burst,
+         (now_sec() - start) * 1e9 / (iters / burst * burst));
+  mbstat_print();
+
+  return 0;
+}
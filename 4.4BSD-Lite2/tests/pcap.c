@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+#include "../tools/pcap.h"
+
+// Captures loopback pings through the ring in both file formats, with
+// a snaplen and with a filter, and reads the files back to check what
+// was written.  Then times pings with capture off and on.
+
+// a BPF program: accept TCP, 96 bytes of it (ip proto tcp)
+struct insn
+{
+  unsigned short code;
+  unsigned char jt, jf;
+  int k;
+} tcponly[] = {
+  { 0x30, 0, 0, 9 },   // ldb [9]
+  { 0x15, 0, 1, 6 },   // jeq #IPPROTO_TCP
+  { 0x06, 0, 0, 96 },  // ret #96
+  { 0x06, 0, 0, 0 },   // ret #0
+};
+
+double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+unsigned get32(const unsigned char* p)
+{
+  unsigned v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+int checklen(unsigned caplen, unsigned origlen, unsigned snaplen)
+{
+  return origlen >= 84 && caplen == (origlen < snaplen ? origlen : snaplen);
+}
+
+// returns the number of packets in the file, or -1 if it is malformed;
+// every packet must have been cut to snaplen
+int readback(const char* filename, int format, int snaplen)
+{
+  static unsigned char buf[1 << 26];
+  FILE* fp = fopen(filename, "r");
+  int len = fread(buf, 1, sizeof buf, fp);
+  fclose(fp);
+
+  int npackets = 0, off;
+  if (format == PCAP_FORMAT_PCAP)
+  {
+    for (off = 24; off + 16 <= len; off += 16 + get32(buf + off + 8))
+    {
+      if (!checklen(get32(buf + off + 8), get32(buf + off + 12), snaplen))
+        return -1;
+      ++npackets;
+    }
+  }
+  else
+  {
+    // skip the section header and interface description blocks
+    off = get32(buf + 4);
+    off += get32(buf + off + 4);
+    for (; off + 12 <= len; off += get32(buf + off + 4))
+    {
+      int blocklen = get32(buf + off + 4);
+      if (get32(buf + off) != 6 ||
+          !checklen(get32(buf + off + 20), get32(buf + off + 24), snaplen) ||
+          get32(buf + off + blocklen - 4) != blocklen)
+        return -1;
+      ++npackets;
+    }
+  }
+  return off == len ? npackets : -1;
+}
+
+// each ping is captured twice: the request and the reply
+double pings(int n)
+{
+  double start = now_sec();
+  for (int i = 0; i < n; ++i)
+    ping();
+  return (now_sec() - start) * 1e9 / n;
+}
+
+int main(int argc, char* argv[])
+{
+  int n = argc > 1 ? atoi(argv[1]) : 100000;
+  struct
+  {
+    const char* name;
+    int format, snaplen, filter;
+  } cases[] = {
+    { "pcap", PCAP_FORMAT_PCAP, 65536, 0 },
+    { "pcapng", PCAP_FORMAT_PCAPNG, 65536, 0 },
+    { "pcap, snaplen 40", PCAP_FORMAT_PCAP, 40, 0 },
+    { "pcapng, snaplen 41", PCAP_FORMAT_PCAPNG, 41 },
+    { "pcap, tcp only", PCAP_FORMAT_PCAP, 65536, 1 },
+  };
+
+  init();
+  double off = pings(n);
+  printf("%-20s %6.0f ns per ping\n", "capture off", off);
+  for (int i = 0; i < sizeof cases / sizeof cases[0]; ++i)
+  {
+    pcap_setfilter(cases[i].filter ? (struct bpf_insn*)tcponly : NULL, 4);
+    pcap_open("test.pcap", cases[i].snaplen, cases[i].format);
+    double on = pings(n);
+    pcap_stop();
+    int want = cases[i].filter ? 0 : 2 * n - pcap_drops;
+    int got = readback("test.pcap", cases[i].format, cases[i].snaplen);
+    if (got != want)
+    {
+      printf("%s: read back %d packets, want %d\n", cases[i].name, got, want);
+      return 1;
+    }
+    printf("%-20s %6.0f ns per ping, %ld dropped\n", cases[i].name, on, pcap_drops);
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Opens many loopback connections, then bounces a small message over
+// each of them, so every inbound segment goes through the pcb lookup
+// while the tcb list holds 2*nconn entries.
+
+extern int tcp_do_rfc1323;
+
+double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+  int nconn = argc > 1 ? atoi(argv[1]) : 10000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 5;
+  const unsigned short port = 1234;
+  char buf[64] = "ping";
+
+  init();
+  tcp_do_rfc1323 = 0;
+  struct socket* listenso = listenon(port);
+  struct socket** clients = malloc(nconn * sizeof clients[0]);
+  struct socket** servers = malloc(nconn * sizeof servers[0]);
+
+  double start = now_sec();
+  for (int i = 0; i < nconn; ++i)
+  {
+    clients[i] = connectfrom(10000 + i, 0x7f000001, port);
+    ipintr();
+    servers[i] = acceptso(listenso);
+    if (servers[i] == NULL)
+    {
+      printf("connection %d not accepted\n", i);
+      return 1;
+    }
+  }
+  double elapsed = now_sec() - start;
+  printf("%d connections in %.3f s, %.0f conn/s, %.0f segments/s\n",
+         nconn, elapsed, nconn / elapsed, 3 * nconn / elapsed);
+
+  start = now_sec();
+  for (int r = 0; r < rounds; ++r)
+  {
+    for (int i = 0; i < nconn; ++i)
+    {
+      writeso(clients[i], buf, sizeof buf);
+      ipintr();
+      if (readso(servers[i], buf, sizeof buf) != sizeof buf)
+      {
+        printf("round %d connection %d: short read\n", r, i);
+        return 1;
+      }
+      writeso(servers[i], buf, sizeof buf);
+      ipintr();
+      readso(clients[i], buf, sizeof buf);
+    }
+  }
+  elapsed = now_sec() - start;
+  printf("%d round trips in %.3f s, %.0f segments/s\n",
+         nconn * rounds, elapsed, 2.0 * nconn * rounds / elapsed);
+  return 0;
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Feeds a 1 MB window to a connection out of order, last segment
+// first, shuffled, and with only the first segment held back, and
+// times the reassembly.  Then reads the window back to check it.
+// Last, it feeds the window in 256-byte segments, a cluster each, to
+// check that the queue stops taking them at the receive buffer's
+// sb_mbmax.
+//
+// The connection runs over the pigeon interface with the test as the
+// wire, as in tests/sack.c.  Once it is up, the client writes one
+// segment; the test takes it off the wire as a template and forges
+// the window's segments from it.
+
+extern unsigned long tcp_sendspace, tcp_recvspace;
+
+enum { PORT = 1234, WINDOW = 1 << 20 };
+
+double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+unsigned get32(const unsigned char* p)
+{
+  return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+void put16(unsigned char* p, unsigned v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+void put32(unsigned char* p, unsigned v)
+{
+  put16(p, v >> 16);
+  put16(p + 2, v);
+}
+
+unsigned sum16(const unsigned char* p, int len, unsigned sum)
+{
+  for (; len > 1; p += 2, len -= 2)
+    sum += p[0] << 8 | p[1];
+  if (len)
+    sum += p[0] << 8;
+  return sum;
+}
+
+unsigned fold(unsigned sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum & 0xffff;
+}
+
+char pattern(unsigned off)
+{
+  return off * 7 ^ off >> 8;
+}
+
+// delivers what is on the wire with the addresses swapped
+void roundtrip()
+{
+  char pkt[2048];
+  int len;
+  while ((len = pigeon_dequeue(pkt, sizeof pkt)) > 0)
+  {
+    char addr[4];
+    memcpy(addr, pkt + 12, 4);
+    memcpy(pkt + 12, pkt + 16, 4);
+    memcpy(pkt + 16, addr, 4);
+    inject(pkt, len);
+  }
+}
+
+void discard()
+{
+  char pkt[2048];
+  while (pigeon_dequeue(pkt, sizeof pkt) > 0)
+    ;
+}
+
+// the template: IP and TCP headers of the client's first data segment
+unsigned char hdr[128];
+int hdrlen;
+
+void take_template()
+{
+  unsigned char pkt[2048];
+  int len;
+  while ((len = pigeon_dequeue((char*)pkt, sizeof pkt)) > 0)
+  {
+    int ihl = (pkt[0] & 0xf) * 4;
+    int hl = ihl + (pkt[ihl + 12] >> 4) * 4;
+    if (pkt[9] == 6 && (pkt[ihl + 2] << 8 | pkt[ihl + 3]) == PORT && len > hl)
+    {
+      memcpy(hdr, pkt, hl);
+      hdrlen = hl;
+      // addressed to the server
+      memcpy(hdr + 12, pkt + 16, 4);
+      memcpy(hdr + 16, pkt + 12, 4);
+    }
+  }
+}
+
+// forges segment k of the window, seglen bytes from seq0
+int forge(unsigned char* pkt, unsigned seq0, int k, int seglen)
+{
+  int ihl = (hdr[0] & 0xf) * 4;
+  unsigned char* th = pkt + ihl;
+  int len = hdrlen + seglen;
+  memcpy(pkt, hdr, hdrlen);
+  for (int i = 0; i < seglen; ++i)
+    pkt[hdrlen + i] = pattern(k * seglen + i);
+  put16(pkt + 2, len);
+  put16(pkt + 10, 0);
+  put16(pkt + 10, fold(sum16(pkt, ihl, 0)));
+  put32(th + 4, seq0 + k * seglen);
+  put16(th + 16, 0);
+  unsigned sum = sum16(pkt + 12, 8, 6 + len - ihl);
+  put16(th + 16, fold(sum16(th, len - ihl, sum)));
+  return len;
+}
+
+// returns ns per segment, or -1 if the data read back differs;
+// *received gets the bytes read back
+double feed(struct socket* listenso, const int* order, int n, int seglen,
+            int* received)
+{
+  static unsigned char pkts[WINDOW / 64][2048];
+  static int lens[WINDOW / 64];
+  static char buf[WINDOW];
+
+  struct socket* client = connectto(0xc0a80001, PORT);
+  struct socket* server = NULL;
+  while (server == NULL)
+  {
+    roundtrip();
+    server = acceptso(listenso);
+  }
+  char c = pattern(0);
+  writeso(client, &c, 1);
+  take_template();
+  unsigned seq0 = get32(hdr + (hdr[0] & 0xf) * 4 + 4);
+  for (int i = 0; i < n; ++i)
+    lens[i] = forge(pkts[i], seq0, order[i], seglen);
+
+  double start = now_sec();
+  for (int i = 0; i < n; ++i)
+  {
+    inject((char*)pkts[i], lens[i]);
+    discard();  // the acks
+  }
+  double elapsed = now_sec() - start;
+
+  int total = n * seglen, nr;
+  *received = 0;
+  while (*received < total &&
+         (nr = readso(server, buf + *received, total - *received)) > 0)
+    *received += nr;
+  soclose(client);
+  soclose(server);
+  discard();
+  for (int i = 0; i < *received; ++i)
+    if (buf[i] != pattern(i))
+      return -1;
+  return elapsed * 1e9 / n;
+}
+
+void shuffle(int* order, int n)
+{
+  for (int i = 0; i < n; ++i)
+    order[i] = i;
+  for (int i = n - 1; i > 0; --i)
+  {
+    int j = rand() % (i + 1), t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  static int order[WINDOW / 256];
+  const char* names[] = { "reversed", "shuffled", "first last" };
+
+  pigeonattach(1);
+  init();
+  setipaddr("pg0", 0xc0a80002);  // 192.168.0.2
+  tcp_recvspace = WINDOW + WINDOW / 2;
+  struct socket* listenso = listenon(PORT);
+
+  srand(1);
+  int seglen = 1448, n = WINDOW / seglen, received;
+  printf("%d segments of %d bytes\n", n, seglen);
+  for (int k = 0; k < 3; ++k)
+  {
+    if (k == 0)
+      for (int i = 0; i < n; ++i)
+        order[i] = n - 1 - i;
+    else if (k == 1)
+      shuffle(order, n);
+    else
+      for (int i = 0; i < n; ++i)
+        order[i] = (i + 1) % n;
+    double ns = feed(listenso, order, n, seglen, &received);
+    if (ns < 0 || received != n * seglen)
+    {
+      printf("%s: data differs\n", names[k]);
+      return 1;
+    }
+    printf("  %-10s  %6.0f ns per segment\n", names[k], ns);
+  }
+
+  // each segment takes MSIZE + MCLBYTES, 8.5 times its data
+  seglen = 256;
+  n = WINDOW / seglen;
+  for (int i = 0; i < n; ++i)
+    order[i] = (i + 1) % n;
+  if (feed(listenso, order, n, seglen, &received) < 0)
+  {
+    printf("bounded: data differs\n");
+    return 1;
+  }
+  printf("%d segments of %d bytes: %d bytes queued\n", n, seglen, received);
+  if (received == n * seglen || received < WINDOW / 16)
+    return 1;
+  return 0;
+}
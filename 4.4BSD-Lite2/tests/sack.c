@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/tcpv2.h"
+
+// Moves a bulk transfer across the pigeon interface, dropping several
+// segments of one window, with and without SACK, and counts the round
+// trips, retransmissions and retransmit timeouts the recovery takes.
+//
+// The test is the wire: each round it takes everything pg0 has sent
+// and injects it back with the source and destination addresses
+// swapped.  A connection from 192.168.0.2 to 192.168.0.1 comes back as
+// one from 192.168.0.1 to 192.168.0.2, so both ends live in this one
+// stack.  The swap leaves both checksums valid.
+//
+// Then checks that a SACK sender counts an ack that changes the window
+// as a duplicate only if it SACKs new data.
+
+extern int tcp_do_sack;
+extern unsigned long tcp_sendspace, tcp_recvspace;
+extern void tcp_fasttimo();
+extern void tcp_slowtimo();
+
+enum { PORT = 1234, TOTAL = 256 * 1024, MAXPKTS = 256 };
+
+// the first transmissions of these segments are lost
+const int lost[] = { 40, 43, 46, 49, 52 };
+const int nlost = sizeof lost / sizeof lost[0];
+
+struct stats
+{
+  int rounds, timeouts, rexmits, drops;
+  unsigned maxseq;  // past the highest data sent to the server
+  int newsegs;
+  int seqvalid;
+};
+
+unsigned get32(const unsigned char* p)
+{
+  return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+void put16(unsigned char* p, unsigned v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+void put32(unsigned char* p, unsigned v)
+{
+  put16(p, v >> 16);
+  put16(p + 2, v);
+}
+
+unsigned sum16(unsigned sum, const unsigned char* p, int len)
+{
+  for (int i = 0; i < len; i += 2)
+    sum += p[i] << 8 | (i + 1 < len ? p[i + 1] : 0);
+  return sum;
+}
+
+unsigned short fold(unsigned sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+int droppable(struct stats* st, const unsigned char* pkt, int len)
+{
+  int ihl = (pkt[0] & 0xf) * 4;
+  const unsigned char* th = pkt + ihl;
+  int datalen = len - ihl - (th[12] >> 4) * 4;
+  if (pkt[9] != 6 || (th[2] << 8 | th[3]) != PORT || datalen == 0)
+    return 0;
+
+  unsigned seq = get32(th + 4);
+  if (st->seqvalid && (int)(seq - st->maxseq) < 0)
+  {
+    ++st->rexmits;
+    return 0;
+  }
+  st->maxseq = seq + datalen;
+  st->seqvalid = 1;
+  for (int i = 0; i < nlost; ++i)
+    if (st->newsegs == lost[i])
+    {
+      ++st->newsegs;
+      ++st->drops;
+      // sent once, so its retransmission is not new data
+      return 1;
+    }
+  ++st->newsegs;
+  return 0;
+}
+
+// puts a packet pg0 sent back on the wire, its addresses swapped
+void deliver(char* pkt, int len)
+{
+  char addr[4];
+  memcpy(addr, pkt + 12, 4);
+  memcpy(pkt + 12, pkt + 16, 4);
+  memcpy(pkt + 16, addr, 4);
+  inject(pkt, len);
+}
+
+// one round trip: delivers what is on the wire, returns how many
+// packets there were
+int roundtrip(struct stats* st)
+{
+  static char pkts[MAXPKTS][2048];
+  static int lens[MAXPKTS];
+  int n = 0, len;
+  while (n < MAXPKTS && (len = pigeon_dequeue(pkts[n], sizeof pkts[n])) > 0)
+    lens[n++] = len;
+  for (int i = 0; i < n; ++i)
+  {
+    if (!droppable(st, (unsigned char*)pkts[i], lens[i]))
+      deliver(pkts[i], lens[i]);
+  }
+  tcp_fasttimo();
+  ++st->rounds;
+  return n;
+}
+
+int transfer(struct socket* listenso, const char* pattern, struct stats* st)
+{
+  static char buf[TOTAL];
+  memset(st, 0, sizeof *st);
+  struct socket* client = connectto(0xc0a80001, PORT);
+  struct socket* server = NULL;
+  while (server == NULL)
+  {
+    roundtrip(st);
+    server = acceptso(listenso);
+  }
+
+  memset(st, 0, sizeof *st);
+  int sent = 0, received = 0;
+  while (received < TOTAL)
+  {
+    if (sent < TOTAL)
+      sent += writeso(client, (char*)pattern + sent, TOTAL - sent);
+    if (roundtrip(st) == 0)
+    {
+      // nothing in flight, wait for the retransmit timer
+      tcp_slowtimo();
+      ++st->timeouts;
+    }
+    int nr = readso(server, buf + received, TOTAL - received);
+    if (nr > 0)
+      received += nr;
+  }
+  soclose(client);
+  soclose(server);
+  for (int i = 0; i < 10; ++i)
+    roundtrip(st);
+  return memcmp(buf, pattern, TOTAL) == 0;
+}
+
+void drain()
+{
+  char pkt[2048];
+  while (pigeon_dequeue(pkt, sizeof pkt) > 0)
+    ;
+}
+
+// A SACK sender takes an ack that changes the window for a duplicate
+// only if it SACKs new data.  Holds back a window of the client's
+// segments but the first, then answers with four acks for the first,
+// each with a larger window, and with SACK blocks that cover one more
+// of the held segments each if sackblocks is set.  Returns how many
+// duplicates the client counted, and sets *recovered if that started
+// recovery; -1 if it didn't get that far.
+int windowupdates(struct socket* listenso, const char* pattern,
+                  int sackblocks, int* recovered)
+{
+  static char pkts[MAXPKTS][2048];
+  static int lens[MAXPKTS];
+  static char buf[TOTAL];
+  unsigned start[MAXPKTS], end[MAXPKTS];
+  struct stats st;
+  memset(&st, 0, sizeof st);
+  tcp_do_sack = 1;
+  struct socket* client = connectto(0xc0a80001, PORT);
+  struct socket* server = NULL;
+  while (server == NULL)
+  {
+    roundtrip(&st);
+    server = acceptso(listenso);
+  }
+
+  // open the window, then take a round with five segments or more
+  int sent = 0, n = 0, nheld = 0;
+  for (int r = 0; r < 20 && nheld < 5; ++r)
+  {
+    sent += writeso(client, (char*)pattern + sent, TOTAL - sent);
+    if (r < 4)
+    {
+      roundtrip(&st);
+      readso(server, buf, sizeof buf);
+      continue;
+    }
+    int len;
+    n = nheld = 0;
+    while (n < MAXPKTS && (len = pigeon_dequeue(pkts[n], sizeof pkts[n])) > 0)
+    {
+      const unsigned char* th = (unsigned char*)pkts[n] + 20;
+      int datalen = len - 20 - (th[12] >> 4) * 4;
+      lens[n] = len;
+      if ((th[2] << 8 | th[3]) == PORT && datalen > 0)
+      {
+        start[nheld] = get32(th + 4);
+        end[nheld++] = get32(th + 4) + datalen;
+      }
+      ++n;
+    }
+    if (nheld < 5)
+    {
+      for (int i = 0; i < n; ++i)
+        deliver(pkts[i], lens[i]);
+      tcp_fasttimo();
+      readso(server, buf, sizeof buf);
+    }
+  }
+  if (nheld < 5)
+    return -1;
+
+  // all but the held segments after the first get through
+  for (int i = 0; i < n; ++i)
+  {
+    const unsigned char* th = (unsigned char*)pkts[i] + 20;
+    if ((th[2] << 8 | th[3]) != PORT || get32(th + 4) == start[0] ||
+        lens[i] == 20 + (th[12] >> 4) * 4)
+      deliver(pkts[i], lens[i]);
+  }
+  tcp_fasttimo();
+
+  // the server's ack for the first, to copy the acks from
+  unsigned char ack[2048];
+  int len, acklen = 0;
+  while ((len = pigeon_dequeue((char*)ack, sizeof ack)) > 0)
+  {
+    const unsigned char* th = ack + 20;
+    if ((th[0] << 8 | th[1]) == PORT && get32(th + 8) == end[0])
+    {
+      acklen = len;
+      break;
+    }
+  }
+  if (acklen == 0)
+    return -1;
+  unsigned char copy[2048];  // deliver() swaps in place
+  memcpy(copy, ack, acklen);
+  deliver((char*)copy, acklen);
+  drain();
+
+  unsigned long dupacks = kstat("tcps_rcvdupack");
+  unsigned long recoveries = kstat("tcps_sackrecovery");
+  unsigned win = ack[20 + 14] << 8 | ack[20 + 15];
+  for (int k = 1; k <= 4; ++k)
+  {
+    unsigned char pkt[60];
+    unsigned char pseudo[12] = { 0 };
+    unsigned char* th = pkt + 20;
+    int hlen = sackblocks ? 32 : 20;
+    memcpy(pkt, ack, 20);
+    put16(pkt + 2, 20 + hlen);
+    put16(pkt + 10, 0);
+    put16(pkt + 10, fold(sum16(0, pkt, 20)));
+    memcpy(th, ack + 20, 16);
+    th[12] = hlen / 4 << 4;
+    th[13] = 0x10;  // ACK
+    put16(th + 14, win + k);
+    put16(th + 16, 0);
+    put16(th + 18, 0);
+    if (sackblocks)
+    {
+      th[20] = th[21] = 1;  // NOPs
+      th[22] = 5;           // SACK
+      th[23] = 10;
+      put32(th + 24, start[1]);
+      put32(th + 28, end[k]);
+    }
+    memcpy(pseudo, pkt + 12, 8);
+    pseudo[9] = 6;
+    put16(pseudo + 10, hlen);
+    put16(th + 16, fold(sum16(sum16(0, pseudo, 12), th, hlen)));
+    deliver((char*)pkt, 20 + hlen);
+  }
+  drain();
+  *recovered = kstat("tcps_sackrecovery") != recoveries;
+  return kstat("tcps_rcvdupack") - dupacks;
+}
+
+int main()
+{
+  char* pattern = malloc(TOTAL);
+  for (int i = 0; i < TOTAL; ++i)
+    pattern[i] = i * 7 ^ i >> 8;
+
+  pigeonattach(1);
+  init();
+  setipaddr("pg0", 0xc0a80002);  // 192.168.0.2
+  tcp_sendspace = tcp_recvspace = 24 * 1024;
+  struct socket* listenso = listenon(PORT);
+
+  struct stats sack, nosack;
+  tcp_do_sack = 1;
+  if (!transfer(listenso, pattern, &sack))
+  {
+    printf("sack: data differs\n");
+    return 1;
+  }
+  tcp_do_sack = 0;
+  if (!transfer(listenso, pattern, &nosack))
+  {
+    printf("no sack: data differs\n");
+    return 1;
+  }
+  printf("%d of %d segments lost\n", sack.drops, sack.newsegs);
+  printf("sack:    %4d rounds, %2d retransmitted, %2d timeout ticks\n",
+         sack.rounds, sack.rexmits, sack.timeouts);
+  printf("no sack: %4d rounds, %2d retransmitted, %2d timeout ticks\n",
+         nosack.rounds, nosack.rexmits, nosack.timeouts);
+  // every loss repaired once, without waiting for a timeout
+  if (sack.drops != nlost || sack.rexmits != nlost || sack.timeouts != 0)
+    return 1;
+
+  int barerec, sackedrec;
+  int bare = windowupdates(listenso, pattern, 0, &barerec);
+  int sacked = windowupdates(listenso, pattern, 1, &sackedrec);
+  printf("window updates: %d duplicates bare%s, %d with new SACK blocks%s\n",
+         bare, barerec ? ", recovery" : "", sacked,
+         sackedrec ? ", recovery" : "");
+  return bare == 0 && !barerec && sacked == 4 && sackedrec ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../lib/tcpv2.h"
+
+// Runs 1, 2, 4 and 8 stack instances side by side, one process each,
+// as test_tun -n does, and reports the total loopback connections/sec
+// and bulk throughput.  The instances share nothing, so the totals
+// should grow with the number of cores until they run out.
+
+extern void tcp_slowtimo();
+extern void tcp_fasttimo();
+
+enum { NPORTS = 20000, TWTICKS = 2 * 30 * 2 + 1 };  // 2*MSL at PR_SLOWHZ
+
+double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// opens and closes connections, the client closing first
+double churn(double secs)
+{
+  struct socket* listenso = listenon(1234);
+  long n = 0;
+  double start = now_sec(), elapsed;
+  do
+  {
+    for (int i = 0; i < 1000; ++i, ++n)
+    {
+      // let the TIME_WAITs on the ports expire before reusing them
+      if (n > 0 && n % NPORTS == 0)
+        for (int t = 0; t < TWTICKS; ++t)
+          tcp_slowtimo();
+      struct socket* so = connectfrom(10000 + n % NPORTS, 0x7f000001, 1234);
+      ipintr();
+      struct socket* peer = acceptso(listenso);
+      if (so == NULL || peer == NULL)
+      {
+        printf("connection %ld not accepted\n", n);
+        exit(1);
+      }
+      soclose(so);
+      ipintr();
+      soclose(peer);
+      ipintr();
+    }
+  } while ((elapsed = now_sec() - start) < secs);
+  soclose(listenso);
+  return n / elapsed;
+}
+
+// sends and reads 64KB at a time over one connection, in MB/s
+double bulk(double secs)
+{
+  static char buf[65536];
+  struct socket* listenso = listenon(1235);
+  struct socket* so = connectto(0x7f000001, 1235);
+  ipintr();
+  struct socket* peer = acceptso(listenso);
+  long long bytes = 0;
+  double start = now_sec(), elapsed;
+  do
+  {
+    for (int i = 0; i < 100; ++i)
+    {
+      writeso(so, buf, sizeof buf);
+      ipintr();
+      bytes += readso(peer, buf, sizeof buf);
+      ipintr();
+      tcp_fasttimo();
+      ipintr();
+    }
+  } while ((elapsed = now_sec() - start) < secs);
+  return bytes / elapsed / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+  double secs = argc > 1 ? atoi(argv[1]) : 1;
+  int maxinst = argc > 2 ? atoi(argv[2]) : 8;
+
+  for (int ninst = 1; ninst <= maxinst; ninst *= 2)
+  {
+    int fds[2];
+    if (pipe(fds) < 0)
+      return 1;
+    for (int i = 0; i < ninst; ++i)
+    {
+      if (fork() == 0)
+      {
+        double result[2];
+        init();
+        result[0] = churn(secs);
+        result[1] = bulk(secs);
+        write(fds[1], result, sizeof result);
+        _exit(0);
+      }
+    }
+
+    double conns = 0, mbps = 0;
+    for (int i = 0; i < ninst; ++i)
+    {
+      double result[2];
+      if (read(fds[0], result, sizeof result) != sizeof result)
+        return 1;
+      conns += result[0];
+      mbps += result[1];
+    }
+    while (wait(NULL) > 0)
+      ;
+    close(fds[0]);
+    close(fds[1]);
+    printf("%d instance(s): %8.0f connections/s, %6.0f MB/s\n",
+           ninst, conns, mbps);
+  }
+  return 0;
+}
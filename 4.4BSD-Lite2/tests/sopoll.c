@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Checks that sopoll_wait() reports accepts, data, EOF and
+// writability, also after the send buffer has filled, for exactly the
+// sockets they happen on, then grows the number of idle registered
+// connections and times a wait with one of them readable.  The cost
+// should not depend on how many are idle.
+
+extern void tcp_fasttimo();
+
+enum { PORT = 1234, MAXEVENTS = 64 };
+
+struct socket** clients;
+struct socket** servers;
+
+double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void flush()
+{
+  ipintr();
+  tcp_fasttimo();
+  ipintr();
+}
+
+// waits once, returns the events of the socket with udata i, or -1 if
+// some other socket had one
+int waitfor(struct sopoll* sp, long i, int* nevents)
+{
+  struct sopoll_event ev[MAXEVENTS];
+  int n = sopoll_wait(sp, ev, MAXEVENTS);
+  int events = 0;
+  *nevents = n;
+  for (int j = 0; j < n; ++j)
+  {
+    if ((long)ev[j].udata != i)
+      return -1;
+    events |= ev[j].events;
+  }
+  return events;
+}
+
+int check(struct sopoll* sp, long i, int want, const char* what)
+{
+  int n, events = waitfor(sp, i, &n);
+  if (events != want)
+  {
+    printf("%s: got events %x from %d socket(s), want %x\n", what, events, n, want);
+    return 1;
+  }
+  return 0;
+}
+
+// connects clients from..to-1, accepts them and registers the server ends
+int grow(struct sopoll* sp, struct socket* listenso, int from, int to)
+{
+  for (int i = from; i < to; ++i)
+  {
+    clients[i] = connectfrom(10000 + i, 0x7f000001, PORT);
+    ipintr();
+    servers[i] = acceptso(listenso);
+    if (servers[i] == NULL)
+    {
+      printf("connection %d not accepted\n", i);
+      return 1;
+    }
+    sopoll_add(sp, servers[i], SOPOLL_IN, (void*)(long)i);
+  }
+  // the new sockets were ready to write, and are idle now
+  int n;
+  waitfor(sp, -1, &n);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  int maxconn = argc > 1 ? atoi(argv[1]) : 10000;
+  int waits = argc > 2 ? atoi(argv[2]) : 10000;
+  char buf[1024] = "hello";
+
+  init();
+  clients = malloc(maxconn * sizeof clients[0]);
+  servers = malloc(maxconn * sizeof servers[0]);
+  struct sopoll* sp = sopoll_create();
+  struct socket* listenso = listenon(PORT);
+  sopoll_add(sp, listenso, SOPOLL_IN, (void*)-1L);
+  if (check(sp, -1, 0, "idle listener"))
+    return 1;
+
+  clients[0] = connectfrom(10000, 0x7f000001, PORT);
+  ipintr();
+  if (check(sp, -1, SOPOLL_IN, "connection to accept"))
+    return 1;
+  servers[0] = acceptso(listenso);
+  if (check(sp, -1, 0, "accepted"))
+    return 1;
+  sopoll_add(sp, servers[0], SOPOLL_IN | SOPOLL_OUT, (void*)0L);
+  if (check(sp, 0, SOPOLL_OUT, "new connection"))
+    return 1;
+  sopoll_mod(sp, servers[0], SOPOLL_IN, (void*)0L);
+  if (check(sp, 0, 0, "not asking for writes"))
+    return 1;
+
+  writeso(clients[0], buf, 5);
+  flush();
+  if (check(sp, 0, SOPOLL_IN, "data") || check(sp, 0, SOPOLL_IN, "data again"))
+    return 1;
+  readso(servers[0], buf, sizeof buf);
+  if (check(sp, 0, 0, "data read"))
+    return 1;
+
+  sopoll_mod(sp, servers[0], SOPOLL_IN | SOPOLL_ET, (void*)0L);
+  writeso(clients[0], buf, 5);
+  flush();
+  if (check(sp, 0, SOPOLL_IN, "edge") || check(sp, 0, 0, "edge only once"))
+    return 1;
+  readso(servers[0], buf, sizeof buf);
+
+  // writable again once a full send buffer is acked
+  sopoll_mod(sp, servers[0], SOPOLL_OUT | SOPOLL_ET, (void*)0L);
+  if (check(sp, 0, SOPOLL_OUT, "writable") || check(sp, 0, 0, "writable once"))
+    return 1;
+  while (writeso(servers[0], buf, sizeof buf) > 0)
+    flush();
+  if (check(sp, 0, 0, "send buffer full"))
+    return 1;
+  for (int k = 0; k < 100; ++k)
+  {
+    readso(clients[0], buf, sizeof buf);
+    flush();
+  }
+  if (check(sp, 0, SOPOLL_OUT, "send buffer acked"))
+    return 1;
+
+  sopoll_mod(sp, servers[0], SOPOLL_IN, (void*)0L);
+  soclose(clients[0]);
+  flush();
+  if (check(sp, 0, SOPOLL_IN, "EOF"))
+    return 1;
+  sopoll_del(sp, servers[0]);
+  soclose(servers[0]);
+  flush();
+  if (check(sp, 0, 0, "closed"))
+    return 1;
+  printf("events agree\n");
+
+  int nconn = 1;
+  for (int size = 100; size <= maxconn; size *= 10)
+  {
+    if (grow(sp, listenso, nconn, size))
+      return 1;
+    nconn = size;
+
+    // the data stays unread, so each wait reports the same socket again
+    double elapsed = 0;
+    for (int w = 0; w < waits; w += 100)
+    {
+      long i = 1 + rand() % (nconn - 1);
+      writeso(clients[i], buf, 1);
+      flush();
+      double start = now_sec();
+      for (int k = 0; k < 100; ++k)
+      {
+        int n, events = waitfor(sp, i, &n);
+        if (events != SOPOLL_IN)
+        {
+          printf("connection %ld: got events %x from %d socket(s)\n", i, events, n);
+          return 1;
+        }
+      }
+      elapsed += now_sec() - start;
+      readso(servers[i], buf, sizeof buf);
+      int n;
+      waitfor(sp, i, &n);
+    }
+    printf("%6d connections: %6.0f ns per sopoll_wait\n", nconn, elapsed * 1e9 / waits);
+  }
+  sopoll_close(sp);
+  return 0;
+}
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// The listen path under a SYN flood, on the pigeon interface: the test
+// plays the clients, from 192.168.0.0/24, to a listener on pg0.
+//  - Floods more SYNs than the SYN cache holds.  Each is answered, the
+//    first tcp_syncache_limit from entries that offer the options the
+//    SYN did, the rest with cookies that offer only an MSS; no socket
+//    is made for any of them.
+//  - Completes every handshake: each ACK makes a connection, from its
+//    entry or its cookie, and all of them wait to be accepted at once.
+//  - ACKs that complete nothing are answered with a RST.
+//  - A cookie is good for the period it was made in and the next.
+//  - Entries never answered get their SYN-ACK three more times, then
+//    go; a RST for one takes it at once.
+//  - A SYN with a new ISN for an entry, a connect() started over, is
+//    answered for the new ISN at once and completes.
+
+extern int tcp_syncache_limit, somaxconn;
+extern void tcp_slowtimo();
+
+enum { DST = 0xc0a80002, PORT = 80, NFLOOD = 40000, NIDLE = 10000 };
+enum { SYN = 0x02, RST = 0x04, ACK = 0x10 };
+
+unsigned rs = 1;
+
+unsigned xorshift()
+{
+  rs ^= rs << 13;
+  rs ^= rs >> 17;
+  rs ^= rs << 5;
+  return rs;
+}
+
+double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void put32(unsigned char* p, unsigned v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+unsigned get32(const unsigned char* p)
+{
+  return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+unsigned sum16(unsigned sum, const unsigned char* p, int len)
+{
+  for (int i = 0; i < len; i += 2)
+    sum += p[i] << 8 | (i + 1 < len ? p[i + 1] : 0);
+  return sum;
+}
+
+unsigned short fold(unsigned sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+// a client: 192.168.0.3 to .252, each from many ports
+struct peer
+{
+  unsigned addr;
+  unsigned short port;
+  unsigned irs, iss;  // the client's ISN, and ours from the SYN-ACK
+  int full;           // the SYN-ACK offered window scaling
+};
+
+struct peer peerof(int i)
+{
+  struct peer p = { 0xc0a80000 + 3 + i % 250, 1024 + i / 250 };
+  return p;
+}
+
+// a segment from p to the listener; a SYN offers MSS 1460, window
+// scaling, SACK and timestamps
+void segment(const struct peer* p, unsigned seq, unsigned ack, int flags)
+{
+  unsigned char pkt[20 + 20 + 24] = { 0 };
+  unsigned char* th = pkt + 20;
+  int optlen = flags & SYN ? 24 : 0;
+  int len = 40 + optlen;
+  pkt[0] = 0x45;
+  pkt[3] = len;
+  pkt[8] = 64;
+  pkt[9] = 6;
+  put32(pkt + 12, p->addr);
+  put32(pkt + 16, DST);
+  unsigned short sum = fold(sum16(0, pkt, 20));
+  pkt[10] = sum >> 8;
+  pkt[11] = sum;
+  th[0] = p->port >> 8;
+  th[1] = p->port;
+  th[3] = PORT;
+  put32(th + 4, seq);
+  put32(th + 8, ack);
+  th[12] = (20 + optlen) / 4 << 4;
+  th[13] = flags;
+  th[14] = 0xff;
+  th[15] = 0xff;
+  if (optlen)
+  {
+    static const unsigned char opts[24] = { 2, 4, 0x05, 0xb4,  // MSS 1460
+                                            1, 3, 3, 7,        // wscale 7
+                                            1, 1, 4, 2,        // SACK ok
+                                            1, 1, 8, 10 };     // timestamp
+    memcpy(th + 20, opts, 24);
+    put32(th + 36, 1000);
+  }
+  unsigned char pseudo[12] = { 0 };
+  memcpy(pseudo, pkt + 12, 8);
+  pseudo[9] = 6;
+  pseudo[11] = 20 + optlen;
+  sum = fold(sum16(sum16(0, pseudo, 12), th, 20 + optlen));
+  th[16] = sum >> 8;
+  th[17] = sum;
+  inject((char*)pkt, len);
+}
+
+struct wire
+{
+  int synacks, full, rsts, data, tstamps;
+} w;
+
+// takes everything off the wire, and the ISN and options of a SYN-ACK
+// to p if there is one; returns 1 if there was
+int drain(struct peer* p)
+{
+  unsigned char pkt[2048];
+  int len, found = 0;
+  while ((len = pigeon_dequeue((char*)pkt, sizeof pkt)) > 0)
+  {
+    const unsigned char* th = pkt + (pkt[0] & 0xf) * 4;
+    int hlen = (th[12] >> 4) * 4;
+    if ((th[13] & (SYN | ACK)) == (SYN | ACK))
+    {
+      int full = 0;
+      for (int i = 20; i < hlen; i += th[i] == 1 ? 1 : th[i + 1])
+        if (th[i] == 3)
+          full = 1;
+      w.synacks++;
+      w.full += full;
+      if (p && get32(pkt + 16) == p->addr &&
+          (th[2] << 8 | th[3]) == p->port && get32(th + 8) == p->irs + 1)
+      {
+        p->iss = get32(th + 4);
+        p->full = full;
+        found = 1;
+      }
+    }
+    else if (th[13] & RST)
+      w.rsts++;
+    else if (len > (pkt[0] & 0xf) * 4 + hlen)
+    {
+      w.data++;
+      w.tstamps += hlen == 32;
+    }
+  }
+  return found;
+}
+
+int fail(const char* what)
+{
+  printf("%s\n", what);
+  printf("wire: %d SYN-ACKs, %d with options, %d RSTs; sc_added %lu "
+         "completed %lu timedout %lu overflow %lu cookies %lu/%lu "
+         "listendrop %lu badsyn %lu\n",
+         w.synacks, w.full, w.rsts, kstat("tcps_sc_added"),
+         kstat("tcps_sc_completed"), kstat("tcps_sc_timedout"),
+         kstat("tcps_sc_overflow"), kstat("tcps_sc_sendcookie"),
+         kstat("tcps_sc_recvcookie"), kstat("tcps_listendrop"),
+         kstat("tcps_badsyn"));
+  return 1;
+}
+
+static struct peer flood[NFLOOD];
+
+// a handshake through a cookie: the SYN, then after ticks slow
+// timeouts, the ACK; returns the connection, if one was made
+struct socket* cookie(struct socket* listener, int i, int ticks)
+{
+  struct peer p = peerof(i);
+  p.irs = xorshift();
+  segment(&p, p.irs, 0, SYN);
+  if (!drain(&p) || p.full)
+    return NULL;
+  for (int t = 0; t < ticks; ++t)
+    tcp_slowtimo();
+  segment(&p, p.irs + 1, p.iss + 1, ACK);
+  drain(NULL);
+  return acceptso(listener);
+}
+
+int main()
+{
+  pigeonattach(1);
+  pigeon_setqlen(4096);
+  init();
+  setipaddr("pg0", DST);  // 192.168.0.2
+  somaxconn = 2 * NFLOOD;
+  struct socket* listener = listenon(PORT);
+  drain(NULL);
+
+  // the flood: nothing answers the SYN-ACKs yet
+  long sockets = kmemuse("socket"), pcbs = kmemuse("pcb");
+  long cache = kmemuse("syncache");
+  double start = now();
+  for (int i = 0; i < NFLOOD; ++i)
+  {
+    flood[i] = peerof(i);
+    flood[i].irs = xorshift();
+    segment(&flood[i], flood[i].irs, 0, SYN);
+    if (!drain(&flood[i]))
+      return fail("a SYN-ACK for every SYN");
+  }
+  double sec = now() - start;
+  long held = kmemuse("syncache") - cache;
+  if (w.synacks != NFLOOD || w.full != tcp_syncache_limit ||
+      kstat("tcps_sc_added") != tcp_syncache_limit ||
+      kstat("tcps_sc_sendcookie") != NFLOOD - tcp_syncache_limit)
+    return fail("an entry for the first SYNs, a cookie for the rest");
+  if (kmemuse("socket") != sockets || kmemuse("pcb") != pcbs)
+    return fail("no socket for a SYN");
+  printf("%d SYNs: %.0f ns each, %lu entries of %ld bytes, %lu cookies\n",
+         NFLOOD, sec * 1e9 / NFLOOD, kstat("tcps_sc_added"),
+         held / (long)kstat("tcps_sc_added"), kstat("tcps_sc_sendcookie"));
+
+  // every client answers
+  memset(&w, 0, sizeof w);
+  start = now();
+  for (int i = 0; i < NFLOOD; ++i)
+    segment(&flood[i], flood[i].irs + 1, flood[i].iss + 1, ACK);
+  sec = now() - start;
+  drain(NULL);
+  if (w.rsts || kstat("tcps_sc_completed") != NFLOOD ||
+      kstat("tcps_sc_recvcookie") != NFLOOD - tcp_syncache_limit)
+    return fail("a connection for every ACK");
+  if (kmemuse("syncache") != cache)
+    return fail("the entries go as their connections are made");
+  printf("%d ACKs: %.0f ns each to make the connection\n", NFLOOD,
+         sec * 1e9 / NFLOOD);
+
+  static struct socket* accepted[NFLOOD];
+  int n = 0;
+  start = now();
+  while ((accepted[n] = acceptso(listener)) != NULL)
+    if (++n == NFLOOD)
+      break;
+  sec = now() - start;
+  if (n != NFLOOD || acceptso(listener) != NULL)
+    return fail("every connection accepted");
+  printf("%d connections accepted: %.0f ns each\n", n, sec * 1e9 / n);
+
+  // a connection from an entry has timestamps; one from a cookie not
+  writeso(accepted[0], "x", 1);
+  writeso(accepted[NFLOOD - 1], "x", 1);
+  drain(NULL);
+  if (w.data != 2 || w.tstamps != 1)
+    return fail("timestamps from an entry only");
+
+  // ACKs for handshakes that never were
+  memset(&w, 0, sizeof w);
+  unsigned long badsyn = kstat("tcps_badsyn");
+  sockets = kmemuse("socket");
+  for (int i = 0; i < 1000; ++i)
+  {
+    struct peer p = peerof(NFLOOD + i);
+    segment(&p, xorshift(), xorshift(), ACK);
+  }
+  drain(NULL);
+  if (w.rsts != 1000 || kstat("tcps_badsyn") - badsyn != 1000 ||
+      kmemuse("socket") != sockets || acceptso(listener) != NULL)
+    return fail("a RST and no connection for a forged ACK");
+  printf("1000 forged ACKs: %d RSTs, no connection\n", w.rsts);
+
+  // cookies only, and how long they last
+  int limit = tcp_syncache_limit;
+  tcp_syncache_limit = 0;
+  if (cookie(listener, NFLOOD + 1000, 0) == NULL ||
+      cookie(listener, NFLOOD + 1001, 128) == NULL)
+    return fail("a cookie is good for its period and the next");
+  memset(&w, 0, sizeof w);
+  if (cookie(listener, NFLOOD + 1002, 256) != NULL || w.rsts != 1)
+    return fail("a cookie goes after two periods");
+  printf("cookies: good after 0 and 64 s, not after 128 s\n");
+  tcp_syncache_limit = limit;
+
+  // SYNs never answered: three more SYN-ACKs, then the entry goes
+  memset(&w, 0, sizeof w);
+  unsigned long retransmitted = kstat("tcps_sc_retransmitted");
+  unsigned long timedout = kstat("tcps_sc_timedout");
+  struct peer* idle = flood;
+  for (int i = 0; i < NIDLE; ++i)
+  {
+    idle[i] = peerof(NFLOOD + 2000 + i);
+    idle[i].irs = xorshift();
+    segment(&idle[i], idle[i].irs, 0, SYN);
+    drain(NULL);
+  }
+  segment(&idle[1], idle[1].irs, 0, SYN);  // the SYN again
+  segment(&idle[0], idle[0].irs + 1, 0, RST);
+  drain(NULL);
+  if (w.synacks != NIDLE + 1 || kstat("tcps_sc_dupsyn") != 1 ||
+      kstat("tcps_sc_reset") != 1)
+    return fail("a SYN-ACK again for the SYN again; a RST takes its entry");
+  for (int t = 0; t < 90; ++t)
+  {
+    tcp_slowtimo();
+    drain(NULL);
+  }
+  if (kstat("tcps_sc_retransmitted") - retransmitted != 3 * (NIDLE - 1) ||
+      kstat("tcps_sc_timedout") != timedout)
+    return fail("three more SYN-ACKs in 45 s");
+  tcp_slowtimo();
+  if (kstat("tcps_sc_timedout") - timedout != NIDLE - 1 ||
+      kmemuse("syncache") != cache)
+    return fail("the entries go after 45 s");
+  printf("%d SYNs unanswered: %lu SYN-ACKs again, %lu entries timed out\n",
+         NIDLE, kstat("tcps_sc_retransmitted") - retransmitted,
+         kstat("tcps_sc_timedout") - timedout);
+
+  // the client starts its connect() over, with a new ISN
+  memset(&w, 0, sizeof w);
+  struct peer p = peerof(NFLOOD + 3000);
+  p.irs = xorshift();
+  segment(&p, p.irs, 0, SYN);
+  drain(NULL);
+  p.irs += 0x10000000;
+  segment(&p, p.irs, 0, SYN);
+  if (!drain(&p) || w.synacks != 2 || kstat("tcps_sc_restarted") != 1)
+    return fail("a SYN-ACK for the new ISN");
+  segment(&p, p.irs + 1, p.iss + 1, ACK);
+  drain(NULL);
+  struct socket* so = acceptso(listener);
+  if (so == NULL || w.rsts != 0 || kmemuse("syncache") != cache)
+    return fail("the new ISN's handshake completes");
+  printf("a SYN with a new ISN: its SYN-ACK at once, and a connection\n");
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Grows the number of idle loopback connections and times the
+// protocol timeouts at each size.  Idle connections only have their
+// keepalive timer armed, so a tick should cost the same whether there
+// are a hundred of them or a hundred thousand.
+
+extern void tcp_slowtimo();
+extern void tcp_fasttimo();
+
+double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+  int maxconn = argc > 1 ? atoi(argv[1]) : 100000;
+  int ticks = argc > 2 ? atoi(argv[2]) : 1000;
+  const int nports = 4;
+  const unsigned short port = 1234;
+  struct socket* listenso[nports];
+
+  init();
+  for (int p = 0; p < nports; ++p)
+    listenso[p] = listenon(port + p);
+
+  // each listening port takes one connection from every local port
+  int nconn = 0;
+  for (int size = 100; size <= maxconn; size *= 10)
+  {
+    for (; nconn < size; ++nconn)
+    {
+      int p = nconn % nports;
+      struct socket* so = connectfrom(10000 + nconn / nports, 0x7f000001, port + p);
+      ipintr();
+      if (so == NULL || acceptso(listenso[p]) == NULL)
+      {
+        printf("connection %d not accepted\n", nconn);
+        return 1;
+      }
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < ticks; ++i)
+      tcp_slowtimo();
+    double slow = now_sec() - start;
+
+    start = now_sec();
+    for (int i = 0; i < ticks; ++i)
+      tcp_fasttimo();
+    double fast = now_sec() - start;
+
+    printf("%6d connections: slowtimo %8.0f ns/tick, fasttimo %8.0f ns/tick\n",
+           nconn, slow * 1e9 / ticks, fast * 1e9 / ticks);
+  }
+  return 0;
+}
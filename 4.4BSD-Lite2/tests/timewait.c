@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// TIME_WAIT after the socket is closed, on the pigeon interface: the
+// test plays the peers, from 192.168.0.0/24, to a listener on pg0.
+//  - Many connections, each closed by the server first, go through
+//    TIME_WAIT with their sockets and pcbs freed; only a small entry
+//    is kept for each.
+//  - A FIN sent again is acked, with the timestamp the connection
+//    had, and restarts the 2MSL; a duplicate ACK is not answered; an
+//    old timestamp is acked and dropped.
+//  - A RST in the window ends the entry; an ACK after that is reset.
+//  - A SYN above the old sequence numbers ends the entry and makes a
+//    new connection, with an ISS above the old one; so does a connect()
+//    from the same port to the same peer.
+//  - The entries go after 2MSL.
+
+extern int somaxconn;
+extern void tcp_slowtimo();
+
+enum { DST = 0xc0a80002, PORT = 80, NCONN = 10000, MSL2 = 120 };
+enum { FIN = 0x01, SYN = 0x02, RST = 0x04, ACK = 0x10 };
+
+double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void put32(unsigned char* p, unsigned v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+unsigned get32(const unsigned char* p)
+{
+  return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+unsigned sum16(unsigned sum, const unsigned char* p, int len)
+{
+  for (int i = 0; i < len; i += 2)
+    sum += p[i] << 8 | (i + 1 < len ? p[i + 1] : 0);
+  return sum;
+}
+
+unsigned short fold(unsigned sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+// a peer: its address and port, and our port
+struct peer
+{
+  unsigned addr;
+  unsigned short port, lport;
+  unsigned irs, iss;  // the peer's ISN, and ours
+  unsigned ts;        // the peer's clock, for timestamps
+};
+
+struct peer peerof(int i)
+{
+  struct peer p = { 0xc0a80000 + 3 + i % 250, 1024 + i / 250, PORT };
+  p.irs = i * 7919;
+  p.ts = 1000;
+  return p;
+}
+
+// a segment from p; a SYN offers MSS 1460, window scaling, SACK and
+// timestamps, anything else carries a timestamp if tsval isn't 0
+void segment(const struct peer* p, unsigned seq, unsigned ack, int flags,
+             unsigned tsval)
+{
+  unsigned char pkt[20 + 20 + 24] = { 0 };
+  unsigned char* th = pkt + 20;
+  int optlen = flags & SYN ? 24 : tsval ? 12 : 0;
+  int len = 40 + optlen;
+  pkt[0] = 0x45;
+  pkt[3] = len;
+  pkt[8] = 64;
+  pkt[9] = 6;
+  put32(pkt + 12, p->addr);
+  put32(pkt + 16, DST);
+  unsigned short sum = fold(sum16(0, pkt, 20));
+  pkt[10] = sum >> 8;
+  pkt[11] = sum;
+  th[0] = p->port >> 8;
+  th[1] = p->port;
+  th[2] = p->lport >> 8;
+  th[3] = p->lport;
+  put32(th + 4, seq);
+  put32(th + 8, ack);
+  th[12] = (20 + optlen) / 4 << 4;
+  th[13] = flags;
+  th[14] = 0xff;
+  th[15] = 0xff;
+  if (flags & SYN)
+  {
+    static const unsigned char opts[24] = { 2, 4, 0x05, 0xb4,  // MSS 1460
+                                            1, 3, 3, 7,        // wscale 7
+                                            1, 1, 4, 2,        // SACK ok
+                                            1, 1, 8, 10 };     // timestamp
+    memcpy(th + 20, opts, 24);
+    put32(th + 36, tsval);
+  }
+  else if (tsval)
+  {
+    static const unsigned char opts[4] = { 1, 1, 8, 10 };
+    memcpy(th + 20, opts, 4);
+    put32(th + 24, tsval);
+  }
+  unsigned char pseudo[12] = { 0 };
+  memcpy(pseudo, pkt + 12, 8);
+  pseudo[9] = 6;
+  pseudo[11] = 20 + optlen;
+  sum = fold(sum16(sum16(0, pseudo, 12), th, 20 + optlen));
+  th[16] = sum >> 8;
+  th[17] = sum;
+  inject((char*)pkt, len);
+}
+
+// what came off the wire; the last segment's fields
+struct wire
+{
+  int segs, synacks, syns, fins, acks, rsts;
+  unsigned seq, ack, tsecr;
+  int tstamp;
+} w;
+
+void drain()
+{
+  unsigned char pkt[2048];
+  int len;
+  while ((len = pigeon_dequeue((char*)pkt, sizeof pkt)) > 0)
+  {
+    const unsigned char* th = pkt + (pkt[0] & 0xf) * 4;
+    int hlen = (th[12] >> 4) * 4;
+    int flags = th[13];
+    w.segs++;
+    if ((flags & (SYN | ACK)) == (SYN | ACK))
+      w.synacks++;
+    else if (flags & SYN)
+      w.syns++;
+    else if (flags & RST)
+      w.rsts++;
+    else if (flags & FIN)
+      w.fins++;
+    else
+      w.acks++;
+    w.seq = get32(th + 4);
+    w.ack = get32(th + 8);
+    w.tstamp = 0;
+    for (int i = 20; i < hlen; i += th[i] == 1 ? 1 : th[i + 1])
+      if (th[i] == 8)
+      {
+        w.tstamp = 1;
+        w.tsecr = get32(th + i + 6);
+      }
+      else if (th[i] == 0)
+        break;
+  }
+}
+
+int fail(const char* what)
+{
+  printf("%s\n", what);
+  printf("wire: %d segments, %d SYN-ACKs, %d SYNs, %d FINs, %d ACKs, "
+         "%d RSTs; last seq %u ack %u; tw_added %lu expired %lu "
+         "reused %lu reset %lu\n",
+         w.segs, w.synacks, w.syns, w.fins, w.acks, w.rsts, w.seq, w.ack,
+         kstat("tcps_tw_added"), kstat("tcps_tw_expired"),
+         kstat("tcps_tw_reused"), kstat("tcps_tw_reset"));
+  return 1;
+}
+
+// a connection from p, accepted, and closed by us first: to TIME_WAIT
+// with our FIN and the peer's both acked; returns 0 if it went wrong
+int timewait(struct socket* listener, struct peer* p)
+{
+  memset(&w, 0, sizeof w);
+  segment(p, p->irs, 0, SYN, p->ts);
+  drain();
+  if (w.synacks != 1 || w.ack != p->irs + 1)
+    return 0;
+  p->iss = w.seq;
+  segment(p, p->irs + 1, p->iss + 1, ACK, p->ts);
+  struct socket* so = acceptso(listener);
+  if (so == NULL)
+    return 0;
+  soclose(so);
+  drain();
+  if (w.fins != 1 || w.seq != p->iss + 1)
+    return 0;
+  segment(p, p->irs + 1, p->iss + 2, FIN | ACK, ++p->ts);
+  drain();
+  return w.acks == 1 && w.ack == p->irs + 2;
+}
+
+static struct peer peers[NCONN];
+
+int main()
+{
+  pigeonattach(1);
+  pigeon_setqlen(4096);
+  init();
+  setipaddr("pg0", DST);  // 192.168.0.2
+  somaxconn = 1024;
+  struct socket* listener = listenon(PORT);
+  drain();
+
+  long sockets = kmemuse("socket"), pcbs = kmemuse("pcb");
+  long tws = kmemuse("tcptw");
+  double start = now();
+  for (int i = 0; i < NCONN; ++i)
+  {
+    peers[i] = peerof(i);
+    if (!timewait(listener, &peers[i]))
+      return fail("a connection through to TIME_WAIT");
+  }
+  double sec = now() - start;
+  long held = kmemuse("tcptw") - tws;
+  if (kstat("tcps_tw_added") != NCONN)
+    return fail("an entry for every connection in TIME_WAIT");
+  if (kmemuse("socket") != sockets || kmemuse("pcb") != pcbs)
+    return fail("no socket or pcb kept in TIME_WAIT");
+  printf("%d connections to TIME_WAIT: %.0f ns each, entries of %ld bytes, "
+         "no socket or pcb\n",
+         NCONN, sec * 1e9 / NCONN, held / NCONN);
+
+  // half the 2MSL, then the FIN again for peers[1]: acked, timestamp
+  // echoed, and its 2MSL restarted
+  for (int t = 0; t < MSL2 / 2; ++t)
+    tcp_slowtimo();
+  struct peer* p = &peers[1];
+  memset(&w, 0, sizeof w);
+  segment(p, p->irs + 1, p->iss + 2, FIN | ACK, ++p->ts);
+  drain();
+  if (w.acks != 1 || w.seq != p->iss + 2 || w.ack != p->irs + 2 ||
+      !w.tstamp || w.tsecr != p->ts)
+    return fail("the FIN again is acked, with its timestamp echoed");
+
+  // a duplicate ACK is not answered; data or an old timestamp is
+  memset(&w, 0, sizeof w);
+  segment(p, p->irs + 2, p->iss + 2, ACK, ++p->ts);
+  drain();
+  if (w.segs)
+    return fail("no answer to a duplicate ACK");
+  unsigned long pawsdrop = kstat("tcps_pawsdrop");
+  segment(p, p->irs + 2, p->iss + 2, ACK, p->ts - 100);
+  drain();
+  if (w.acks != 1 || kstat("tcps_pawsdrop") - pawsdrop != 1)
+    return fail("an old timestamp is acked and dropped");
+  printf("the FIN again: acked, timestamp %u echoed; old timestamp: "
+         "acked and dropped\n",
+         w.tsecr);
+
+  // a RST outside the window is dropped; one in it ends the entry
+  p = &peers[2];
+  memset(&w, 0, sizeof w);
+  segment(p, p->irs + 2 + 10000000, 0, RST, 0);
+  segment(p, p->irs + 2, p->iss + 2, ACK | FIN, ++p->ts);
+  drain();
+  if (w.acks != 1 || kstat("tcps_tw_reset") != 0)
+    return fail("a RST outside the window is dropped");
+  segment(p, p->irs + 2, 0, RST, 0);
+  segment(p, p->irs + 2, p->iss + 2, ACK, 0);
+  drain();
+  if (kstat("tcps_tw_reset") != 1 || w.rsts != 1)
+    return fail("a RST in the window ends the entry");
+  printf("RST: ends the entry in the window, not outside\n");
+
+  // a SYN above the old sequence numbers makes a new connection
+  p = &peers[3];
+  memset(&w, 0, sizeof w);
+  segment(p, p->irs + 100000, 0, SYN, ++p->ts);
+  drain();
+  unsigned incr = w.seq - (p->iss + 2);
+  if (w.synacks != 1 || w.ack != p->irs + 100001 ||
+      kstat("tcps_tw_reused") != 1 || incr < 122 * 1024 ||
+      incr > 122 * 1024 + 0x3ffff)
+    return fail("a new SYN ends TIME_WAIT, with a higher ISS");
+  segment(p, p->irs + 100001, w.seq + 1, ACK, p->ts);
+  struct socket* so = acceptso(listener);
+  if (so == NULL)
+    return fail("a new connection for the SYN");
+  printf("SYN: a new connection, ISS %u above the old\n", incr);
+
+  // a SYN below them is answered as TIME_WAIT
+  p = &peers[4];
+  memset(&w, 0, sizeof w);
+  segment(p, p->irs, 0, SYN, ++p->ts);
+  drain();
+  if (w.synacks || w.acks != 1 || w.ack != p->irs + 2 ||
+      kstat("tcps_tw_reused") != 1)
+    return fail("an old SYN is acked");
+
+  // connect() from the port of an entry, to its peer
+  struct peer a = { 0xc0a80000 + 253, 7777, 5000 };
+  struct socket* co = connectfrom(a.lport, a.addr, a.port);
+  memset(&w, 0, sizeof w);
+  drain();
+  if (w.syns != 1)
+    return fail("a SYN for connect()");
+  a.iss = w.seq;
+  a.irs = 555555;
+  segment(&a, a.irs, a.iss + 1, SYN | ACK, a.ts = 50);
+  soclose(co);
+  memset(&w, 0, sizeof w);
+  drain();
+  if (w.fins != 1 || w.seq != a.iss + 1)
+    return fail("a FIN for close()");
+  segment(&a, a.irs + 1, a.iss + 2, FIN | ACK, ++a.ts);
+  if (kstat("tcps_tw_added") != NCONN + 1)
+    return fail("an entry for the active close");
+  co = connectfrom(a.lport, a.addr, a.port);
+  memset(&w, 0, sizeof w);
+  drain();
+  incr = w.seq - (a.iss + 2);
+  if (w.syns != 1 || kstat("tcps_tw_reused") != 2 || incr < 122 * 1024 ||
+      incr > 122 * 1024 + 0x3ffff)
+    return fail("connect() ends TIME_WAIT, with a higher ISS");
+  soclose(co);
+  drain();
+  printf("connect(): ends the entry, ISS %u above the old\n", incr);
+
+  // the rest of the 2MSL: all but peers[1] go
+  for (int t = 0; t <= MSL2 / 2; ++t)
+  {
+    tcp_slowtimo();
+    drain();
+  }
+  if (kstat("tcps_tw_expired") != NCONN - 3)
+    return fail("the entries go after 2MSL");
+  for (int t = 0; t < MSL2 / 2; ++t)
+    tcp_slowtimo();
+  if (kstat("tcps_tw_expired") != NCONN - 2 || kmemuse("tcptw") != tws)
+    return fail("an entry whose 2MSL was restarted goes after it");
+  memset(&w, 0, sizeof w);
+  p = &peers[1];
+  segment(p, p->irs + 2, p->iss + 2, ACK, 0);
+  drain();
+  if (w.rsts != 1)
+    return fail("an ACK after TIME_WAIT is reset");
+  printf("2MSL: %lu entries expired, %lu reset, %lu reused\n",
+         kstat("tcps_tw_expired"), kstat("tcps_tw_reset"),
+         kstat("tcps_tw_reused"));
+  return 0;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// Moves a bulk transfer across the pigeon interface with large sends
+// off and on, and times the sending side: the writes, and the acks
+// that clock out more data.  With large sends tcp_output() goes
+// through ip_output() once per 64 KB and tcp_segment() cuts the
+// segments at the interface.
+//
+// As in tests/sack.c the test is the wire and both ends live in this
+// one stack.  Every packet must fit the 1500 byte mtu, and the data
+// must arrive intact.
+
+extern int tcp_do_tso;
+extern unsigned long tcp_sendspace, tcp_recvspace;
+extern unsigned long sb_max;
+extern void tcp_fasttimo();
+
+enum { PORT = 1234, MTU = 1500, TOTAL = 64 << 20, CHUNK = 1 << 20 };
+
+struct stats
+{
+  long long sendus;  // in writeso() and injecting acks
+  int segs, toobig;
+};
+
+long long now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void swapaddrs(char* pkt)
+{
+  char addr[4];
+  memcpy(addr, pkt + 12, 4);
+  memcpy(pkt + 12, pkt + 16, 4);
+  memcpy(pkt + 16, addr, 4);
+}
+
+// delivers what is on the wire, all but the last of the server's pure
+// acks: the client sees one ack a round, as from a receiver that
+// coalesces them, and each opens the window for many segments
+void roundtrip(struct stats* st)
+{
+  static char pkt[65536], ack[128];
+  int len, acklen = 0;
+  while ((len = pigeon_dequeue(pkt, sizeof pkt)) > 0)
+  {
+    const unsigned char* th = (unsigned char*)pkt + (pkt[0] & 0xf) * 4;
+    int datalen = len - (pkt[0] & 0xf) * 4 - (th[12] >> 4) * 4;
+    if (len > MTU)
+      ++st->toobig;
+    swapaddrs(pkt);
+    if ((th[0] << 8 | th[1]) != PORT)
+    {
+      if (datalen > 0)
+        ++st->segs;
+      inject(pkt, len);
+    }
+    else if (datalen == 0 && (th[13] & 0x07) == 0 && len <= sizeof ack)
+      memcpy(ack, pkt, acklen = len);
+    else
+    {
+      long long start = now();
+      inject(pkt, len);
+      st->sendus += now() - start;
+    }
+  }
+  if (acklen)
+  {
+    long long start = now();
+    inject(ack, acklen);
+    st->sendus += now() - start;
+  }
+  tcp_fasttimo();
+}
+
+int transfer(struct socket* listenso, struct stats* st)
+{
+  static char src[CHUNK + 251], buf[CHUNK];
+  for (int i = 0; i < sizeof src; ++i)
+    src[i] = i % 251;
+
+  struct socket* client = connectto(0xc0a80001, PORT);
+  struct socket* server = NULL;
+  while (server == NULL)
+  {
+    roundtrip(st);
+    server = acceptso(listenso);
+  }
+
+  memset(st, 0, sizeof *st);
+  long long sent = 0, received = 0;
+  while (received < TOTAL)
+  {
+    if (sent < TOTAL)
+    {
+      long long start = now();
+      int n = TOTAL - sent < CHUNK ? TOTAL - sent : CHUNK;
+      sent += writeso(client, src + sent % 251, n);
+      st->sendus += now() - start;
+    }
+    roundtrip(st);
+    int nr = readso(server, buf, sizeof buf);
+    for (int i = 0; i < nr; ++i)
+      if (buf[i] != (char)((received + i) % 251))
+        return 0;
+    if (nr > 0)
+      received += nr;
+  }
+  soclose(client);
+  soclose(server);
+  for (int i = 0; i < 10; ++i)
+    roundtrip(st);
+  return 1;
+}
+
+int main()
+{
+  struct stats st[2];
+
+  pigeonattach(1);
+  // a large send puts up to 45 segments on the queue at once
+  pigeon_setqlen(4096);
+  init();
+  setipaddr("pg0", 0xc0a80002);  // 192.168.0.2
+  sb_max = 1024 * 1024;
+  tcp_sendspace = tcp_recvspace = 256 * 1024;
+  struct socket* listenso = listenon(PORT);
+
+  for (int tso = 0; tso < 2; ++tso)
+  {
+    tcp_do_tso = tso;
+    if (!transfer(listenso, &st[tso]))
+    {
+      printf("tso %d: data differs\n", tso);
+      return 1;
+    }
+    if (st[tso].toobig)
+    {
+      printf("tso %d: %d packets over the mtu\n", tso, st[tso].toobig);
+      return 1;
+    }
+    printf("tso %d: %d segments, %7.1f ns a segment to send\n", tso,
+           st[tso].segs, st[tso].sendus * 1000.0 / st[tso].segs);
+  }
+  printf("%.2fx\n", (double)st[0].sendus / st[1].sendus);
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <stdint.h>
@@ -13,18 +14,50 @@
 #include <netinet/ip_icmp.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include "../lib/tcpv2.h"
 
-void pffasttimo(void *);  // run every 200ms
-void pfslowtimo(void *);  // run every 500ms
+// usage: test_tun [-z] [-b batch] [-n queues] [-q]
+//   -z  zero-copy mode, read up to batch packets per wakeup
+//   -n  open the device with that many queues and fork one stack
+//       instance per queue
+//   -q  print packet rates once a second instead of every packet
+
+// sys/net/netisr.h: set while ipintr() has left packets for want of budget
+extern int netisr;
+enum { NETISR_IP = 2 };
 
 int tun_fd = -1;
+int verbose = 1;
+long npackets_out = 0;
+
+// lib/if_tun.c drops the packet when the fd is full; anything else
+// is the end
+int checkwrite(int n)
+{
+  if (n < 0 && errno != EAGAIN)
+  {
+    perror("write");
+    exit(1);
+  }
+  return n;
+}
 
 int tun_write(const char *buf, int len)
 {
-  printf("write %4d bytes\n", len);
-  return write(tun_fd, buf, len);
+  if (verbose)
+    printf("write %4d bytes\n", len);
+  ++npackets_out;
+  return checkwrite(write(tun_fd, buf, len));
+}
+
+int tun_writev(const struct iovec *iov, int iovcnt)
+{
+  if (verbose)
+    printf("writev %d pieces\n", iovcnt);
+  ++npackets_out;
+  return checkwrite(writev(tun_fd, iov, iovcnt));
 }
 
 int sethostaddr(const char* dev)
@@ -73,7 +106,7 @@ done:
   return err;
 }
 
-int tun_alloc(char dev[IFNAMSIZ])
+int tun_alloc(char dev[IFNAMSIZ], int flags)
 {
   struct ifreq ifr;
   int fd, err;
@@ -85,7 +118,7 @@ int tun_alloc(char dev[IFNAMSIZ])
   }
 
   bzero(&ifr, sizeof(ifr));
-  ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+  ifr.ifr_flags = IFF_TUN | IFF_NO_PI | flags;
 
   if (*dev)
   {
@@ -99,14 +132,10 @@ int tun_alloc(char dev[IFNAMSIZ])
     return err;
   }
   strcpy(dev, ifr.ifr_name);
-  if ((err = sethostaddr(dev)) < 0)
-    return err;
 
   return fd;
 }
 
-int64_t slowtimer, fasttimer;
-
 int64_t now_ms()
 {
   struct timeval tv;
@@ -114,45 +143,90 @@ int64_t now_ms()
   return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-void do_timers()
+int main(int argc, char* argv[])
 {
-  int64_t now = now_ms();
-  if (now - fasttimer >= 200)
-  {
-    pffasttimo(NULL);
-    fasttimer = now;
-  }
-  if (now - slowtimer >= 500)
+  int zerocopy = 0;
+  int batch = 32;
+  int nqueues = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "zb:n:q")) != -1)
   {
-    pfslowtimo(NULL);
-    slowtimer = now;
+    switch (opt)
+    {
+      case 'z':
+        zerocopy = 1;
+        break;
+      case 'b':
+        batch = atoi(optarg);
+        break;
+      case 'n':
+        nqueues = atoi(optarg);
+        break;
+      case 'q':
+        verbose = 0;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-z] [-b batch] [-n queues] [-q]\n", argv[0]);
+        exit(1);
+    }
   }
-}
+  if (batch < 1)
+    batch = 1;
+  if (nqueues < 1)
+    nqueues = 1;
 
-int64_t min(int64_t a, int64_t b)
-{
-  return a < b ? a : b;
-}
-
-int main()
-{
   tunattach(1);
+  tun_setzerocopy(zerocopy);
   init();
   setipaddr("tun0", 0xc0a80002);  // 192.168.0.2
-  do_timers();
 
   char ifname[IFNAMSIZ] = "tun%d";
-  tun_fd = tun_alloc(ifname);
-
-  if (tun_fd < 0)
+  int flags = nqueues > 1 ? IFF_MULTI_QUEUE : 0;
+  int fds[nqueues];
+  fds[0] = tun_alloc(ifname, flags);
+  if (fds[0] < 0 || sethostaddr(ifname) < 0)
   {
     fprintf(stderr, "tunnel interface allocation failed\n");
     exit(1);
   }
+  for (int i = 1; i < nqueues; ++i)
+  {
+    if ((fds[i] = tun_alloc(ifname, flags)) < 0)
+    {
+      fprintf(stderr, "tunnel queue %d allocation failed\n", i);
+      exit(1);
+    }
+  }
 
-  printf("allocted tunnel interface %s\n", ifname);
+  printf("allocted tunnel interface %s with %d queue(s)\n", ifname, nqueues);
 
   struct socket *server = listenon(1234);
+
+  // One stack instance per queue.  Each process gets its own copy of
+  // the kernel: PCBs, mbufs, ipintrq, callouts and statistics.  The
+  // routes, interfaces and listening socket set up above are the same
+  // in every copy.  The tun driver steers each flow to one queue by a
+  // symmetric hash of its addresses and ports, and remembers which
+  // queue a flow last transmitted on, so both directions of a
+  // connection reach the instance that owns it.
+  int instance = 0;
+  for (int i = 1; i < nqueues; ++i)
+  {
+    if (fork() == 0)
+    {
+      instance = i;
+      break;
+    }
+  }
+  tun_fd = fds[instance];
+  for (int i = 0; i < nqueues; ++i)
+    if (i != instance)
+      close(fds[i]);
+
+  // drain the device until EAGAIN on each wakeup
+  if (zerocopy)
+    fcntl(tun_fd, F_SETFL, O_NONBLOCK);
+
   struct socket *client = NULL;
 
   struct pollfd pfd = {
@@ -160,39 +234,90 @@ int main()
     .events = POLLIN,
     .revents = 0,
   };
+  struct iovec iov[batch];
+  int lens[batch];
+  long npackets_in = 0;
+  int64_t report = now_ms() + 1000;
 
   for (;;)
   {
     char buf[2048];
 
-    int64_t next_timeout = min(fasttimer+200, slowtimer+500);
+    // sleep until the next callout is due, or a packet arrives
     int64_t now = now_ms();
-    int waitms = next_timeout - now;
-    if (waitms < 0)
+    int64_t next_timeout = callout_run(now);
+    int waitms = -1;
+    if (next_timeout >= 0)
+    {
+      now = now_ms();
+      waitms = next_timeout > now ? next_timeout - now : 0;
+    }
+    // then what the last ipintr() didn't get to, without waiting
+    if (netisr & 1 << NETISR_IP)
+    {
+      ipintr();
       waitms = 0;
-    int nevents = poll(&pfd, 1, waitms+10);
-
-    do_timers();
+    }
+    if (!verbose)
+    {
+      if (now >= report)
+      {
+        printf("[%d] %ld packets in, %ld out\n", instance, npackets_in, npackets_out);
+        npackets_in = npackets_out = 0;
+        report = now + 1000;
+      }
+      if (waitms < 0 || waitms > report - now)
+        waitms = report - now;
+    }
+    int nevents = poll(&pfd, 1, waitms);
 
     if (nevents == 0)
       continue;
 
-    int len = read(tun_fd, buf, sizeof(buf));
-    if (len < 0)
+    if (zerocopy)
     {
-      perror("read");
-      close(tun_fd);
-      exit(1);
+      // read straight into cluster mbufs, then run IP once per batch
+      int n = tun_rxbufs(iov, batch);
+      int i;
+      for (i = 0; i < n; ++i)
+      {
+        int len = read(tun_fd, iov[i].iov_base, iov[i].iov_len);
+        if (len < 0)
+        {
+          if (errno == EAGAIN)
+            break;
+          perror("read");
+          close(tun_fd);
+          exit(1);
+        }
+        if (verbose)
+          printf("read  %4d bytes from %s\n", len, ifname);
+        lens[i] = len;
+      }
+      tun_input(lens, i);
+      npackets_in += i;
     }
-    if (len == sizeof buf)
+    else
     {
-      fprintf(stderr, "tun read too much\n");
-      close(tun_fd);
-      exit(1);
-    }
+      int len = read(tun_fd, buf, sizeof(buf));
+      if (len < 0)
+      {
+        perror("read");
+        close(tun_fd);
+        exit(1);
+      }
+      if (len == sizeof buf)
+      {
+        fprintf(stderr, "tun read too much\n");
+        close(tun_fd);
+        exit(1);
+      }
 
-    printf("read  %4d bytes from %s\n", len, ifname);
-    inject(buf, len);
+      if (verbose)
+        printf("read  %4d bytes from %s\n", len, ifname);
+      inject(buf, len);
+      ++npackets_in;
+    }
     struct socket* so = acceptso(server);
     if (so)
     {
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/tcpv2.h"
+
+// A DNS-like echo server on a bound, unconnected UDP socket, timed
+// answering queries from many client ports one datagram a call, with
+// recvfromso() and sendtoso(), and BATCH a call, with recvmmsgso()
+// and sendmmsgso().  The queries are put in with inject_batch() and
+// the replies taken off pg0 untimed, and each reply is checked to go
+// back to its query's sender with its payload.
+//
+// Then checks the edges: nothing to receive, a batch larger than what
+// is queued, a datagram truncated to its buffer, and no addresses to
+// send to.
+
+enum
+{
+  DST = 0xc0a80002,   // 192.168.0.2, pg0
+  SRC = 0xc0a80001,
+  PORT = 53,
+  CLIENTS = 1000,     // client ports from 10000 on
+  BATCH = 32,
+  ROUNDS = 20000,
+  QLEN = 40,
+};
+
+long long now_us()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void put16(unsigned char* p, unsigned v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+void put32(unsigned char* p, unsigned v)
+{
+  put16(p, v >> 16);
+  put16(p + 2, v);
+}
+
+unsigned get16(const unsigned char* p)
+{
+  return p[0] << 8 | p[1];
+}
+
+unsigned get32(const unsigned char* p)
+{
+  return get16(p) << 16 | get16(p + 2);
+}
+
+unsigned sum16(unsigned sum, const unsigned char* p, int len)
+{
+  for (int i = 0; i < len; i += 2)
+    sum += p[i] << 8 | (i + 1 < len ? p[i + 1] : 0);
+  return sum;
+}
+
+unsigned short fold(unsigned sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+// query i, from a client port of its own, its payload the number i
+// repeated
+int query(unsigned char* pkt, unsigned i)
+{
+  unsigned char pseudo[12] = { 0 };
+  unsigned char* uh = pkt + 20;
+  int len = 20 + 8 + QLEN;
+  memset(pkt, 0, 20);
+  pkt[0] = 0x45;
+  put16(pkt + 2, len);
+  pkt[8] = 64;
+  pkt[9] = 17;
+  put32(pkt + 12, SRC);
+  put32(pkt + 16, DST);
+  put16(pkt + 10, fold(sum16(0, pkt, 20)));
+  memcpy(pseudo, pkt + 12, 8);
+  pseudo[9] = 17;
+  put16(pseudo + 10, 8 + QLEN);
+  put16(uh, 10000 + i % CLIENTS);
+  put16(uh + 2, PORT);
+  put16(uh + 4, 8 + QLEN);
+  put16(uh + 6, 0);
+  for (int j = 0; j < QLEN; j += 2)
+    put16(uh + 8 + j, i);
+  put16(uh + 6, fold(sum16(sum16(0, pseudo, 12), uh, 8 + QLEN)));
+  return len;
+}
+
+unsigned char pkts[BATCH][1500];
+char* msgs[BATCH];
+int lens[BATCH];
+
+char bufs[BATCH][512];
+char* bufp[BATCH];
+int buflens[BATCH];
+unsigned ips[BATCH];
+unsigned short ports[BATCH];
+
+// takes the replies to queries seq to seq+n off pg0, returns how many
+// are right: to SRC at the query's port, the query's payload, and a
+// checksum that adds up
+int replies(unsigned seq, int n)
+{
+  unsigned char pkt[2048];
+  int len, ok = 0;
+  for (int i = 0; i < n; ++i, ++seq)
+  {
+    if ((len = pigeon_dequeue((char*)pkt, sizeof pkt)) != 20 + 8 + QLEN)
+      continue;
+    const unsigned char* uh = pkt + 20;
+    unsigned char pseudo[12] = { 0 };
+    memcpy(pseudo, pkt + 12, 8);
+    pseudo[9] = 17;
+    put16(pseudo + 10, 8 + QLEN);
+    if (get32(pkt + 16) == SRC && get16(uh) == PORT &&
+        get16(uh + 2) == 10000 + seq % CLIENTS &&
+        get16(uh + 8 + QLEN - 2) == (seq & 0xffff) &&
+        fold(sum16(sum16(0, pseudo, 12), uh, 8 + QLEN)) == 0)
+      ++ok;
+  }
+  if (pigeon_dequeue((char*)pkt, sizeof pkt) > 0)
+    return -1;  // more than asked for is wrong too
+  return ok;
+}
+
+// ns per query to take in and answer n of them, BATCH at a time; -1 if
+// any reply is wrong
+double run(struct socket* so, int batched, int n)
+{
+  long long us = 0;
+  unsigned seq = 0;
+  for (int r = 0; r < n / BATCH; ++r, seq += BATCH)
+  {
+    for (int i = 0; i < BATCH; ++i)
+    {
+      msgs[i] = (char*)pkts[i];
+      lens[i] = query(pkts[i], seq + i);
+    }
+    inject_batch((const char* const*)msgs, lens, BATCH);
+
+    long long t = now_us();
+    if (batched)
+    {
+      for (int i = 0; i < BATCH; ++i)
+        buflens[i] = sizeof bufs[i];
+      int got = recvmmsgso(so, bufp, buflens, ips, ports, BATCH);
+      if (sendmmsgso(so, bufp, buflens, ips, ports, got) != BATCH)
+        return -1;
+    }
+    else
+    {
+      for (int i = 0; i < BATCH; ++i)
+      {
+        int len = recvfromso(so, bufs[i], sizeof bufs[i], &ips[i], &ports[i]);
+        if (len < 0 || sendtoso(so, bufs[i], len, ips[i], ports[i]) != len)
+          return -1;
+      }
+    }
+    us += now_us() - t;
+
+    if (replies(seq, BATCH) != BATCH)
+      return -1;
+  }
+  return us * 1000.0 / (n / BATCH * BATCH);
+}
+
+int main()
+{
+  pigeonattach(1);
+  pigeon_setqlen(4096);
+  init();
+  setipaddr("pg0", DST);
+  struct socket* so = udpon(PORT);
+  for (int i = 0; i < BATCH; ++i)
+    bufp[i] = bufs[i];
+  int n = ROUNDS * BATCH;
+
+  // warm up the mbuf free lists and the route, then time
+  run(so, 1, n / 10);
+  double one = run(so, 0, n), batch = run(so, 1, n);
+  if (one < 0 || batch < 0)
+  {
+    printf("replies differ\n");
+    return 1;
+  }
+  printf("%d queries, %d a batch:   one at a time      batched\n", n, BATCH);
+  printf("udp %d bytes, recv+send %8.1f ns %5.2f Mpps %6.1f ns %5.2f Mpps"
+         "  %.2fx\n", QLEN, one, 1000 / one, batch, 1000 / batch,
+         one / batch);
+
+  // nothing queued: none, and no waiting for any
+  if (recvmmsgso(so, bufp, buflens, ips, ports, BATCH) != 0)
+    return 1;
+
+  // 5 queued, asked for 32: the 5, then none
+  for (int i = 0; i < 5; ++i)
+  {
+    msgs[i] = (char*)pkts[i];
+    lens[i] = query(pkts[i], i);
+  }
+  inject_batch((const char* const*)msgs, lens, 5);
+  for (int i = 0; i < BATCH; ++i)
+    buflens[i] = i == 2 ? 10 : sizeof bufs[i];
+  int got = recvmmsgso(so, bufp, buflens, ips, ports, BATCH);
+  printf("5 queued: %d received, lens %d %d %d, from %x:%d\n", got,
+         buflens[0], buflens[2], buflens[4], ips[4], ports[4]);
+  if (got != 5 || buflens[0] != QLEN || buflens[2] != 10 ||
+      buflens[4] != QLEN || ips[4] != SRC || ports[4] != 10004 ||
+      recvmmsgso(so, bufp, buflens, ips, ports, BATCH) != 0)
+    return 1;
+
+  // the truncated one filled in again, all 5 go back
+  for (int j = 0; j < QLEN; j += 2)
+    put16((unsigned char*)bufs[2] + j, 2);
+  buflens[2] = QLEN;
+  if (sendmmsgso(so, bufp, buflens, ips, ports, 5) != 5 ||
+      replies(0, 5) != 5)
+    return 1;
+
+  // without addresses an unconnected socket sends none
+  got = sendmmsgso(so, bufp, buflens, NULL, NULL, 5);
+  printf("no addresses: %d sent\n", got);
+  return got == 0 && replies(0, 0) == 0 ? 0 : 1;
+}
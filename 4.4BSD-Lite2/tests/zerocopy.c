@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "../lib/tcpv2.h"
+
+// Sends a pattern over a loopback connection with writeso_ext() and
+// reads it with readso_mbuf(), checking the bytes and that every
+// buffer is handed back exactly once.  Then times bulk transfer with
+// the copying and the zero-copy calls.
+
+extern void tcp_fasttimo();
+
+enum { CHUNK = 65536, TOTAL = 1 << 20 };
+
+int ncalls, nfreed;
+
+double now_sec()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void freebuf(char* buf, void* arg)
+{
+  ++*(int*)arg;
+}
+
+void flush()
+{
+  ipintr();
+  tcp_fasttimo();
+  ipintr();
+}
+
+// walks a chain, checking it against the pattern if want != NULL
+int consume(struct mbuf* m, const char* want)
+{
+  struct iovec iov[64];
+  int niov, len = 0;
+  while ((niov = mtoiov(&m, iov, 64)) > 0)
+  {
+    for (int i = 0; i < niov; ++i)
+    {
+      if (want)
+        for (int j = 0; j < iov[i].iov_len; ++j)
+          if (((char*)iov[i].iov_base)[j] != want[len + j])
+          {
+            printf("byte %d differs\n", len + j);
+            exit(1);
+          }
+      len += iov[i].iov_len;
+    }
+  }
+  return len;
+}
+
+int main(int argc, char* argv[])
+{
+  int total = argc > 1 ? atoi(argv[1]) : 64 << 20;
+  char* pattern = malloc(TOTAL);
+  char* rbuf = malloc(CHUNK);
+  for (int i = 0; i < TOTAL; ++i)
+    pattern[i] = i * 7 ^ i >> 8;
+
+  init();
+  struct socket* listenso = listenon(1234);
+  struct socket* so = connectto(0x7f000001, 1234);
+  ipintr();
+  struct socket* peer = acceptso(listenso);
+
+  int sent = 0, received = 0;
+  while (received < TOTAL)
+  {
+    if (sent < TOTAL)
+    {
+      int len = TOTAL - sent < CHUNK ? TOTAL - sent : CHUNK;
+      sent += writeso_ext(so, pattern + sent, len, freebuf, &nfreed);
+      ++ncalls;
+    }
+    ipintr();
+    struct mbuf* m = readso_mbuf(peer, TOTAL);
+    if (m)
+    {
+      received += consume(m, pattern + received);
+      m_freem(m);
+    }
+    flush();
+  }
+  flush();
+  if (nfreed != ncalls)
+  {
+    printf("%d writeso_ext() calls, %d buffers handed back\n", ncalls, nfreed);
+    return 1;
+  }
+  printf("%d bytes agree, all %d buffers handed back\n", received, nfreed);
+
+  double start = now_sec();
+  long long bytes = 0;
+  while (bytes < total)
+  {
+    writeso(so, pattern, CHUNK);
+    ipintr();
+    bytes += readso(peer, rbuf, CHUNK);
+    flush();
+  }
+  printf("writeso/readso:           %6.0f MB/s\n", bytes / (now_sec() - start) / 1e6);
+
+  start = now_sec();
+  bytes = 0;
+  while (bytes < total)
+  {
+    writeso_ext(so, pattern, CHUNK, freebuf, &nfreed);
+    ipintr();
+    struct mbuf* m = readso_mbuf(peer, CHUNK);
+    if (m)
+    {
+      bytes += consume(m, NULL);
+      m_freem(m);
+    }
+    flush();
+  }
+  printf("writeso_ext/readso_mbuf:  %6.0f MB/s\n", bytes / (now_sec() - start) / 1e6);
+  return 0;
+}
@@ -1,8 +1,29 @@
 #include <assert.h>
-#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
 
+#include "pcap.h"
+
+// Packets are captured into a ring on the datapath and written out by
+// a background thread.  The ring holds the file's bytes themselves:
+// ip_intercept() gets room for a record with pcap_begin(), which fills
+// in the record header, copies the packet behind it and publishes it
+// with pcap_end().  The writer hands whatever has been published to
+// write() in one go.  When the ring is full the packet is dropped and
+// counted, the datapath never waits.
+//
+// The ring has one producer and one consumer and no lock.  head and
+// tail count bytes, free-running; a record that doesn't fit before the
+// end of the buffer starts the next lap, and skipfrom tells the writer
+// where the unused end of the lap begins.
+
 struct pcap_header {
   uint32_t magic_number;   /* magic number */
   uint16_t version_major;  /* major version number */
@@ -20,57 +41,220 @@ struct pcap_record_header {
   uint32_t orig_len;       /* actual length of packet */
 };
 
+// pcapng: a section header and one interface, then enhanced packet blocks
+struct pcapng_block_header {
+  uint32_t type;
+  uint32_t total_len;
+};
+
+struct pcapng_shb {
+  struct pcapng_block_header h;  /* type 0x0A0D0D0A */
+  uint32_t byte_order_magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int64_t  section_len;
+  uint32_t total_len;
+};
+
+struct pcapng_idb {
+  struct pcapng_block_header h;  /* type 1 */
+  uint16_t linktype;
+  uint16_t reserved;
+  uint32_t snaplen;
+  uint32_t total_len;
+};
+
+struct pcapng_epb {
+  struct pcapng_block_header h;  /* type 6 */
+  uint32_t interface_id;
+  uint32_t ts_high;        /* microseconds since 1970 */
+  uint32_t ts_low;
+  uint32_t cap_len;
+  uint32_t orig_len;
+  // packet data padded to 32 bits, then total_len again
+};
+
+enum { LINKTYPE_RAW = 101, RINGSIZE = 8 << 20 };
+
 int pcap_enabled;
-// 全局指针
-FILE* pcap_fp;
+int pcap_snaplen;
+long pcap_drops;
 
-void pcap_start(const char* filename)
+static int pcap_fd = -1;
+static int pcap_format;
+static char* ring;
+static _Atomic uint32_t head, tail;
+static uint32_t skipfrom;
+static uint32_t reclen;  // of the record between pcap_begin() and pcap_end()
+static atomic_int stopping;
+static pthread_t writer;
+
+static void writeall(const char* buf, uint32_t len)
+{
+  while (len > 0)
+  {
+    ssize_t nw = write(pcap_fd, buf, len);
+    assert(nw > 0);
+    buf += nw;
+    len -= nw;
+  }
+}
+
+static void* writer_thread(void* arg)
+{
+  uint32_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+  for (;;)
+  {
+    uint32_t h = atomic_load_explicit(&head, memory_order_acquire);
+    if (h == t)
+    {
+      if (atomic_load(&stopping))
+        break;
+      struct timespec ts = { 0, 1000 * 1000 };
+      nanosleep(&ts, NULL);
+      continue;
+    }
+    uint32_t phys = t & (RINGSIZE - 1);
+    uint32_t len = h - t, valid;
+    if (len > RINGSIZE - phys)
+      len = RINGSIZE - phys;
+    valid = len;
+    if (skipfrom - t < len)
+    {
+      // the rest of this lap is unused
+      valid = skipfrom - t;
+      len = RINGSIZE - phys;
+    }
+    writeall(ring + phys, valid);
+    t += len;
+    atomic_store_explicit(&tail, t, memory_order_release);
+  }
+  return NULL;
+}
+
+void pcap_open(const char* filename, int snaplen, int format)
 {
-  assert(!pcap_enabled && pcap_fp == NULL);
-
-  // 打开文件
-  pcap_fp = fopen(filename, "w");
-
-  // 写入头
-  struct pcap_header header = {
-    .magic_number = 0xa1b2c3d4,
-    .version_major = 2,
-    .version_minor = 4,
-    .thiszone = 0,
-    .sigfigs = 0,
-    .snaplen = 65536,
-    .network = 101  // Raw IP
-  };
-
-  // 直接写入
-  int nw = fwrite(&header, 1, sizeof header, pcap_fp);
-  assert(nw == sizeof header);
+  assert(!pcap_enabled && pcap_fd < 0);
+
+  FILE* fp = fopen(filename, "w");
+  assert(fp != NULL);
+  pcap_fd = dup(fileno(fp));
+  fclose(fp);
 
+  if (format == PCAP_FORMAT_PCAPNG)
+  {
+    struct pcapng_shb shb = {
+      .h = { 0x0A0D0D0A, sizeof shb },
+      .byte_order_magic = 0x1A2B3C4D,
+      .version_major = 1,
+      .version_minor = 0,
+      .section_len = -1,
+      .total_len = sizeof shb,
+    };
+    struct pcapng_idb idb = {
+      .h = { 1, sizeof idb },
+      .linktype = LINKTYPE_RAW,
+      .snaplen = snaplen,
+      .total_len = sizeof idb,
+    };
+    writeall((char*)&shb, sizeof shb);
+    writeall((char*)&idb, sizeof idb);
+  }
+  else
+  {
+    struct pcap_header header = {
+      .magic_number = 0xa1b2c3d4,
+      .version_major = 2,
+      .version_minor = 4,
+      .thiszone = 0,
+      .sigfigs = 0,
+      .snaplen = snaplen,
+      .network = LINKTYPE_RAW
+    };
+    writeall((char*)&header, sizeof header);
+  }
+
+  if (ring == NULL)
+    ring = malloc(RINGSIZE);
+  assert(ring != NULL);
+  atomic_store(&head, 0);
+  atomic_store(&tail, 0);
+  skipfrom = -RINGSIZE;
+  atomic_store(&stopping, 0);
+  pcap_format = format;
+  pcap_snaplen = snaplen;
+  pcap_drops = 0;
+  pthread_create(&writer, NULL, writer_thread, NULL);
   pcap_enabled = 1;
 }
 
+void pcap_start(const char* filename)
+{
+  pcap_open(filename, 65536, PCAP_FORMAT_PCAP);
+}
+
+// waits for the writer to drain the ring
 void pcap_stop()
 {
-  fclose(pcap_fp);
-  pcap_fp = NULL;
   pcap_enabled = 0;
+  atomic_store(&stopping, 1);
+  pthread_join(writer, NULL);
+  close(pcap_fd);
+  pcap_fd = -1;
 }
 
-void pcap_write(const char *buf, int len, int origlen)
+char* pcap_begin(int caplen, int origlen)
 {
-  struct timeval tv = { 0, 0 };
+  uint32_t len = pcap_format == PCAP_FORMAT_PCAPNG
+                   ? sizeof(struct pcapng_epb) + ((caplen + 3) & ~3) + 4
+                   : sizeof(struct pcap_record_header) + caplen;
+  uint32_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  uint32_t t = atomic_load_explicit(&tail, memory_order_acquire);
+  uint32_t phys = h & (RINGSIZE - 1);
+  uint32_t skip = phys + len > RINGSIZE ? RINGSIZE - phys : 0;
+
+  if (skip + len > RINGSIZE - (h - t))
+  {
+    ++pcap_drops;
+    return NULL;
+  }
+  if (skip)
+  {
+    skipfrom = h;
+    h += skip;
+    phys = 0;
+    atomic_store_explicit(&head, h, memory_order_release);
+  }
+  reclen = len;
+
+  struct timeval tv;
   gettimeofday(&tv, NULL);
-  struct pcap_record_header record = {
-    .ts_sec = tv.tv_sec,
-    .ts_usec = tv.tv_usec,
-    .incl_len = len,
-    .orig_len = origlen
-  };
-
-  // 将直接将结构体写入到文件中
-  int nw = fwrite(&record, 1, sizeof record, pcap_fp);
-  // 确保写入的
-  assert(nw == sizeof record);
-  nw = fwrite(buf, 1, len, pcap_fp);
-  assert(nw == len);
+  char* p = ring + phys;
+  if (pcap_format == PCAP_FORMAT_PCAPNG)
+  {
+    uint64_t us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    struct pcapng_epb* epb = (struct pcapng_epb*)p;
+    epb->h.type = 6;
+    epb->h.total_len = len;
+    epb->interface_id = 0;
+    epb->ts_high = us >> 32;
+    epb->ts_low = us;
+    epb->cap_len = caplen;
+    epb->orig_len = origlen;
+    memset(p + len - 8, 0, 4);  // padding
+    memcpy(p + len - 4, &len, 4);
+    return p + sizeof *epb;
+  }
+  struct pcap_record_header* record = (struct pcap_record_header*)p;
+  record->ts_sec = tv.tv_sec;
+  record->ts_usec = tv.tv_usec;
+  record->incl_len = caplen;
+  record->orig_len = origlen;
+  return p + sizeof *record;
+}
+
+void pcap_end()
+{
+  uint32_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  atomic_store_explicit(&head, h + reclen, memory_order_release);
 }
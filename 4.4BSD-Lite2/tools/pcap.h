@@ -1,3 +1,14 @@
+enum { PCAP_FORMAT_PCAP, PCAP_FORMAT_PCAPNG };
+
 void pcap_start(const char* filename);
+void pcap_open(const char* filename, int snaplen, int format);
 void pcap_stop();
-int pcap_write(const char *buf, int len, int origlen);
+extern long pcap_drops;  // packets lost to a full ring
+
+// for ip_intercept(): room for caplen bytes of packet, or NULL to drop it
+char* pcap_begin(int caplen, int origlen);
+void pcap_end();
+
+// captures only what the program accepts, NULL to capture everything
+struct bpf_insn;
+int pcap_setfilter(const struct bpf_insn* insns, int ninsns);